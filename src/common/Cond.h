@@ -45,8 +45,10 @@ class Cond {
   int Wait(Mutex &mutex)  { 
     assert(mutex.is_locked());
     --mutex.nlock;
+    mutex.locked_by = 0;
     int r = pthread_cond_wait(&_c, &mutex._m);
     ++mutex.nlock;
+    mutex.locked_by = pthread_self();
     return r;
   }
 
@@ -54,8 +56,10 @@ class Cond {
     //cout << "Wait: " << s << endl;
     assert(mutex.is_locked());
     --mutex.nlock;
+    mutex.locked_by = 0;
     int r = pthread_cond_wait(&_c, &mutex._m);
     ++mutex.nlock;
+    mutex.locked_by = pthread_self();
     return r;
   }
 
@@ -64,8 +68,10 @@ class Cond {
     struct timespec ts;
     when.to_timespec(&ts);
     --mutex.nlock;
+    mutex.locked_by = 0;
     int r = pthread_cond_timedwait(&_c, &mutex._m, &ts);
     ++mutex.nlock;
+    mutex.locked_by = pthread_self();
     return r;
   }
   int WaitInterval(CephContext *cct, Mutex &mutex, utime_t interval) {
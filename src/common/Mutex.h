@@ -32,6 +32,7 @@ private:
 
   pthread_mutex_t _m;
   int nlock;
+  pthread_t locked_by;
 
   // don't allow copying.
   void operator=(Mutex &M) {}
@@ -52,7 +53,8 @@ private:
 
 public:
   Mutex(const char *n, bool r = false, bool ld=true, bool bt=false) :
-    name(n), id(-1), recursive(r), lockdep(ld), backtrace(bt), nlock(0) {
+    name(n), id(-1), recursive(r), lockdep(ld), backtrace(bt), nlock(0),
+    locked_by(0) {
     if (recursive) {
       // Mutexes of type PTHREAD_MUTEX_RECURSIVE do all the same checks as
       // mutexes of type PTHREAD_MUTEX_ERRORCHECK.
@@ -93,12 +95,16 @@ public:
   bool is_locked() const {
     return (nlock > 0);
   }
+  bool is_locked_by_me() const {
+    return nlock > 0 && pthread_equal(locked_by, pthread_self());
+  }
 
   bool TryLock() {
     int r = pthread_mutex_trylock(&_m);
     if (r == 0) {
       if (lockdep && g_lockdep) _locked();
       nlock++;
+      locked_by = pthread_self();
     }
     return r == 0;
   }
@@ -111,6 +117,7 @@ public:
     if (!recursive)
       assert(nlock == 0);
     nlock++;
+    locked_by = pthread_self();
   }
 
   void Unlock() {
@@ -118,6 +125,8 @@ public:
     --nlock;
     if (!recursive)
       assert(nlock == 0);
+    if (nlock == 0)
+      locked_by = 0;
     if (lockdep && g_lockdep) _will_unlock();
     int r = pthread_mutex_unlock(&_m);
     assert(r == 0);
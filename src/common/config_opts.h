@@ -168,6 +168,10 @@ OPTION(objecter_mon_retry_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data (both directions)
 OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
+OPTION(objecter_list_parallel_ops, OPT_INT, 8)  // pgls ops a parallel listing keeps in flight
+OPTION(objecter_batch_window_us, OPT_INT, 0)    // hold small ops this long to batch them per osd (0 = off)
+OPTION(objecter_batch_max_ops, OPT_INT, 32)      // send a batch once it has this many ops
+OPTION(objecter_batch_max_bytes, OPT_U64, 64<<10) // ... or this much data; bigger ops aren't batched
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
 OPTION(journaler_prefetch_periods, OPT_INT, 10)   // * journal object size
@@ -281,24 +285,56 @@ OPTION(osd_pool_default_crush_rule, OPT_INT, 0)
 OPTION(osd_pool_default_size, OPT_INT, 2)
 OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
+OPTION(osd_pool_default_erasure_code_technique, OPT_STR, "reed_solomon")
+OPTION(osd_pool_default_stripe_unit, OPT_U32, 4096)   // bytes of each data chunk per stripe in new erasure pools
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
+OPTION(osd_load_pgs_threads, OPT_INT, 4)   // threads reading pg state at startup
+OPTION(osd_load_pgs_lazy, OPT_BOOL, false) // read pg log/missing in the background after startup
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_fast_dispatch, OPT_BOOL, true) // queue client/replica ops to pgs without osd_lock when possible
+OPTION(osd_op_scheduler, OPT_STR, "wfq")   // wfq (weighted fair) or fifo
+OPTION(osd_op_sched_cost_per_io, OPT_U64, 65536)  // cost of an op in addition to its bytes
+OPTION(osd_op_sched_per_client, OPT_BOOL, false)  // share client class fairly between clients
+OPTION(osd_op_sched_client_res, OPT_DOUBLE, 0)    // reservation, cost/sec (0 = none)
+OPTION(osd_op_sched_client_wgt, OPT_DOUBLE, 100)  // weight
+OPTION(osd_op_sched_client_lim, OPT_DOUBLE, 0)    // limit, cost/sec (0 = none)
+OPTION(osd_op_sched_recovery_res, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_recovery_wgt, OPT_DOUBLE, 10)
+OPTION(osd_op_sched_recovery_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_scrub_res, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_scrub_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_sched_scrub_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_snaptrim_res, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_snaptrim_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_sched_snaptrim_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_removal_res, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_removal_wgt, OPT_DOUBLE, 1)
+OPTION(osd_op_sched_removal_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_scrub_cost, OPT_U64, 4<<20)     // charge per scrub step
+OPTION(osd_op_sched_snaptrim_cost, OPT_U64, 1<<20)  // charge per snap trim step
+OPTION(osd_op_sched_removal_cost, OPT_U64, 4<<20)   // charge per batch of objects reaped
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
+OPTION(osd_map_advance_threads, OPT_INT, 2)   // threads bringing pgs up to date with new osdmaps
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
+OPTION(osd_recover_delta, OPT_BOOL, true)   // recover only extents modified since the peer's version, when the log says
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
+OPTION(osd_object_context_cache_size, OPT_INT, 16384)  // idle object/snapset contexts kept, osd-wide (0 = none)
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
+OPTION(osd_snap_trim_batch, OPT_INT, 16)  // clones trimmed per transaction
+OPTION(osd_snap_trim_max_objects_per_sec, OPT_U64, 0)  // osd-wide trim rate (0 = unlimited)
+OPTION(osd_snap_trim_max_bytes_per_sec, OPT_U64, 0)    // osd-wide rate of clone data freed (0 = unlimited)
 OPTION(osd_scrub_thread_timeout, OPT_INT, 60)
-OPTION(osd_scrub_finalize_thread_timeout, OPT_INT, 60*10)
 OPTION(osd_remove_thread_timeout, OPT_INT, 60*60)
+OPTION(osd_remove_batch, OPT_INT, 512)  // objects removed per transaction when reaping a removed pg
 OPTION(osd_command_thread_timeout, OPT_INT, 10*60)
 OPTION(osd_age, OPT_FLOAT, .8)
 OPTION(osd_age_time, OPT_INT, 0)
@@ -322,6 +358,11 @@ OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
+OPTION(osd_scrub_chunk_min, OPT_INT, 5)      // objects per scrub chunk, at least...
+OPTION(osd_scrub_chunk_max, OPT_INT, 25)     // ...and at most (clones stay with their head)
+OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
+OPTION(osd_deep_scrub_stride, OPT_INT, 524288)           // read size while deep scrubbing
+OPTION(osd_deep_scrub_bytes_per_sec, OPT_U64, 32<<20)    // deep scrub read rate per pg (0 = unlimited)
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_error_timeout, OPT_DOUBLE, 60.0)  // seconds
 OPTION(osd_class_timeout, OPT_DOUBLE, 60*60.0) // seconds
@@ -330,6 +371,7 @@ OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
 OPTION(osd_use_stale_snap, OPT_BOOL, false)
 OPTION(osd_rollback_to_cluster_snap, OPT_STR, "")
 OPTION(osd_default_notify_timeout, OPT_U32, 30) // default notify timeout in seconds
+OPTION(osd_notify_batch_max, OPT_INT, 64) // watch notifies packed into one message to a client (1 = no batching)
 OPTION(osd_kill_backfill_at, OPT_INT, 0)
 OPTION(osd_min_pg_log_entries, OPT_U32, 1000) // number of entries to keep in the pg log when trimming it
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
@@ -338,6 +380,8 @@ OPTION(osd_op_log_threshold, OPT_INT, 5) // how many op log messages to show in
 OPTION(osd_verify_sparse_read_holes, OPT_BOOL, false)  // read fiemap-reported holes and verify they are zeros
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
+OPTION(filestore_omap_header_cache_size, OPT_INT, 1024) // cached omap headers
+OPTION(filestore_omap_header_cache_shards, OPT_INT, 16)
 // Use omap for xattrs for attrs over
 OPTION(filestore_xattr_use_omap, OPT_BOOL, false)
 // filestore_max_inline_xattr_size or
@@ -382,6 +426,8 @@ OPTION(journal_queue_max_ops, OPT_INT, 500)
 OPTION(journal_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
 OPTION(journal_replay_from, OPT_INT, 0)
+OPTION(journal_replay_prefetch_bytes, OPT_INT, 4 << 20)  // read-ahead window during replay; 0 to disable
+OPTION(journal_replay_skip_index_max, OPT_INT, 32)  // seq -> offset samples kept in the journal header
 OPTION(journal_zero_on_create, OPT_BOOL, false)
 OPTION(rbd_cache, OPT_BOOL, false) // whether to enable caching (writeback unless rbd_cache_max_dirty is 0)
 OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
@@ -43,6 +43,62 @@ static void sanitize_object_contents (bench_data *data, int length) {
   memset(data->object_contents, 'z', length);
 }
 
+static unsigned latency_bucket(double latency)
+{
+  uint64_t us = latency * 1000000.0;
+  if (us < 16)
+    return us;
+  int e = 63 - __builtin_clzll(us);  // us is in [2^e, 2^(e+1))
+  return (e - 3) * 16 + ((us >> (e - 4)) & 15);
+}
+
+static double bucket_latency(unsigned b)
+{
+  if (b < 16)
+    return (double)b / 1000000.0;
+  int e = b / 16 + 3;
+  uint64_t lo = (uint64_t)(16 + b % 16) << (e - 4);
+  uint64_t width = 1ull << (e - 4);
+  return (double)(lo + width / 2) / 1000000.0;
+}
+
+void bench_histogram::add(double latency)
+{
+  unsigned b = latency_bucket(latency);
+  if (b >= buckets.size())
+    buckets.resize(b + 1);
+  buckets[b]++;
+  count++;
+  if (latency > max)
+    max = latency;
+}
+
+double bench_histogram::percentile(double p) const
+{
+  if (!count)
+    return 0;
+  uint64_t want = (uint64_t)ceil(p / 100.0 * count);
+  if (want < 1)
+    want = 1;
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < buckets.size(); b++) {
+    seen += buckets[b];
+    if (seen >= want)
+      return std::min(bucket_latency(b), max);
+  }
+  return max;
+}
+
+void bench_histogram::dump(Formatter *f) const
+{
+  f->dump_unsigned("count", count);
+  f->dump_float("p50", percentile(50));
+  f->dump_float("p90", percentile(90));
+  f->dump_float("p99", percentile(99));
+  f->dump_float("p99.9", percentile(99.9));
+  f->dump_float("max", max);
+}
+
 ostream& ObjBencher::out(ostream& os, utime_t& t)
 {
   if (show_time)
@@ -64,6 +120,7 @@ void *ObjBencher::status_printer(void *_bencher) {
   int i = 0;
   int previous_writes = 0;
   int cycleSinceChange = 0;
+  int previous_second = 0;
   double avg_bandwidth;
   double bandwidth;
   utime_t ONE_SECOND;
@@ -104,6 +161,21 @@ void *ObjBencher::status_printer(void *_bencher) {
 
     avg_bandwidth = (double) (data.trans_size) * (data.finished)
       / (double)(cur_time - data.start_time) / (1024*1024);
+    if (i > 0) {
+      bench_second sec;
+      sec.time = cur_time - data.start_time;
+      sec.in_flight = data.in_flight;
+      sec.started = data.started;
+      sec.finished = data.finished;
+      sec.ops = data.finished - previous_second;
+      sec.bandwidth = (double)sec.ops * data.trans_size / (1024*1024);
+      sec.p50_latency = data.interval_hist.percentile(50);
+      sec.p99_latency = data.interval_hist.percentile(99);
+      sec.max_latency = data.interval_hist.max;
+      data.history.series.push_back(sec);
+      previous_second = data.finished;
+      data.interval_hist.clear();
+    }
     if (previous_writes != data.finished) {
       previous_writes = data.finished;
       cycleSinceChange = 0;
@@ -139,16 +211,41 @@ void *ObjBencher::status_printer(void *_bencher) {
 int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, int op_size) {
   int object_size = op_size;
   int num_objects = 0;
-  char* contentsChars = new char[op_size];
   int r = 0;
   int prevPid = 0;
 
-  //get data from previous write run, if available
-  if (operation != OP_WRITE) {
+  if (target_iops > 0 && operation != OP_MIX) {
+    cerr << "a target rate only applies to the mix benchmark" << std::endl;
+    return -EINVAL;
+  }
+  if (operation == OP_MIX) {
+    int total = 0;
+    for (int i = 0; i < MIX_NUM_OPS; i++) {
+      if (mix_weight[i] < 0)
+	return -EINVAL;
+      total += mix_weight[i];
+    }
+    if (!total) {
+      cerr << "the op mix must include some ops" << std::endl;
+      return -EINVAL;
+    }
+    if (!mix_max_size)
+      mix_min_size = mix_max_size = op_size;
+    if (mix_min_size > mix_max_size) {
+      cerr << "min object size is larger than max object size" << std::endl;
+      return -EINVAL;
+    }
+    // the contents buffer has to hold the largest object, and the
+    // status lines assume the average one
+    object_size = mix_max_size;
+    op_size = (mix_min_size + mix_max_size) / 2;
+  }
+
+  //get data from previous write run, if available; the mix makes its own
+  if (operation == OP_SEQ_READ || operation == OP_RAND_READ) {
     bufferlist object_data;
     r = sync_read(BENCH_DATA, object_data, sizeof(int)*3);
     if (r <= 0) {
-      delete[] contentsChars;
       if (r == -2)
 	cerr << "Must write data before running a read benchmark!" << std::endl;
       return r;
@@ -157,9 +254,11 @@ int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, in
     ::decode(object_size, p);
     ::decode(num_objects, p);
     ::decode(prevPid, p);
-  } else {
+  } else if (operation == OP_WRITE) {
     object_size = op_size;
   }
+  // sized only now that object_size is final
+  char* contentsChars = new char[MAX(object_size, op_size)];
 
   lock.Lock();
   data.done = false;
@@ -173,6 +272,9 @@ int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, in
   data.avg_latency = 0;
   data.idata.min_bandwidth = 99999999.0;
   data.idata.max_bandwidth = 0;
+  data.latency_hist.clear();
+  data.interval_hist.clear();
+  data.history.series.clear();
   data.object_contents = contentsChars;
   lock.Unlock();
 
@@ -191,6 +293,10 @@ int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, in
     cerr << "Random test not implemented yet!" << std::endl;
     r = -1;
   }
+  else if (OP_MIX == operation) {
+    r = mix_bench(secondsToRun, concurrentios);
+    if (r != 0) goto out;
+  }
 
  out:
   delete[] contentsChars;
@@ -328,6 +434,8 @@ int ObjBencher::write_bench(int secondsToRun, int concurrentios) {
     data.cur_latency = ceph_clock_now(g_ceph_context) - start_times[slot];
     data.history.latency.push_back(data.cur_latency);
     total_latency += data.cur_latency;
+    data.latency_hist.add(data.cur_latency);
+    data.interval_hist.add(data.cur_latency);
     if( data.cur_latency > data.max_latency) data.max_latency = data.cur_latency;
     if (data.cur_latency < data.min_latency) data.min_latency = data.cur_latency;
     ++data.finished;
@@ -369,6 +477,8 @@ int ObjBencher::write_bench(int secondsToRun, int concurrentios) {
     data.cur_latency = ceph_clock_now(g_ceph_context) - start_times[slot];
     data.history.latency.push_back(data.cur_latency);
     total_latency += data.cur_latency;
+    data.latency_hist.add(data.cur_latency);
+    data.interval_hist.add(data.cur_latency);
     if (data.cur_latency > data.max_latency) data.max_latency = data.cur_latency;
     if (data.cur_latency < data.min_latency) data.min_latency = data.cur_latency;
     ++data.finished;
@@ -403,7 +513,10 @@ int ObjBencher::write_bench(int secondsToRun, int concurrentios) {
        << "Average Latency:        " << data.avg_latency << std::endl
        << "Stddev Latency:         " << vec_stddev(data.history.latency) << std::endl
        << "Max latency:            " << data.max_latency << std::endl
-       << "Min latency:            " << data.min_latency << std::endl;
+       << "Min latency:            " << data.min_latency << std::endl
+       << "Latency p50/90/99/99.9: ";
+  print_percentiles(cout, data.latency_hist);
+  dump_results("write", concurrentios, timePassed, NULL);
 
   //write object size/number data for read benchmarks
   ::encode(data.object_size, b_write);
@@ -517,6 +630,8 @@ int ObjBencher::seq_read_bench(int seconds_to_run, int num_objects, int concurre
     }
     data.cur_latency = ceph_clock_now(g_ceph_context) - start_times[slot];
     total_latency += data.cur_latency;
+    data.latency_hist.add(data.cur_latency);
+    data.interval_hist.add(data.cur_latency);
     if( data.cur_latency > data.max_latency) data.max_latency = data.cur_latency;
     if (data.cur_latency < data.min_latency) data.min_latency = data.cur_latency;
     ++data.finished;
@@ -561,6 +676,8 @@ int ObjBencher::seq_read_bench(int seconds_to_run, int num_objects, int concurre
     }
     data.cur_latency = ceph_clock_now(g_ceph_context) - start_times[slot];
     total_latency += data.cur_latency;
+    data.latency_hist.add(data.cur_latency);
+    data.interval_hist.add(data.cur_latency);
     if (data.cur_latency > data.max_latency) data.max_latency = data.cur_latency;
     if (data.cur_latency < data.min_latency) data.min_latency = data.cur_latency;
     ++data.finished;
@@ -596,7 +713,10 @@ int ObjBencher::seq_read_bench(int seconds_to_run, int num_objects, int concurre
        << "Bandwidth (MB/sec):    " << bw << std::endl
        << "Average Latency:       " << data.avg_latency << std::endl
        << "Max latency:           " << data.max_latency << std::endl
-       << "Min latency:           " << data.min_latency << std::endl;
+       << "Min latency:           " << data.min_latency << std::endl
+       << "Latency p50/90/99/99.9: ";
+  print_percentiles(cout, data.latency_hist);
+  dump_results("seq", concurrentios, runtime, NULL);
 
   completions_done();
 
@@ -611,3 +731,298 @@ int ObjBencher::seq_read_bench(int seconds_to_run, int num_objects, int concurre
 }
 
 
+
+static const char *mix_op_name[MIX_NUM_OPS] = { "read", "write", "stat", "remove" };
+
+struct mix_slot {
+  int op;
+  string oid;
+  uint64_t size;
+  bufferlist bl;
+  utime_t start;
+  mix_slot() : op(-1), size(0) {}
+};
+
+/*
+ * a random mix of reads, writes, stats and removes.  writes create new
+ * objects; the other ops pick one we've already written.  with a
+ * target rate set, ops are issued on schedule (as long as there is a
+ * free slot) rather than whenever one completes.
+ */
+int ObjBencher::mix_bench(int secondsToRun, int concurrentios) {
+  int total_weight = 0;
+  for (int i = 0; i < MIX_NUM_OPS; i++)
+    total_weight += mix_weight[i];
+
+  out(cout) << "Mixing reads:writes:stats:removes "
+	    << mix_weight[MIX_READ] << ":" << mix_weight[MIX_WRITE] << ":"
+	    << mix_weight[MIX_STAT] << ":" << mix_weight[MIX_REMOVE]
+	    << " on objects of " << mix_min_size << "-" << mix_max_size << " bytes, ";
+  if (target_iops > 0)
+    cout << target_iops << " ops/sec with at most " << concurrentios << " in flight";
+  else
+    cout << concurrentios << " concurrent ops";
+  cout << ", for at least " << secondsToRun << " seconds." << std::endl;
+
+  vector<mix_slot> slots(concurrentios);
+  vector<pair<string, uint64_t> > objects;  // written and not being removed
+  map<string, int> in_use;                  // objects with reads or stats in flight
+  bench_histogram op_hist[MIX_NUM_OPS];
+  char name[128];
+  int num_written = 0;
+  int errors = 0;
+  int late = 0;
+  bool stalled = false;
+  double total_latency = 0;
+  lock_cond lc(&lock);
+  utime_t stop_time, next_issue, interval, runtime;
+  int r;
+
+  r = completions_init(concurrentios);
+  if (r < 0)
+    return r;
+  srand(time(NULL) ^ getpid());
+  memset(data.object_contents, 'z', mix_max_size);
+  if (target_iops > 0)
+    interval.set_from_double(1.0 / target_iops);
+
+  pthread_t print_thread;
+  pthread_create(&print_thread, NULL, ObjBencher::status_printer, (void *)this);
+
+  lock.Lock();
+  data.start_time = ceph_clock_now(g_ceph_context);
+  runtime.set_from_double(secondsToRun);
+  stop_time = data.start_time + runtime;
+  next_issue = data.start_time;
+  while (true) {
+    // reap anything that finished
+    int slot;
+    for (slot = 0; slot < concurrentios; slot++)
+      if (slots[slot].op >= 0 && completion_is_done(slot))
+	break;
+    if (slot < concurrentios) {
+      mix_slot& ms = slots[slot];
+      lock.Unlock();
+      completion_wait(slot);
+      r = completion_ret(slot);
+      release_completion(slot);
+      lock.Lock();
+      data.cur_latency = ceph_clock_now(g_ceph_context) - ms.start;
+      if (r < 0) {
+	cerr << mix_op_name[ms.op] << " " << ms.oid << " got " << r << std::endl;
+	++errors;
+      } else if (ms.op == MIX_WRITE) {
+	objects.push_back(make_pair(ms.oid, ms.size));
+      }
+      if (ms.op == MIX_READ || ms.op == MIX_STAT) {
+	if (--in_use[ms.oid] == 0)
+	  in_use.erase(ms.oid);
+      }
+      op_hist[ms.op].add(data.cur_latency);
+      data.latency_hist.add(data.cur_latency);
+      data.interval_hist.add(data.cur_latency);
+      total_latency += data.cur_latency;
+      if (data.cur_latency > data.max_latency) data.max_latency = data.cur_latency;
+      if (data.cur_latency < data.min_latency) data.min_latency = data.cur_latency;
+      ++data.finished;
+      data.avg_latency = total_latency / data.finished;
+      --data.in_flight;
+      ms.op = -1;
+      ms.bl.clear();
+      continue;
+    }
+
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (now >= stop_time) {
+      if (!data.in_flight)
+	break;
+      lc.cond.Wait(lock);
+      continue;
+    }
+    if (target_iops > 0 && now < next_issue) {
+      lc.cond.WaitUntil(lock, next_issue);
+      continue;
+    }
+    for (slot = 0; slot < concurrentios; slot++)
+      if (slots[slot].op < 0)
+	break;
+    if (slot == concurrentios) {
+      stalled = true;
+      lc.cond.Wait(lock);
+      continue;
+    }
+
+    // pick an op, and an object for it
+    mix_slot& ms = slots[slot];
+    int pick = rand() % total_weight;
+    for (ms.op = 0; pick >= mix_weight[ms.op]; ms.op++)
+      pick -= mix_weight[ms.op];
+    if (ms.op != MIX_WRITE) {
+      if (objects.empty()) {
+	ms.op = MIX_WRITE;
+      } else {
+	unsigned i = rand() % objects.size();
+	if (ms.op == MIX_REMOVE && in_use.count(objects[i].first)) {
+	  ms.op = MIX_WRITE;  // don't pull it out from under a read
+	} else {
+	  ms.oid = objects[i].first;
+	  ms.size = objects[i].second;
+	  if (ms.op == MIX_REMOVE) {
+	    objects[i] = objects.back();
+	    objects.pop_back();
+	  } else {
+	    in_use[ms.oid]++;
+	  }
+	}
+      }
+    }
+    if (ms.op == MIX_WRITE) {
+      generate_object_name(name, sizeof(name), num_written++);
+      ms.oid = name;
+      ms.size = mix_min_size;
+      if (mix_max_size > mix_min_size)
+	ms.size += (uint64_t)rand() % (mix_max_size - mix_min_size + 1);
+      ms.bl.append(data.object_contents, ms.size);
+    }
+    if (target_iops > 0) {
+      ms.start = next_issue;
+      next_issue += interval;
+      if (stalled)
+	++late;
+    } else {
+      ms.start = now;
+    }
+    stalled = false;
+    ++data.started;
+    ++data.in_flight;
+    lock.Unlock();
+
+    r = create_completion(slot, _aio_cb, (void *)&lc);
+    if (r < 0)
+      goto ERR;
+    switch (ms.op) {
+    case MIX_READ:
+      r = aio_read(ms.oid, slot, &ms.bl, ms.size);
+      break;
+    case MIX_WRITE:
+      r = aio_write(ms.oid, slot, ms.bl, ms.size);
+      break;
+    case MIX_STAT:
+      r = aio_stat(ms.oid, slot, &ms.size);
+      break;
+    case MIX_REMOVE:
+      r = aio_remove(ms.oid, slot);
+      break;
+    }
+    if (r < 0) {
+      cerr << mix_op_name[ms.op] << " " << ms.oid << " failed to start: " << r << std::endl;
+      goto ERR;
+    }
+    lock.Lock();
+  }
+  runtime = ceph_clock_now(g_ceph_context) - data.start_time;
+  data.done = true;
+  lock.Unlock();
+
+  pthread_join(print_thread, NULL);
+
+  out(cout) << "Total time run:         " << runtime << std::endl
+	    << "Total ops made:         " << data.finished << std::endl
+	    << "Ops/sec:                " << (double)data.finished / (double)runtime << std::endl
+	    << "Errors:                 " << errors << std::endl;
+  if (target_iops > 0)
+    cout << "Ops issued late:        " << late << std::endl;
+  cout << "Average Latency:        " << data.avg_latency << std::endl
+       << "Max latency:            " << data.max_latency << std::endl
+       << "Min latency:            " << data.min_latency << std::endl
+       << "Latency p50/90/99/99.9: ";
+  print_percentiles(cout, data.latency_hist);
+  for (int i = 0; i < MIX_NUM_OPS; i++) {
+    if (!op_hist[i].count)
+      continue;
+    cout << "  " << setw(7) << std::left << mix_op_name[i] << std::right
+	 << setw(10) << op_hist[i].count << " ops, p50/90/99/99.9: ";
+    print_percentiles(cout, op_hist[i]);
+  }
+  dump_results("mix", concurrentios, runtime, op_hist);
+
+  completions_done();
+  return 0;
+
+ ERR:
+  lock.Lock();
+  data.done = 1;
+  lock.Unlock();
+  pthread_join(print_thread, NULL);
+  return -5;
+}
+
+void ObjBencher::print_percentiles(ostream& os, const bench_histogram& h)
+{
+  os << h.percentile(50) << " / " << h.percentile(90) << " / "
+     << h.percentile(99) << " / " << h.percentile(99.9) << std::endl;
+}
+
+/*
+ * write the results, and the per-second series, as json so runs can
+ * be compared (or several processes' runs combined) later.
+ */
+void ObjBencher::dump_results(const char *bench, int concurrentios, double runtime,
+			      const bench_histogram *op_hist)
+{
+  if (json_output.empty())
+    return;
+
+  JSONFormatter f(true);
+  f.open_object_section("bench");
+  f.dump_string("benchmark", bench);
+  f.dump_int("pid", getpid());
+  f.dump_int("concurrent_ios", concurrentios);
+  f.dump_int("object_size", data.object_size);
+  if (target_iops > 0)
+    f.dump_float("target_iops", target_iops);
+  f.dump_float("runtime", runtime);
+  f.dump_int("ops", data.finished);
+  f.dump_float("ops_per_sec", runtime > 0 ? data.finished / runtime : 0);
+  f.dump_float("avg_latency", data.avg_latency);
+  f.open_object_section("latency");
+  data.latency_hist.dump(&f);
+  f.close_section();
+  if (op_hist) {
+    f.open_object_section("op_latency");
+    for (int i = 0; i < MIX_NUM_OPS; i++) {
+      if (!op_hist[i].count)
+	continue;
+      f.open_object_section(mix_op_name[i]);
+      op_hist[i].dump(&f);
+      f.close_section();
+    }
+    f.close_section();
+  }
+  f.open_array_section("series");
+  for (vector<bench_second>::iterator p = data.history.series.begin();
+       p != data.history.series.end();
+       ++p) {
+    f.open_object_section("second");
+    f.dump_float("time", p->time);
+    f.dump_int("in_flight", p->in_flight);
+    f.dump_int("started", p->started);
+    f.dump_int("finished", p->finished);
+    f.dump_int("ops", p->ops);
+    f.dump_float("bandwidth", p->bandwidth);
+    f.dump_float("p50_latency", p->p50_latency);
+    f.dump_float("p99_latency", p->p99_latency);
+    f.dump_float("max_latency", p->max_latency);
+    f.close_section();
+  }
+  f.close_section();
+  f.close_section();
+
+  ofstream of(json_output.c_str());
+  if (!of) {
+    cerr << "could not open " << json_output << std::endl;
+    return;
+  }
+  f.flush(of);
+  of << std::endl;
+}
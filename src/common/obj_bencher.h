@@ -16,15 +16,53 @@
 
 #include "common/config.h"
 #include "common/Cond.h"
+#include "common/Formatter.h"
+
+#include <errno.h>
 
 struct bench_interval_data {
   double min_bandwidth;
   double max_bandwidth;
 };
 
+/**
+ * latency histogram.  buckets are 1/16th of a power of two
+ * microseconds wide, so percentiles are within ~6% no matter how
+ * long the run.
+ */
+struct bench_histogram {
+  vector<uint64_t> buckets;
+  uint64_t count;
+  double max;
+
+  bench_histogram() : count(0), max(0) {}
+  void add(double latency);
+  double percentile(double p) const;  ///< p in [0, 100], in seconds
+  void clear() {
+    buckets.clear();
+    count = 0;
+    max = 0;
+  }
+  void dump(Formatter *f) const;
+};
+
+/// one line of the per-second status output
+struct bench_second {
+  double time;        ///< since the start of the run
+  int in_flight;
+  int started;
+  int finished;
+  int ops;            ///< finished in this interval
+  double bandwidth;   ///< MB/s in this interval
+  double p50_latency;
+  double p99_latency;
+  double max_latency;
+};
+
 struct bench_history {
   vector<double> bandwidth;
   vector<double> latency;
+  vector<bench_second> series;
 };
 
 struct bench_data {
@@ -41,6 +79,8 @@ struct bench_data {
   struct bench_interval_data idata; // data that is updated by time intervals and not by events
   struct bench_history history; // data history, used to calculate stddev
   utime_t cur_latency; //latency of last completed transaction
+  bench_histogram latency_hist; //every completed transaction
+  bench_histogram interval_hist; //since the last status line
   utime_t start_time; //start time for benchmark
   char *object_contents; //pointer to the contents written to each object
 };
@@ -48,9 +88,21 @@ struct bench_data {
 const int OP_WRITE     = 1;
 const int OP_SEQ_READ  = 2;
 const int OP_RAND_READ = 3;
+const int OP_MIX       = 4;
+
+// op types in a mixed workload
+const int MIX_READ   = 0;
+const int MIX_WRITE  = 1;
+const int MIX_STAT   = 2;
+const int MIX_REMOVE = 3;
+const int MIX_NUM_OPS = 4;
 
 class ObjBencher {
   bool show_time;
+  int mix_weight[MIX_NUM_OPS]; //relative share of each op type in OP_MIX
+  uint64_t mix_min_size, mix_max_size; //object sizes written in OP_MIX
+  double target_iops; //if nonzero, issue ops at this rate (OP_MIX only)
+  string json_output; //file for the results and per-second series
 protected:
   Mutex lock;
 
@@ -60,6 +112,11 @@ protected:
 
   int write_bench(int secondsToRun, int concurrentios);
   int seq_read_bench(int secondsToRun, int concurrentios, int num_objects, int writePid);
+  int mix_bench(int secondsToRun, int concurrentios);
+
+  void print_percentiles(ostream& os, const bench_histogram& h);
+  void dump_results(const char *bench, int concurrentios, double runtime,
+		    const bench_histogram *op_hist);
 
   virtual int completions_init(int concurrentios) = 0;
   virtual void completions_done() = 0;
@@ -75,17 +132,51 @@ protected:
   virtual int aio_write(const std::string& oid, int slot, bufferlist& bl, size_t len) = 0;
   virtual int sync_read(const std::string& oid, bufferlist& bl, size_t len) = 0;
   virtual int sync_write(const std::string& oid, bufferlist& bl, size_t len) = 0;
+  virtual int aio_stat(const std::string& oid, int slot, uint64_t *psize) {
+    return -EOPNOTSUPP;
+  }
+  virtual int aio_remove(const std::string& oid, int slot) {
+    return -EOPNOTSUPP;
+  }
 
   ostream& out(ostream& os);
   ostream& out(ostream& os, utime_t& t);
 public:
-  ObjBencher() : show_time(false), lock("ObjBencher::lock") {}
+  ObjBencher() : show_time(false), mix_min_size(0), mix_max_size(0),
+		 target_iops(0), lock("ObjBencher::lock") {
+    for (int i = 0; i < MIX_NUM_OPS; i++)
+      mix_weight[i] = 0;
+    mix_weight[MIX_WRITE] = 1;
+  }
   virtual ~ObjBencher() {}
   int aio_bench(int operation, int secondsToRun, int concurrentios, int op_size);
 
   void set_show_time(bool dt) {
     show_time = dt;
   }
+  /// relative shares of reads, writes, stats and removes for OP_MIX
+  void set_op_mix(int read, int write, int stat, int remove) {
+    mix_weight[MIX_READ] = read;
+    mix_weight[MIX_WRITE] = write;
+    mix_weight[MIX_STAT] = stat;
+    mix_weight[MIX_REMOVE] = remove;
+  }
+  /// OP_MIX writes objects of uniformly random size in [min, max]
+  void set_object_size_range(uint64_t min, uint64_t max) {
+    mix_min_size = min;
+    mix_max_size = max;
+  }
+  /**
+   * open-loop mode: issue ops at a fixed rate instead of as fast as
+   * they complete.  latency is measured from when each op was due, so
+   * a backed-up cluster shows up in the numbers.
+   */
+  void set_target_iops(double iops) {
+    target_iops = iops;
+  }
+  void set_json_output(const string& fn) {
+    json_output = fn;
+  }
 };
 
 
@@ -89,6 +89,17 @@ public:
     Mutex::Locker l(lock);
     _add(key, value);
   }
+
+  void clear(K key) {
+    Mutex::Locker l(lock);
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i != contents.end()) {
+      lru.erase(i->second);
+      contents.erase(i);
+    }
+    pinned.erase(key);
+  }
 };
 
 #endif
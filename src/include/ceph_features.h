@@ -20,6 +20,11 @@
 #define CEPH_FEATURE_OSDENC         (1<<13)
 #define CEPH_FEATURE_OMAP           (1<<14)
 #define CEPH_FEATURE_MONENC         (1<<15)
+#define CEPH_FEATURE_CHUNKY_SCRUB   (1<<16)
+#define CEPH_FEATURE_DELTA_RECOVERY (1<<17)
+#define CEPH_FEATURE_OSD_OP_BATCH   (1<<18)
+#define CEPH_FEATURE_WATCH_NOTIFY_BATCH (1<<19)
+#define CEPH_FEATURE_ERASURE_POOLS  (1<<20)
 
 /*
  * Features supported.  Should be everything above.
@@ -40,7 +45,12 @@
 	 CEPH_FEATURE_OSDREPLYMUX |	 \
 	 CEPH_FEATURE_OSDENC |		 \
 	 CEPH_FEATURE_OMAP |		 \
-	 CEPH_FEATURE_MONENC)
+	 CEPH_FEATURE_MONENC |		 \
+	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
+	 CEPH_FEATURE_DELTA_RECOVERY |	 \
+	 CEPH_FEATURE_OSD_OP_BATCH |	 \
+	 CEPH_FEATURE_WATCH_NOTIFY_BATCH | \
+	 CEPH_FEATURE_ERASURE_POOLS)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
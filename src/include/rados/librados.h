@@ -34,7 +34,7 @@ extern "C" {
 
 /**
  * @defgroup librados_h_xattr_comp xattr comparison operations
- * @note BUG: there's no way to use these in the C api
+ * For use with rados_write_op_cmpxattr() and rados_read_op_cmpxattr()
  * @{
  */
 /** @cond TODO_enums_not_yet_in_asphyxiate */
@@ -50,6 +50,19 @@ enum {
 /** @endcond */
 /** @} */
 
+/**
+ * @defgroup librados_h_operation_flags Operation Flags
+ * Flags for rados_write_op_set_flags() and rados_read_op_set_flags()
+ * @{
+ */
+/** @cond TODO_enums_not_yet_in_asphyxiate */
+enum {
+	LIBRADOS_OP_FLAG_EXCL   = 1,
+	LIBRADOS_OP_FLAG_FAILOK = 2
+};
+/** @endcond */
+/** @} */
+
 /**
  * @typedef rados_t
  *
@@ -116,6 +129,52 @@ typedef uint64_t rados_snap_t;
  */
 typedef void *rados_xattrs_iter_t;
 
+/**
+ * @typedef rados_omap_iter_t
+ * An iterator for listing omap key/value pairs on an object.
+ * Used with rados_read_op_omap_get_vals(), rados_read_op_omap_get_keys(),
+ * rados_read_op_omap_get_vals_by_keys(), rados_omap_get_next(), and
+ * rados_omap_get_end().
+ */
+typedef void *rados_omap_iter_t;
+
+/**
+ * @typedef rados_write_op_t
+ *
+ * An object write operation stores a number of operations which can be
+ * executed atomically. For usage, see:
+ * - Creation and deletion: rados_create_write_op() rados_release_write_op()
+ * - Extended attribute manipulation: rados_write_op_cmpxattr()
+ *   rados_write_op_setxattr(), rados_write_op_rmxattr()
+ * - Creating objects: rados_write_op_create()
+ * - IO on objects: rados_write_op_append(), rados_write_op_write(), rados_write_op_zero
+ *   rados_write_op_write_full(), rados_write_op_remove, rados_write_op_truncate()
+ * - Omap operations: rados_write_op_omap_set(), rados_write_op_omap_rm_keys(),
+ *   rados_write_op_omap_clear()
+ * - Object class methods: rados_write_op_exec()
+ * - Request properties: rados_write_op_set_flags()
+ * - Performing the operation: rados_write_op_operate(), rados_aio_write_op_operate()
+ */
+typedef void *rados_write_op_t;
+
+/**
+ * @typedef rados_read_op_t
+ *
+ * An object read operation stores a number of operations which can be
+ * executed atomically. For usage, see:
+ * - Creation and deletion: rados_create_read_op() rados_release_read_op()
+ * - Extended attribute manipulation: rados_read_op_cmpxattr(),
+ *   rados_read_op_getxattrs()
+ * - Omap operations: rados_read_op_omap_get_vals(), rados_read_op_omap_get_keys(),
+ *   rados_read_op_omap_get_vals_by_keys()
+ * - Object properties: rados_read_op_stat()
+ * - IO on objects: rados_read_op_read()
+ * - Object class methods: rados_read_op_exec()
+ * - Request properties: rados_read_op_set_flags()
+ * - Performing the operation: rados_read_op_operate(), rados_aio_read_op_operate()
+ */
+typedef void *rados_read_op_t;
+
 /**
  * @struct rados_pool_stat_t
  * Usage information for a pool.
@@ -611,6 +670,46 @@ int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *ctx);
  */
 int rados_objects_list_next(rados_list_ctx_t ctx, const char **entry, const char **key);
 
+/**
+ * Start listing objects in a pool, several placement groups at a time
+ *
+ * Up to max_in_flight placement groups are listed concurrently, and
+ * their results are handed out by rados_objects_list_next() as they
+ * arrive, so objects are not returned in any particular order.
+ * Listing pauses while the caller falls behind, so memory use is
+ * bounded no matter how large the pool is.
+ *
+ * @param io the pool to list from
+ * @param max_in_flight how many placement groups to list at once, or
+ * 0 for the objecter_list_parallel_ops config option
+ * @param cursor from rados_objects_list_get_cursor(), to resume an
+ * earlier listing, or NULL to start at the beginning
+ * @param cursor_len length of cursor
+ * @param ctx the handle to store list context in
+ * @returns 0 on success, negative error code on failure
+ * @returns -EINVAL if the cursor is invalid or from another pool
+ */
+int rados_objects_list_open_parallel(rados_ioctx_t io, int max_in_flight,
+				     const char *cursor, size_t cursor_len,
+				     rados_list_ctx_t *ctx);
+
+/**
+ * Get the position of a parallel listing
+ *
+ * The cursor records where each placement group is up to, as of the
+ * objects returned so far.  A listing resumed from it will not miss
+ * any objects, but may return some of them again.  If the pool's
+ * placement groups are split in the meantime the listing restarts.
+ *
+ * @param ctx a handle from rados_objects_list_open_parallel()
+ * @param buf where to store the cursor
+ * @param len size of buf
+ * @returns length of the cursor on success
+ * @returns -ERANGE if buf is too small
+ * @returns -EINVAL if ctx is not a parallel listing
+ */
+int rados_objects_list_get_cursor(rados_list_ctx_t ctx, char *buf, size_t len);
+
 /**
  * Close the object listing handle.
  *
@@ -1366,6 +1465,9 @@ int rados_aio_write_full(rados_ioctx_t io, const char *oid,
  *
  * @note only the 'complete' callback of the completion will be called.
  *
+ * @note the reply may be received directly into buf, so it must not
+ * be touched until the read is complete.
+ *
  * @param io the context in which to perform the read
  * @param oid the name of the object to read from
  * @param completion what to do when the read is complete
@@ -1394,6 +1496,457 @@ int rados_aio_flush(rados_ioctx_t io);
 
 /** @} Asynchronous I/O */
 
+/**
+ * @defgroup librados_h_obj_op Object Operations
+ *
+ * A single rados operation can do multiple operations on one object
+ * atomically. The whole operation will suceed or fail, and no partial
+ * results will be visible.
+ *
+ * Operations may be either reads, which can return data, or writes,
+ * which cannot. The effects of writes are applied and visible all at
+ * once, so an operation that sets an xattr and then checks its value
+ * will not see the updated value.
+ *
+ * Submitting an operation asynchronously lets metadata updates and
+ * lookups be pipelined the same way as rados_aio_write() and friends.
+ * An operation may only be performed once; release it afterwards,
+ * even if it failed.
+ *
+ * @{
+ */
+
+/**
+ * Create a new rados_write_op_t write operation. This will store all actions
+ * to be performed atomically. You must call rados_release_write_op when you are
+ * finished with it.
+ *
+ * @returns non-NULL on success, NULL on memory allocation error.
+ */
+rados_write_op_t rados_create_write_op(void);
+
+/**
+ * Free a rados_write_op_t, must be called when you're done with it.
+ * @param write_op operation to deallocate, created with rados_create_write_op
+ */
+void rados_release_write_op(rados_write_op_t write_op);
+
+/**
+ * Set flags for the last operation added to this write_op.
+ * At least one op must have been added to the write_op.
+ * @param write_op operation to add the flags to
+ * @param flags see librados_h_operation_flags
+ */
+void rados_write_op_set_flags(rados_write_op_t write_op, int flags);
+
+/**
+ * Ensure that given xattr satisfies comparison
+ * @param write_op operation to add this action to
+ * @param name name of the xattr to look up
+ * @param comparison_operator currently undocumented, look for
+ * LIBRADOS_CMPXATTR_OP_EQ in librados.h
+ * @param value buffer to compare actual xattr value to
+ * @param value_len length of buffer to compare actual xattr value to
+ */
+void rados_write_op_cmpxattr(rados_write_op_t write_op,
+			     const char *name,
+			     uint8_t comparison_operator,
+			     const char *value,
+			     size_t value_len);
+
+/**
+ * Set an xattr
+ * @param write_op operation to add this action to
+ * @param name name of the xattr
+ * @param value buffer to set xattr to
+ * @param value_len length of buffer to set xattr to
+ */
+void rados_write_op_setxattr(rados_write_op_t write_op,
+			     const char *name,
+			     const char *value,
+			     size_t value_len);
+
+/**
+ * Remove an xattr
+ * @param write_op operation to add this action to
+ * @param name name of the xattr to remove
+ */
+void rados_write_op_rmxattr(rados_write_op_t write_op, const char *name);
+
+/**
+ * Create the object
+ * @param write_op operation to add this action to
+ * @param exclusive set to nonzero to fail if the object already exists
+ * @param category category string (NULL for none)
+ */
+void rados_write_op_create(rados_write_op_t write_op,
+			   int exclusive,
+			   const char *category);
+
+/**
+ * Write to offset
+ * @param write_op operation to add this action to
+ * @param buffer bytes to write
+ * @param len length of buffer
+ * @param offset offset to write to
+ */
+void rados_write_op_write(rados_write_op_t write_op,
+			  const char *buffer,
+			  size_t len,
+			  uint64_t offset);
+
+/**
+ * Write whole object, atomically replacing it.
+ * @param write_op operation to add this action to
+ * @param buffer bytes to write
+ * @param len length of buffer
+ */
+void rados_write_op_write_full(rados_write_op_t write_op,
+			       const char *buffer,
+			       size_t len);
+
+/**
+ * Append to end of object.
+ * @param write_op operation to add this action to
+ * @param buffer bytes to write
+ * @param len length of buffer
+ */
+void rados_write_op_append(rados_write_op_t write_op,
+			   const char *buffer,
+			   size_t len);
+
+/**
+ * Remove object
+ * @param write_op operation to add this action to
+ */
+void rados_write_op_remove(rados_write_op_t write_op);
+
+/**
+ * Truncate an object
+ * @param write_op operation to add this action to
+ * @param offset Offset to truncate to
+ */
+void rados_write_op_truncate(rados_write_op_t write_op, uint64_t offset);
+
+/**
+ * Zero part of an object
+ * @param write_op operation to add this action to
+ * @param offset Offset to zero
+ * @param len length to zero
+ */
+void rados_write_op_zero(rados_write_op_t write_op,
+			 uint64_t offset,
+			 uint64_t len);
+
+/**
+ * Execute an OSD class method on an object
+ * See rados_exec() for general description.
+ *
+ * @param write_op operation to add this action to
+ * @param cls the name of the class
+ * @param method the name of the method
+ * @param in_buf where to find input
+ * @param in_len length of in_buf in bytes
+ * @param prval where to store the return value from the method
+ */
+void rados_write_op_exec(rados_write_op_t write_op,
+			 const char *cls,
+			 const char *method,
+			 const char *in_buf,
+			 size_t in_len,
+			 int *prval);
+
+/**
+ * Set key/value pairs on an object
+ *
+ * @param write_op operation to add this action to
+ * @param keys array of null-terminated char arrays representing keys to set
+ * @param vals array of pointers to values to set
+ * @param lens array of lengths corresponding to each value
+ * @param num number of key/value pairs to set
+ */
+void rados_write_op_omap_set(rados_write_op_t write_op,
+			     char const* const* keys,
+			     char const* const* vals,
+			     const size_t *lens,
+			     size_t num);
+
+/**
+ * Remove key/value pairs from an object
+ *
+ * @param write_op operation to add this action to
+ * @param keys array of null-terminated char arrays representing keys to remove
+ * @param keys_len number of key/value pairs to remove
+ */
+void rados_write_op_omap_rm_keys(rados_write_op_t write_op,
+				 char const* const* keys,
+				 size_t keys_len);
+
+/**
+ * Remove all key/value pairs from an object
+ *
+ * @param write_op operation to add this action to
+ */
+void rados_write_op_omap_clear(rados_write_op_t write_op);
+
+/**
+ * Perform a write operation synchronously
+ * @param write_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param oid the object id
+ * @param mtime the time to set the mtime to, NULL for the current time
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_write_op_operate(rados_write_op_t write_op,
+			   rados_ioctx_t io,
+			   const char *oid,
+			   time_t *mtime);
+
+/**
+ * Perform a write operation asynchronously
+ * @param write_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param completion what to do when operation has been attempted
+ * @param oid the object id
+ * @param mtime the time to set the mtime to, NULL for the current time
+ * @returns 0 on success, -EROFS if the io context specifies a snap_seq
+ * other than CEPH_NOSNAP
+ */
+int rados_aio_write_op_operate(rados_write_op_t write_op,
+			       rados_ioctx_t io,
+			       rados_completion_t completion,
+			       const char *oid,
+			       time_t *mtime);
+
+/**
+ * Create a new rados_read_op_t write operation. This will store all
+ * actions to be performed atomically. You must call
+ * rados_release_read_op when you are finished with it (after it
+ * completes, or you decide not to send it in the first place).
+ *
+ * @returns non-NULL on success, NULL on memory allocation error.
+ */
+rados_read_op_t rados_create_read_op(void);
+
+/**
+ * Free a rados_read_op_t, must be called when you're done with it.
+ * @param read_op operation to deallocate, created with rados_create_read_op
+ */
+void rados_release_read_op(rados_read_op_t read_op);
+
+/**
+ * Set flags for the last operation added to this read_op.
+ * At least one op must have been added to the read_op.
+ * @param read_op operation to add the flags to
+ * @param flags see librados_h_operation_flags
+ */
+void rados_read_op_set_flags(rados_read_op_t read_op, int flags);
+
+/**
+ * Ensure that the an xattr satisfies a comparison
+ * @param read_op operation to add this action to
+ * @param name name of the xattr to look up
+ * @param comparison_operator currently undocumented, look for
+ * LIBRADOS_CMPXATTR_OP_EQ in librados.h
+ * @param value buffer to compare actual xattr value to
+ * @param value_len length of buffer to compare actual xattr value to
+ */
+void rados_read_op_cmpxattr(rados_read_op_t read_op,
+			    const char *name,
+			    uint8_t comparison_operator,
+			    const char *value,
+			    size_t value_len);
+
+/**
+ * Start iterating over xattrs on an object.
+ *
+ * The iterator is valid once the operation completes, and must be
+ * freed with rados_getxattrs_end() even if the operation fails.
+ *
+ * @param read_op operation to add this action to
+ * @param iter where to store the iterator
+ * @param prval where to store the return value of this action
+ */
+void rados_read_op_getxattrs(rados_read_op_t read_op,
+			     rados_xattrs_iter_t *iter,
+			     int *prval);
+
+/**
+ * Start iterating over key/value pairs on an object.
+ *
+ * They will be returned sorted by key. The iterator is valid once the
+ * operation completes, and must be freed with rados_omap_get_end()
+ * even if the operation fails.
+ *
+ * @param read_op operation to add this action to
+ * @param start_after list keys starting after start_after
+ * @param filter_prefix list only keys beginning with filter_prefix
+ * @param max_return list no more than max_return key/value pairs
+ * @param iter where to store the iterator
+ * @param prval where to store the return value from this action
+ */
+void rados_read_op_omap_get_vals(rados_read_op_t read_op,
+				 const char *start_after,
+				 const char *filter_prefix,
+				 uint64_t max_return,
+				 rados_omap_iter_t *iter,
+				 int *prval);
+
+/**
+ * Start iterating over keys on an object.
+ *
+ * They will be returned sorted by key, and the iterator
+ * will fill in NULL for all values if specified.
+ *
+ * @param read_op operation to add this action to
+ * @param start_after list keys starting after start_after
+ * @param max_return list no more than max_return keys
+ * @param iter where to store the iterator
+ * @param prval where to store the return value from this action
+ */
+void rados_read_op_omap_get_keys(rados_read_op_t read_op,
+				 const char *start_after,
+				 uint64_t max_return,
+				 rados_omap_iter_t *iter,
+				 int *prval);
+
+/**
+ * Start iterating over specific key/value pairs
+ *
+ * They will be returned sorted by key.
+ *
+ * @param read_op operation to add this action to
+ * @param keys array of pointers to null-terminated keys to get
+ * @param keys_len the number of strings in keys
+ * @param iter where to store the iterator
+ * @param prval where to store the return value from this action
+ */
+void rados_read_op_omap_get_vals_by_keys(rados_read_op_t read_op,
+					 char const* const* keys,
+					 size_t keys_len,
+					 rados_omap_iter_t *iter,
+					 int *prval);
+
+/**
+ * Get the next omap key/value pair on the object
+ *
+ * @pre iter is a valid iterator
+ *
+ * @post key and val are the next key/value pair. key is
+ * null-terminated, and val has length len. If the end of the list has
+ * been reached, key and val are NULL, and len is 0. key and val will
+ * not be accessible after rados_omap_get_end() is called on iter, so
+ * if they are needed after that they should be copied.
+ *
+ * @param iter iterator to advance
+ * @param key where to store the key of the next omap entry
+ * @param val where to store the value of the next omap entry
+ * @param len where to store the number of bytes in val
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_omap_get_next(rados_omap_iter_t iter,
+			char **key,
+			char **val,
+			size_t *len);
+
+/**
+ * Close the omap iterator.
+ *
+ * iter should not be used after this is called.
+ *
+ * @param iter the iterator to close
+ */
+void rados_omap_get_end(rados_omap_iter_t iter);
+
+/**
+ * Get object size and mtime
+ * @param read_op operation to add this action to
+ * @param psize where to store object size
+ * @param pmtime where to store modification time
+ * @param prval where to store the return value of this action
+ */
+void rados_read_op_stat(rados_read_op_t read_op,
+			uint64_t *psize,
+			time_t *pmtime,
+			int *prval);
+
+/**
+ * Read bytes from offset into buffer.
+ *
+ * prlen will be filled with the number of bytes read if successful.
+ * A short read can only occur if the read reaches the end of the
+ * object.
+ *
+ * @param read_op operation to add this action to
+ * @param offset offset to read from
+ * @param len length of buffer
+ * @param buf where to put the data
+ * @param bytes_read where to store the number of bytes read by this action
+ * @param prval where to store the return value of this action
+ */
+void rados_read_op_read(rados_read_op_t read_op,
+			uint64_t offset,
+			size_t len,
+			char *buf,
+			size_t *bytes_read,
+			int *prval);
+
+/**
+ * Execute an OSD class method on an object
+ * See rados_exec() for general description.
+ *
+ * If the output does not fit in out_buf, prval is set to -ERANGE.
+ *
+ * @param read_op operation to add this action to
+ * @param cls the name of the class
+ * @param method the name of the method
+ * @param in_buf where to find input
+ * @param in_len length of in_buf in bytes
+ * @param out_buf user-provided buffer to read into
+ * @param out_len length of out_buf
+ * @param used_len where to store the number of bytes read into out_buf
+ * @param prval where to store the return value from the method
+ */
+void rados_read_op_exec(rados_read_op_t read_op,
+			const char *cls,
+			const char *method,
+			const char *in_buf,
+			size_t in_len,
+			char *out_buf,
+			size_t out_len,
+			size_t *used_len,
+			int *prval);
+
+/**
+ * Perform a read operation synchronously
+ * @param read_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param oid the object id
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_read_op_operate(rados_read_op_t read_op,
+			  rados_ioctx_t io,
+			  const char *oid);
+
+/**
+ * Perform a read operation asynchronously
+ *
+ * The outputs of each action are filled in before the completion's
+ * callback is called.
+ *
+ * @param read_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param completion what to do when operation has been attempted
+ * @param oid the object id
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_read_op_operate(rados_read_op_t read_op,
+			      rados_ioctx_t io,
+			      rados_completion_t completion,
+			      const char *oid);
+
+/** @} Object Operations */
+
 /**
  * @defgroup librados_h_watch_notify Watch/Notify
  *
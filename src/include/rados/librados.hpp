@@ -69,6 +69,9 @@ namespace librados
     const std::pair<std::string, std::string>* operator->() const;
     ObjectIterator &operator++(); // Preincrement
     ObjectIterator operator++(int); // Postincrement
+    /// position of a parallel listing, after the current entry, to pass
+    /// to IoCtx::objects_begin_parallel
+    int get_cursor(bufferlist *cursor) const;
     friend class IoCtx;
   private:
     void get_next();
@@ -414,6 +417,13 @@ namespace librados
     int selfmanaged_snap_rollback(const std::string& oid, uint64_t snapid);
 
     ObjectIterator objects_begin();
+    /**
+     * list with up to max_in_flight pgs at a time (0 for the default);
+     * objects come back in no particular order.  a cursor from
+     * ObjectIterator::get_cursor resumes an earlier listing.
+     */
+    ObjectIterator objects_begin_parallel(int max_in_flight);
+    ObjectIterator objects_begin_parallel(int max_in_flight, const bufferlist& cursor);
     const ObjectIterator& objects_end() const;
 
     uint64_t get_last_version();
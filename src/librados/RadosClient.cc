@@ -29,6 +29,7 @@
 #include "include/buffer.h"
 
 #include "messages/MWatchNotify.h"
+#include "messages/MWatchNotifyBatch.h"
 #include "msg/SimpleMessenger.h"
 
 #include "AioCompletionImpl.h"
@@ -254,6 +255,13 @@ bool librados::RadosClient::ms_dispatch(Message *m)
 {
   bool ret;
 
+  // op replies only need the objecter's own locks, so many
+  // threads' ops don't serialize on ours
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY && state == CONNECTED) {
+    objecter->handle_osd_op_reply((MOSDOpReply*)m);
+    return true;
+  }
+
   lock.Lock();
   if (state == DISCONNECTED) {
     ldout(cct, 10) << "disconnected, discarding " << *m << dendl;
@@ -315,6 +323,20 @@ bool librados::RadosClient::_dispatch(Message *m)
   case CEPH_MSG_WATCH_NOTIFY:
     watch_notify((MWatchNotify *)m);
     break;
+  case MSG_WATCH_NOTIFY_BATCH:
+    {
+      MWatchNotifyBatch *b = (MWatchNotifyBatch *)m;
+      while (!b->notifies.empty()) {
+	Message *n = b->notifies.front();
+	b->notifies.pop_front();
+	if (n->get_type() == CEPH_MSG_WATCH_NOTIFY)
+	  watch_notify((MWatchNotify *)n);
+	else
+	  n->put();
+      }
+      b->put();
+    }
+    break;
   default:
     return false;
   }
@@ -487,8 +509,10 @@ void librados::RadosClient::watch_notify(MWatchNotify *m)
   if (iter != watchers.end())
     wc = iter->second;
 
-  if (!wc)
+  if (!wc) {
+    m->put();
     return;
+  }
 
   wc->get();
   finisher.queue(new C_WatchNotify(wc, &lock, m->opcode, m->ver, m->notify_id, m->bl));
@@ -323,10 +323,21 @@ librados::WatchCtx::
 struct librados::ObjListCtx {
   librados::IoCtxImpl *ctx;
   Objecter::ListContext *lc;
+  Objecter::ParallelListContext *plc;
 
-  ObjListCtx(IoCtxImpl *c, Objecter::ListContext *l) : ctx(c), lc(l) {}
+  ObjListCtx(IoCtxImpl *c, Objecter::ListContext *l) : ctx(c), lc(l), plc(NULL) {}
+  ObjListCtx(IoCtxImpl *c, Objecter::ParallelListContext *l)
+    : ctx(c), lc(NULL), plc(l) {}
   ~ObjListCtx() {
     delete lc;
+    if (plc) {
+      // replies still in flight refer to plc
+      plc->lock.Lock();
+      while (plc->num_in_flight)
+	plc->cond.Wait(plc->lock);
+      plc->lock.Unlock();
+      delete plc;
+    }
   }
 };
 
@@ -388,6 +399,14 @@ void librados::ObjectIterator::get_next()
   cur_obj = make_pair(entry, key ? key : string());
 }
 
+int librados::ObjectIterator::get_cursor(bufferlist *cursor) const
+{
+  if (!ctx || !ctx->plc)
+    return -EINVAL;
+  ctx->plc->encode_cursor(*cursor);
+  return 0;
+}
+
 const librados::ObjectIterator librados::ObjectIterator::__EndObjectIterator(NULL);
 
 ///////////////////////////// PoolAsyncCompletion //////////////////////////////
@@ -810,7 +829,8 @@ int librados::IoCtx::operate(const std::string& oid, librados::ObjectReadOperati
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectWriteOperation *o)
 {
   object_t obj(oid);
-  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc);
+  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc,
+				  o->pmtime);
 }
 
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectReadOperation *o, bufferlist *pbl)
@@ -894,6 +914,29 @@ librados::ObjectIterator librados::IoCtx::objects_begin()
   return iter;
 }
 
+librados::ObjectIterator librados::IoCtx::objects_begin_parallel(int max_in_flight)
+{
+  return objects_begin_parallel(max_in_flight, bufferlist());
+}
+
+librados::ObjectIterator librados::IoCtx::objects_begin_parallel(int max_in_flight,
+								  const bufferlist& cursor)
+{
+  rados_list_ctx_t listh;
+  bufferlist bl(cursor);
+  int r = rados_objects_list_open_parallel(io_ctx_impl, max_in_flight,
+					   bl.length() ? bl.c_str() : NULL,
+					   bl.length(), &listh);
+  if (r < 0) {
+    ostringstream oss;
+    oss << "rados returned " << cpp_strerror(r);
+    throw std::runtime_error(oss.str());
+  }
+  ObjectIterator iter((ObjListCtx*)listh);
+  iter.get_next();
+  return iter;
+}
+
 const librados::ObjectIterator& librados::IoCtx::objects_end() const
 {
   return ObjectIterator::__EndObjectIterator;
@@ -1922,6 +1965,44 @@ extern "C" int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *listh
   return 0;
 }
 
+extern "C" int rados_objects_list_open_parallel(rados_ioctx_t io, int max_in_flight,
+						const char *cursor, size_t cursor_len,
+						rados_list_ctx_t *listh)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  Objecter::ParallelListContext *h = new Objecter::ParallelListContext;
+  h->pool_id = ctx->poolid;
+  h->pool_snap_seq = ctx->snap_seq;
+  if (max_in_flight <= 0)
+    max_in_flight = ctx->client->cct->_conf->objecter_list_parallel_ops;
+  h->max_in_flight = max_in_flight > 0 ? max_in_flight : 1;
+  h->max_entries = RADOS_LIST_MAX_ENTRIES;
+  if (cursor_len) {
+    bufferlist bl;
+    bl.append(cursor, cursor_len);
+    int r = h->decode_cursor(bl);
+    if (r < 0) {
+      delete h;
+      return r;
+    }
+  }
+  *listh = (void *)new librados::ObjListCtx(ctx, h);
+  return 0;
+}
+
+extern "C" int rados_objects_list_get_cursor(rados_list_ctx_t listctx, char *buf, size_t len)
+{
+  librados::ObjListCtx *lh = (librados::ObjListCtx *)listctx;
+  if (!lh->plc)
+    return -EINVAL;
+  bufferlist bl;
+  lh->plc->encode_cursor(bl);
+  if (bl.length() > len)
+    return -ERANGE;
+  bl.copy(0, bl.length(), buf);
+  return bl.length();
+}
+
 extern "C" void rados_objects_list_close(rados_list_ctx_t h)
 {
   librados::ObjListCtx *lh = (librados::ObjListCtx *)h;
@@ -1934,6 +2015,16 @@ extern "C" int rados_objects_list_next(rados_list_ctx_t listctx, const char **en
   Objecter::ListContext *h = lh->lc;
   int ret;
 
+  if (lh->plc) {
+    ret = lh->ctx->list_parallel(lh->plc);
+    if (ret < 0)
+      return ret;
+    *entry = lh->plc->cur.first.name.c_str();
+    if (key)
+      *key = lh->plc->cur.second.size() ? lh->plc->cur.second.c_str() : NULL;
+    return 0;
+  }
+
   // if the list is non-empty, this method has been called before
   if (!h->list.empty())
     // so let's kill the previously-returned object
@@ -2084,6 +2175,441 @@ extern "C" int rados_aio_flush(rados_ioctx_t io)
   return 0;
 }
 
+// -------------------------
+// object operations
+
+class RadosOmapIter {
+public:
+  RadosOmapIter()
+    : val(NULL)
+  {
+    i = values.end();
+  }
+  ~RadosOmapIter()
+  {
+    free(val);
+    val = NULL;
+  }
+  std::map<std::string, bufferlist> values;
+  std::set<std::string> keys;   ///< for omap_get_keys, copied into values
+  std::map<std::string, bufferlist>::iterator i;
+  char *val;
+};
+
+/// point an xattr iterator at the start once its map has been decoded
+struct C_XattrsIter : public Context {
+  Context *decode;
+  RadosXattrsIter *iter;
+  C_XattrsIter(Context *d, RadosXattrsIter *it) : decode(d), iter(it) {}
+  void finish(int r) {
+    decode->complete(r);
+    iter->i = iter->attrset.begin();
+  }
+};
+
+/// likewise for omap iterators
+struct C_OmapIter : public Context {
+  Context *decode;
+  RadosOmapIter *iter;
+  C_OmapIter(Context *d, RadosOmapIter *it) : decode(d), iter(it) {}
+  void finish(int r) {
+    decode->complete(r);
+    for (std::set<std::string>::iterator p = iter->keys.begin();
+	 p != iter->keys.end(); ++p)
+      iter->values[*p];
+    iter->i = iter->values.begin();
+  }
+};
+
+/// copy an op's output into a caller's buffer
+struct C_bl_to_buf : public Context {
+  char *out_buf;
+  size_t out_len;
+  size_t *bytes_read;
+  int *prval;
+  bufferlist bl;
+  C_bl_to_buf(char *out, size_t len, size_t *bytes, int *pr)
+    : out_buf(out), out_len(len), bytes_read(bytes), prval(pr) {}
+  void finish(int r) {
+    if (r < 0)
+      return;
+    if (bl.length() > out_len) {
+      if (prval)
+	*prval = -ERANGE;
+      if (bytes_read)
+	*bytes_read = 0;
+      return;
+    }
+    bl.copy(0, bl.length(), out_buf);
+    if (bytes_read)
+      *bytes_read = bl.length();
+  }
+};
+
+static void release_op(::ObjectOperation *o)
+{
+  // handlers are only consumed if the op was sent
+  for (vector<Context*>::iterator p = o->out_handler.begin();
+       p != o->out_handler.end(); ++p)
+    delete *p;
+  delete o;
+}
+
+static int to_op_flags(int flags)
+{
+  int rados_flags = 0;
+  if (flags & LIBRADOS_OP_FLAG_EXCL)
+    rados_flags |= CEPH_OSD_OP_FLAG_EXCL;
+  if (flags & LIBRADOS_OP_FLAG_FAILOK)
+    rados_flags |= CEPH_OSD_OP_FLAG_FAILOK;
+  return rados_flags;
+}
+
+extern "C" rados_write_op_t rados_create_write_op(void)
+{
+  return new (std::nothrow) ::ObjectOperation;
+}
+
+extern "C" void rados_release_write_op(rados_write_op_t write_op)
+{
+  release_op((::ObjectOperation *)write_op);
+}
+
+extern "C" void rados_write_op_set_flags(rados_write_op_t write_op, int flags)
+{
+  ((::ObjectOperation *)write_op)->set_last_op_flags(to_op_flags(flags));
+}
+
+extern "C" void rados_write_op_cmpxattr(rados_write_op_t write_op,
+				       const char *name,
+				       uint8_t comparison_operator,
+				       const char *value,
+				       size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->cmpxattr(name, comparison_operator,
+					    CEPH_OSD_CMPXATTR_MODE_STRING, bl);
+}
+
+extern "C" void rados_write_op_setxattr(rados_write_op_t write_op,
+				       const char *name,
+				       const char *value,
+				       size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->setxattr(name, bl);
+}
+
+extern "C" void rados_write_op_rmxattr(rados_write_op_t write_op, const char *name)
+{
+  ((::ObjectOperation *)write_op)->rmxattr(name);
+}
+
+extern "C" void rados_write_op_create(rados_write_op_t write_op,
+				     int exclusive,
+				     const char *category)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)write_op;
+  if (category)
+    o->create(!!exclusive, category);
+  else
+    o->create(!!exclusive);
+}
+
+extern "C" void rados_write_op_write(rados_write_op_t write_op,
+				    const char *buffer,
+				    size_t len,
+				    uint64_t offset)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->write(offset, bl);
+}
+
+extern "C" void rados_write_op_write_full(rados_write_op_t write_op,
+					 const char *buffer,
+					 size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->write_full(bl);
+}
+
+extern "C" void rados_write_op_append(rados_write_op_t write_op,
+				     const char *buffer,
+				     size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->append(bl);
+}
+
+extern "C" void rados_write_op_remove(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->remove();
+}
+
+extern "C" void rados_write_op_truncate(rados_write_op_t write_op, uint64_t offset)
+{
+  ((::ObjectOperation *)write_op)->truncate(offset);
+}
+
+extern "C" void rados_write_op_zero(rados_write_op_t write_op,
+				   uint64_t offset,
+				   uint64_t len)
+{
+  ((::ObjectOperation *)write_op)->zero(offset, len);
+}
+
+extern "C" void rados_write_op_exec(rados_write_op_t write_op,
+				   const char *cls,
+				   const char *method,
+				   const char *in_buf,
+				   size_t in_len,
+				   int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)write_op;
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  o->call(cls, method, inbl);
+  o->out_rval[o->ops.size() - 1] = prval;
+}
+
+extern "C" void rados_write_op_omap_set(rados_write_op_t write_op,
+				       char const* const* keys,
+				       char const* const* vals,
+				       const size_t *lens,
+				       size_t num)
+{
+  std::map<std::string, bufferlist> entries;
+  for (size_t i = 0; i < num; i++) {
+    bufferlist bl;
+    bl.append(vals[i], lens[i]);
+    entries[keys[i]] = bl;
+  }
+  ((::ObjectOperation *)write_op)->omap_set(entries);
+}
+
+extern "C" void rados_write_op_omap_rm_keys(rados_write_op_t write_op,
+					   char const* const* keys,
+					   size_t keys_len)
+{
+  std::set<std::string> to_remove(keys, keys + keys_len);
+  ((::ObjectOperation *)write_op)->omap_rm_keys(to_remove);
+}
+
+extern "C" void rados_write_op_omap_clear(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->omap_clear();
+}
+
+extern "C" int rados_write_op_operate(rados_write_op_t write_op,
+				     rados_ioctx_t io,
+				     const char *oid,
+				     time_t *mtime)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->operate(obj, (::ObjectOperation *)write_op, mtime);
+}
+
+extern "C" int rados_aio_write_op_operate(rados_write_op_t write_op,
+					 rados_ioctx_t io,
+					 rados_completion_t completion,
+					 const char *oid,
+					 time_t *mtime)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->aio_operate(obj, (::ObjectOperation *)write_op,
+			  (librados::AioCompletionImpl *)completion, mtime);
+}
+
+extern "C" rados_read_op_t rados_create_read_op(void)
+{
+  return new (std::nothrow) ::ObjectOperation;
+}
+
+extern "C" void rados_release_read_op(rados_read_op_t read_op)
+{
+  release_op((::ObjectOperation *)read_op);
+}
+
+extern "C" void rados_read_op_set_flags(rados_read_op_t read_op, int flags)
+{
+  ((::ObjectOperation *)read_op)->set_last_op_flags(to_op_flags(flags));
+}
+
+extern "C" void rados_read_op_cmpxattr(rados_read_op_t read_op,
+				      const char *name,
+				      uint8_t comparison_operator,
+				      const char *value,
+				      size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)read_op)->cmpxattr(name, comparison_operator,
+					   CEPH_OSD_CMPXATTR_MODE_STRING, bl);
+}
+
+extern "C" void rados_read_op_getxattrs(rados_read_op_t read_op,
+				       rados_xattrs_iter_t *iter,
+				       int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosXattrsIter *it = new RadosXattrsIter();
+  o->getxattrs(&it->attrset, prval);
+  unsigned p = o->ops.size() - 1;
+  o->out_handler[p] = new C_XattrsIter(o->out_handler[p], it);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_omap_get_vals(rados_read_op_t read_op,
+					   const char *start_after,
+					   const char *filter_prefix,
+					   uint64_t max_return,
+					   rados_omap_iter_t *iter,
+					   int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosOmapIter *it = new RadosOmapIter();
+  o->omap_get_vals(start_after ? start_after : "",
+		   filter_prefix ? filter_prefix : "",
+		   max_return, &it->values, prval);
+  unsigned p = o->ops.size() - 1;
+  o->out_handler[p] = new C_OmapIter(o->out_handler[p], it);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_omap_get_keys(rados_read_op_t read_op,
+					   const char *start_after,
+					   uint64_t max_return,
+					   rados_omap_iter_t *iter,
+					   int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosOmapIter *it = new RadosOmapIter();
+  o->omap_get_keys(start_after ? start_after : "", max_return,
+		   &it->keys, prval);
+  unsigned p = o->ops.size() - 1;
+  o->out_handler[p] = new C_OmapIter(o->out_handler[p], it);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_omap_get_vals_by_keys(rados_read_op_t read_op,
+						   char const* const* keys,
+						   size_t keys_len,
+						   rados_omap_iter_t *iter,
+						   int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  std::set<std::string> to_get(keys, keys + keys_len);
+  RadosOmapIter *it = new RadosOmapIter();
+  o->omap_get_vals_by_keys(to_get, &it->values, prval);
+  unsigned p = o->ops.size() - 1;
+  o->out_handler[p] = new C_OmapIter(o->out_handler[p], it);
+  *iter = it;
+}
+
+extern "C" int rados_omap_get_next(rados_omap_iter_t iter,
+				   char **key,
+				   char **val,
+				   size_t *len)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  if (it->i == it->values.end()) {
+    *key = NULL;
+    *val = NULL;
+    *len = 0;
+    return 0;
+  }
+  free(it->val);
+  it->val = NULL;
+  *key = (char*)it->i->first.c_str();
+  bufferlist &bl(it->i->second);
+  size_t bl_len = bl.length();
+  if (bl_len) {
+    it->val = (char*)malloc(bl_len);
+    if (!it->val)
+      return -ENOMEM;
+    memcpy(it->val, bl.c_str(), bl_len);
+  }
+  *val = it->val;
+  *len = bl_len;
+  ++it->i;
+  return 0;
+}
+
+extern "C" void rados_omap_get_end(rados_omap_iter_t iter)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  delete it;
+}
+
+extern "C" void rados_read_op_stat(rados_read_op_t read_op,
+				  uint64_t *psize,
+				  time_t *pmtime,
+				  int *prval)
+{
+  ((::ObjectOperation *)read_op)->stat(psize, pmtime, prval);
+}
+
+extern "C" void rados_read_op_read(rados_read_op_t read_op,
+				  uint64_t offset,
+				  size_t len,
+				  char *buf,
+				  size_t *bytes_read,
+				  int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  C_bl_to_buf *h = new C_bl_to_buf(buf, len, bytes_read, prval);
+  o->read(offset, len, &h->bl, prval);
+  o->out_handler[o->ops.size() - 1] = h;
+}
+
+extern "C" void rados_read_op_exec(rados_read_op_t read_op,
+				  const char *cls,
+				  const char *method,
+				  const char *in_buf,
+				  size_t in_len,
+				  char *out_buf,
+				  size_t out_len,
+				  size_t *used_len,
+				  int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  o->call(cls, method, inbl);
+  unsigned p = o->ops.size() - 1;
+  C_bl_to_buf *h = new C_bl_to_buf(out_buf, out_len, used_len, prval);
+  o->out_handler[p] = h;
+  o->out_bl[p] = &h->bl;
+  o->out_rval[p] = prval;
+}
+
+extern "C" int rados_read_op_operate(rados_read_op_t read_op,
+				    rados_ioctx_t io,
+				    const char *oid)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->operate_read(obj, (::ObjectOperation *)read_op, NULL);
+}
+
+extern "C" int rados_aio_read_op_operate(rados_read_op_t read_op,
+					rados_ioctx_t io,
+					rados_completion_t completion,
+					const char *oid)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->aio_operate_read(obj, (::ObjectOperation *)read_op,
+			       (librados::AioCompletionImpl *)completion, NULL);
+}
+
 struct C_WatchCB : public librados::WatchCtx {
   rados_watchcb_t wcb;
   void *arg;
@@ -0,0 +1,70 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ * Several small client ops bound for the same osd, sent as one message
+ * to save per-message overhead.  The osd dispatches each op as if it
+ * had arrived on its own, and replies to each individually.
+ */
+
+#ifndef CEPH_MOSDOPBATCH_H
+#define CEPH_MOSDOPBATCH_H
+
+#include "msg/Message.h"
+#include "include/encoding.h"
+#include "global/global_context.h"
+
+struct MOSDOpBatch : public Message {
+  list<Message*> ops;
+
+  MOSDOpBatch() : Message(MSG_OSD_OP_BATCH) {}
+private:
+  ~MOSDOpBatch() {
+    for (list<Message*>::iterator p = ops.begin(); p != ops.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  void encode_payload(uint64_t features) {
+    __u32 n = ops.size();
+    ::encode(n, payload);
+    for (list<Message*>::iterator p = ops.begin(); p != ops.end(); ++p)
+      encode_message(*p, features, payload);
+  }
+
+  /*
+   * all or nothing: if any op won't decode (or isn't an op, say a nested
+   * batch) we throw, and decode_message drops the whole batch along with
+   * the ops decoded so far.
+   */
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    __u32 n;
+    ::decode(n, p);
+    while (n--) {
+      Message *m = decode_message(g_ceph_context, p);
+      if (!m)
+	throw buffer::malformed_input("undecodable op in osd_op_batch");
+      if (m->get_type() != CEPH_MSG_OSD_OP) {
+	m->put();
+	throw buffer::malformed_input("non-op message in osd_op_batch");
+      }
+      ops.push_back(m);
+    }
+  }
+
+  const char *get_type_name() const { return "osd_op_batch"; }
+  void print(ostream& o) const {
+    o << "osd_op_batch(" << ops.size() << " ops)";
+  }
+};
+
+#endif
@@ -24,21 +24,38 @@
 
 struct MOSDRepScrub : public Message {
 
-  static const int HEAD_VERSION = 2;
+  static const int HEAD_VERSION = 4;
 
   pg_t pgid;             // PG to scrub
   eversion_t scrub_from; // only scrub log entries after scrub_from
   eversion_t scrub_to;   // last_update_applied when message sent
   epoch_t map_epoch;
+  bool deep;             // digest object data and omap
+  bool chunky;           // scrub only objects in [start, end)
+  hobject_t start;
+  hobject_t end;
 
-  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION) { }
+  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
+		   deep(false), chunky(false) { }
   MOSDRepScrub(pg_t pgid, eversion_t scrub_from, eversion_t scrub_to,
-	       epoch_t map_epoch)
+	       epoch_t map_epoch, bool deep)
     : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
       pgid(pgid),
       scrub_from(scrub_from),
       scrub_to(scrub_to),
-      map_epoch(map_epoch) { }
+      map_epoch(map_epoch),
+      deep(deep),
+      chunky(false) { }
+  MOSDRepScrub(pg_t pgid, eversion_t scrub_to, epoch_t map_epoch,
+	       hobject_t start, hobject_t end, bool deep)
+    : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
+      pgid(pgid),
+      scrub_to(scrub_to),
+      map_epoch(map_epoch),
+      deep(deep),
+      chunky(true),
+      start(start),
+      end(end) { }
   
 private:
   ~MOSDRepScrub() {}
@@ -49,6 +66,10 @@ public:
     out << "replica scrub(pg: ";
     out << pgid << ",from:" << scrub_from << ",to:" << scrub_to
 	<< "epoch:" << map_epoch;
+    if (deep)
+      out << ",deep";
+    if (chunky)
+      out << ",chunk:" << start << "-" << end;
     out << ")";
   }
 
@@ -57,6 +78,10 @@ public:
     ::encode(scrub_from, payload);
     ::encode(scrub_to, payload);
     ::encode(map_epoch, payload);
+    ::encode(deep, payload);
+    ::encode(chunky, payload);
+    ::encode(start, payload);
+    ::encode(end, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -64,6 +89,17 @@ public:
     ::decode(scrub_from, p);
     ::decode(scrub_to, p);
     ::decode(map_epoch, p);
+    if (header.version >= 3)
+      ::decode(deep, p);
+    else
+      deep = false;
+    if (header.version >= 4) {
+      ::decode(chunky, p);
+      ::decode(start, p);
+      ::decode(end, p);
+    } else {
+      chunky = false;
+    }
   }
 };
 
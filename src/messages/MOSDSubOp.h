@@ -25,7 +25,7 @@
 
 class MOSDSubOp : public Message {
 
-  static const int HEAD_VERSION = 7;
+  static const int HEAD_VERSION = 8;
   static const int COMPAT_VERSION = 1;
 
 public:
@@ -62,6 +62,7 @@ public:
 
   // piggybacked osd/og state
   eversion_t pg_trim_to;   // primary->replica: trim to here
+  eversion_t pg_acked_to;  // primary->replica: all replicas committed to here
   osd_peer_stat_t peer_stat;
 
   map<string,bufferptr> attrset;
@@ -137,6 +138,8 @@ public:
       ::decode(omap_entries, p);
     if (header.version >= 6)
       ::decode(omap_header, p);
+    if (header.version >= 8)
+      ::decode(pg_acked_to, p);
 
     if (header.version < 7) {
       // Handle hobject_t format change
@@ -188,6 +191,7 @@ public:
     ::encode(current_progress, payload);
     ::encode(omap_entries, payload);
     ::encode(omap_header, payload);
+    ::encode(pg_acked_to, payload);
   }
 
   MOSDSubOp()
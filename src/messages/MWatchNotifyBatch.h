@@ -0,0 +1,65 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ * Several watch notifies for the same client, sent as one message.
+ * The client handles each as if it had arrived on its own.
+ */
+
+#ifndef CEPH_MWATCHNOTIFYBATCH_H
+#define CEPH_MWATCHNOTIFYBATCH_H
+
+#include "msg/Message.h"
+#include "include/encoding.h"
+#include "global/global_context.h"
+
+struct MWatchNotifyBatch : public Message {
+  list<Message*> notifies;
+
+  MWatchNotifyBatch() : Message(MSG_WATCH_NOTIFY_BATCH) {}
+private:
+  ~MWatchNotifyBatch() {
+    for (list<Message*>::iterator p = notifies.begin(); p != notifies.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  void encode_payload(uint64_t features) {
+    __u32 n = notifies.size();
+    ::encode(n, payload);
+    for (list<Message*>::iterator p = notifies.begin(); p != notifies.end(); ++p)
+      encode_message(*p, features, payload);
+  }
+
+  /// all or nothing, as with MOSDOpBatch
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    __u32 n;
+    ::decode(n, p);
+    while (n--) {
+      Message *m = decode_message(g_ceph_context, p);
+      if (!m)
+	throw buffer::malformed_input("undecodable notify in watch-notify-batch");
+      if (m->get_type() != CEPH_MSG_WATCH_NOTIFY) {
+	m->put();
+	throw buffer::malformed_input("non-notify message in watch-notify-batch");
+      }
+      notifies.push_back(m);
+    }
+  }
+
+  const char *get_type_name() const { return "watch-notify-batch"; }
+  void print(ostream& o) const {
+    o << "watch-notify-batch(" << notifies.size() << " notifies)";
+  }
+};
+
+#endif
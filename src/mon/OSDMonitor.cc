@@ -24,6 +24,8 @@
 #include "crush/CrushWrapper.h"
 #include "crush/CrushTester.h"
 
+#include "osd/ErasureCode.h"
+
 #include "messages/MOSDFailure.h"
 #include "messages/MOSDMap.h"
 #include "messages/MOSDBoot.h"
@@ -750,6 +752,20 @@ bool OSDMonitor::preprocess_boot(MOSDBoot *m)
     return true;
   }
 
+  // an osd that can't open erasure pgs would assert on them
+  if (!m->get_connection()->has_feature(CEPH_FEATURE_ERASURE_POOLS)) {
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      if (p->second.is_erasure()) {
+	mon->clog.info() << "disallowing boot of " << m->get_orig_source_inst()
+			 << ": it does not support erasure pools and pool "
+			 << p->first << " is one\n";
+	goto ignore;
+      }
+    }
+  }
+
   // noup?
   if (!can_mark_up(from)) {
     dout(7) << "preprocess_boot ignoring boot from " << m->get_orig_source_inst() << dendl;
@@ -765,6 +781,19 @@ bool OSDMonitor::preprocess_boot(MOSDBoot *m)
   return true;
 }
 
+/*
+ * features are recorded in the osdmap at boot, so an osd marked up by
+ * an older monitor has none and counts as lacking them.
+ */
+bool OSDMonitor::up_osds_have_feature(uint64_t f)
+{
+  for (int o = 0; o < osdmap.get_max_osd(); o++) {
+    if (osdmap.is_up(o) && (osdmap.get_xinfo(o).features & f) != f)
+      return false;
+  }
+  return true;
+}
+
 bool OSDMonitor::prepare_boot(MOSDBoot *m)
 {
   dout(7) << "prepare_boot from " << m->get_orig_source_inst() << " sb " << m->sb
@@ -822,6 +851,9 @@ bool OSDMonitor::prepare_boot(MOSDBoot *m)
 
     if (m->sb.weight)
       osd_weight[from] = m->sb.weight;
+    osd_xinfo_t xi = osdmap.get_xinfo(from);
+    xi.features = m->get_connection()->get_features();
+    pending_inc.new_xinfo[from] = xi;
 
     // set uuid?
     dout(10) << " setting osd." << from << " uuid to " << m->sb.osd_fsid << dendl;
@@ -1594,10 +1626,11 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	r = 0;
       }
     }
-    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "repair")) {
+    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "repair" ||
+	      m->cmd[1] == "deep-scrub")) {
       if (m->cmd.size() <= 2) {
 	r = -EINVAL;
-	ss << "usage: osd [scrub|repair] <who>";
+	ss << "usage: osd [scrub|deep-scrub|repair] <who>";
 	goto out;
       }
       if (m->cmd[2] == "*") {
@@ -1607,7 +1640,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	  if (osdmap.is_up(i)) {
 	    ss << (c++ ? ",":"") << i;
 	    mon->try_send_message(new MOSDScrub(osdmap.get_fsid(),
-						m->cmd[1] == "repair"),
+						m->cmd[1] == "repair",
+						m->cmd[1] == "deep-scrub"),
 				  osdmap.get_inst(i));
 	  }	    
 	r = 0;
@@ -1616,7 +1650,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	long osd = strtol(m->cmd[2].c_str(), 0, 10);
 	if (osdmap.is_up(osd)) {
 	  mon->try_send_message(new MOSDScrub(osdmap.get_fsid(),
-					      m->cmd[1] == "repair"),
+					      m->cmd[1] == "repair",
+					      m->cmd[1] == "deep-scrub"),
 				osdmap.get_inst(osd));
 	  r = 0;
 	  ss << "osd." << osd << " instructed to " << m->cmd[1];
@@ -1685,7 +1720,8 @@ int OSDMonitor::prepare_new_pool(MPoolOp *m)
  * @return 0 in all cases. That's silly.
  */
 int OSDMonitor::prepare_new_pool(string& name, uint64_t auid, int crush_rule,
-                                 unsigned pg_num, unsigned pgp_num)
+                                 unsigned pg_num, unsigned pgp_num,
+                                 unsigned erasure_k, unsigned erasure_m)
 {
   if (osdmap.name_pool.count(name)) {
     return -EEXIST;
@@ -1700,9 +1736,17 @@ int OSDMonitor::prepare_new_pool(string& name, uint64_t auid, int crush_rule,
   if (-1 == pending_inc.new_pool_max)
     pending_inc.new_pool_max = osdmap.pool_max;
   int64_t pool = ++pending_inc.new_pool_max;
-  pending_inc.new_pools[pool].type = pg_pool_t::TYPE_REP;
-
-  pending_inc.new_pools[pool].size = g_conf->osd_pool_default_size;
+  if (erasure_k) {
+    pending_inc.new_pools[pool].type = pg_pool_t::TYPE_ERASURE;
+    pending_inc.new_pools[pool].size = erasure_k + erasure_m;
+    pending_inc.new_pools[pool].erasure_k = erasure_k;
+    pending_inc.new_pools[pool].erasure_code_technique =
+      g_conf->osd_pool_default_erasure_code_technique;
+    pending_inc.new_pools[pool].stripe_unit = g_conf->osd_pool_default_stripe_unit;
+  } else {
+    pending_inc.new_pools[pool].type = pg_pool_t::TYPE_REP;
+    pending_inc.new_pools[pool].size = g_conf->osd_pool_default_size;
+  }
   if (crush_rule >= 0)
     pending_inc.new_pools[pool].crush_ruleset = crush_rule;
   else
@@ -2237,7 +2281,10 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  if (pending_inc.new_pools.count(pool))
 	    pp = &pending_inc.new_pools[pool];
 	  const string& snapname = m->cmd[4];
-	  if (p->snap_exists(snapname.c_str()) ||
+	  if (p->is_erasure()) {
+	    ss << "pool " << m->cmd[3] << " is erasure coded and can't be snapshotted";
+	    err = -EOPNOTSUPP;
+	  } else if (p->snap_exists(snapname.c_str()) ||
 	      (pp && pp->snap_exists(snapname.c_str()))) {
 	    ss << "pool " << m->cmd[3] << " snap " << snapname << " already exists";
 	    err = -EEXIST;
@@ -2288,6 +2335,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
       else if (m->cmd[2] == "create" && m->cmd.size() >= 4) {
         int pg_num = 0;
         int pgp_num = 0;
+        int erasure_k = 0, erasure_m = 0;
         if (m->cmd.size() > 4) { // try to parse out pg_num and pgp_num
           const char *start = m->cmd[4].c_str();
           char *end = (char*)start;
@@ -2307,9 +2355,35 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
             }
           }
         }
+        if (m->cmd.size() > 6) { // erasure <k> <m>
+          string err1, err2;
+          if (m->cmd[6] == "erasure" && m->cmd.size() == 9) {
+            erasure_k = strict_strtol(m->cmd[7].c_str(), 10, &err1);
+            erasure_m = strict_strtol(m->cmd[8].c_str(), 10, &err2);
+          }
+          if (m->cmd[6] != "erasure" || m->cmd.size() != 9 ||
+              !err1.empty() || !err2.empty() || erasure_k < 1 || erasure_m < 1) {
+            err = -EINVAL;
+            ss << "usage: osd pool create <poolname> <pg_num> <pgp_num> erasure <k> <m>";
+            goto out;
+          }
+          ErasureCodeInterface *codec =
+            ErasureCode::create(g_conf->osd_pool_default_erasure_code_technique,
+                                erasure_k, erasure_m, &ss);
+          if (!codec) {
+            err = -EINVAL;
+            goto out;
+          }
+          delete codec;
+          if (!up_osds_have_feature(CEPH_FEATURE_ERASURE_POOLS)) {
+            err = -EAGAIN;
+            ss << "not all up osds support erasure pools; upgrade them and retry";
+            goto out;
+          }
+        }
         err = prepare_new_pool(m->cmd[3], 0,  // auid=0 for admin created pool
 			       -1,            // default crush rule
-			       pg_num, pgp_num);
+			       pg_num, pgp_num, erasure_k, erasure_m);
         if (err < 0) {
           if (err == -EEXIST)
             ss << "pool '" << m->cmd[3] << "' exists";
@@ -2369,7 +2443,11 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  char *end = (char *)start;
 	  unsigned n = strtol(start, &end, 10);
 	  if (*end == '\0') {
-	    if (m->cmd[4] == "size") {
+	    if (m->cmd[4] == "size" && p->is_erasure()) {
+	      ss << "pool " << m->cmd[3] << " is erasure coded; its size is fixed at k+m = "
+		 << p->get_size();
+	      err = -EINVAL;
+	    } else if (m->cmd[4] == "size") {
 	      if (pending_inc.new_pools.count(pool) == 0)
 		pending_inc.new_pools[pool] = *p;
 	      pending_inc.new_pools[pool].size = n;
@@ -2602,6 +2680,13 @@ bool OSDMonitor::prepare_pool_op(MPoolOp *m)
   else
     pp = *osdmap.get_pg_pool(m->pool);
 
+  // erasure coded pools have no clones to snapshot into
+  if (pp.is_erasure() &&
+      (m->op == POOL_OP_CREATE_SNAP || m->op == POOL_OP_CREATE_UNMANAGED_SNAP)) {
+    ret = -EOPNOTSUPP;
+    goto out;
+  }
+
   // pool snaps vs unmanaged snaps are mutually exclusive
   switch (m->op) {
   case POOL_OP_CREATE_SNAP:
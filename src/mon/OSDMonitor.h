@@ -49,6 +49,7 @@ private:
   map<int,utime_t>    down_pending_out;  // osd down -> out
 
   map<int,double> osd_weight;
+  bool up_osds_have_feature(uint64_t f);
 
   // map thrashing
   int thrash_map;
@@ -114,7 +115,8 @@ private:
   bool prepare_pool_op_delete(MPoolOp *m);
   bool prepare_pool_op_auid(MPoolOp *m);
   int prepare_new_pool(string& name, uint64_t auid, int crush_rule,
-                       unsigned pg_num, unsigned pgp_num);
+                       unsigned pg_num, unsigned pgp_num,
+                       unsigned erasure_k = 0, unsigned erasure_m = 0);
   int prepare_new_pool(MPoolOp *m);
   
   bool prepare_set_flag(MMonCommand *m, int flag);
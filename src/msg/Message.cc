@@ -71,6 +71,8 @@ using namespace std;
 #include "messages/MOSDRepScrub.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDOpBatch.h"
+#include "messages/MWatchNotifyBatch.h"
 
 #include "messages/MRemoveSnaps.h"
 
@@ -369,6 +371,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case CEPH_MSG_WATCH_NOTIFY:
     m = new MWatchNotify;
     break;
+  case MSG_WATCH_NOTIFY_BATCH:
+    m = new MWatchNotifyBatch;
+    break;
 
   case MSG_OSD_PG_NOTIFY:
     m = new MOSDPGNotify;
@@ -410,6 +415,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case MSG_OSD_PG_BACKFILL:
     m = new MOSDPGBackfill;
     break;
+  case MSG_OSD_OP_BATCH:
+    m = new MOSDOpBatch;
+    break;
    // auth
   case CEPH_MSG_AUTH:
     m = new MAuth;
@@ -605,12 +613,14 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   // it against compat_version.
   if (m->get_header().version &&
       m->get_header().version < header.compat_version) {
-    ldout(cct, 0) << "will not decode message of type " << type
-		  << " version " << header.version
-		  << " because compat_version " << header.compat_version
-		  << " > supported version " << m->get_header().version << dendl;
-    if (cct->_conf->ms_die_on_bad_msg)
-      assert(0);
+    if (cct) {
+      ldout(cct, 0) << "will not decode message of type " << type
+		    << " version " << header.version
+		    << " because compat_version " << header.compat_version
+		    << " > supported version " << m->get_header().version << dendl;
+      if (cct->_conf->ms_die_on_bad_msg)
+	assert(0);
+    }
     m->put();
     return 0;
   }
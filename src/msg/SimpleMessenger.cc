@@ -1863,17 +1863,17 @@ int SimpleMessenger::Pipe::read_message(Message **pm)
       // get a buffer
       connection_state->lock.Lock();
       map<tid_t,pair<bufferlist,int> >::iterator p = connection_state->rx_buffers.find(header.tid);
-      if (p != connection_state->rx_buffers.end()) {
+      // only read into a posted buffer that can hold the whole payload;
+      // it may be the caller's own memory, so we mustn't grow it
+      if (p != connection_state->rx_buffers.end() &&
+	  p->second.first.length() >= data_len) {
 	if (rxbuf.length() == 0 || p->second.second != rxbuf_version) {
 	  ldout(msgr->cct,10) << "reader seleting rx buffer v " << p->second.second
 		   << " at offset " << offset
 		   << " len " << p->second.first.length() << dendl;
 	  rxbuf = p->second.first;
 	  rxbuf_version = p->second.second;
-	  // make sure it's big enough
-	  if (rxbuf.length() < data_len)
-	    rxbuf.push_back(buffer::create(data_len - rxbuf.length()));
-	  blp = p->second.first.begin();
+	  blp = rxbuf.begin();
 	  blp.advance(offset);
 	}
       } else {
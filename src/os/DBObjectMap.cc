@@ -38,6 +38,26 @@ const string DBObjectMap::HOBJECT_TO_SEQ = "_HOBJTOSEQ_";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db),
+    header_lock("DBOBjectMap"),
+    batch_lock("DBObjectMap::batch_lock")
+{
+  unsigned shards = MAX(g_conf->filestore_omap_header_cache_shards, 1);
+  size_t shard_size = g_conf->filestore_omap_header_cache_size / shards + 1;
+  for (unsigned i = 0; i < shards; ++i)
+    header_cache.push_back(new HeaderCacheShard(shard_size));
+}
+
+DBObjectMap::~DBObjectMap()
+{
+  assert(batches.empty());
+  for (vector<HeaderCacheShard*>::iterator i = header_cache.begin();
+       i != header_cache.end();
+       ++i)
+    delete *i;
+}
+
 static void append_escaped(const string &in, string *out)
 {
   for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
@@ -79,6 +99,7 @@ static bool append_unescaped(string::const_iterator begin,
 
 bool DBObjectMap::check(std::ostream &out)
 {
+  flush_batch();
   bool retval = true;
   map<uint64_t, uint64_t> parent_to_num_children;
   map<uint64_t, uint64_t> parent_to_actual_num_children;
@@ -316,6 +337,7 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
 ObjectMap::ObjectMapIterator DBObjectMap::get_iterator(
   const hobject_t &hoid)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return ObjectMapIterator(new EmptyIteratorImpl());
@@ -503,7 +525,7 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 			  const map<string, bufferlist> &set,
 			  const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
+  KeyValueDB::Transaction t = get_transaction();
   Header header = lookup_create_map_header(hoid, t);
   if (!header)
     return -EINVAL;
@@ -512,21 +534,21 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 
   t->set(user_prefix(header), set);
 
-  return db->submit_transaction(t);
+  return submit_transaction(t);
 }
 
 int DBObjectMap::set_header(const hobject_t &hoid,
 			    const bufferlist &bl,
 			    const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
+  KeyValueDB::Transaction t = get_transaction();
   Header header = lookup_create_map_header(hoid, t);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   _set_header(header, bl, t);
-  return db->submit_transaction(t);
+  return submit_transaction(t);
 }
 
 void DBObjectMap::_set_header(Header header, const bufferlist &bl,
@@ -540,6 +562,7 @@ void DBObjectMap::_set_header(Header header, const bufferlist &bl,
 int DBObjectMap::get_header(const hobject_t &hoid,
 			    bufferlist *bl)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header) {
     return 0;
@@ -575,6 +598,7 @@ int DBObjectMap::_get_header(Header header,
 int DBObjectMap::clear(const hobject_t &hoid,
 		       const SequencerPosition *spos)
 {
+  flush_batch();
   KeyValueDB::Transaction t = db->get_transaction();
   Header header = lookup_map_header(hoid);
   if (!header)
@@ -587,7 +611,9 @@ int DBObjectMap::clear(const hobject_t &hoid,
   int r = _clear(header, t);
   if (r < 0)
     return r;
-  return db->submit_transaction(t);
+  r = db->submit_transaction(t);
+  invalidate_map_header(hoid);
+  return r;
 }
 
 int DBObjectMap::_clear(Header header,
@@ -700,14 +726,19 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
-  KeyValueDB::Transaction t = db->get_transaction();
   if (check_spos(hoid, header, spos))
     return 0;
-  t->rmkeys(user_prefix(header), to_clear);
   if (!header->parent) {
-    return db->submit_transaction(t);
+    KeyValueDB::Transaction t = get_transaction();
+    t->rmkeys(user_prefix(header), to_clear);
+    return submit_transaction(t);
   }
 
+  // Copying up from the parent reads back the keys, so cannot be batched
+  flush_batch();
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->rmkeys(user_prefix(header), to_clear);
+
   // Copy up keys from parent around to_clear
   int keep_parent;
   {
@@ -765,13 +796,16 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
     set_map_header(hoid, *header, t);
     t->rmkeys_by_prefix(complete_prefix(header));
   }
-  return db->submit_transaction(t);
+  int r = db->submit_transaction(t);
+  invalidate_map_header(hoid);
+  return r;
 }
 
 int DBObjectMap::get(const hobject_t &hoid,
 		     bufferlist *_header,
 		     map<string, bufferlist> *out)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -788,6 +822,7 @@ int DBObjectMap::get(const hobject_t &hoid,
 int DBObjectMap::get_keys(const hobject_t &hoid,
 			  set<string> *keys)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -826,6 +861,7 @@ int DBObjectMap::get_values(const hobject_t &hoid,
 			    const set<string> &keys,
 			    map<string, bufferlist> *out)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -836,6 +872,7 @@ int DBObjectMap::check_keys(const hobject_t &hoid,
 			    const set<string> &keys,
 			    set<string> *out)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -846,6 +883,7 @@ int DBObjectMap::get_xattrs(const hobject_t &hoid,
 			    const set<string> &to_get,
 			    map<string, bufferlist> *out)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -855,10 +893,12 @@ int DBObjectMap::get_xattrs(const hobject_t &hoid,
 int DBObjectMap::get_all_xattrs(const hobject_t &hoid,
 				set<string> *out)
 {
+  flush_batch();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
-  KeyValueDB::Iterator iter = db->get_iterator(xattr_prefix(header));
+  KeyValueDB::Iterator iter =
+    db->get_bounded_iterator(xattr_prefix(header), "", "", true);
   if (!iter)
     return -EINVAL;
   for (iter->seek_to_first(); !iter->status() && iter->valid(); iter->next())
@@ -870,28 +910,28 @@ int DBObjectMap::set_xattrs(const hobject_t &hoid,
 			    const map<string, bufferlist> &to_set,
 			    const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
+  KeyValueDB::Transaction t = get_transaction();
   Header header = lookup_create_map_header(hoid, t);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   t->set(xattr_prefix(header), to_set);
-  return db->submit_transaction(t);
+  return submit_transaction(t);
 }
 
 int DBObjectMap::remove_xattrs(const hobject_t &hoid,
 			       const set<string> &to_remove,
 			       const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
+  KeyValueDB::Transaction t = get_transaction();
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
   if (check_spos(hoid, header, spos))
     return 0;
   t->rmkeys(xattr_prefix(header), to_remove);
-  return db->submit_transaction(t);
+  return submit_transaction(t);
 }
 
 int DBObjectMap::clone(const hobject_t &hoid,
@@ -901,6 +941,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
   if (hoid == target)
     return 0;
 
+  flush_batch();
   KeyValueDB::Transaction t = db->get_transaction();
   {
     Header destination = lookup_map_header(target);
@@ -914,8 +955,11 @@ int DBObjectMap::clone(const hobject_t &hoid,
   }
 
   Header parent = lookup_map_header(hoid);
-  if (!parent)
-    return db->submit_transaction(t);
+  if (!parent) {
+    int r = db->submit_transaction(t);
+    invalidate_map_header(target);
+    return r;
+  }
 
   Header source = generate_new_header(hoid, parent);
   Header destination = generate_new_header(target, parent);
@@ -936,7 +980,10 @@ int DBObjectMap::clone(const hobject_t &hoid,
   t->set(xattr_prefix(source), to_set);
   t->set(xattr_prefix(destination), to_set);
   t->rmkeys_by_prefix(xattr_prefix(parent));
-  return db->submit_transaction(t);
+  int r = db->submit_transaction(t);
+  invalidate_map_header(hoid);
+  invalidate_map_header(target);
+  return r;
 }
 
 int DBObjectMap::upgrade()
@@ -994,7 +1041,8 @@ int DBObjectMap::upgrade()
   
   while (1) {
     KeyValueDB::Transaction t = db->get_transaction();
-    KeyValueDB::Iterator iter = db->get_iterator(REVERSE_LEAF_PREFIX);
+    KeyValueDB::Iterator iter =
+      db->get_bounded_iterator(REVERSE_LEAF_PREFIX, "", "", true);
     iter->seek_to_first();
     if (!iter->valid())
       break;
@@ -1046,6 +1094,7 @@ int DBObjectMap::init(bool do_upgrade)
 
 int DBObjectMap::sync(const hobject_t *hoid,
 		      const SequencerPosition *spos) {
+  flush_batch();
   KeyValueDB::Transaction t = db->get_transaction();
   write_state(t);
   if (hoid) {
@@ -1058,7 +1107,10 @@ int DBObjectMap::sync(const hobject_t *hoid,
       set_map_header(*hoid, *header, t);
     }
   }
-  return db->submit_transaction_sync(t);
+  int r = db->submit_transaction_sync(t);
+  if (hoid)
+    invalidate_map_header(*hoid);
+  return r;
 }
 
 int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
@@ -1073,10 +1125,26 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
+DBObjectMap::Header DBObjectMap::lookup_map_header(const hobject_t &hoid)
 {
-  while (map_header_in_use.count(hoid))
-    header_cond.Wait(header_lock);
+  {
+    Mutex::Locker l(batch_lock);
+    map<pthread_t, Batch>::iterator i = batches.find(pthread_self());
+    if (i != batches.end()) {
+      map<hobject_t, _Header>::iterator j = i->second.headers.find(hoid);
+      if (j != i->second.headers.end())
+	return Header(new _Header(j->second),
+		      RemoveMapHeaderOnDelete(this, hoid));
+    }
+  }
+
+  HeaderCacheShard *shard = get_cache_shard(hoid);
+  Mutex::Locker l(shard->lock);
+  _Header cached;
+  if (shard->lru.lookup(hoid, &cached)) {
+    dout(30) << "lookup_map_header: cache hit for " << hoid << dendl;
+    return Header(new _Header(cached), RemoveMapHeaderOnDelete(this, hoid));
+  }
 
   map<string, bufferlist> out;
   set<string> to_get;
@@ -1090,9 +1158,85 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
   Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
+  shard->lru.add(hoid, *ret);
   return ret;
 }
 
+void DBObjectMap::invalidate_map_header(const hobject_t &hoid)
+{
+  HeaderCacheShard *shard = get_cache_shard(hoid);
+  Mutex::Locker l(shard->lock);
+  shard->lru.clear(hoid);
+}
+
+KeyValueDB::Transaction DBObjectMap::get_transaction()
+{
+  Mutex::Locker l(batch_lock);
+  map<pthread_t, Batch>::iterator i = batches.find(pthread_self());
+  if (i != batches.end())
+    return i->second.t;
+  return db->get_transaction();
+}
+
+int DBObjectMap::submit_transaction(KeyValueDB::Transaction t)
+{
+  {
+    Mutex::Locker l(batch_lock);
+    map<pthread_t, Batch>::iterator i = batches.find(pthread_self());
+    if (i != batches.end() && i->second.t == t) {
+      i->second.pending++;
+      return 0;
+    }
+  }
+  return db->submit_transaction(t);
+}
+
+int DBObjectMap::flush_batch()
+{
+  KeyValueDB::Transaction t;
+  map<hobject_t, _Header> headers;
+  {
+    Mutex::Locker l(batch_lock);
+    map<pthread_t, Batch>::iterator i = batches.find(pthread_self());
+    if (i == batches.end() || !i->second.pending)
+      return 0;
+    dout(20) << "flush_batch: " << i->second.pending << " updates" << dendl;
+    t.swap(i->second.t);
+    i->second.t = db->get_transaction();
+    i->second.pending = 0;
+    headers.swap(i->second.headers);
+  }
+  int r = db->submit_transaction(t);
+  for (map<hobject_t, _Header>::iterator i = headers.begin();
+       i != headers.end();
+       ++i) {
+    HeaderCacheShard *shard = get_cache_shard(i->first);
+    Mutex::Locker l(shard->lock);
+    if (r < 0)
+      shard->lru.clear(i->first);
+    else
+      shard->lru.add(i->first, i->second);
+  }
+  return r;
+}
+
+void DBObjectMap::start_batch()
+{
+  KeyValueDB::Transaction t = db->get_transaction();
+  Mutex::Locker l(batch_lock);
+  Batch &batch = batches[pthread_self()];
+  assert(!batch.t);
+  batch.t = t;
+}
+
+int DBObjectMap::end_batch()
+{
+  int r = flush_batch();
+  Mutex::Locker l(batch_lock);
+  batches.erase(pthread_self());
+  return r;
+}
+
 DBObjectMap::Header DBObjectMap::_generate_new_header(const hobject_t &hoid,
 						      Header parent)
 {
@@ -1147,7 +1291,7 @@ DBObjectMap::Header DBObjectMap::lookup_create_map_header(
   KeyValueDB::Transaction t)
 {
   Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hoid);
+  Header header = lookup_map_header(hoid);
   if (!header) {
     header = _generate_new_header(hoid, Header());
     set_map_header(hoid, *header, t);
@@ -1195,6 +1339,13 @@ void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(hoid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
+
+  // The cache only sees the header once t is committed: flush_batch()
+  // adds batched headers, unbatched callers invalidate after submitting.
+  Mutex::Locker l(batch_lock);
+  map<pthread_t, Batch>::iterator i = batches.find(pthread_self());
+  if (i != batches.end() && i->second.t == t)
+    i->second.headers[hoid] = header;
 }
 
 bool DBObjectMap::check_spos(const hobject_t &hoid,
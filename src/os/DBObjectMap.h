@@ -17,6 +17,7 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/simple_cache.hpp"
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -69,9 +70,18 @@ public:
   set<uint64_t> in_use;
   set<hobject_t> map_header_in_use;
 
-  DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
-    {}
+  /**
+   * Open batches, by thread @see start_batch
+   *
+   * Simple mutations made by a thread with an open batch go into its
+   * batch transaction instead of being submitted one by one.  Reads and
+   * mutations which must read back their own updates (clone, clear, ...)
+   * first submit the calling thread's batch.
+   */
+  Mutex batch_lock;
+
+  DBObjectMap(KeyValueDB *db);
+  ~DBObjectMap();
 
   int set_keys(
     const hobject_t &hoid,
@@ -165,6 +175,9 @@ public:
   /// Ensure that all previous operations are durable
   int sync(const hobject_t *hoid=0, const SequencerPosition *spos=0);
 
+  void start_batch();
+  int end_batch();
+
   ObjectMapIterator get_iterator(const hobject_t &hoid);
 
   static const string USER_PREFIX;
@@ -274,6 +287,42 @@ private:
   /// Implicit lock on Header->seq
   typedef std::tr1::shared_ptr<_Header> Header;
 
+  /**
+   * Cache of HOBJECT_TO_SEQ entries, sharded by hobject hash
+   *
+   * lock is held across a cache miss and the backing store lookup that
+   * fills it, and across invalidations, so a lookup racing with an
+   * update cannot leave a stale entry behind.
+   */
+  struct HeaderCacheShard {
+    Mutex lock;
+    SimpleLRU<hobject_t, _Header> lru;
+    HeaderCacheShard(size_t size)
+      : lock("DBObjectMap::HeaderCacheShard::lock"), lru(size) {}
+  };
+  vector<HeaderCacheShard*> header_cache;
+  HeaderCacheShard *get_cache_shard(const hobject_t &hoid) {
+    return header_cache[hoid.hash % header_cache.size()];
+  }
+  /// Drop cached entry for hoid; call after submitting an update to it
+  void invalidate_map_header(const hobject_t &hoid);
+
+  /// Open batch for one thread @see start_batch
+  struct Batch {
+    KeyValueDB::Transaction t;
+    unsigned pending;                ///< updates added to t
+    map<hobject_t, _Header> headers; ///< map headers written to t
+    Batch() : pending(0) {}
+  };
+  map<pthread_t, Batch> batches;     ///< protected by batch_lock
+
+  /// Transaction for an update: the calling thread's batch, if open
+  KeyValueDB::Transaction get_transaction();
+  /// Submit t unless it is the calling thread's batch
+  int submit_transaction(KeyValueDB::Transaction t);
+  /// Submit the calling thread's batched updates, leaving the batch open
+  int flush_batch();
+
   string map_header_key(const hobject_t &hoid);
   string header_key(uint64_t seq);
   string complete_prefix(Header header);
@@ -365,7 +414,7 @@ private:
   /// Set node containing input to new contents
   void set_header(Header input, KeyValueDB::Transaction t);
 
-  /// Remove leaf node corresponding to hoid in c
+  /// Remove leaf node corresponding to hoid in c; invalidate once t is submitted
   void remove_map_header(const hobject_t &hoid,
 			 Header header,
 			 KeyValueDB::Transaction t);
@@ -395,11 +444,7 @@ private:
   }
 
   /// Lookup leaf header for c hoid
-  Header _lookup_map_header(const hobject_t &hoid);
-  Header lookup_map_header(const hobject_t &hoid) {
-    Mutex::Locker l(header_lock);
-    return _lookup_map_header(hoid);
-  }
+  Header lookup_map_header(const hobject_t &hoid);
 
   /// Lookup header node for input
   Header lookup_parent(Header input);
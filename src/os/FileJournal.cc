@@ -523,19 +523,24 @@ int FileJournal::open(uint64_t fs_op_seq)
 
   // looks like a valid header.
   write_pos = 0;  // not writeable yet
+  reset_prefetch();
 
-  // find next entry
-  read_pos = header.start;
+  // find next entry.  entries before next_seq are already committed to
+  // the fs, so we only walk their headers and footers.
+  read_pos = find_replay_start(next_seq);
+  replay_start_seq = 0;
+  replay_walked = 0;
   uint64_t seq = 0;
   while (1) {
-    bufferlist bl;
     off64_t old_pos = read_pos;
-    if (!read_entry(bl, seq)) {
+    if (!_read_entry(NULL, seq)) {
       dout(10) << "open reached end of journal." << dendl;
       break;
     }
+    if (!replay_start_seq)
+      replay_start_seq = seq;
     if (seq > next_seq) {
-      dout(10) << "open entry " << seq << " len " << bl.length() << " > next_seq " << next_seq
+      dout(10) << "open entry " << seq << " > next_seq " << next_seq
 	       << ", ignoring journal contents"
 	       << dendl;
       read_pos = -1;
@@ -544,10 +549,12 @@ int FileJournal::open(uint64_t fs_op_seq)
       return 0;
     }
     if (seq == next_seq) {
-      dout(10) << "open reached seq " << seq << dendl;
+      dout(10) << "open reached seq " << seq << " after stepping over "
+	       << replay_walked << " entries from " << replay_start_seq << dendl;
       read_pos = old_pos;
       break;
     }
+    replay_walked++;
     seq++;  // next event should follow.
   }
 
@@ -566,6 +573,7 @@ void FileJournal::close()
   assert(fd >= 0);
   TEMP_FAILURE_RETRY(::close(fd));
   fd = -1;
+  reset_prefetch();
 }
 
 
@@ -579,6 +587,7 @@ int FileJournal::dump(ostream& out)
     return err;
 
   read_pos = header.start;
+  reset_prefetch();
 
   JSONFormatter f(true);
 
@@ -657,7 +666,8 @@ void FileJournal::print_header()
 	   << " alignment " << header.alignment
 	   << " max_size " << header.max_size
 	   << dendl;
-  dout(10) << "header: start " << header.start << dendl;
+  dout(10) << "header: start " << header.start
+	   << " skip_index " << header.skip_index << dendl;
   dout(10) << " write_pos " << write_pos << dendl;
 }
 
@@ -707,6 +717,7 @@ bufferptr FileJournal::prepare_header()
 {
   bufferlist bl;
   ::encode(header, bl);
+  assert(bl.length() <= (unsigned)get_top());
   bufferptr bp = buffer::create_page_aligned(get_top());
   bp.zero();
   memcpy(bp.c_str(), bl.c_str(), bl.length());
@@ -1451,6 +1462,11 @@ void FileJournal::commit_start()
 {
   dout(10) << "commit_start" << dendl;
 
+  {
+    Mutex::Locker locker(write_lock);
+    update_skip_index();
+  }
+
   // was full?
   switch (full_state) {
   case FULL_NOTFULL:
@@ -1495,6 +1511,9 @@ void FileJournal::committed_thru(uint64_t seq)
   } else {
     header.start = write_pos;
   }
+  // index entries behind the new start may be overwritten
+  header.skip_index.erase(header.skip_index.begin(),
+			  header.skip_index.upper_bound(seq));
   must_write_header = true;
   print_header();
 
@@ -1546,6 +1565,7 @@ void FileJournal::put_throttle(uint64_t ops, uint64_t bytes)
 void FileJournal::make_writeable()
 {
   _open(true);
+  reset_prefetch();
 
   if (read_pos > 0)
     write_pos = read_pos;
@@ -1568,27 +1588,139 @@ void FileJournal::wrap_read_bl(off64_t& pos, int64_t olen, bufferlist& bl)
       len = header.max_size - pos;        // partial
     else
       len = olen;                         // rest
-    
-#ifdef DARWIN
-    ::lseek(fd, pos, SEEK_SET);
-#else
-    ::lseek64(fd, pos, SEEK_SET);
-#endif
-    
+
+    prefetch_read_bl(pos, len, bl);
+    pos += len;
+    olen -= len;
+  }
+}
+
+/*
+ * Replay walks the journal front to back, so serve reads out of a
+ * large block-aligned window instead of issuing a pair of small reads
+ * (header, footer) plus the payload read for every entry.  The caller
+ * guarantees pos~len does not wrap.
+ */
+void FileJournal::prefetch_read_bl(off64_t pos, int64_t len, bufferlist& bl)
+{
+  int64_t window = g_conf->journal_replay_prefetch_bytes;
+  if (window <= 0 || len > window) {
     bufferptr bp = buffer::create(len);
-    int r = safe_read_exact(fd, bp.c_str(), len);
+    int r = safe_pread_exact(fd, bp.c_str(), len, pos);
     if (r) {
-      derr << "FileJournal::wrap_read_bl: safe_read_exact " << pos << "~" << len << " returned "
-	   << r << dendl;
+      derr << "FileJournal::prefetch_read_bl: safe_pread_exact " << pos << "~" << len
+	   << " returned " << r << dendl;
       ceph_abort();
     }
     bl.push_back(bp);
-    pos += len;
-    olen -= len;
+    return;
+  }
+
+  if (prefetch_pos < 0 ||
+      pos < prefetch_pos ||
+      pos + len > prefetch_pos + (off64_t)prefetch_buf.length()) {
+    off64_t start = pos - pos % block_size;
+    int64_t rlen = ROUND_UP_TO(window + (pos - start), block_size);
+    if (start + rlen > header.max_size)
+      rlen = header.max_size - start;
+    assert(pos + len <= start + rlen);
+
+    dout(20) << "prefetch_read_bl " << start << "~" << rlen << " for " << pos << "~" << len << dendl;
+    reset_prefetch();
+    bufferptr bp = buffer::create_page_aligned(rlen);
+    int r = safe_pread_exact(fd, bp.c_str(), rlen, start);
+    if (r) {
+      derr << "FileJournal::prefetch_read_bl: safe_pread_exact " << start << "~" << rlen
+	   << " returned " << r << dendl;
+      ceph_abort();
+    }
+    prefetch_buf = bp;
+    prefetch_pos = start;
+  }
+  bl.push_back(bufferptr(prefetch_buf, pos - prefetch_pos, len));
+}
+
+/*
+ * Sample journalq into the header so that open() can jump close to
+ * the first uncommitted entry instead of walking every entry from
+ * header.start.  Called with write_lock held.
+ */
+void FileJournal::update_skip_index()
+{
+  assert(write_lock.is_locked());
+
+  // keep the encoded header within its block
+  unsigned max = g_conf->journal_replay_skip_index_max;
+  unsigned fit = (get_top() - 128) / (sizeof(uint64_t) + sizeof(int64_t));
+  if (max > fit)
+    max = fit;
+
+  header.skip_index.clear();
+  if (max && !journalq.empty()) {
+    unsigned stride = (journalq.size() + max - 1) / max;
+    for (int i = journalq.size() - 1; i >= 0; i -= stride)
+      header.skip_index.insert(journalq[i]);
   }
+  dout(10) << "update_skip_index " << header.skip_index.size() << " of "
+	   << journalq.size() << " journaled entries" << dendl;
+  must_write_header = true;
+}
+
+/*
+ * Pick the replay starting point: the last indexed entry at or before
+ * next_seq, if it is still intact and lies ahead of header.start;
+ * otherwise header.start.
+ */
+off64_t FileJournal::find_replay_start(uint64_t next_seq)
+{
+  map<uint64_t, int64_t>::iterator p = header.skip_index.upper_bound(next_seq);
+  if (p == header.skip_index.begin())
+    return header.start;
+  --p;
+
+  entry_header_t h;
+  bufferlist hbl;
+  off64_t pos = header.start;
+  wrap_read_bl(pos, sizeof(h), hbl);
+  hbl.copy(0, sizeof(h), (char *)&h);
+  if (!h.check_magic(header.start, header.get_fsid64()) ||
+      p->first <= h.seq) {
+    dout(10) << "find_replay_start skip_index entry " << p->first << " at " << p->second
+	     << " not past start, using start " << header.start << dendl;
+    return header.start;
+  }
+
+  if (p->second < get_top() || p->second >= header.max_size ||
+      p->second % header.alignment) {
+    dout(2) << "find_replay_start skip_index entry " << p->first << " has bad offset "
+	    << p->second << ", using start " << header.start << dendl;
+    return header.start;
+  }
+  hbl.clear();
+  pos = p->second;
+  wrap_read_bl(pos, sizeof(h), hbl);
+  hbl.copy(0, sizeof(h), (char *)&h);
+  if (!h.check_magic(p->second, header.get_fsid64()) || h.seq != p->first) {
+    dout(2) << "find_replay_start skip_index entry " << p->first << " at " << p->second
+	    << " doesn't match on-disk entry, using start " << header.start << dendl;
+    return header.start;
+  }
+
+  dout(10) << "find_replay_start skipping from " << header.start << " to seq " << p->first
+	   << " at " << p->second << dendl;
+  return p->second;
 }
 
 bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
+{
+  return _read_entry(&bl, seq);
+}
+
+/*
+ * Read the entry at read_pos.  If bl is NULL only the header and
+ * footer are read: the payload is neither read nor checksummed.
+ */
+bool FileJournal::_read_entry(bufferlist *bl, uint64_t& seq)
 {
   if (!read_pos) {
     dout(2) << "read_entry -- not readable" << dendl;
@@ -1612,8 +1744,12 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
   if (h->pre_pad)
     pos += h->pre_pad;
 
-  bl.clear();
-  wrap_read_bl(pos, h->len, bl);
+  if (bl) {
+    bl->clear();
+    wrap_read_bl(pos, h->len, *bl);
+  } else {
+    pos += h->len;
+  }
 
   if (h->post_pad)
     pos += h->post_pad;
@@ -1628,9 +1764,10 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
     return false;
   }
 
-  if ((header.flags & header_t::FLAG_CRC) ||   // if explicitly enabled (new journal)
-      h->crc32c != 0) {                        // newer entry in old journal
-    uint32_t actual_crc = bl.crc32c(0);
+  if (bl &&
+      ((header.flags & header_t::FLAG_CRC) ||  // if explicitly enabled (new journal)
+       h->crc32c != 0)) {                      // newer entry in old journal
+    uint32_t actual_crc = bl->crc32c(0);
     if (actual_crc != h->crc32c) {
       dout(2) << "read_entry " << read_pos << " : header crc (" << h->crc32c
 	      << ") doesn't match body crc (" << actual_crc << ")" << dendl;
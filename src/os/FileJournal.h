@@ -88,6 +88,9 @@ public:
     int64_t max_size;   // max size of journal ring buffer
     int64_t start;      // offset of first entry
 
+    /// sampled seq -> offset of journaled entries, refreshed at commit_start
+    map<uint64_t, int64_t> skip_index;
+
     header_t() : flags(0), block_size(0), alignment(0), max_size(0), start(0) {}
 
     void clear() {
@@ -99,7 +102,7 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      __u32 v = 2;
+      __u32 v = 3;
       ::encode(v, bl);
       bufferlist em;
       {
@@ -109,6 +112,7 @@ public:
 	::encode(alignment, em);
 	::encode(max_size, em);
 	::encode(start, em);
+	::encode(skip_index, em);
       }
       ::encode(em, bl);
     }
@@ -138,6 +142,9 @@ public:
       ::decode(alignment, t);
       ::decode(max_size, t);
       ::decode(start, t);
+      skip_index.clear();
+      if (v >= 3)
+	::decode(skip_index, t);
     }
   } header;
 
@@ -173,6 +180,14 @@ private:
   off64_t write_pos;      // byte where the next entry to be written will go
   off64_t read_pos;       // 
 
+  // replay read-ahead
+  bufferptr prefetch_buf;     ///< block-aligned window of the journal, read sequentially
+  off64_t prefetch_pos;       ///< journal offset of prefetch_buf, or -1 if empty
+
+  // what the last open() did, for tests
+  uint64_t replay_start_seq;  ///< first entry it read
+  unsigned replay_walked;     ///< committed entries it stepped over
+
 #ifdef HAVE_LIBAIO
   /// state associated with an in-flight aio request
   /// Protected by aio_lock
@@ -263,6 +278,15 @@ private:
   void align_bl(off64_t pos, bufferlist& bl);
   int write_bl(off64_t& pos, bufferlist& bl);
   void wrap_read_bl(off64_t& pos, int64_t len, bufferlist& bl);
+  void prefetch_read_bl(off64_t pos, int64_t len, bufferlist& bl);
+  void reset_prefetch() {
+    prefetch_buf = bufferptr();
+    prefetch_pos = -1;
+  }
+
+  void update_skip_index();
+  off64_t find_replay_start(uint64_t next_seq);
+  bool _read_entry(bufferlist *bl, uint64_t& seq);
 
   class Writer : public Thread {
     FileJournal *journal;
@@ -300,6 +324,8 @@ private:
     is_bdev(false), directio(dio), aio(ai),
     must_write_header(false),
     write_pos(0), read_pos(0),
+    prefetch_pos(-1),
+    replay_start_seq(0), replay_walked(0),
 #ifdef HAVE_LIBAIO
     aio_lock("FileJournal::aio_lock"),
     aio_num(0), aio_bytes(0),
@@ -346,6 +372,9 @@ private:
 
   // reads
   bool read_entry(bufferlist& bl, uint64_t& seq);
+
+  uint64_t get_replay_start_seq() const { return replay_start_seq; }
+  unsigned get_replay_walked() const { return replay_walked; }
 };
 
 WRITE_CLASS_ENCODER(FileJournal::header_t)
@@ -2373,6 +2373,8 @@ int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
     ops += (*p)->get_num_ops();
   }
 
+  // group this op's omap updates into a single backing store update
+  object_map->start_batch();
   int trans_num = 0;
   for (list<Transaction*>::iterator p = tls.begin();
        p != tls.end();
@@ -2381,6 +2383,9 @@ int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
     if (r < 0)
       break;
   }
+  int br = object_map->end_batch();
+  if (r >= 0 && br < 0)
+    r = br;
   
   return r;
 }
@@ -36,6 +36,13 @@ public:
       const string &prefix ///< [in] Prefix by which to remove keys
       ) = 0;
 
+    /// Removes keys of prefix in [start, end)
+    virtual void rm_range_keys(
+      const string &prefix, ///< [in] Prefix by which to remove keys
+      const string &start,  ///< [in] First key to remove
+      const string &end     ///< [in] Bound past last key, "" for none
+      ) = 0;
+
     virtual ~TransactionImpl() {};
   };
   typedef std::tr1::shared_ptr< TransactionImpl > Transaction;
@@ -70,6 +77,19 @@ public:
   typedef std::tr1::shared_ptr< IteratorImpl > Iterator;
   virtual Iterator get_iterator(const string &prefix) = 0;
 
+  /**
+   * Iterator over the keys of prefix in [start, end)
+   *
+   * With keys_only, value() may not be called; implementations may use
+   * this to avoid reading or caching values during key scans.
+   */
+  virtual Iterator get_bounded_iterator(
+    const string &prefix, ///< [in] Prefix to iterate over
+    const string &start,  ///< [in] First key, "" for none
+    const string &end,    ///< [in] Bound past last key, "" for none
+    bool keys_only = false
+    ) = 0;
+
   virtual ~KeyValueDB() {}
 };
 
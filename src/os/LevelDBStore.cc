@@ -57,13 +57,25 @@ void LevelDBStore::LevelDBTransactionImpl::rmkeys(const string &prefix,
 
 void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
-  KeyValueDB::Iterator it = db->get_iterator(prefix);
-  for (it->seek_to_first();
-       it->valid();
-       it->next()) {
-    string key = combine_strings(prefix, it->key());
-    keys.push_back(key);
-    bat.Delete(*(keys.rbegin()));
+  rm_range_keys(prefix, "", "");
+}
+
+void LevelDBStore::LevelDBTransactionImpl::rm_range_keys(const string &prefix,
+							 const string &start,
+							 const string &end)
+{
+  // Walk the raw leveldb keys rather than going through LevelDBIteratorImpl:
+  // no user key is split out and no value is read.  WriteBatch::Delete
+  // copies the key, so it need not be kept in keys.
+  string lower = combine_strings(prefix, start);
+  string upper = end.empty() ? past_prefix(prefix) : combine_strings(prefix, end);
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  boost::scoped_ptr<leveldb::Iterator> it(db->db->NewIterator(options));
+  for (it->Seek(leveldb::Slice(lower));
+       it->Valid() && it->key().compare(leveldb::Slice(upper)) < 0;
+       it->Next()) {
+    bat.Delete(it->key());
   }
 }
 
@@ -45,6 +45,11 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void rm_range_keys(
+      const string &prefix,
+      const string &start,
+      const string &end
+      );
   };
 
   KeyValueDB::Transaction get_transaction() {
@@ -77,17 +82,25 @@ public:
   class LevelDBIteratorImpl : public KeyValueDB::IteratorImpl {
     boost::scoped_ptr<leveldb::Iterator> dbiter;
     const string prefix;
+    const string start; ///< first user key in range
+    const string lower; ///< first leveldb key in range
+    const string upper; ///< leveldb key past the range
+    const bool keys_only;
   public:
-    LevelDBIteratorImpl(leveldb::Iterator *iter, const string &prefix) :
-      dbiter(iter), prefix(prefix) {}
+    LevelDBIteratorImpl(leveldb::Iterator *iter, const string &prefix,
+			const string &start = "", const string &end = "",
+			bool keys_only = false) :
+      dbiter(iter), prefix(prefix), start(start),
+      lower(combine_strings(prefix, start)),
+      upper(end.empty() ? past_prefix(prefix) : combine_strings(prefix, end)),
+      keys_only(keys_only) {}
     int seek_to_first() {
-      leveldb::Slice slice_prefix(prefix);
-      dbiter->Seek(slice_prefix);
+      leveldb::Slice slice_lower(lower);
+      dbiter->Seek(slice_lower);
       return dbiter->status().ok() ? 0 : -1;
     }
     int seek_to_last() {
-      string limit = past_prefix(prefix);
-      leveldb::Slice slice_limit(limit);
+      leveldb::Slice slice_limit(upper);
 	dbiter->Seek(slice_limit);
       if (!dbiter->Valid()) {
 	dbiter->SeekToLast();
@@ -97,19 +110,25 @@ public:
       return dbiter->status().ok() ? 0 : -1;
     }
     int upper_bound(const string &after) {
+      if (after < start)
+	return seek_to_first();
       lower_bound(after);
       if (valid() && key() == after)
 	next();
       return dbiter->status().ok() ? 0 : -1;
     }
     int lower_bound(const string &to) {
+      if (to < start)
+	return seek_to_first();
       string bound = combine_strings(prefix, to);
       leveldb::Slice slice_bound(bound);
       dbiter->Seek(slice_bound);
       return dbiter->status().ok() ? 0 : -1;
     }
     bool valid() {
-      return dbiter->Valid() && in_prefix(prefix, dbiter->key());
+      return dbiter->Valid() &&
+	dbiter->key().compare(leveldb::Slice(lower)) >= 0 &&
+	dbiter->key().compare(leveldb::Slice(upper)) < 0;
     }
     int next() {
       if (valid())
@@ -122,11 +141,12 @@ public:
       return dbiter->status().ok() ? 0 : -1;
     }
     string key() {
-      string out_key;
-      split_key(dbiter->key(), 0, &out_key);
-      return out_key;
+      // valid() implies the key is prefix + '\0' + user key
+      leveldb::Slice k = dbiter->key();
+      return string(k.data() + prefix.size() + 1, k.size() - prefix.size() - 1);
     }
     bufferlist value() {
+      assert(!keys_only);
       return to_bufferlist(dbiter->value());
     }
     int status() {
@@ -139,6 +159,16 @@ public:
 	db->NewIterator(leveldb::ReadOptions()),
 	prefix));
   }
+  Iterator get_bounded_iterator(const string &prefix, const string &start,
+				const string &end, bool keys_only = false) {
+    leveldb::ReadOptions options;
+    // key scans (mostly for removal) should not push out cached values
+    options.fill_cache = !keys_only;
+    return std::tr1::shared_ptr<LevelDBIteratorImpl>(
+      new LevelDBIteratorImpl(
+	db->NewIterator(options),
+	prefix, start, end, keys_only));
+  }
 
 
   /// Utility
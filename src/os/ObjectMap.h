@@ -129,6 +129,12 @@ public:
     const SequencerPosition *spos=0   ///< [in] Sequencer
     ) { return 0; }
 
+  /// Group subsequent updates from this thread into one backing store update
+  virtual void start_batch() {}
+
+  /// Apply the updates grouped since start_batch()
+  virtual int end_batch() { return 0; }
+
   virtual bool check(std::ostream &out) { return true; }
 
   class ObjectMapIteratorImpl {
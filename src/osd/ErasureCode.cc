@@ -0,0 +1,59 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "ErasureCode.h"
+#include "ErasureCodeReedSolomon.h"
+
+#include "common/Mutex.h"
+
+static Mutex& registry_lock()
+{
+  static Mutex lock("ErasureCode::registry_lock");
+  return lock;
+}
+
+static std::map<std::string, ErasureCode::factory_t>& registry()
+{
+  static std::map<std::string, ErasureCode::factory_t> r;
+  if (r.empty())
+    r["reed_solomon"] = ErasureCodeReedSolomon::factory;
+  return r;
+}
+
+void ErasureCode::add_technique(const std::string &name, factory_t f)
+{
+  Mutex::Locker l(registry_lock());
+  registry()[name] = f;
+}
+
+ErasureCodeInterface *ErasureCode::create(const std::string &technique, int k, int m,
+					  std::ostream *ss)
+{
+  factory_t f;
+  {
+    Mutex::Locker l(registry_lock());
+    std::map<std::string, factory_t>::iterator p = registry().find(technique);
+    if (p == registry().end()) {
+      if (ss)
+	*ss << "unknown erasure code technique '" << technique << "'";
+      return NULL;
+    }
+    f = p->second;
+  }
+  if (k < 1 || m < 1) {
+    if (ss)
+      *ss << "need k >= 1 and m >= 1, not k=" << k << " m=" << m;
+    return NULL;
+  }
+  return f(k, m, ss);
+}
@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_OSD_ERASURECODE_H
+#define CEPH_OSD_ERASURECODE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <ostream>
+
+#include "include/buffer.h"
+
+/**
+ * an erasure code turns k equally sized data chunks into k+m chunks,
+ * any k of which are enough to get the data back.  chunks 0..k-1 are
+ * the data itself (the code is systematic); k..k+m-1 are parity.
+ */
+class ErasureCodeInterface {
+public:
+  virtual ~ErasureCodeInterface() {}
+
+  virtual unsigned get_data_chunk_count() const = 0;    ///< k
+  virtual unsigned get_chunk_count() const = 0;         ///< k + m
+
+  /**
+   * compute the parity chunks
+   *
+   * @param chunks [in] data chunks 0..k-1, all the same length;
+   *               [out] plus parity chunks k..k+m-1
+   * @return 0 or -EINVAL if the data chunks are missing or uneven
+   */
+  virtual int encode(std::map<int, bufferlist> &chunks) = 0;
+
+  /**
+   * rebuild chunks from whichever ones we have
+   *
+   * @param want chunks the caller needs
+   * @param chunks [in] at least k distinct chunks, all the same length;
+   *               [out] plus everything in @want
+   * @return 0, or -EIO if there are fewer than k chunks
+   */
+  virtual int decode(const std::set<int> &want,
+		     std::map<int, bufferlist> &chunks) = 0;
+};
+
+/**
+ * registry of erasure code techniques, by name.  reed_solomon is
+ * built in; others can be added with add_technique() before any pool
+ * using them is instantiated.
+ */
+class ErasureCode {
+public:
+  typedef ErasureCodeInterface *(*factory_t)(int k, int m, std::ostream *ss);
+
+  static void add_technique(const std::string &name, factory_t f);
+
+  /**
+   * @return a new codec, or NULL (with the reason in @ss) if the
+   *         technique is unknown or can't do k+m
+   */
+  static ErasureCodeInterface *create(const std::string &technique, int k, int m,
+				      std::ostream *ss = 0);
+};
+
+#endif
@@ -0,0 +1,246 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "ErasureCodeReedSolomon.h"
+#include "include/assert.h"
+
+/*
+ * GF(2^8) with the usual 0x11d polynomial.  log/exp for the odd
+ * multiply, and a full product table for the byte-at-a-time tail of
+ * the region operations.
+ */
+struct gf_tables_t {
+  uint8_t exp[512];
+  uint8_t log[256];
+  uint8_t mul[256][256];
+
+  gf_tables_t() {
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++) {
+      exp[i] = x;
+      log[x] = i;
+      x <<= 1;
+      if (x & 0x100)
+	x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++)
+      exp[i] = exp[i - 255];
+    log[0] = 0;
+    for (int a = 0; a < 256; a++)
+      for (int b = 0; b < 256; b++)
+	mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+  }
+};
+static const gf_tables_t gf;
+
+uint8_t ErasureCodeReedSolomon::gf_mul(uint8_t a, uint8_t b)
+{
+  return gf.mul[a][b];
+}
+
+uint8_t ErasureCodeReedSolomon::gf_inv(uint8_t a)
+{
+  assert(a);
+  return gf.exp[255 - gf.log[a]];
+}
+
+void ErasureCodeReedSolomon::region_multiply_add(uint8_t c, const uint8_t *src,
+						 uint8_t *dst, size_t len)
+{
+  if (c == 0)
+    return;
+  size_t i = 0;
+  if (c == 1) {
+    for (; i + 8 <= len; i += 8) {
+      uint64_t s, d;
+      memcpy(&s, src + i, 8);
+      memcpy(&d, dst + i, 8);
+      d ^= s;
+      memcpy(dst + i, &d, 8);
+    }
+    for (; i < len; i++)
+      dst[i] ^= src[i];
+    return;
+  }
+#if defined(__SSSE3__)
+  // c * x == c * (x & 0xf) ^ c * (x & 0xf0): two 16 entry tables
+  // looked up 16 bytes at a time with pshufb.
+  uint8_t lo[16], hi[16];
+  for (int x = 0; x < 16; x++) {
+    lo[x] = gf.mul[c][x];
+    hi[x] = gf.mul[c][x << 4];
+  }
+  __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+  __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  for (; i + 16 <= len; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i l = _mm_and_si128(s, mask);
+    __m128i h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+    __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, l),
+			      _mm_shuffle_epi8(thi, h));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+  }
+#endif
+  const uint8_t *row = gf.mul[c];
+  for (; i < len; i++)
+    dst[i] ^= row[src[i]];
+}
+
+
+ErasureCodeReedSolomon::ErasureCodeReedSolomon(int k_, int m_)
+  : k(k_), m(m_), parity(m_ * k_)
+{
+  assert(k + m <= 256);
+  // cauchy: 1 / (x_i + y_j), x_i = i, y_j = m + j; all distinct.
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < k; j++)
+      parity[i * k + j] = gf_inv(i ^ (m + j));
+}
+
+ErasureCodeInterface *ErasureCodeReedSolomon::factory(int k, int m, std::ostream *ss)
+{
+  if (k + m > 256) {
+    if (ss)
+      *ss << "reed_solomon needs k + m <= 256";
+    return NULL;
+  }
+  return new ErasureCodeReedSolomon(k, m);
+}
+
+int ErasureCodeReedSolomon::encode(std::map<int, bufferlist> &chunks)
+{
+  if (chunks.count(0) == 0)
+    return -EINVAL;
+  unsigned len = chunks[0].length();
+  std::vector<const uint8_t*> data(k);
+  for (int j = 0; j < k; j++) {
+    std::map<int, bufferlist>::iterator p = chunks.find(j);
+    if (p == chunks.end() || p->second.length() != len)
+      return -EINVAL;
+    data[j] = (const uint8_t *)p->second.c_str();
+  }
+  for (int i = 0; i < m; i++) {
+    bufferptr bp(buffer::create_page_aligned(len));
+    bp.zero();
+    uint8_t *out = (uint8_t *)bp.c_str();
+    for (int j = 0; j < k; j++)
+      region_multiply_add(parity[i * k + j], data[j], out, len);
+    chunks[k + i].clear();
+    chunks[k + i].push_back(bp);
+  }
+  return 0;
+}
+
+int ErasureCodeReedSolomon::decode(const std::set<int> &want,
+				   std::map<int, bufferlist> &chunks)
+{
+  bool need_data = false;
+  for (std::set<int>::const_iterator p = want.begin(); p != want.end(); ++p) {
+    assert(*p >= 0 && *p < k + m);
+    if (!chunks.count(*p))
+      need_data = true;
+  }
+  if (!need_data)
+    return 0;
+
+  // the first k chunks we have, and the rows of the generator for them
+  std::vector<int> rows;
+  for (std::map<int, bufferlist>::iterator p = chunks.begin();
+       p != chunks.end() && (int)rows.size() < k;
+       ++p)
+    if (p->first >= 0 && p->first < k + m)
+      rows.push_back(p->first);
+  if ((int)rows.size() < k)
+    return -EIO;
+  unsigned len = chunks[rows[0]].length();
+  std::vector<const uint8_t*> have(k);
+  for (int r = 0; r < k; r++) {
+    if (chunks[rows[r]].length() != len)
+      return -EINVAL;
+    have[r] = (const uint8_t *)chunks[rows[r]].c_str();
+  }
+
+  // invert them (gauss-jordan); every k x k submatrix is nonsingular.
+  std::vector<uint8_t> a(k * k, 0), inv(k * k, 0);
+  for (int r = 0; r < k; r++) {
+    if (rows[r] < k)
+      a[r * k + rows[r]] = 1;
+    else
+      memcpy(&a[r * k], &parity[(rows[r] - k) * k], k);
+    inv[r * k + r] = 1;
+  }
+  for (int c = 0; c < k; c++) {
+    int piv = c;
+    while (a[piv * k + c] == 0)
+      piv++;
+    assert(piv < k);
+    if (piv != c) {
+      for (int j = 0; j < k; j++) {
+	std::swap(a[piv * k + j], a[c * k + j]);
+	std::swap(inv[piv * k + j], inv[c * k + j]);
+      }
+    }
+    uint8_t s = gf_inv(a[c * k + c]);
+    for (int j = 0; j < k; j++) {
+      a[c * k + j] = gf_mul(a[c * k + j], s);
+      inv[c * k + j] = gf_mul(inv[c * k + j], s);
+    }
+    for (int r = 0; r < k; r++) {
+      uint8_t f = a[r * k + c];
+      if (r == c || f == 0)
+	continue;
+      for (int j = 0; j < k; j++) {
+	a[r * k + j] ^= gf_mul(f, a[c * k + j]);
+	inv[r * k + j] ^= gf_mul(f, inv[c * k + j]);
+      }
+    }
+  }
+
+  // rebuild missing data chunks, then any parity that was asked for
+  std::vector<const uint8_t*> data(k);
+  for (int j = 0; j < k; j++) {
+    std::map<int, bufferlist>::iterator p = chunks.find(j);
+    if (p != chunks.end()) {
+      data[j] = (const uint8_t *)p->second.c_str();
+      continue;
+    }
+    bufferptr bp(buffer::create_page_aligned(len));
+    bp.zero();
+    uint8_t *out = (uint8_t *)bp.c_str();
+    for (int r = 0; r < k; r++)
+      region_multiply_add(inv[j * k + r], have[r], out, len);
+    chunks[j].push_back(bp);
+    data[j] = out;
+  }
+  for (std::set<int>::const_iterator p = want.begin(); p != want.end(); ++p) {
+    if (*p < k || chunks.count(*p))
+      continue;
+    int i = *p - k;
+    bufferptr bp(buffer::create_page_aligned(len));
+    bp.zero();
+    uint8_t *out = (uint8_t *)bp.c_str();
+    for (int j = 0; j < k; j++)
+      region_multiply_add(parity[i * k + j], data[j], out, len);
+    chunks[*p].push_back(bp);
+  }
+  return 0;
+}
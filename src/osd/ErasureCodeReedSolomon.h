@@ -0,0 +1,53 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_OSD_ERASURECODEREEDSOLOMON_H
+#define CEPH_OSD_ERASURECODEREEDSOLOMON_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "ErasureCode.h"
+
+/**
+ * systematic Reed-Solomon over GF(2^8), with a Cauchy matrix for the
+ * parity rows so that every k x k submatrix of the generator is
+ * invertible.  k + m <= 256.
+ *
+ * the region multiply-accumulate at the bottom of encode and decode
+ * uses SSSE3 nibble lookups when the build targets it (e.g.
+ * -mssse3), and a 64KB multiplication table otherwise.
+ */
+class ErasureCodeReedSolomon : public ErasureCodeInterface {
+  int k, m;
+  std::vector<uint8_t> parity;   ///< m x k coding matrix, row-major
+
+public:
+  ErasureCodeReedSolomon(int k, int m);
+
+  static ErasureCodeInterface *factory(int k, int m, std::ostream *ss);
+
+  unsigned get_data_chunk_count() const { return k; }
+  unsigned get_chunk_count() const { return k + m; }
+
+  int encode(std::map<int, bufferlist> &chunks);
+  int decode(const std::set<int> &want, std::map<int, bufferlist> &chunks);
+
+  /// dst ^= c * src, over len bytes
+  static void region_multiply_add(uint8_t c, const uint8_t *src, uint8_t *dst,
+				  size_t len);
+  static uint8_t gf_mul(uint8_t a, uint8_t b);
+  static uint8_t gf_inv(uint8_t a);
+};
+
+#endif
@@ -0,0 +1,2762 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "PG.h"
+#include "ErasureCodedPG.h"
+#include "OSD.h"
+#include "OpRequest.h"
+
+#include "common/errno.h"
+#include "common/perf_counters.h"
+
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+#include "messages/MOSDSubOp.h"
+#include "messages/MOSDSubOpReply.h"
+
+#include "messages/MOSDPGTrim.h"
+#include "messages/MOSDPGScan.h"
+#include "messages/MOSDPGBackfill.h"
+
+#include "common/config.h"
+#include "include/compat.h"
+
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, this, osd->whoami, get_osdmap())
+static ostream& _prefix(std::ostream *_dout, PG *pg, int whoami, OSDMapRef osdmap) {
+  return *_dout << "osd." << whoami
+		<< " " << (osdmap ? osdmap->get_epoch():0) << " " << *pg << " ";
+}
+
+#include <sstream>
+#include <errno.h>
+
+ErasureCodedPG::ErasureCodedPG(OSD *o, PGPool *_pool, pg_t p,
+			       const hobject_t& oid, const hobject_t& ioid) :
+  PG(o, _pool, p, oid, ioid), codec(NULL)
+{
+  const pg_pool_t& pi = pool->info;
+  codec = ErasureCode::create(pi.get_erasure_code_technique(),
+			      pi.get_data_chunk_count(),
+			      pi.get_coding_chunk_count());
+  assert(codec);  // the monitor only creates pools it can code
+}
+
+ErasureCodedPG::~ErasureCodedPG()
+{
+  delete codec;
+}
+
+// =======================
+// pg changes
+
+bool ErasureCodedPG::same_for_read_since(epoch_t e)
+{
+  return (e >= info.history.same_primary_since);
+}
+
+bool ErasureCodedPG::same_for_modify_since(epoch_t e)
+{
+  return (e >= info.history.same_primary_since);
+}
+
+bool ErasureCodedPG::same_for_rep_modify_since(epoch_t e)
+{
+  return e >= info.history.same_primary_since;
+}
+
+int ErasureCodedPG::do_command(vector<string>& cmd, ostream& ss,
+			       bufferlist& idata, bufferlist& odata)
+{
+  if (cmd.size() && cmd[0] == "query") {
+    JSONFormatter jsf(true);
+    jsf.open_object_section("pg");
+    jsf.dump_string("state", pg_state_string(get_state()));
+    jsf.open_array_section("up");
+    for (vector<int>::iterator p = up.begin(); p != up.end(); ++p)
+      jsf.dump_unsigned("osd", *p);
+    jsf.close_section();
+    jsf.open_array_section("acting");
+    for (vector<int>::iterator p = acting.begin(); p != acting.end(); ++p)
+      jsf.dump_unsigned("osd", *p);
+    jsf.close_section();
+    jsf.open_object_section("info");
+    info.dump(&jsf);
+    jsf.close_section();
+
+    jsf.open_array_section("recovery_state");
+    recovery_state.handle_query_state(&jsf);
+    jsf.close_section();
+
+    jsf.close_section();
+    stringstream dss;
+    jsf.flush(dss);
+    odata.append(dss);
+    return 0;
+  }
+  else if (cmd.size() > 1 &&
+	   cmd[0] == "mark_unfound_lost") {
+    if (cmd.size() > 2) {
+      ss << "too many arguments";
+      return -EINVAL;
+    }
+    if (cmd[1] != "delete") {
+      ss << "mode must be 'delete'; an erasure coded pg can't revert";
+      return -EINVAL;
+    }
+    if (!is_primary()) {
+      ss << "not primary";
+      return -EROFS;
+    }
+
+    int unfound = missing.num_missing() - missing_loc.size();
+    if (!unfound) {
+      ss << "pg has no unfound objects";
+      return -ENOENT;
+    }
+
+    if (!all_unfound_are_queried_or_lost(get_osdmap())) {
+      ss << "pg has " << unfound
+	 << " objects but we haven't probed all sources, not marking lost";
+      return -EINVAL;
+    }
+
+    ss << "pg has " << unfound << " objects unfound and apparently lost, deleting";
+    mark_all_unfound_lost(pg_log_entry_t::LOST_DELETE);
+    return 0;
+  }
+
+  ss << "unknown command " << cmd;
+  return -EINVAL;
+}
+
+// ====================
+// chunks
+
+uint64_t ErasureCodedPG::get_chunk_size(uint64_t size) const
+{
+  uint64_t su = get_stripe_unit();
+  uint64_t width = get_k() * su;
+  return (size + width - 1) / width * su;
+}
+
+void ErasureCodedPG::encode_object(bufferlist& data, map<int, bufferlist> *chunks)
+{
+  unsigned k = get_k();
+  uint64_t su = get_stripe_unit();
+  uint64_t chunk_len = get_chunk_size(data.length());
+
+  if (!chunk_len) {
+    for (unsigned i = 0; i < get_chunk_count(); i++)
+      (*chunks)[i] = bufferlist();
+    return;
+  }
+
+  vector<bufferptr> bp(k);
+  for (unsigned j = 0; j < k; j++) {
+    bp[j] = buffer::create_page_aligned(chunk_len);
+    bp[j].zero();
+  }
+
+  // stripe s of the object is unit s of chunk 0, then of chunk 1, ...
+  bufferlist::iterator p = data.begin();
+  uint64_t left = data.length();
+  for (uint64_t s = 0; left > 0; s++) {
+    for (unsigned j = 0; j < k && left > 0; j++) {
+      unsigned len = MIN(su, left);
+      p.copy(len, bp[j].c_str() + s * su);
+      left -= len;
+    }
+  }
+
+  for (unsigned j = 0; j < k; j++)
+    (*chunks)[j].push_back(bp[j]);
+  int r = codec->encode(*chunks);
+  assert(r == 0);
+}
+
+int ErasureCodedPG::decode_object(map<int, bufferlist>& chunks, uint64_t size,
+				  bufferlist *data)
+{
+  if (!size)
+    return 0;
+
+  unsigned k = get_k();
+  set<int> want;
+  for (unsigned j = 0; j < k; j++)
+    want.insert(j);
+  int r = codec->decode(want, chunks);
+  if (r < 0)
+    return r;
+
+  uint64_t su = get_stripe_unit();
+  uint64_t left = size;
+  for (uint64_t s = 0; left > 0; s++) {
+    for (unsigned j = 0; j < k && left > 0; j++) {
+      unsigned len = MIN(su, left);
+      bufferlist bit;
+      bit.substr_of(chunks[j], s * su, len);
+      data->claim_append(bit);
+      left -= len;
+    }
+  }
+  return 0;
+}
+
+// ====================
+// object state
+
+bool ErasureCodedPG::is_missing_object(const hobject_t& soid)
+{
+  return missing.missing.count(soid);
+}
+
+bool ErasureCodedPG::shard_has_object(int peer, const hobject_t& soid)
+{
+  if (peer == osd->whoami)
+    return !missing.is_missing(soid);
+  if (peer_missing.count(peer) &&
+      peer_missing[peer].is_missing(soid))
+    return false;
+  if (peer == backfill_target &&
+      !(soid < peer_info[peer].last_backfill))
+    return false;
+  return true;
+}
+
+/// true if @osd has a chunk of @soid we can decode from, wherever it belongs
+bool ErasureCodedPG::shard_can_read(int osd, const hobject_t& soid)
+{
+  if (shard_has_object(osd, soid))
+    return true;
+  map<int, set<hobject_t> >::iterator p = misplaced.find(osd);
+  return p != misplaced.end() && p->second.count(soid);
+}
+
+void ErasureCodedPG::got_misplaced(int osd, const hobject_t& soid)
+{
+  map<int, set<hobject_t> >::iterator p = misplaced.find(osd);
+  if (p == misplaced.end())
+    return;
+  p->second.erase(soid);
+  if (p->second.empty())
+    misplaced.erase(p);
+}
+
+bool ErasureCodedPG::is_degraded_object(const hobject_t& soid)
+{
+  if (missing.missing.count(soid))
+    return true;
+  for (unsigned i = 1; i < acting.size(); i++) {
+    int peer = acting[i];
+    if (peer_missing.count(peer) &&
+	peer_missing[peer].missing.count(soid))
+      return true;
+
+    if (peer == backfill_target &&
+	backfill_pos == soid)
+      return true;
+
+    if (peer == backfill_target &&
+	peer_info[peer].last_backfill <= soid &&
+	backfill_pos >= soid &&
+	backfills_in_flight.count(soid))
+      return true;
+  }
+  return false;
+}
+
+/*
+ * our own chunk carries the full object_info_t and user xattrs, so
+ * metadata comes from the local store.
+ */
+int ErasureCodedPG::get_object_state(const hobject_t& soid, object_info_t *oi,
+				     map<string, bufferptr> *attrs)
+{
+  int r = osd->store->getattrs(coll, soid, *attrs);
+  if (r < 0)
+    return r;
+  map<string, bufferptr>::iterator p = attrs->find(OI_ATTR);
+  if (p == attrs->end())
+    return -ENOENT;
+  bufferlist bv;
+  bv.push_back(p->second);
+  *oi = object_info_t(bv);
+  attrs->erase(EC_SHARD_ATTR);
+  return 0;
+}
+
+int ErasureCodedPG::read_chunk(const hobject_t& soid, int *idx, bufferlist *data,
+			       map<string, bufferptr> *attrs)
+{
+  osr.flush();
+  int r = osd->store->getattrs(coll, soid, *attrs);
+  if (r < 0)
+    return r;
+  map<string, bufferptr>::iterator p = attrs->find(EC_SHARD_ATTR);
+  if (p == attrs->end())
+    return -ENODATA;
+  bufferlist bl;
+  bl.push_back(p->second);
+  bufferlist::iterator bp = bl.begin();
+  __u32 i;
+  ::decode(i, bp);
+  *idx = i;
+  attrs->erase(p);
+  r = osd->store->read(coll, soid, 0, 0, *data);
+  if (r < 0)
+    return r;
+  return 0;
+}
+
+bool ErasureCodedPG::start_busy(const hobject_t& soid, OpRequestRef op)
+{
+  if (busy.count(soid)) {
+    dout(10) << "start_busy " << soid << " busy, waiting" << dendl;
+    waiting_for_object[soid].push_back(op);
+    op->mark_delayed();
+    return false;
+  }
+  busy.insert(soid);
+  return true;
+}
+
+void ErasureCodedPG::finish_busy(const hobject_t& soid)
+{
+  dout(20) << "finish_busy " << soid << dendl;
+  busy.erase(soid);
+  map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_object.find(soid);
+  if (p != waiting_for_object.end()) {
+    osd->requeue_ops(this, p->second);
+    waiting_for_object.erase(p);
+  }
+  if (!is_primary())
+    return;
+  if (backfills_deferred.count(soid)) {
+    backfills_deferred.erase(soid);
+    push_backfill_object(soid);
+  } else if (is_degraded_object(soid) && !recovering.count(soid)) {
+    osd->queue_for_recovery(this);
+  }
+}
+
+// ====================
+// client ops
+
+void ErasureCodedPG::do_pg_op(OpRequestRef op)
+{
+  MOSDOp *m = (MOSDOp *)op->request;
+  assert(m->get_header().type == CEPH_MSG_OSD_OP);
+  dout(10) << "do_pg_op " << *m << dendl;
+
+  op->mark_started();
+
+  bufferlist outdata;
+  int result = 0;
+
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); p++) {
+    bufferlist::iterator bp = p->indata.begin();
+    switch (p->op.op) {
+    case CEPH_OSD_OP_PGLS:
+      if (m->get_pg() != info.pgid) {
+        dout(10) << " pgls pg=" << m->get_pg() << " != " << info.pgid << dendl;
+	result = 0; // hmm?
+      } else {
+	unsigned list_size = MIN(g_conf->osd_max_pgls, p->op.pgls.count);
+
+        dout(10) << " pgls pg=" << m->get_pg() << " count " << list_size << dendl;
+        vector<hobject_t> sentries;
+        pg_ls_response_t response;
+	try {
+	  ::decode(response.handle, bp);
+	}
+	catch (const buffer::error& e) {
+	  dout(0) << "unable to decode PGLS handle in " << *m << dendl;
+	  result = -EINVAL;
+	  break;
+	}
+
+	hobject_t next;
+	hobject_t current = response.handle;
+	osr.flush();
+	int r = osd->store->collection_list_partial(coll, current,
+						    list_size,
+						    list_size,
+						    CEPH_NOSNAP,
+						    &sentries,
+						    &next);
+	if (r != 0) {
+	  result = -EINVAL;
+	  break;
+	}
+
+	map<hobject_t, pg_missing_t::item>::iterator missing_iter =
+	  missing.missing.lower_bound(current);
+	vector<hobject_t>::iterator ls_iter = sentries.begin();
+	while (1) {
+	  if (ls_iter == sentries.end()) {
+	    break;
+	  }
+
+	  hobject_t candidate;
+	  if (missing_iter == missing.missing.end() ||
+	      *ls_iter < missing_iter->first) {
+	    candidate = *(ls_iter++);
+	  } else {
+	    candidate = (missing_iter++)->first;
+	  }
+
+	  if (response.entries.size() == list_size) {
+	    next = candidate;
+	    break;
+	  }
+
+	  response.entries.push_back(make_pair(candidate.oid,
+					       candidate.get_key()));
+	}
+	if (next.is_max() &&
+	    missing_iter == missing.missing.end() &&
+	    ls_iter == sentries.end()) {
+	  result = 1;
+	}
+	response.handle = next;
+	::encode(response, outdata);
+	dout(10) << " pgls result=" << result << " outdata.length()="
+		 << outdata.length() << dendl;
+      }
+      break;
+
+    default:
+      result = -EINVAL;
+      break;
+    }
+  }
+
+  MOSDOpReply *reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(),
+				       CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
+  reply->set_data(outdata);
+  reply->set_result(result);
+  osd->client_messenger->send_message(reply, m->get_connection());
+}
+
+/** do_op - do an op
+ * pg lock will be held (if multithreaded)
+ * osd_lock NOT held.
+ */
+void ErasureCodedPG::do_op(OpRequestRef op)
+{
+  MOSDOp *m = (MOSDOp*)op->request;
+  assert(m->get_header().type == CEPH_MSG_OSD_OP);
+  if ((m->get_rmw_flags() & CEPH_OSD_FLAG_PGOP)) {
+    do_pg_op(op);
+    return;
+  }
+
+  dout(10) << "do_op " << *m << (m->may_write() ? " may_write" : "") << dendl;
+
+  if (!is_primary()) {
+    // a shard only has its own chunk; send balanced reads to the primary
+    osd->logger->inc(l_osd_op_r_bounce);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
+  if (!codec) {
+    dout(0) << "do_op no '" << pool->info.get_erasure_code_technique()
+	    << "' erasure code for k=" << pool->info.get_data_chunk_count()
+	    << " m=" << pool->info.get_coding_chunk_count() << dendl;
+    osd->reply_op_error(op, -EOPNOTSUPP);
+    return;
+  }
+
+  if (acting.size() < get_k()) {
+    dout(10) << "do_op only " << acting.size() << " shards, need " << get_k() << dendl;
+    waiting_for_active.push_back(op);
+    op->mark_delayed();
+    return;
+  }
+
+  if (m->get_snapid() != CEPH_NOSNAP || m->get_snaps().size()) {
+    osd->reply_op_error(op, -EOPNOTSUPP);
+    return;
+  }
+
+  hobject_t soid(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(),
+		 info.pgid.pool());
+
+  if (m->may_write() && write_blocked_by_scrub(soid)) {
+    dout(20) << __func__ << ": waiting for scrub" << dendl;
+    waiting_for_active.push_back(op);
+    op->mark_delayed();
+    return;
+  }
+
+  // missing object?
+  if (is_missing_object(soid)) {
+    dout(7) << "missing " << soid << dendl;
+    recover_object(soid, missing.missing[soid].need);
+    waiting_for_missing_object[soid].push_back(op);
+    op->mark_delayed();
+    return;
+  }
+
+  // degraded object?
+  if (m->may_write() && is_degraded_object(soid)) {
+    dout(7) << "degraded " << soid << dendl;
+    eversion_t v;
+    for (unsigned i = 1; i < acting.size(); i++) {
+      int peer = acting[i];
+      if (peer_missing.count(peer) &&
+	  peer_missing[peer].missing.count(soid)) {
+	v = peer_missing[peer].missing[soid].need;
+	break;
+      }
+    }
+    if (v != eversion_t())
+      recover_object(soid, v);
+    waiting_for_degraded_object[soid].push_back(op);
+    op->mark_delayed();
+    return;
+  }
+
+  if (m->may_write()) {
+    eversion_t oldv = log.get_request_version(m->get_reqid());
+    if (oldv != eversion_t()) {
+      dout(3) << "do_op dup " << m->get_reqid() << " was " << oldv << dendl;
+      if (oldv <= last_update_ondisk) {
+	osd->reply_op_error(op, 0, oldv);
+      } else {
+	dout(10) << " waiting for " << oldv << " to commit" << dendl;
+	waiting_for_ondisk[oldv].push_back(op);
+	op->mark_delayed();
+      }
+      return;
+    }
+  }
+
+  if (!start_busy(soid, op))
+    return;
+
+  op->mark_started();
+
+  object_info_t oi(soid, m->get_object_locator());
+  map<string, bufferptr> attrs;
+  int r = get_object_state(soid, &oi, &attrs);
+  if (r == 0 && oi.size > 0 && ops_need_data(m)) {
+    ReadOp *rop = new ReadOp;
+    rop->tid = osd->get_tid();
+    rop->soid = soid;
+    rop->v = oi.version;
+    rop->size = oi.size;
+    rop->op = op;
+    for (unsigned j = 0; j < get_k(); j++)
+      rop->want.insert(j);
+    start_read(rop);
+    return;
+  }
+
+  bufferlist data;
+  execute_ops(op, soid, data);
+}
+
+bool ErasureCodedPG::ops_need_data(MOSDOp *m)
+{
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p) {
+    switch (p->op.op) {
+    case CEPH_OSD_OP_READ:
+    case CEPH_OSD_OP_WRITE:
+    case CEPH_OSD_OP_APPEND:
+    case CEPH_OSD_OP_ZERO:
+    case CEPH_OSD_OP_TRUNCATE:
+      return true;
+    }
+  }
+  return false;
+}
+
+/// write @bl at @off in @data, zero filling any gap
+static void splice_data(bufferlist& data, uint64_t off, bufferlist& bl)
+{
+  bufferlist ndata;
+  if (off > data.length()) {
+    ndata.claim(data);
+    bufferptr z(off - ndata.length());
+    z.zero();
+    ndata.append(z);
+  } else {
+    ndata.substr_of(data, 0, off);
+  }
+  ndata.append(bl);
+  if (off + bl.length() < data.length()) {
+    bufferlist tail;
+    tail.substr_of(data, off + bl.length(), data.length() - off - bl.length());
+    ndata.claim_append(tail);
+  }
+  data.claim(ndata);
+}
+
+/*
+ * run the client's ops against the object in memory: @data is its
+ * whole content if any op needed it.  writes are re-encoded and sent
+ * to every shard.
+ */
+void ErasureCodedPG::execute_ops(OpRequestRef op, const hobject_t& soid,
+				 bufferlist& data)
+{
+  MOSDOp *m = (MOSDOp*)op->request;
+
+  object_info_t oi(soid, m->get_object_locator());
+  map<string, bufferptr> attrs;
+  bool existed = (get_object_state(soid, &oi, &attrs) == 0);
+  bool exists = existed;
+  eversion_t old_version = oi.version;
+  uint64_t old_size = existed ? oi.size : 0;
+
+  bool data_dirty = false, attrs_dirty = false;
+  set<string> rmattrs;
+  object_stat_sum_t delta;
+  int result = 0;
+
+  dout(10) << "execute_ops " << soid << " " << m->ops << " ov " << oi.version << dendl;
+
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); p++) {
+    OSDOp& osd_op = *p;
+    ceph_osd_op& o = osd_op.op;
+    bufferlist::iterator bp = osd_op.indata.begin();
+
+    switch (o.op) {
+
+      // --- READS ---
+
+    case CEPH_OSD_OP_READ:
+      if (!exists) {
+	result = -ENOENT;
+	break;
+      }
+      {
+	bufferlist bl;
+	uint64_t off = o.extent.offset;
+	if (off < data.length()) {
+	  uint64_t len = o.extent.length;
+	  if (!len || off + len > data.length())
+	    len = data.length() - off;
+	  bl.substr_of(data, off, len);
+	}
+	o.extent.length = bl.length();
+	osd_op.outdata.claim_append(bl);
+	delta.num_rd_kb += SHIFT_ROUND_UP(o.extent.length, 10);
+	delta.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_STAT:
+      if (exists) {
+	::encode(oi.size, osd_op.outdata);
+	::encode(oi.mtime, osd_op.outdata);
+      } else {
+	result = -ENOENT;
+      }
+      delta.num_rd++;
+      break;
+
+    case CEPH_OSD_OP_GETXATTR:
+      {
+	string aname;
+	bp.copy(o.xattr.name_len, aname);
+	map<string, bufferptr>::iterator a = attrs.find("_" + aname);
+	if (exists && a != attrs.end()) {
+	  osd_op.outdata.append(a->second);
+	  o.xattr.value_len = a->second.length();
+	} else {
+	  result = exists ? -ENODATA : -ENOENT;
+	}
+	delta.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_GETXATTRS:
+      {
+	map<string, bufferlist> newattrs;
+	for (map<string, bufferptr>::iterator a = attrs.begin(); a != attrs.end(); ++a) {
+	  if (a->first.length() > 1 && a->first[0] == '_')
+	    newattrs[a->first.substr(1)].append(a->second);
+	}
+	::encode(newattrs, osd_op.outdata);
+	delta.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_CMPXATTR:
+      {
+	string aname;
+	bp.copy(o.xattr.name_len, aname);
+	bufferlist xattr;
+	map<string, bufferptr>::iterator a = attrs.find("_" + aname);
+	if (a != attrs.end())
+	  xattr.append(a->second);
+
+	switch (o.xattr.cmp_mode) {
+	case CEPH_OSD_CMPXATTR_MODE_STRING:
+	  {
+	    string val;
+	    bp.copy(o.xattr.value_len, val);
+	    result = do_xattr_cmp_str(o.xattr.cmp_op, val, xattr);
+	  }
+	  break;
+	case CEPH_OSD_CMPXATTR_MODE_U64:
+	  {
+	    uint64_t u64val;
+	    ::decode(u64val, bp);
+	    result = do_xattr_cmp_u64(o.xattr.cmp_op, u64val, xattr);
+	  }
+	  break;
+	default:
+	  dout(10) << "bad cmp mode " << (int)o.xattr.cmp_mode << dendl;
+	  result = -EINVAL;
+	}
+	if (!result) {
+	  dout(10) << "comparison returned false" << dendl;
+	  result = -ECANCELED;
+	  break;
+	}
+	if (result < 0)
+	  break;
+	delta.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_ASSERT_VER:
+      {
+	uint64_t ver = o.watch.ver;
+	if (!ver)
+	  result = -EINVAL;
+	else if (ver < oi.user_version.version)
+	  result = -ERANGE;
+	else if (ver > oi.user_version.version)
+	  result = -EOVERFLOW;
+      }
+      break;
+
+      // --- WRITES ---
+
+    case CEPH_OSD_OP_CREATE:
+      {
+	int flags = le32_to_cpu(o.flags);
+	if (exists && (flags & CEPH_OSD_OP_FLAG_EXCL)) {
+	  result = -EEXIST;
+	  break;
+	}
+	if (osd_op.indata.length()) {
+	  string category;
+	  ::decode(category, bp);
+	  if (category.size()) {
+	    if (exists) {
+	      if (oi.category != category)
+		result = -EEXIST;  // category cannot be reset
+	    } else {
+	      oi.category = category;
+	    }
+	  }
+	}
+	if (result >= 0 && !exists) {
+	  exists = true;
+	  data_dirty = true;
+	}
+      }
+      break;
+
+    case CEPH_OSD_OP_WRITE:
+    case CEPH_OSD_OP_WRITEFULL:
+    case CEPH_OSD_OP_APPEND:
+      {
+	bufferlist nbl;
+	bp.copy(o.extent.length, nbl);
+	uint64_t off = o.extent.offset;
+	if (o.op == CEPH_OSD_OP_WRITEFULL)
+	  data.clear();
+	else if (o.op == CEPH_OSD_OP_APPEND)
+	  off = data.length();
+	splice_data(data, off, nbl);
+	exists = true;
+	data_dirty = true;
+	delta.num_wr++;
+	delta.num_wr_kb += SHIFT_ROUND_UP(o.extent.length, 10);
+      }
+      break;
+
+    case CEPH_OSD_OP_ZERO:
+      if (exists && o.extent.offset < data.length()) {
+	uint64_t len = MIN(o.extent.length, data.length() - o.extent.offset);
+	bufferptr z(len);
+	z.zero();
+	bufferlist zbl;
+	zbl.append(z);
+	splice_data(data, o.extent.offset, zbl);
+	data_dirty = true;
+	delta.num_wr++;
+      }
+      break;
+
+    case CEPH_OSD_OP_TRUNCATE:
+      if (!exists) {
+	result = -ENOENT;
+	break;
+      }
+      if (o.extent.offset < data.length()) {
+	bufferlist keep;
+	keep.substr_of(data, 0, o.extent.offset);
+	data.claim(keep);
+      } else if (o.extent.offset > data.length()) {
+	bufferlist empty;
+	splice_data(data, o.extent.offset, empty);
+      }
+      data_dirty = true;
+      delta.num_wr++;
+      break;
+
+    case CEPH_OSD_OP_DELETE:
+      if (!exists) {
+	result = -ENOENT;
+	break;
+      }
+      exists = false;
+      data.clear();
+      attrs.clear();
+      break;
+
+    case CEPH_OSD_OP_SETXATTR:
+      {
+	if (!exists) {
+	  exists = true;
+	  data_dirty = true;
+	}
+	string aname;
+	bp.copy(o.xattr.name_len, aname);
+	string name = "_" + aname;
+	bufferlist bl;
+	bp.copy(o.xattr.value_len, bl);
+	attrs[name] = bufferptr(bl.c_str(), bl.length());
+	rmattrs.erase(name);
+	attrs_dirty = true;
+	delta.num_wr++;
+      }
+      break;
+
+    case CEPH_OSD_OP_RMXATTR:
+      {
+	string aname;
+	bp.copy(o.xattr.name_len, aname);
+	string name = "_" + aname;
+	attrs.erase(name);
+	rmattrs.insert(name);
+	attrs_dirty = true;
+	delta.num_wr++;
+      }
+      break;
+
+    case CEPH_OSD_OP_STARTSYNC:
+      break;
+
+    default:
+      dout(1) << "unsupported osd op " << o.op
+	      << " " << ceph_osd_op_name(o.op) << " on erasure coded pg" << dendl;
+      result = -EOPNOTSUPP;
+    }
+
+    if (result < 0 && (o.flags & CEPH_OSD_OP_FLAG_FAILOK))
+      result = 0;
+    if (result < 0)
+      break;
+  }
+
+  bool modified = data_dirty || attrs_dirty || exists != existed;
+
+  MOSDOpReply *reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(), 0);
+
+  // read or error?
+  if (!modified || result < 0) {
+    if (result >= 0)
+      update_stats();
+    reply->claim_op_out_data(m->ops);
+    reply->set_result(result);
+    reply->set_version(info.last_update);
+    reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
+    osd->client_messenger->send_message(reply, m->get_connection());
+    finish_busy(soid);
+    return;
+  }
+
+  assert(m->may_write());
+  if (result > 0)
+    result = 0;
+  reply->set_result(result);
+
+  // version
+  eversion_t v = log.head;
+  v.epoch = get_osdmap()->get_epoch();
+  v.version++;
+  assert(v > info.last_update);
+
+  if (exists) {
+    oi.version = v;
+    oi.prior_version = old_version;
+    oi.last_reqid = m->get_reqid();
+    oi.user_version = v;
+    if (m->get_mtime() != utime_t())
+      oi.mtime = m->get_mtime();
+    if (data_dirty)
+      oi.size = data.length();
+    bufferlist bv(sizeof(oi));
+    ::encode(oi, bv);
+    attrs[OI_ATTR] = bufferptr(bv.c_str(), bv.length());
+  }
+  reply->set_version(v);
+
+  // stats
+  if (exists)
+    delta.num_bytes += oi.size;
+  if (existed)
+    delta.num_bytes -= old_size;
+  if (exists && !existed)
+    delta.num_objects++;
+  if (!exists && existed)
+    delta.num_objects--;
+  info.stats.stats.add(delta, oi.category);
+  if (scrub_active && soid < scrub_start)
+    scrub_cstat.add(delta, oi.category);
+  if (backfill_target >= 0) {
+    pg_info_t& pinfo = peer_info[backfill_target];
+    if (soid < pinfo.last_backfill)
+      pinfo.stats.stats.add(delta, oi.category);
+    else if (soid < backfill_pos)
+      pending_backfill_updates[soid].stats.add(delta, oi.category);
+  }
+
+  // log
+  vector<pg_log_entry_t> log_entries;
+  log_entries.push_back(pg_log_entry_t(exists ? pg_log_entry_t::MODIFY : pg_log_entry_t::DELETE,
+				       soid, v, old_version, m->get_reqid(), m->get_mtime()));
+
+  // one transaction per shard
+  map<int, bufferlist> chunks;
+  bool rewrite = exists && (data_dirty || !existed);
+  if (rewrite)
+    encode_object(data, &chunks);
+
+  vector<ObjectStore::Transaction> shard_t(acting.size());
+  for (unsigned i = 0; i < acting.size(); i++) {
+    ObjectStore::Transaction& t = shard_t[i];
+    if (!exists) {
+      t.remove(coll, soid);
+    } else if (rewrite) {
+      t.remove(coll, soid);
+      t.touch(coll, soid);
+      if (chunks[i].length())
+	t.write(coll, soid, 0, chunks[i].length(), chunks[i]);
+      t.setattrs(coll, soid, attrs);
+      bufferlist sb;
+      ::encode((__u32)i, sb);
+      t.setattr(coll, soid, EC_SHARD_ATTR, sb);
+    } else {
+      for (set<string>::iterator a = rmattrs.begin(); a != rmattrs.end(); ++a)
+	t.rmattr(coll, soid, *a);
+      t.setattrs(coll, soid, attrs);
+    }
+  }
+
+  WriteOp *wop = new WriteOp;
+  wop->tid = osd->get_tid();
+  wop->soid = soid;
+  wop->v = v;
+  wop->op = op;
+  wop->reply = reply;
+  wop->pg_local_last_complete = info.last_complete;
+
+  // trim log?
+  calc_trim_to();
+
+  append_log(log_entries, pg_trim_to, wop->local_t);
+  stash_prior_versions(wop->local_t, log_entries);
+  trim_rollback_stashes(wop->local_t, min_last_complete_ondisk);
+
+  issue_write(wop, m, log_entries, shard_t);
+  wop->put();
+}
+
+// ====================
+// reads
+
+void ErasureCodedPG::start_read(ReadOp *rop)
+{
+  dout(10) << "start_read " << rop->soid << " v " << rop->v
+	   << " want " << rop->want << " tid " << rop->tid << dendl;
+  reads_in_flight[rop->tid] = rop;
+  if (!send_reads(rop))
+    finish_read(rop);
+}
+
+/**
+ * ask shards we haven't tried yet for their chunk, until we have or
+ * are waiting on k of them
+ *
+ * @return true if any reads are outstanding
+ */
+bool ErasureCodedPG::send_reads(ReadOp *rop)
+{
+  unsigned k = get_k();
+  for (unsigned i = 0;
+       i < acting.size() && rop->chunks.size() + rop->pending.size() < k;
+       i++) {
+    int peer = acting[i];
+    if (rop->tried.count(peer) || !shard_can_read(peer, rop->soid))
+      continue;
+    rop->tried.insert(peer);
+
+    if (peer == osd->whoami) {
+      int idx = -1;
+      bufferlist data;
+      map<string, bufferptr> attrs;
+      int r = read_chunk(rop->soid, &idx, &data, &attrs);
+      if (r < 0) {
+	dout(0) << "send_reads local read of " << rop->soid << " got " << r << dendl;
+	continue;
+      }
+      add_chunk(rop, peer, idx, data, attrs);
+      continue;
+    }
+
+    dout(15) << "send_reads " << rop->soid << " tid " << rop->tid
+	     << " from osd." << peer << dendl;
+    osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, rop->tid);
+    MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, rop->soid, false, 0,
+				     get_osdmap()->get_epoch(), rop->tid, rop->v);
+    subop->ops = vector<OSDOp>(1);
+    subop->ops[0].op.op = CEPH_OSD_OP_EC_READ;
+    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+    rop->pending.insert(peer);
+  }
+  return !rop->pending.empty();
+}
+
+void ErasureCodedPG::add_chunk(ReadOp *rop, int from, int idx, bufferlist& data,
+			       map<string, bufferptr>& attrs)
+{
+  map<string, bufferptr>::iterator p = attrs.find(OI_ATTR);
+  if (p == attrs.end()) {
+    dout(10) << "add_chunk " << rop->soid << " from osd." << from << ": no object info" << dendl;
+    return;
+  }
+  bufferlist bv;
+  bv.push_back(p->second);
+  object_info_t oi(bv);
+  if (oi.version != rop->v) {
+    dout(10) << "add_chunk " << rop->soid << " from osd." << from
+	     << " is v " << oi.version << " != " << rop->v << dendl;
+    return;
+  }
+  if (idx < 0 || idx >= (int)get_chunk_count() ||
+      data.length() != get_chunk_size(oi.size)) {
+    osd->clog.error() << info.pgid << " " << rop->soid << " chunk " << idx
+		      << " on osd." << from << " is " << data.length()
+		      << " bytes, expected " << get_chunk_size(oi.size) << "\n";
+    return;
+  }
+  dout(15) << "add_chunk " << rop->soid << " chunk " << idx << " from osd." << from << dendl;
+  rop->size = oi.size;
+  rop->chunks[idx].claim(data);
+  if (rop->attrs.empty())
+    rop->attrs.swap(attrs);
+}
+
+void ErasureCodedPG::sub_op_ec_read(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  dout(10) << "sub_op_ec_read " << m->poid << " v " << m->version << dendl;
+
+  op->mark_started();
+
+  int idx = -1;
+  bufferlist data;
+  map<string, bufferptr> attrs;
+  int r = read_chunk(m->poid, &idx, &data, &attrs);
+
+  MOSDSubOp *reply = new MOSDSubOp(m->reqid, info.pgid, m->poid, false, 0,
+				   get_osdmap()->get_epoch(), m->get_tid(), m->version);
+  reply->ops = vector<OSDOp>(1);
+  reply->ops[0].op.op = CEPH_OSD_OP_EC_CHUNK;
+  if (r == 0) {
+    reply->ops[0].op.extent.offset = idx;
+    reply->ops[0].indata.claim(data);
+    reply->attrset.swap(attrs);
+  } else {
+    dout(10) << "sub_op_ec_read " << m->poid << " got " << r << dendl;
+  }
+  osd->cluster_messenger->send_message(reply, m->get_connection());
+}
+
+void ErasureCodedPG::handle_chunk_reply(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  int from = m->get_source().num();
+
+  op->mark_started();
+
+  map<tid_t, ReadOp*>::iterator p = reads_in_flight.find(m->get_tid());
+  if (p == reads_in_flight.end() || !p->second->pending.count(from)) {
+    dout(10) << "handle_chunk_reply tid " << m->get_tid() << " from osd." << from
+	     << ", not reading" << dendl;
+    return;
+  }
+  ReadOp *rop = p->second;
+  rop->pending.erase(from);
+
+  if (m->attrset.size()) {
+    bufferlist data;
+    m->claim_data(data);
+    add_chunk(rop, from, m->ops[0].op.extent.offset, data, m->attrset);
+  }
+
+  if (rop->pending.empty() && !send_reads(rop))
+    finish_read(rop);
+}
+
+void ErasureCodedPG::finish_read(ReadOp *rop)
+{
+  dout(10) << "finish_read " << rop->soid << " v " << rop->v
+	   << " have chunks " << rop->chunks.size() << "/" << get_k() << dendl;
+  reads_in_flight.erase(rop->tid);
+
+  if (rop->for_recovery) {
+    finish_recovery_read(rop);
+    delete rop;
+    return;
+  }
+
+  bufferlist data;
+  int r = -EIO;
+  if (rop->chunks.size() >= get_k())
+    r = decode_object(rop->chunks, rop->size, &data);
+  if (r < 0) {
+    osd->clog.error() << info.pgid << " " << rop->soid << " v " << rop->v
+		      << " read failed, only " << rop->chunks.size()
+		      << " of " << get_k() << " chunks readable\n";
+    osd->reply_op_error(rop->op, -EIO);
+    finish_busy(rop->soid);
+  } else {
+    execute_ops(rop->op, rop->soid, data);
+  }
+  delete rop;
+}
+
+// ====================
+// writes
+
+void ErasureCodedPG::issue_write(WriteOp *wop, MOSDOp *m,
+				 vector<pg_log_entry_t>& log_entries,
+				 vector<ObjectStore::Transaction>& shard_t)
+{
+  const hobject_t& soid = wop->soid;
+  dout(7) << "issue_write tid " << wop->tid << " o " << soid << " v " << wop->v << dendl;
+
+  wop->waitfor_disk.insert(acting[0]);
+
+  int acks_wanted = CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK;
+  for (unsigned i = 1; i < acting.size(); i++) {
+    wop->op->mark_sub_op_sent();
+    int peer = acting[i];
+    pg_info_t &pinfo = peer_info[peer];
+
+    wop->waitfor_disk.insert(peer);
+
+    MOSDSubOp *wr = new MOSDSubOp(m->get_reqid(), info.pgid, soid,
+				  false, acks_wanted,
+				  get_osdmap()->get_epoch(),
+				  wop->tid, wop->v);
+    if (peer == backfill_target && soid >= backfill_pos) {
+      dout(10) << "issue_write shipping empty opt to osd." << peer << ", object beyond backfill_pos "
+	       << backfill_pos << ", last_backfill is " << pinfo.last_backfill << dendl;
+      ObjectStore::Transaction t;
+      ::encode(t, wr->get_data());
+    } else {
+      ::encode(shard_t[i], wr->get_data());
+    }
+    ::encode(log_entries, wr->logbl);
+
+    if (backfill_target >= 0 && backfill_target == peer)
+      wr->pg_stats = pinfo.stats;  // reflects backfill progress
+    else
+      wr->pg_stats = info.stats;
+
+    wr->pg_trim_to = pg_trim_to;
+    wr->pg_acked_to = min_last_complete_ondisk;
+    osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
+
+    pinfo.last_update = wop->v;
+  }
+
+  writes_in_flight[wop->tid] = wop;
+  wop->get();
+
+  wop->op_t.swap(shard_t[0]);
+  wop->tls.push_back(&wop->local_t);
+  wop->tls.push_back(&wop->op_t);
+  Context *oncommit = new C_EC_OpCommit(this, wop);
+  Context *onapplied = new C_EC_OpApplied(this, wop);
+  int r = osd->store->queue_transactions(&osr, wop->tls, onapplied, oncommit, 0, wop->op);
+  if (r) {
+    derr << "issue_write queue_transactions returned " << r << " on " << *wop << dendl;
+    assert(0);
+  }
+}
+
+void ErasureCodedPG::op_applied(WriteOp *wop)
+{
+  lock();
+  dout(10) << "op_applied " << *wop << dendl;
+  wop->op->mark_event("op_applied");
+  wop->op->request->clear_data();
+
+  wop->applied = true;
+
+  assert(info.last_update >= wop->v);
+  assert(last_update_applied < wop->v);
+  last_update_applied = wop->v;
+  if (scrub_active && scrub_state == SCRUB_WAIT_LAST_UPDATE &&
+      last_update_applied >= scrub_subset_last_update) {
+    dout(10) << "requeueing scrub, chunk writes applied" << dendl;
+    osd->scrub_wq.queue(this);
+  }
+
+  if (!wop->aborted)
+    eval_write(wop);
+
+  wop->put();
+  unlock();
+}
+
+void ErasureCodedPG::op_commit(WriteOp *wop)
+{
+  lock();
+  wop->op->mark_event("op_commit");
+
+  if (wop->aborted) {
+    dout(10) << "op_commit " << *wop << " -- aborted" << dendl;
+  } else {
+    dout(10) << "op_commit " << *wop << dendl;
+    wop->waitfor_disk.erase(osd->get_nodeid());
+
+    last_update_ondisk = wop->v;
+    if (waiting_for_ondisk.count(wop->v)) {
+      osd->requeue_ops(this, waiting_for_ondisk[wop->v]);
+      waiting_for_ondisk.erase(wop->v);
+    }
+
+    last_complete_ondisk = wop->pg_local_last_complete;
+    eval_write(wop);
+  }
+
+  wop->put();
+  unlock();
+}
+
+/*
+ * a client can only be told once every shard has its chunk: with
+ * fewer, a later read might not find k chunks at the new version.
+ */
+void ErasureCodedPG::eval_write(WriteOp *wop)
+{
+  dout(10) << "eval_write " << *wop << dendl;
+  if (wop->done || !wop->applied || !wop->waitfor_disk.empty())
+    return;
+
+  wop->done = true;
+
+  update_stats();
+
+  MOSDOp *m = (MOSDOp *)wop->op->request;
+  MOSDOpReply *reply = wop->reply;
+  wop->reply = NULL;
+  reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
+  dout(10) << " sending commit on " << *wop << " " << reply << dendl;
+  osd->client_messenger->send_message(reply, m->get_connection());
+
+  calc_min_last_complete_ondisk();
+
+  writes_in_flight.erase(wop->tid);
+  finish_busy(wop->soid);
+  wop->put();
+}
+
+void ErasureCodedPG::abort_writes(bool requeue)
+{
+  list<OpRequestRef> rq;
+  for (map<tid_t, WriteOp*>::iterator p = writes_in_flight.begin();
+       p != writes_in_flight.end();
+       writes_in_flight.erase(p++)) {
+    WriteOp *wop = p->second;
+    dout(10) << " aborting " << *wop << dendl;
+    wop->aborted = true;
+    if (requeue)
+      rq.push_back(wop->op);
+    wop->put();
+  }
+  if (requeue)
+    osd->requeue_ops(this, rq);
+}
+
+/*
+ * keep the version each of @entries replaces, so that peering can put
+ * it back.  the stash is a clone, linked into the rollback collection
+ * so that it stays out of listings of the pg.  objects past
+ * last_backfill aren't here to stash; nothing rolls them back either.
+ */
+void ErasureCodedPG::stash_prior_versions(ObjectStore::Transaction& t,
+					  vector<pg_log_entry_t>& entries)
+{
+  for (vector<pg_log_entry_t>::iterator p = entries.begin(); p != entries.end(); ++p) {
+    if (p->prior_version == eversion_t() || p->soid > info.last_backfill)
+      continue;
+    coll_t rb = make_snap_collection(t, CEPH_SNAPDIR);
+    hobject_t stash = get_rollback_stash(p->soid, p->version);
+    dout(20) << "stash_prior_versions " << p->soid << " " << p->prior_version
+	     << " as " << stash << dendl;
+    t.clone(coll, p->soid, stash);
+    t.collection_move(rb, coll, stash);
+    rollback_stashes[p->version] = stash;
+  }
+}
+
+/// drop stashes of writes every shard has committed through @to
+void ErasureCodedPG::trim_rollback_stashes(ObjectStore::Transaction& t, eversion_t to)
+{
+  coll_t rb = get_rollback_coll();
+  while (!rollback_stashes.empty() &&
+	 rollback_stashes.begin()->first <= to) {
+    dout(20) << "trim_rollback_stashes " << rollback_stashes.begin()->second << dendl;
+    t.remove(rb, rollback_stashes.begin()->second);
+    rollback_stashes.erase(rollback_stashes.begin());
+  }
+}
+
+void ErasureCodedPG::sub_op_modify(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+
+  const hobject_t& soid = m->poid;
+
+  dout(10) << "sub_op_modify " << soid << " v " << m->version
+	   << (m->noop ? " NOOP" : "") << " " << m->logbl.length() << dendl;
+
+  // sanity checks
+  assert(m->map_epoch >= info.history.same_interval_since);
+  assert(is_active());
+  assert(is_replica());
+
+  // we better not be missing this.
+  assert(!missing.is_missing(soid));
+
+  op->mark_started();
+
+  RepModify *rm = new RepModify;
+  rm->pg = this;
+  get();
+  rm->op = op;
+  rm->ackerosd = acting[0];
+  rm->last_complete = info.last_complete;
+
+  if (!m->noop) {
+    vector<pg_log_entry_t> log;
+
+    bufferlist::iterator p = m->get_data().begin();
+    ::decode(rm->opt, p);
+    p = m->logbl.begin();
+    ::decode(log, p);
+
+    info.stats = m->pg_stats;
+    append_log(log, m->pg_trim_to, rm->localt);
+    stash_prior_versions(rm->localt, log);
+    trim_rollback_stashes(rm->localt, m->pg_acked_to);
+
+    rm->tls.push_back(&rm->localt);
+    rm->tls.push_back(&rm->opt);
+  } else {
+    // just trim the log
+    if (m->pg_trim_to != eversion_t())
+      trim(rm->localt, m->pg_trim_to);
+    trim_rollback_stashes(rm->localt, m->pg_acked_to);
+    if (!rm->localt.empty())
+      rm->tls.push_back(&rm->localt);
+  }
+
+  Context *oncommit = new C_EC_RepModifyCommit(rm);
+  Context *onapply = new C_EC_RepModifyApply(rm);
+  int r = osd->store->queue_transactions(&osr, rm->tls, onapply, oncommit, 0, op);
+  if (r) {
+    dout(0) << "error applying transaction: r = " << r << dendl;
+    assert(0);
+  }
+  // op is cleaned up by oncommit/onapply when both are executed
+}
+
+void ErasureCodedPG::sub_op_modify_applied(RepModify *rm)
+{
+  lock();
+  rm->op->mark_event("sub_op_applied");
+  dout(10) << "sub_op_modify_applied on " << rm << " op " << *rm->op->request << dendl;
+  MOSDSubOp *m = (MOSDSubOp*)rm->op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+
+  if (!rm->committed) {
+    // send ack to acker only if we haven't sent a commit already
+    MOSDSubOpReply *ack = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    ack->set_priority(CEPH_MSG_PRIO_HIGH); // this better match commit priority!
+    osd->cluster_messenger->send_message(ack, get_osdmap()->get_cluster_inst(rm->ackerosd));
+  }
+
+  rm->applied = true;
+  bool done = rm->applied && rm->committed;
+
+  assert(info.last_update >= m->version);
+  assert(last_update_applied < m->version);
+  last_update_applied = m->version;
+  if (finalizing_scrub) {
+    assert(active_rep_scrub);
+    assert(info.last_update <= active_rep_scrub->scrub_to);
+    if (last_update_applied == active_rep_scrub->scrub_to) {
+      osd->rep_scrub_wq.queue(active_rep_scrub);
+      active_rep_scrub = 0;
+    }
+  } else if (active_rep_scrub &&
+	     last_update_applied >= active_rep_scrub->scrub_to) {
+    osd->rep_scrub_wq.queue(active_rep_scrub);
+    active_rep_scrub = 0;
+  }
+
+  unlock();
+  if (done) {
+    delete rm;
+    put();
+  }
+}
+
+void ErasureCodedPG::sub_op_modify_commit(RepModify *rm)
+{
+  lock();
+  rm->op->mark_event("sub_op_commit");
+
+  dout(10) << "sub_op_modify_commit on op " << *rm->op->request
+           << ", sending commit to osd." << rm->ackerosd
+           << dendl;
+
+  if (get_osdmap()->is_up(rm->ackerosd)) {
+    last_complete_ondisk = rm->last_complete;
+    MOSDSubOpReply *commit = new MOSDSubOpReply((MOSDSubOp*)rm->op->request, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ONDISK);
+    commit->set_last_complete_ondisk(rm->last_complete);
+    commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
+    osd->cluster_messenger->send_message(commit, get_osdmap()->get_cluster_inst(rm->ackerosd));
+  }
+
+  rm->committed = true;
+  bool done = rm->applied && rm->committed;
+
+  unlock();
+  if (done) {
+    delete rm;
+    put();
+  }
+}
+
+void ErasureCodedPG::sub_op_modify_reply(OpRequestRef op)
+{
+  MOSDSubOpReply *r = (MOSDSubOpReply*)op->request;
+  assert(r->get_header().type == MSG_OSD_SUBOPREPLY);
+
+  op->mark_started();
+
+  int fromosd = r->get_source().num();
+  map<tid_t, WriteOp*>::iterator p = writes_in_flight.find(r->get_tid());
+  if (p == writes_in_flight.end())
+    return;
+  WriteOp *wop = p->second;
+
+  dout(7) << "sub_op_modify_reply " << *wop << " ack_type " << (int)r->ack_type
+	  << " from osd." << fromosd << dendl;
+
+  // only the commit matters; an ack alone doesn't make the chunk durable
+  if ((r->ack_type & CEPH_OSD_FLAG_ONDISK) &&
+      wop->waitfor_disk.count(fromosd)) {
+    wop->op->mark_event("sub_op_commit_rec");
+    wop->waitfor_disk.erase(fromosd);
+    peer_last_complete_ondisk[fromosd] = r->get_last_complete_ondisk();
+    eval_write(wop);
+  }
+}
+
+// ====================
+// sub ops
+
+void ErasureCodedPG::do_sub_op(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  dout(15) << "do_sub_op " << *op->request << dendl;
+
+  if (m->ops.size() >= 1) {
+    OSDOp& first = m->ops[0];
+    switch (first.op.op) {
+    case CEPH_OSD_OP_EC_READ:
+      sub_op_ec_read(op);
+      return;
+    case CEPH_OSD_OP_EC_CHUNK:
+      handle_chunk_reply(op);
+      return;
+    case CEPH_OSD_OP_PUSH:
+      sub_op_push(op);
+      return;
+    case CEPH_OSD_OP_DELETE:
+      sub_op_remove(op);
+      return;
+    case CEPH_OSD_OP_SCRUB_RESERVE:
+      sub_op_scrub_reserve(op);
+      return;
+    case CEPH_OSD_OP_SCRUB_UNRESERVE:
+      sub_op_scrub_unreserve(op);
+      return;
+    case CEPH_OSD_OP_SCRUB_STOP:
+      sub_op_scrub_stop(op);
+      return;
+    case CEPH_OSD_OP_SCRUB_MAP:
+      sub_op_scrub_map(op);
+      return;
+    }
+  }
+
+  sub_op_modify(op);
+}
+
+void ErasureCodedPG::do_sub_op_reply(OpRequestRef op)
+{
+  MOSDSubOpReply *r = (MOSDSubOpReply *)op->request;
+  assert(r->get_header().type == MSG_OSD_SUBOPREPLY);
+  if (r->ops.size() >= 1) {
+    OSDOp& first = r->ops[0];
+    switch (first.op.op) {
+    case CEPH_OSD_OP_PUSH:
+      sub_op_push_reply(op);
+      return;
+
+    case CEPH_OSD_OP_SCRUB_RESERVE:
+      sub_op_scrub_reserve_reply(op);
+      return;
+    }
+  }
+
+  sub_op_modify_reply(op);
+}
+
+// ====================
+// recovery
+
+/**
+ * rebuild @soid at @v onto every shard that lacks it
+ *
+ * @return true if recovery of the object is (now) under way
+ */
+bool ErasureCodedPG::recover_object(const hobject_t& soid, eversion_t v)
+{
+  if (recovering.count(soid))
+    return true;
+  if (busy.count(soid) || unreadable.count(soid))
+    return false;
+
+  set<int> want;
+  int sources = 0;
+  for (unsigned i = 0; i < acting.size(); i++) {
+    int peer = acting[i];
+    if (peer == backfill_target && backfills_in_flight.count(soid)) {
+      want.insert(i);
+    } else if (shard_has_object(peer, soid)) {
+      sources++;
+    } else {
+      if (shard_can_read(peer, soid))
+	sources++;
+      if (peer != backfill_target)
+	want.insert(i);
+    }
+  }
+  if (want.empty())
+    return false;
+  if (sources < (int)get_k()) {
+    dout(10) << "recover_object " << soid << " v " << v << " only on "
+	     << sources << " shards, need " << get_k() << dendl;
+    return false;
+  }
+
+  dout(10) << "recover_object " << soid << " v " << v << " chunks " << want << dendl;
+  busy.insert(soid);
+  start_recovery_op(soid);
+  recovering[soid].v = v;
+
+  ReadOp *rop = new ReadOp;
+  rop->tid = osd->get_tid();
+  rop->soid = soid;
+  rop->v = v;
+  rop->for_recovery = true;
+  rop->want = want;
+  start_read(rop);
+  return true;
+}
+
+void ErasureCodedPG::finish_recovery_read(ReadOp *rop)
+{
+  const hobject_t& soid = rop->soid;
+  RecoveryOp& rec = recovering[soid];
+
+  int r = -EIO;
+  if (rop->chunks.size() >= get_k())
+    r = codec->decode(rop->want, rop->chunks);
+  if (r < 0) {
+    osd->clog.error() << info.pgid << " recovery of " << soid << " v " << rop->v
+		      << " failed, only " << rop->chunks.size()
+		      << " of " << get_k() << " chunks readable\n";
+    unreadable.insert(soid);
+    recovering.erase(soid);
+    backfills_in_flight.erase(soid);
+    finish_recovery_op(soid);
+    finish_busy(soid);
+    return;
+  }
+
+  ObjectRecoveryInfo recovery_info;
+  recovery_info.soid = soid;
+  recovery_info.version = rop->v;
+  recovery_info.size = rop->size;
+  {
+    bufferlist bv;
+    bv.push_back(rop->attrs[OI_ATTR]);
+    recovery_info.oi = object_info_t(bv);
+  }
+
+  for (set<int>::iterator i = rop->want.begin(); i != rop->want.end(); ++i) {
+    int peer = acting[*i];
+    bufferlist& chunk = rop->chunks[*i];
+    map<string, bufferptr> attrs = rop->attrs;
+    bufferlist sb;
+    ::encode((__u32)*i, sb);
+    attrs[EC_SHARD_ATTR] = bufferptr(sb.c_str(), sb.length());
+
+    rec.pushing.insert(peer);
+    if (peer == osd->whoami) {
+      dout(10) << "finish_recovery_read " << soid << " chunk " << *i << " locally" << dendl;
+      ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      t->remove(coll, soid);
+      t->touch(coll, soid);
+      if (chunk.length())
+	t->write(coll, soid, 0, chunk.length(), chunk);
+      t->setattrs(coll, soid, attrs);
+      recover_got(soid, rop->v);
+      got_misplaced(osd->whoami, soid);
+      write_info(*t);
+      int r = osd->store->queue_transaction(
+	&osr, t,
+	new C_EC_AppliedRecoveredObject(this, t, soid, info.history.same_interval_since),
+	new C_EC_CommittedPushedObject(this, info.history.same_interval_since,
+				       info.last_complete));
+      assert(r == 0);
+      continue;
+    }
+
+    dout(10) << "finish_recovery_read pushing " << soid << " chunk " << *i
+	     << " to osd." << peer << dendl;
+    tid_t tid = osd->get_tid();
+    osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
+    MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, soid, false, 0,
+				     get_osdmap()->get_epoch(), tid, rop->v);
+    subop->ops = vector<OSDOp>(1);
+    subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
+    subop->ops[0].indata = chunk;
+    if (chunk.length())
+      subop->data_included.insert(0, chunk.length());
+    subop->attrset = attrs;
+    subop->recovery_info = recovery_info;
+    subop->recovery_info.copy_subset = subop->data_included;
+    subop->recovery_progress.data_complete = true;
+    subop->recovery_progress.omap_complete = true;
+    subop->recovery_progress.first = false;
+    subop->recovery_progress.data_recovered_to = chunk.length();
+    osd->logger->inc(l_osd_push);
+    osd->logger->inc(l_osd_push_outb, chunk.length());
+    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  }
+}
+
+void ErasureCodedPG::_applied_recovered_object(ObjectStore::Transaction *t,
+					       const hobject_t& soid, epoch_t same_since)
+{
+  lock();
+  dout(10) << "_applied_recovered_object " << soid << dendl;
+  if (same_since == info.history.same_interval_since) {
+    map<hobject_t, RecoveryOp>::iterator p = recovering.find(soid);
+    if (p != recovering.end()) {
+      p->second.pushing.erase(osd->whoami);
+      if (p->second.pushing.empty())
+	finish_recovered_object(soid);
+    }
+  }
+  unlock();
+  delete t;
+  put();
+}
+
+void ErasureCodedPG::_committed_pushed_object(epoch_t same_since, eversion_t last_complete)
+{
+  lock();
+  if (same_since == info.history.same_interval_since) {
+    dout(10) << "_committed_pushed_object last_complete " << last_complete << " now ondisk" << dendl;
+    last_complete_ondisk = last_complete;
+
+    if (last_complete_ondisk == info.last_update) {
+      if (is_replica()) {
+	// we are fully up to date.  tell the primary!
+	osd->cluster_messenger->
+	  send_message(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
+				      last_complete_ondisk),
+		       get_osdmap()->get_cluster_inst(get_primary()));
+      } else if (is_primary()) {
+	// we are the primary.  tell replicas to trim?
+	if (calc_min_last_complete_ondisk())
+	  trim_peers();
+      }
+    }
+  } else {
+    dout(10) << "_committed_pushed_object pg has changed, not touching last_complete_ondisk" << dendl;
+  }
+  unlock();
+  put();
+}
+
+void ErasureCodedPG::sub_op_push(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  dout(10) << "sub_op_push " << m->poid << " v " << m->version << dendl;
+
+  op->mark_started();
+
+  const hobject_t& soid = m->poid;
+  bufferlist data;
+  m->claim_data(data);
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  t->remove(coll, soid);
+  t->touch(coll, soid);
+  if (data.length())
+    t->write(coll, soid, 0, data.length(), data);
+  t->setattrs(coll, soid, m->attrset);
+  recover_got(soid, m->version);
+  write_info(*t);
+
+  int r = osd->store->queue_transaction(
+    &osr, t,
+    new ObjectStore::C_DeleteTransaction(t),
+    new C_EC_CommittedPushedObject(this, info.history.same_interval_since,
+				   info.last_complete));
+  assert(r == 0);
+
+  MOSDSubOpReply *reply = new MOSDSubOpReply(
+    m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+  osd->cluster_messenger->send_message(reply, m->get_connection());
+}
+
+void ErasureCodedPG::sub_op_push_reply(OpRequestRef op)
+{
+  MOSDSubOpReply *reply = (MOSDSubOpReply*)op->request;
+  assert(reply->get_header().type == MSG_OSD_SUBOPREPLY);
+  dout(10) << "sub_op_push_reply from " << reply->get_source() << " " << *reply << dendl;
+
+  op->mark_started();
+
+  int peer = reply->get_source().num();
+  const hobject_t& soid = reply->get_poid();
+
+  map<hobject_t, RecoveryOp>::iterator p = recovering.find(soid);
+  if (p == recovering.end() || !p->second.pushing.count(peer)) {
+    dout(10) << "huh, i wasn't pushing " << soid << " to osd." << peer << dendl;
+    return;
+  }
+
+  if (peer == backfill_target && backfills_in_flight.count(soid))
+    backfills_in_flight.erase(soid);
+  else
+    peer_missing[peer].got(soid, p->second.v);
+  got_misplaced(peer, soid);
+
+  p->second.pushing.erase(peer);
+  if (p->second.pushing.empty())
+    finish_recovered_object(soid);
+  else
+    dout(10) << "pushed " << soid << ", still waiting for push ack from "
+	     << p->second.pushing << dendl;
+}
+
+void ErasureCodedPG::finish_recovered_object(const hobject_t& soid)
+{
+  dout(10) << "finish_recovered_object " << soid << dendl;
+  recovering.erase(soid);
+  finish_recovery_op(soid);
+  update_stats();
+
+  if (waiting_for_missing_object.count(soid)) {
+    osd->requeue_ops(this, waiting_for_missing_object[soid]);
+    waiting_for_missing_object.erase(soid);
+  }
+  if (waiting_for_degraded_object.count(soid)) {
+    osd->requeue_ops(this, waiting_for_degraded_object[soid]);
+    waiting_for_degraded_object.erase(soid);
+  }
+  if (missing.num_missing() == 0) {
+    osd->requeue_ops(this, waiting_for_all_missing);
+    waiting_for_all_missing.clear();
+  }
+  finish_busy(soid);
+}
+
+void ErasureCodedPG::sub_op_remove(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  dout(7) << "sub_op_remove " << m->poid << dendl;
+
+  op->mark_started();
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  t->remove(coll, m->poid);
+  int r = osd->store->queue_transaction(&osr, t);
+  assert(r == 0);
+}
+
+void ErasureCodedPG::send_remove_op(const hobject_t& oid, eversion_t v, int peer)
+{
+  tid_t tid = osd->get_tid();
+  osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
+
+  dout(10) << "send_remove_op " << oid << " from osd." << peer
+	   << " tid " << tid << dendl;
+
+  MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, oid, false, CEPH_OSD_FLAG_ACK,
+				   get_osdmap()->get_epoch(), tid, v);
+  subop->ops = vector<OSDOp>(1);
+  subop->ops[0].op.op = CEPH_OSD_OP_DELETE;
+
+  osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+}
+
+/*
+ * the primary's own missing objects first, then each peer's, oldest
+ * first.  unlike replication, every object needs k sources, and the
+ * primary needn't have an object to rebuild it elsewhere.
+ */
+int ErasureCodedPG::recover_objects(int max)
+{
+  int started = 0;
+
+  for (map<version_t, hobject_t>::iterator p = missing.rmissing.begin();
+       p != missing.rmissing.end() && started < max;
+       ++p) {
+    const hobject_t& soid = p->second;
+    if (recovering.count(soid) || unreadable.count(soid))
+      continue;
+    if (recover_object(soid, missing.missing[soid].need))
+      started++;
+  }
+
+  for (unsigned i = 1; i < acting.size() && started < max; i++) {
+    int peer = acting[i];
+    map<int, pg_missing_t>::iterator pm = peer_missing.find(peer);
+    if (pm == peer_missing.end())
+      continue;
+    for (map<version_t, hobject_t>::iterator p = pm->second.rmissing.begin();
+	 p != pm->second.rmissing.end() && started < max;
+	 ++p) {
+      const hobject_t& soid = p->second;
+      if (recovering.count(soid) || unreadable.count(soid))
+	continue;
+      if (recover_object(soid, pm->second.missing[soid].need))
+	started++;
+    }
+  }
+
+  return started;
+}
+
+int ErasureCodedPG::start_recovery_ops(int max, RecoveryCtx *prctx)
+{
+  int started = 0;
+  assert(is_primary());
+
+  if (!codec)
+    return 0;
+
+  if (missing.num_missing() == 0) {
+    info.last_complete = info.last_update;
+  }
+
+  started = recover_objects(max);
+
+  bool peers_missing = false;
+  for (unsigned i = 1; i < acting.size(); i++)
+    if (peer_missing.count(acting[i]) &&
+	peer_missing[acting[i]].num_missing())
+      peers_missing = true;
+
+  if (backfill_target >= 0 && started < max &&
+      missing.num_missing() == 0 &&
+      !waiting_on_backfill) {
+    started += recover_backfill(max - started);
+  }
+
+  dout(10) << " started " << started << dendl;
+  osd->logger->inc(l_osd_rop, started);
+
+  if (started || recovery_ops_active > 0)
+    return started;
+
+  assert(recovery_ops_active == 0);
+
+  if (!unreadable.empty()) {
+    osd->clog.error() << info.pgid << " recovery stalled, " << unreadable.size()
+		      << " objects have fewer than " << get_k() << " readable chunks\n";
+    return started;
+  }
+
+  int unfound = get_num_unfound();
+  if (unfound) {
+    dout(10) << " still have " << unfound << " unfound" << dendl;
+    return started;
+  }
+
+  if (missing.num_missing() > 0 || peers_missing) {
+    dout(10) << " still have missing objects we can't start on yet" << dendl;
+    return started;
+  }
+
+  handle_recovery_complete(prctx);
+
+  return 0;
+}
+
+// ====================
+// backfill
+
+int ErasureCodedPG::recover_backfill(int max)
+{
+  dout(10) << "recover_backfill (" << max << ")" << dendl;
+  assert(backfill_target >= 0);
+
+  pg_info_t& pinfo = peer_info[backfill_target];
+  BackfillInterval& pbi = peer_backfill_info;
+
+  // Initialize from prior backfill state
+  if (pbi.begin < pinfo.last_backfill) {
+    pbi.reset(pinfo.last_backfill);
+    backfill_info.reset(pinfo.last_backfill);
+  }
+
+  dout(10) << " peer osd." << backfill_target
+	   << " pos " << backfill_pos
+	   << " info " << pinfo
+	   << " interval " << pbi.begin << "-" << pbi.end
+	   << " " << pbi.objects.size() << " objects" << dendl;
+
+  int local_min = osd->store->get_ideal_list_min();
+  int local_max = osd->store->get_ideal_list_max();
+
+  // re-scan our local interval to cope with recent changes
+  backfill_info.clear();
+  osr.flush();
+  scan_range(backfill_pos, local_min, local_max, &backfill_info);
+
+  int ops = 0;
+  set<hobject_t> to_push;
+  map<hobject_t, eversion_t> to_remove;
+  set<hobject_t> add_to_stat;
+
+  pbi.trim();
+  backfill_info.trim();
+
+  while (ops < max) {
+    if (backfill_info.begin <= pbi.begin &&
+	!backfill_info.extends_to_end() && backfill_info.empty()) {
+      osr.flush();
+      scan_range(backfill_info.end, local_min, local_max, &backfill_info);
+      backfill_info.trim();
+    }
+    backfill_pos = backfill_info.begin > pbi.begin ? pbi.begin : backfill_info.begin;
+
+    if (pbi.begin <= backfill_info.begin &&
+	!pbi.extends_to_end() && pbi.empty()) {
+      dout(10) << " scanning peer osd." << backfill_target << " from " << pbi.end << dendl;
+      epoch_t e = get_osdmap()->get_epoch();
+      MOSDPGScan *m = new MOSDPGScan(MOSDPGScan::OP_SCAN_GET_DIGEST, e, e, info.pgid,
+				     pbi.end, hobject_t());
+      osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+      waiting_on_backfill = true;
+      start_recovery_op(pbi.end);
+      ops++;
+      break;
+    }
+
+    if (backfill_info.empty() && pbi.empty()) {
+      dout(10) << " reached end for both local and peer" << dendl;
+      break;
+    }
+
+    if (pbi.begin < backfill_info.begin) {
+      dout(20) << " removing peer " << pbi.begin << dendl;
+      to_remove[pbi.begin] = pbi.objects.begin()->second;
+      if (waiting_for_degraded_object.count(pbi.begin)) {
+	osd->requeue_ops(this, waiting_for_degraded_object[pbi.begin]);
+	waiting_for_degraded_object.erase(pbi.begin);
+      }
+      pbi.pop_front();
+    } else if (pbi.begin == backfill_info.begin) {
+      if (pbi.objects.begin()->second !=
+	  backfill_info.objects.begin()->second) {
+	dout(20) << " replacing peer " << pbi.begin << " with local "
+		 << backfill_info.objects.begin()->second << dendl;
+	to_push.insert(pbi.begin);
+	ops++;
+      } else {
+	dout(20) << " keeping peer " << pbi.begin << " "
+		 << pbi.objects.begin()->second << dendl;
+	if (waiting_for_degraded_object.count(pbi.begin)) {
+	  osd->requeue_ops(this, waiting_for_degraded_object[pbi.begin]);
+	  waiting_for_degraded_object.erase(pbi.begin);
+	}
+      }
+      add_to_stat.insert(pbi.begin);
+      backfill_info.pop_front();
+      pbi.pop_front();
+    } else {
+      dout(20) << " pushing local " << backfill_info.begin << " "
+	       << backfill_info.objects.begin()->second
+	       << " to peer osd." << backfill_target << dendl;
+      to_push.insert(backfill_info.begin);
+      add_to_stat.insert(backfill_info.begin);
+      backfill_info.pop_front();
+      ops++;
+    }
+  }
+  backfill_pos = backfill_info.begin > pbi.begin ? pbi.begin : backfill_info.begin;
+
+  for (set<hobject_t>::iterator i = add_to_stat.begin();
+       i != add_to_stat.end();
+       ++i) {
+    bufferlist bv;
+    int r = osd->store->getattr(coll, *i, OI_ATTR, bv);
+    assert(r >= 0);
+    object_info_t oi(bv);
+    pg_stat_t stat;
+    stat.stats.sum.num_objects++;
+    stat.stats.sum.num_bytes += oi.size;
+    stat.stats.cat_sum[oi.category].num_objects++;
+    stat.stats.cat_sum[oi.category].num_bytes += oi.size;
+    pending_backfill_updates[*i] = stat;
+  }
+  for (map<hobject_t, eversion_t>::iterator i = to_remove.begin();
+       i != to_remove.end();
+       ++i) {
+    send_remove_op(i->first, i->second, backfill_target);
+  }
+  for (set<hobject_t>::iterator i = to_push.begin();
+       i != to_push.end();
+       ++i) {
+    push_backfill_object(*i);
+  }
+
+  dout(5) << "backfill_pos is " << backfill_pos << " and pinfo.last_backfill is "
+	  << pinfo.last_backfill << dendl;
+
+  hobject_t bound = backfills_in_flight.size() ?
+    *(backfills_in_flight.begin()) : backfill_pos;
+  if (bound > pinfo.last_backfill) {
+    pinfo.last_backfill = bound;
+    for (map<hobject_t, pg_stat_t>::iterator i = pending_backfill_updates.begin();
+	 i != pending_backfill_updates.end() && i->first < bound;
+	 pending_backfill_updates.erase(i++)) {
+      pinfo.stats.add(i->second);
+    }
+    epoch_t e = get_osdmap()->get_epoch();
+    MOSDPGBackfill *m = NULL;
+    if (bound.is_max()) {
+      m = new MOSDPGBackfill(MOSDPGBackfill::OP_BACKFILL_FINISH, e, e, info.pgid);
+      if (info.stats.stats.sum.num_bytes != pinfo.stats.stats.sum.num_bytes)
+	osd->clog.error() << info.pgid << " backfill osd." << backfill_target << " stat mismatch on finish: "
+			  << "num_bytes " << pinfo.stats.stats.sum.num_bytes
+			  << " != expected " << info.stats.stats.sum.num_bytes << "\n";
+      if (info.stats.stats.sum.num_objects != pinfo.stats.stats.sum.num_objects)
+	osd->clog.error() << info.pgid << " backfill osd." << backfill_target << " stat mismatch on finish: "
+			  << "num_objects " << pinfo.stats.stats.sum.num_objects
+			  << " != expected " << info.stats.stats.sum.num_objects << "\n";
+      start_recovery_op(hobject_t::get_max());
+    } else {
+      m = new MOSDPGBackfill(MOSDPGBackfill::OP_BACKFILL_PROGRESS, e, e, info.pgid);
+    }
+    m->last_backfill = bound;
+    m->stats = pinfo.stats.stats;
+    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+  }
+
+  dout(10) << " peer num_objects now " << pinfo.stats.stats.sum.num_objects
+	   << " / " << info.stats.stats.sum.num_objects << dendl;
+  return ops;
+}
+
+/*
+ * the backfill target's chunk is rebuilt from the other shards like
+ * any other recovery.  an object with an op in flight is picked up
+ * when the op finishes, so backfill never rebuilds a stale version.
+ */
+void ErasureCodedPG::push_backfill_object(const hobject_t& soid)
+{
+  dout(10) << "push_backfill_object " << soid << " to osd." << backfill_target << dendl;
+  backfills_in_flight.insert(soid);
+
+  if (busy.count(soid)) {
+    dout(10) << " " << soid << " busy, deferring" << dendl;
+    backfills_deferred.insert(soid);
+    return;
+  }
+
+  bufferlist bv;
+  int r = osd->store->getattr(coll, soid, OI_ATTR, bv);
+  if (r < 0) {
+    // deleted since we scanned it
+    dout(10) << " " << soid << " is gone, removing from osd." << backfill_target << dendl;
+    send_remove_op(soid, eversion_t(), backfill_target);
+    backfills_in_flight.erase(soid);
+    return;
+  }
+  object_info_t oi(bv);
+  if (!recover_object(soid, oi.version)) {
+    osd->clog.error() << info.pgid << " unable to backfill " << soid
+		      << " to osd." << backfill_target << "\n";
+    backfills_in_flight.erase(soid);
+  }
+}
+
+void ErasureCodedPG::scan_range(hobject_t begin, int min, int max, BackfillInterval *bi)
+{
+  assert(is_locked());
+  dout(10) << "scan_range from " << begin << dendl;
+  bi->begin = begin;
+  bi->objects.clear();  // for good measure
+
+  vector<hobject_t> ls;
+  ls.reserve(max);
+  int r = osd->store->collection_list_partial(coll, begin, min, max,
+					      0, &ls, &bi->end);
+  assert(r >= 0);
+  dout(10) << " got " << ls.size() << " items, next " << bi->end << dendl;
+
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    bufferlist bl;
+    int r = osd->store->getattr(coll, *p, OI_ATTR, bl);
+    assert(r >= 0);
+    object_info_t oi(bl);
+    bi->objects[*p] = oi.version;
+    dout(20) << "  " << *p << " " << oi.version << dendl;
+  }
+}
+
+void ErasureCodedPG::do_scan(OpRequestRef op)
+{
+  MOSDPGScan *m = (MOSDPGScan*)op->request;
+  assert(m->get_header().type == MSG_OSD_PG_SCAN);
+  dout(10) << "do_scan " << *m << dendl;
+
+  op->mark_started();
+
+  switch (m->op) {
+  case MOSDPGScan::OP_SCAN_GET_DIGEST:
+    {
+      BackfillInterval bi;
+      osr.flush();
+      scan_range(m->begin, g_conf->osd_backfill_scan_min, g_conf->osd_backfill_scan_max, &bi);
+      MOSDPGScan *reply = new MOSDPGScan(MOSDPGScan::OP_SCAN_DIGEST,
+					 get_osdmap()->get_epoch(), m->query_epoch,
+					 info.pgid, bi.begin, bi.end);
+      ::encode(bi.objects, reply->get_data());
+      osd->cluster_messenger->send_message(reply, m->get_connection());
+    }
+    break;
+
+  case MOSDPGScan::OP_SCAN_DIGEST:
+    {
+      int from = m->get_source().num();
+      assert(from == backfill_target);
+      BackfillInterval& bi = peer_backfill_info;
+      bi.begin = m->begin;
+      bi.end = m->end;
+      bufferlist::iterator p = m->get_data().begin();
+      ::decode(bi.objects, p);
+
+      backfill_pos = backfill_info.begin > peer_backfill_info.begin ?
+	peer_backfill_info.begin : backfill_info.begin;
+      dout(10) << " backfill_pos now " << backfill_pos << dendl;
+
+      assert(waiting_on_backfill);
+      waiting_on_backfill = false;
+      finish_recovery_op(bi.begin);
+    }
+    break;
+  }
+}
+
+void ErasureCodedPG::do_backfill(OpRequestRef op)
+{
+  MOSDPGBackfill *m = (MOSDPGBackfill*)op->request;
+  assert(m->get_header().type == MSG_OSD_PG_BACKFILL);
+  dout(10) << "do_backfill " << *m << dendl;
+
+  op->mark_started();
+
+  switch (m->op) {
+  case MOSDPGBackfill::OP_BACKFILL_FINISH:
+    {
+      assert(is_replica());
+      MOSDPGBackfill *reply = new MOSDPGBackfill(MOSDPGBackfill::OP_BACKFILL_FINISH_ACK,
+						 get_osdmap()->get_epoch(), m->query_epoch,
+						 info.pgid);
+      osd->cluster_messenger->send_message(reply, m->get_connection());
+    }
+    // fall-thru
+
+  case MOSDPGBackfill::OP_BACKFILL_PROGRESS:
+    {
+      assert(is_replica());
+      info.last_backfill = m->last_backfill;
+      info.stats.stats = m->stats;
+
+      ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      write_info(*t);
+      int tr = osd->store->queue_transaction(&osr, t);
+      assert(tr == 0);
+    }
+    break;
+
+  case MOSDPGBackfill::OP_BACKFILL_FINISH_ACK:
+    {
+      assert(is_primary());
+      finish_recovery_op(hobject_t::get_max());
+    }
+    break;
+  }
+}
+
+// ====================
+// pg lifecycle
+
+bool ErasureCodedPG::snap_trimmer()
+{
+  // erasure coded pools have no snapshots
+  return true;
+}
+
+void ErasureCodedPG::calc_trim_to()
+{
+  if (!is_degraded() && !is_scrubbing() && is_clean()) {
+    if (min_last_complete_ondisk != eversion_t() &&
+	min_last_complete_ondisk != pg_trim_to &&
+	log.approx_size() > g_conf->osd_min_pg_log_entries) {
+      size_t num_to_trim = log.approx_size() - g_conf->osd_min_pg_log_entries;
+      list<pg_log_entry_t>::const_iterator it = log.log.begin();
+      eversion_t new_trim_to;
+      for (size_t i = 0; i < num_to_trim; ++i) {
+	new_trim_to = it->version;
+	++it;
+	if (new_trim_to > min_last_complete_ondisk) {
+	  new_trim_to = min_last_complete_ondisk;
+	  dout(10) << "calc_trim_to trimming to min_last_complete_ondisk" << dendl;
+	  break;
+	}
+      }
+      dout(10) << "calc_trim_to " << pg_trim_to << " -> " << new_trim_to << dendl;
+      pg_trim_to = new_trim_to;
+      assert(pg_trim_to <= log.head);
+      assert(pg_trim_to <= min_last_complete_ondisk);
+    }
+  } else {
+    // don't trim
+    pg_trim_to = eversion_t();
+  }
+}
+
+/** clean_up_local
+ * remove any objects that we're storing but shouldn't.
+ * as determined by log.
+ */
+void ErasureCodedPG::clean_up_local(ObjectStore::Transaction& t)
+{
+  dout(10) << "clean_up_local" << dendl;
+
+  assert(info.last_update >= log.tail);  // otherwise we need some help!
+
+  set<hobject_t> did;
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend();
+       p++) {
+    if (did.count(p->soid))
+      continue;
+    did.insert(p->soid);
+
+    if (p->is_delete()) {
+      dout(10) << " deleting " << p->soid
+	       << " when " << p->version << dendl;
+      t.remove(coll, p->soid);
+    }
+  }
+
+  // whatever peering rolled back is done; the rest isn't needed now
+  // that the log is settled
+  if (snap_collections.contains(CEPH_SNAPDIR)) {
+    coll_t rb = get_rollback_coll();
+    vector<hobject_t> ls;
+    osd->store->collection_list(rb, ls);
+    for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p)
+      t.remove(rb, *p);
+    for (map<eversion_t, hobject_t>::iterator p = rollback_stashes.begin();
+	 p != rollback_stashes.end();
+	 ++p)
+      t.remove(rb, p->second);
+  }
+  rollback_stashes.clear();
+}
+
+/*
+ * put back what divergent writes replaced, from the stashes the shard
+ * kept.  an object is left to merge_old_entry() (and recovery) if it's
+ * past last_backfill, missing, a newer entry in the log supersedes it,
+ * or the version it needs wasn't stashed.
+ */
+void ErasureCodedPG::rollback_divergent_entries(ObjectStore::Transaction& t,
+						list<pg_log_entry_t>& divergent)
+{
+  if (divergent.empty())
+    return;
+
+  // stashes may still be queued
+  osr.flush();
+
+  coll_t rb = get_rollback_coll();
+  map<hobject_t, pg_log_entry_t*> oldest;
+  for (list<pg_log_entry_t>::iterator p = divergent.begin(); p != divergent.end(); ++p)
+    if (!oldest.count(p->soid))
+      oldest[p->soid] = &*p;
+
+  set<hobject_t> rolled_back;
+  for (map<hobject_t, pg_log_entry_t*>::iterator p = oldest.begin();
+       p != oldest.end();
+       ++p) {
+    const pg_log_entry_t& oe = *p->second;
+    hobject_t stash = get_rollback_stash(oe.soid, oe.version);
+    if (oe.soid > info.last_backfill ||
+	missing.is_missing(oe.soid) ||
+	(log.objects.count(oe.soid) &&
+	 log.objects[oe.soid]->version != oe.prior_version) ||
+	(oe.prior_version != eversion_t() &&
+	 !osd->store->exists(rb, stash))) {
+      dout(10) << "rollback_divergent_entries can't roll back " << oe << dendl;
+      continue;
+    }
+    dout(10) << "rollback_divergent_entries " << oe.soid
+	     << " to " << oe.prior_version << dendl;
+    t.remove(coll, oe.soid);
+    if (oe.prior_version != eversion_t()) {
+      t.clone(rb, stash, oe.soid);
+      t.collection_move(coll, rb, oe.soid);
+    }
+    rolled_back.insert(oe.soid);
+  }
+
+  list<pg_log_entry_t>::iterator p = divergent.begin();
+  while (p != divergent.end()) {
+    if (!rolled_back.count(p->soid)) {
+      ++p;
+      continue;
+    }
+    if (p->prior_version != eversion_t()) {
+      t.remove(rb, get_rollback_stash(p->soid, p->version));
+      rollback_stashes.erase(p->version);
+    }
+    divergent.erase(p++);
+  }
+}
+
+/**
+ * @return the position @osd last held chunks at, from the most recent
+ *         interval that may have gone rw with it in the acting set, or
+ *         -1 if there is none
+ */
+int ErasureCodedPG::find_chunk_position(int osd)
+{
+  for (map<epoch_t,pg_interval_t>::reverse_iterator p = past_intervals.rbegin();
+       p != past_intervals.rend();
+       ++p) {
+    if (!p->second.maybe_went_rw)
+      continue;
+    for (unsigned i = 0; i < p->second.acting.size(); i++)
+      if (p->second.acting[i] == osd)
+	return i;
+  }
+  return -1;
+}
+
+/*
+ * called on the primary as it activates, before recovery is queued.
+ * an osd whose position in the acting set changed (say, when an osd
+ * ahead of it dropped out of a firstn mapping) holds every chunk at the
+ * wrong index, so mark all of our objects missing there.
+ */
+void ErasureCodedPG::mark_misplaced_objects()
+{
+  if (past_intervals.empty())
+    return;  // no history to compare against; scrub will find them
+
+  vector<unsigned> moved;
+  for (unsigned i = 0; i < acting.size(); i++) {
+    int o = acting[i];
+    if (i > 0) {
+      const pg_info_t& pi = peer_info[o];
+      if (pi.is_empty() ||
+	  pi.last_backfill != hobject_t::get_max() ||
+	  log.tail > pi.last_update)
+	continue;  // backfill writes every chunk where it belongs anyway
+    }
+    int was = find_chunk_position(o);
+    if (was == (int)i)
+      continue;
+    osd->clog.info() << info.pgid << " osd." << o << " moved from chunk " << was
+		     << " to " << i << ", rebuilding its chunks\n";
+    moved.push_back(i);
+  }
+  if (moved.empty())
+    return;
+
+  map<hobject_t, eversion_t> objects;
+  vector<hobject_t> ls;
+  osd->store->collection_list(coll, ls);
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    hash_map<hobject_t, pg_log_entry_t*>::iterator e = log.objects.find(*p);
+    if (e != log.objects.end() && e->second->is_delete())
+      continue;  // clean_up_local is removing it
+    object_info_t oi;
+    map<string, bufferptr> attrs;
+    if (get_object_state(*p, &oi, &attrs) == 0)
+      objects[*p] = oi.version;
+  }
+  // what we lack ourselves is still out there
+  for (map<hobject_t, pg_missing_t::item>::iterator p = missing.missing.begin();
+       p != missing.missing.end();
+       ++p)
+    objects[p->first] = p->second.need;
+
+  for (map<hobject_t, eversion_t>::iterator p = objects.begin(); p != objects.end(); ++p) {
+    const hobject_t& soid = p->first;
+    bool local = false;
+    for (vector<unsigned>::iterator i = moved.begin(); i != moved.end(); ++i) {
+      int o = acting[*i];
+      pg_missing_t& m = *i ? peer_missing[o] : missing;
+      if (m.is_missing(soid))
+	continue;
+      m.add(soid, p->second, p->second);
+      misplaced[o].insert(soid);
+      if (!*i)
+	local = true;
+    }
+    if (local) {
+      // the other shards are where we rebuild our own chunk from
+      for (unsigned i = 1; i < acting.size(); i++) {
+	if (shard_can_read(acting[i], soid)) {
+	  missing_loc[soid].insert(acting[i]);
+	  missing_loc_sources.insert(acting[i]);
+	}
+      }
+    }
+  }
+  dout(10) << "mark_misplaced_objects " << objects.size() << " objects on "
+	   << moved.size() << " shards" << dendl;
+}
+
+/*
+ * only LOST_DELETE: with fewer than k chunks there is no older
+ * version to revert to either.
+ */
+void ErasureCodedPG::mark_all_unfound_lost(int what)
+{
+  dout(3) << __func__ << " " << pg_log_entry_t::get_op_name(what) << dendl;
+  assert(what == pg_log_entry_t::LOST_DELETE);
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+
+  utime_t mtime = ceph_clock_now(g_ceph_context);
+  info.last_update.epoch = get_osdmap()->get_epoch();
+  map<hobject_t, pg_missing_t::item>::iterator m = missing.missing.begin();
+  map<hobject_t, pg_missing_t::item>::iterator mend = missing.missing.end();
+  while (m != mend) {
+    const hobject_t &oid(m->first);
+    if (missing_loc.find(oid) != missing_loc.end()) {
+      // We only care about unfound objects
+      ++m;
+      continue;
+    }
+
+    ++info.last_update.version;
+    pg_log_entry_t e(pg_log_entry_t::LOST_DELETE, oid, info.last_update, m->second.need,
+		     osd_reqid_t(), mtime);
+    log.add(e);
+    dout(10) << e << dendl;
+
+    t->remove(coll, oid);
+    unreadable.erase(oid);
+    missing.rm(m++);
+  }
+
+  if (missing.num_missing() == 0) {
+    // advance last_complete since nothing else is missing!
+    info.last_complete = info.last_update;
+  }
+  write_info(*t);
+  osd->store->queue_transaction(&osr, t, new ObjectStore::C_DeleteTransaction(t));
+
+  osd->requeue_ops(this, waiting_for_all_missing);
+  waiting_for_all_missing.clear();
+
+  // Send out the PG log to all replicas
+  // So that they know what is lost
+  share_pg_log();
+
+  osd->queue_for_recovery(this);
+}
+
+void ErasureCodedPG::on_shutdown()
+{
+  dout(10) << "on_shutdown" << dendl;
+  abort_writes(false);
+}
+
+void ErasureCodedPG::on_activate()
+{
+  for (unsigned i = 1; i<acting.size(); i++) {
+    if (peer_info[acting[i]].last_backfill != hobject_t::get_max()) {
+      assert(backfill_target == -1);
+      backfill_target = acting[i];
+      backfill_pos = peer_info[acting[i]].last_backfill;
+      dout(10) << " chose backfill target osd." << backfill_target
+	       << " from " << backfill_pos << dendl;
+    }
+  }
+}
+
+void ErasureCodedPG::on_change()
+{
+  dout(10) << "on_change" << dendl;
+  abort_writes(is_primary());
+
+  // reads and recovery die with the interval
+  for (map<tid_t, ReadOp*>::iterator p = reads_in_flight.begin();
+       p != reads_in_flight.end();
+       reads_in_flight.erase(p++)) {
+    if (p->second->op)
+      waiting_for_object[p->second->soid].push_front(p->second->op);
+    delete p->second;
+  }
+  recovering.clear();
+  unreadable.clear();
+  busy.clear();
+  backfills_deferred.clear();
+  requeue_object_waiters(waiting_for_object);
+
+  // clear reserved scrub state
+  clear_scrub_reserved();
+
+  // clear scrub state; an unfinished pass resumes from info.scrub_cursor
+  if (scrub_active) {
+    scrub_clear_state();
+  } else if (is_scrubbing()) {
+    state_clear(PG_STATE_SCRUBBING);
+    state_clear(PG_STATE_REPAIR);
+    state_clear(PG_STATE_DEEP_SCRUB);
+  }
+  if (active_rep_scrub) {
+    active_rep_scrub->put();
+    active_rep_scrub = NULL;
+  }
+  finalizing_scrub = false;
+
+  // take object waiters
+  requeue_object_waiters(waiting_for_missing_object);
+  requeue_object_waiters(waiting_for_degraded_object);
+  osd->requeue_ops(this, waiting_for_all_missing);
+  waiting_for_all_missing.clear();
+}
+
+void ErasureCodedPG::on_role_change()
+{
+  dout(10) << "on_role_change" << dendl;
+
+  // take commit waiters
+  for (map<eversion_t, list<OpRequestRef> >::iterator p = waiting_for_ondisk.begin();
+       p != waiting_for_ondisk.end();
+       p++)
+    osd->requeue_ops(this, p->second);
+  waiting_for_ondisk.clear();
+}
+
+// clear state.  called on recovery completion AND cancellation.
+void ErasureCodedPG::_clear_recovery_state()
+{
+  missing_loc.clear();
+  missing_loc_sources.clear();
+  misplaced.clear();
+  backfill_pos = hobject_t();
+  backfills_in_flight.clear();
+  backfills_deferred.clear();
+  pending_backfill_updates.clear();
+}
+
+void ErasureCodedPG::check_recovery_sources(const OSDMapRef osdmap)
+{
+  /*
+   * reads in flight from an osd that went down are retried against
+   * the other shards when the interval changes; here we just forget
+   * it as a source.
+   */
+  set<int> now_down;
+  for (set<int>::iterator p = missing_loc_sources.begin();
+       p != missing_loc_sources.end();
+       ) {
+    if (osdmap->is_up(*p)) {
+      p++;
+      continue;
+    }
+    dout(10) << "check_recovery_sources source osd." << *p << " now down" << dendl;
+    now_down.insert(*p);
+    missing_loc_sources.erase(p++);
+  }
+  if (!now_down.empty()) {
+    map<hobject_t, set<int> >::iterator p = missing_loc.begin();
+    while (p != missing_loc.end()) {
+      set<int>::iterator q = p->second.begin();
+      while (q != p->second.end())
+	if (now_down.count(*q))
+	  p->second.erase(q++);
+	else
+	  q++;
+      if (p->second.empty())
+	missing_loc.erase(p++);
+      else
+	p++;
+    }
+  }
+
+  for (set<int>::iterator i = peer_log_requested.begin();
+       i != peer_log_requested.end();
+       ) {
+    if (!osdmap->is_up(*i)) {
+      dout(10) << "peer_log_requested removing " << *i << dendl;
+      peer_log_requested.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+
+  for (set<int>::iterator i = peer_missing_requested.begin();
+       i != peer_missing_requested.end();
+       ) {
+    if (!osdmap->is_up(*i)) {
+      dout(10) << "peer_missing_requested removing " << *i << dendl;
+      peer_missing_requested.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+}
+
+// ====================
+// scrub
+
+/*
+ * shards hold different chunks, so only compare what every shard
+ * should agree on: size and attrs other than EC_SHARD_ATTR.
+ */
+bool ErasureCodedPG::_compare_scrub_objects(ScrubMap::object &auth,
+					    ScrubMap::object &candidate,
+					    ostream &errorstream)
+{
+  ScrubMap::object a = auth, c = candidate;
+  a.attrs.erase(EC_SHARD_ATTR);
+  c.attrs.erase(EC_SHARD_ATTR);
+  a.digest_present = c.digest_present = false;
+  return PG::_compare_scrub_objects(a, c, errorstream);
+}
+
+/*
+ * a chunk at the wrong position still decodes, but the next write to
+ * the object would leave two copies of one chunk; count it as
+ * inconsistent so repair rebuilds the right one there.
+ */
+void ErasureCodedPG::_compare_scrubmaps(const map<int,ScrubMap*> &maps,
+					map<hobject_t, set<int> > &missing,
+					map<hobject_t, set<int> > &inconsistent,
+					map<hobject_t, int> &authoritative,
+					ostream &errorstream)
+{
+  PG::_compare_scrubmaps(maps, missing, inconsistent, authoritative, errorstream);
+
+  for (map<int, ScrubMap*>::const_iterator j = maps.begin(); j != maps.end(); ++j) {
+    for (map<hobject_t, ScrubMap::object>::iterator i = j->second->objects.begin();
+	 i != j->second->objects.end();
+	 ++i) {
+      int idx = -1;
+      map<string, bufferptr>::iterator a = i->second.attrs.find(EC_SHARD_ATTR);
+      if (a != i->second.attrs.end()) {
+	bufferlist bl;
+	bl.push_back(a->second);
+	bufferlist::iterator p = bl.begin();
+	__u32 v;
+	::decode(v, p);
+	idx = v;
+      }
+      if (idx == j->first)
+	continue;
+      errorstream << info.pgid << " osd." << acting[j->first]
+		  << ": soid " << i->first << " has chunk " << idx
+		  << ", expected " << j->first << std::endl;
+      inconsistent[i->first].insert(j->first);
+      if (!authoritative.count(i->first) ||
+	  authoritative[i->first] == j->first) {
+	for (map<int, ScrubMap*>::const_iterator k = maps.begin(); k != maps.end(); ++k)
+	  if (k->first != j->first && k->second->objects.count(i->first)) {
+	    authoritative[i->first] = k->first;
+	    break;
+	  }
+      }
+    }
+  }
+}
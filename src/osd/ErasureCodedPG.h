@@ -0,0 +1,371 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_ERASURECODEDPG_H
+#define CEPH_ERASURECODEDPG_H
+
+#include "PG.h"
+#include "OSD.h"
+#include "OpRequest.h"
+#include "ErasureCode.h"
+
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+#include "messages/MOSDSubOp.h"
+class MOSDSubOpReply;
+
+/**
+ * ErasureCodedPG - a pg whose objects are striped over its osds
+ *
+ * The osd at acting[i] stores chunk i of every object: chunks 0..k-1
+ * are the data, in stripe_unit pieces (stripe s of the object is unit
+ * s of chunk 0, then unit s of chunk 1, ...), and k..k+m-1 are the
+ * parity computed by the pool's erasure code.  Every chunk carries
+ * the full object_info_t and user xattrs, plus EC_SHARD_ATTR naming
+ * its chunk index, so metadata ops never need to leave the primary
+ * and a chunk that ends up at the wrong position after an acting set
+ * change still decodes correctly.
+ *
+ * Writes replace whole objects: the primary reads what it needs,
+ * applies the ops in memory, re-encodes, and sends each shard a
+ * transaction that rewrites its chunk.  Appends work the same way.
+ * Reads gather any k chunks at the object's current version.  Ops on
+ * one object are handled one at a time.
+ *
+ * Snapshots, omap, watch/notify and class methods are not supported.
+ */
+class ErasureCodedPG : public PG {
+public:
+  /// chunks of one object being collected from the shards
+  struct ReadOp {
+    tid_t tid;
+    hobject_t soid;
+    eversion_t v;                  ///< version every chunk must match
+    uint64_t size;                 ///< logical object size, for client reads
+    set<int> want;                 ///< chunk indices the caller needs
+    bool for_recovery;
+    OpRequestRef op;               ///< client op to run once we have data
+
+    set<int> pending;              ///< osds we're waiting on
+    set<int> tried;                ///< osds we've asked (or read locally)
+    map<int, bufferlist> chunks;   ///< by chunk index
+    map<string, bufferptr> attrs;  ///< from any shard at v
+
+    ReadOp() : tid(0), size(0), for_recovery(false) {}
+  };
+
+  /**
+   * a modification in flight to the shards.  the object stays busy
+   * until every shard has committed and our own chunk is readable.
+   */
+  struct WriteOp {
+    int nref;
+    tid_t tid;
+    hobject_t soid;
+    eversion_t v;
+    OpRequestRef op;
+    MOSDOpReply *reply;
+    eversion_t pg_local_last_complete;
+    set<int> waitfor_disk;
+    bool applied, done, aborted;
+
+    ObjectStore::Transaction local_t, op_t;
+    list<ObjectStore::Transaction*> tls;
+
+    WriteOp() : nref(1), tid(0), reply(NULL),
+		applied(false), done(false), aborted(false) {}
+    ~WriteOp() {
+      if (reply)
+	reply->put();
+    }
+    void get() { nref++; }
+    void put() {
+      assert(nref > 0);
+      if (--nref == 0)
+	delete this;
+    }
+  };
+
+  /// a rebuilt object being written to the shards that lack it
+  struct RecoveryOp {
+    eversion_t v;
+    set<int> pushing;              ///< osds we're waiting on, maybe us
+  };
+
+  struct RepModify {
+    ErasureCodedPG *pg;
+    OpRequestRef op;
+    bool applied, committed;
+    int ackerosd;
+    eversion_t last_complete;
+    ObjectStore::Transaction opt, localt;
+    list<ObjectStore::Transaction*> tls;
+
+    RepModify() : pg(NULL), applied(false), committed(false), ackerosd(-1) {}
+  };
+
+  struct C_EC_OpApplied : public Context {
+    ErasureCodedPG *pg;
+    WriteOp *wop;
+    C_EC_OpApplied(ErasureCodedPG *p, WriteOp *w) : pg(p), wop(w) {
+      wop->get();
+      pg->get();
+    }
+    void finish(int r) {
+      pg->op_applied(wop);
+      pg->put();
+    }
+  };
+  struct C_EC_OpCommit : public Context {
+    ErasureCodedPG *pg;
+    WriteOp *wop;
+    C_EC_OpCommit(ErasureCodedPG *p, WriteOp *w) : pg(p), wop(w) {
+      wop->get();
+      pg->get();
+    }
+    void finish(int r) {
+      pg->op_commit(wop);
+      pg->put();
+    }
+  };
+  struct C_EC_RepModifyApply : public Context {
+    RepModify *rm;
+    C_EC_RepModifyApply(RepModify *r) : rm(r) { }
+    void finish(int r) {
+      rm->pg->sub_op_modify_applied(rm);
+    }
+  };
+  struct C_EC_RepModifyCommit : public Context {
+    RepModify *rm;
+    C_EC_RepModifyCommit(RepModify *r) : rm(r) { }
+    void finish(int r) {
+      rm->pg->sub_op_modify_commit(rm);
+    }
+  };
+  struct C_EC_AppliedRecoveredObject : public Context {
+    ErasureCodedPG *pg;
+    ObjectStore::Transaction *t;
+    hobject_t soid;
+    epoch_t same_since;
+    C_EC_AppliedRecoveredObject(ErasureCodedPG *p, ObjectStore::Transaction *tt,
+				const hobject_t& o, epoch_t ss)
+      : pg(p), t(tt), soid(o), same_since(ss) {
+      pg->get();
+    }
+    void finish(int r) {
+      pg->_applied_recovered_object(t, soid, same_since);
+    }
+  };
+  struct C_EC_CommittedPushedObject : public Context {
+    ErasureCodedPG *pg;
+    epoch_t same_since;
+    eversion_t last_complete;
+    C_EC_CommittedPushedObject(ErasureCodedPG *p, epoch_t ss, eversion_t lc)
+      : pg(p), same_since(ss), last_complete(lc) {
+      pg->get();
+    }
+    void finish(int r) {
+      pg->_committed_pushed_object(same_since, last_complete);
+    }
+  };
+
+protected:
+  ErasureCodeInterface *codec;
+
+  /// objects with an op or recovery in flight, and who's waiting on them
+  set<hobject_t> busy;
+  map<hobject_t, list<OpRequestRef> > waiting_for_object;
+
+  map<tid_t, ReadOp*> reads_in_flight;
+  map<tid_t, WriteOp*> writes_in_flight;
+  map<hobject_t, RecoveryOp> recovering;
+  set<hobject_t> unreadable;   ///< too few shards to rebuild; retried next interval
+
+  /*
+   * chunks are rewritten in place, so before each write a shard stashes
+   * the chunk it replaces in the rollback collection.  if peering then
+   * drops the write (fewer than k shards have it) the shard puts the
+   * stash back instead of waiting on recovery that can't decode it.
+   * stashes go once every shard has committed the write, or when the
+   * pg next goes active.
+   */
+  map<eversion_t, hobject_t> rollback_stashes;  ///< write -> stash
+
+  coll_t get_rollback_coll() const { return coll_t(info.pgid, CEPH_SNAPDIR); }
+  /// where the version of @soid that the write at @v replaced is kept
+  static hobject_t get_rollback_stash(const hobject_t& soid, eversion_t v) {
+    hobject_t stash = soid;
+    stash.snap = v.version;
+    return stash;
+  }
+  void stash_prior_versions(ObjectStore::Transaction& t,
+			    vector<pg_log_entry_t>& entries);
+  void trim_rollback_stashes(ObjectStore::Transaction& t, eversion_t to);
+
+  /*
+   * chunk i lives on acting[i], so when the acting set shifts an osd
+   * may be left holding chunks of another position.  they still decode
+   * (each chunk knows its index) but must be rebuilt in place; these
+   * objects are also in that osd's missing set until they are.
+   */
+  map<int, set<hobject_t> > misplaced;  ///< osd -> objects
+
+  /*
+   * backfill, as in ReplicatedPG: objects between last_backfill and
+   * backfill_pos are on the peer or in backfills_in_flight.  objects
+   * that were busy when backfill reached them are rebuilt once the op
+   * holding them finishes.
+   */
+  set<hobject_t> backfills_in_flight;
+  set<hobject_t> backfills_deferred;
+  map<hobject_t, pg_stat_t> pending_backfill_updates;
+  hobject_t backfill_pos;
+
+  unsigned get_k() const { return codec->get_data_chunk_count(); }
+  unsigned get_chunk_count() const { return codec->get_chunk_count(); }
+  uint64_t get_stripe_unit() const { return pool->info.get_stripe_unit(); }
+
+  /// length of each chunk of an object of @size bytes
+  uint64_t get_chunk_size(uint64_t size) const;
+  /// split @data into k chunks laid out by stripe, and encode them
+  void encode_object(bufferlist& data, map<int, bufferlist> *chunks);
+  /// inverse of encode_object, for an object of @size bytes
+  int decode_object(map<int, bufferlist>& chunks, uint64_t size,
+		    bufferlist *data);
+
+  bool is_missing_object(const hobject_t& soid);
+  bool is_degraded_object(const hobject_t& soid);
+  bool shard_has_object(int osd, const hobject_t& soid);
+  bool shard_can_read(int osd, const hobject_t& soid);
+  void got_misplaced(int osd, const hobject_t& soid);
+  int get_object_state(const hobject_t& soid, object_info_t *oi,
+		       map<string, bufferptr> *attrs);
+  int read_chunk(const hobject_t& soid, int *idx, bufferlist *data,
+		 map<string, bufferptr> *attrs);
+
+  bool start_busy(const hobject_t& soid, OpRequestRef op);
+  void finish_busy(const hobject_t& soid);
+
+  // client ops
+  void do_pg_op(OpRequestRef op);
+  bool ops_need_data(MOSDOp *m);
+  void execute_ops(OpRequestRef op, const hobject_t& soid, bufferlist& data);
+
+  // reads
+  void start_read(ReadOp *rop);
+  bool send_reads(ReadOp *rop);
+  void add_chunk(ReadOp *rop, int from, int idx, bufferlist& data,
+		 map<string, bufferptr>& attrs);
+  void handle_chunk_reply(OpRequestRef op);
+  void finish_read(ReadOp *rop);
+  void sub_op_ec_read(OpRequestRef op);
+
+  // writes
+  void issue_write(WriteOp *wop, MOSDOp *m, vector<pg_log_entry_t>& log_entries,
+		   vector<ObjectStore::Transaction>& shard_t);
+  void eval_write(WriteOp *wop);
+  void op_applied(WriteOp *wop);
+  void op_commit(WriteOp *wop);
+  void abort_writes(bool requeue);
+
+  void sub_op_modify(OpRequestRef op);
+  void sub_op_modify_applied(RepModify *rm);
+  void sub_op_modify_commit(RepModify *rm);
+  void sub_op_modify_reply(OpRequestRef op);
+
+  // recovery
+  int recover_objects(int max);
+  bool recover_object(const hobject_t& soid, eversion_t v);
+  void finish_recovery_read(ReadOp *rop);
+  void sub_op_push(OpRequestRef op);
+  void sub_op_push_reply(OpRequestRef op);
+  void sub_op_remove(OpRequestRef op);
+  void finish_recovered_object(const hobject_t& soid);
+  void _applied_recovered_object(ObjectStore::Transaction *t, const hobject_t& soid,
+				 epoch_t same_since);
+  void _committed_pushed_object(epoch_t same_since, eversion_t last_complete);
+
+  int recover_backfill(int max);
+  void push_backfill_object(const hobject_t& soid);
+  void send_remove_op(const hobject_t& oid, eversion_t v, int peer);
+  void scan_range(hobject_t begin, int min, int max, BackfillInterval *bi);
+
+  // scrub
+  bool _compare_scrub_objects(ScrubMap::object &auth,
+			      ScrubMap::object &candidate,
+			      ostream &errorstream);
+  void _compare_scrubmaps(const map<int,ScrubMap*> &maps,
+			  map<hobject_t, set<int> > &missing,
+			  map<hobject_t, set<int> > &inconsistent,
+			  map<hobject_t, int> &authoritative,
+			  ostream &errorstream);
+
+public:
+  ErasureCodedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid);
+  ~ErasureCodedPG();
+
+  int do_command(vector<string>& cmd, ostream& ss,
+		 bufferlist& idata, bufferlist& odata);
+
+  void do_op(OpRequestRef op);
+  void do_sub_op(OpRequestRef op);
+  void do_sub_op_reply(OpRequestRef op);
+  void do_scan(OpRequestRef op);
+  void do_backfill(OpRequestRef op);
+  bool snap_trimmer();
+
+  bool same_for_read_since(epoch_t e);
+  bool same_for_modify_since(epoch_t e);
+  bool same_for_rep_modify_since(epoch_t e);
+
+  void calc_trim_to();
+  unsigned min_peers_for_update() const { return get_k(); }
+  bool rolls_back_divergent_entries() const { return true; }
+  void rollback_divergent_entries(ObjectStore::Transaction& t,
+				  list<pg_log_entry_t>& divergent);
+  void clean_up_local(ObjectStore::Transaction& t);
+  int find_chunk_position(int osd);
+  void mark_misplaced_objects();
+  int start_recovery_ops(int max, RecoveryCtx *prctx);
+  void _clear_recovery_state();
+  void check_recovery_sources(const OSDMapRef newmap);
+  void mark_all_unfound_lost(int how);
+
+  void on_role_change();
+  void on_change();
+  void on_activate();
+  void on_shutdown();
+
+  // no watchers on erasure coded objects
+  void remove_watchers_and_notifies() {}
+  void clear_context_cache() {}
+  bool evict_oldest_context() { return false; }
+  void register_unconnected_watcher(void *obc, entity_name_t entity,
+				    utime_t expire) {}
+  void unregister_unconnected_watcher(void *obc, entity_name_t entity) {}
+  void handle_watch_timeout(void *obc, entity_name_t entity,
+			    utime_t expire) {}
+};
+
+inline ostream& operator<<(ostream& out, const ErasureCodedPG::WriteOp& wop)
+{
+  out << "ecwrite(" << wop.soid << " v " << wop.v << " tid " << wop.tid
+      << " wfdisk=" << wop.waitfor_disk;
+  if (wop.applied)
+    out << " applied";
+  if (wop.aborted)
+    out << " aborted";
+  return out << ")";
+}
+
+#endif
@@ -38,6 +38,7 @@
 #include "os/FileJournal.h"
 
 #include "ReplicatedPG.h"
+#include "ErasureCodedPG.h"
 
 #include "Ager.h"
 
@@ -85,6 +86,8 @@
 #include "messages/MPGStatsAck.h"
 
 #include "messages/MWatchNotify.h"
+#include "messages/MWatchNotifyBatch.h"
+#include "messages/MOSDOpBatch.h"
 
 #include "common/perf_counters.h"
 #include "common/Timer.h"
@@ -634,6 +637,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads),
   disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
+  map_advance_tp(external_messenger->cct, "OSD::map_advance_tp", g_conf->osd_map_advance_threads),
   heartbeat_lock("OSD::heartbeat_lock"),
   heartbeat_stop(false), heartbeat_need_update(true), heartbeat_epoch(0),
   hbclient_messenger(hbclientm),
@@ -643,16 +647,23 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
+  op_sched(NULL),
   op_queue_len(0),
   op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
+  map_activated(false),
+  oldest_map_epoch(0),
+  pg_epoch_lock("OSD::pg_epoch_lock"),
   map_cache_lock("OSD::map_cache_lock"),
   map_cache(g_conf->osd_map_cache_size),
   map_bl_cache(g_conf->osd_map_cache_bl_size),
   map_bl_inc_cache(g_conf->osd_map_cache_bl_inc_size),
+  pg_map_lock("OSD::pg_map_lock"),
+  mon_report_lock("OSD::mon_report_lock"),
   outstanding_pg_stats(false),
   up_thru_wanted(0), up_thru_pending(0),
+  pg_temp_lock("OSD::pg_temp_lock"),
   pg_stat_queue_lock("OSD::pg_stat_queue_lock"),
   osd_stat_updated(false),
   pg_stat_tid(0), pg_stat_tid_flushed(0),
@@ -663,21 +674,39 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   recovery_wq(this, g_conf->osd_recovery_thread_timeout, &recovery_tp),
   remove_list_lock("OSD::remove_list_lock"),
   replay_queue_lock("OSD::replay_queue_lock"),
+  snap_trim_budget_lock("OSD::snap_trim_budget_lock"),
+  snap_trim_timer_lock("OSD::snap_trim_timer_lock"),
+  snap_trim_timer(external_messenger->cct, snap_trim_timer_lock),
+  snap_trim_kick(NULL),
   snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &disk_tp),
   sched_scrub_lock("OSD::sched_scrub_lock"),
   scrubs_pending(0),
   scrubs_active(0),
+  context_cache_lock("OSD::context_cache_lock"),
   scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
-  scrub_finalize_wq(this, g_conf->osd_scrub_finalize_thread_timeout, &op_tp),
   rep_scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
   remove_wq(this, g_conf->osd_remove_thread_timeout, &disk_tp),
+  next_removal_seq(0),
+  removal_osr("removal"),
+  reap_wq(this, g_conf->osd_remove_thread_timeout, &disk_tp),
+  map_advance_wq(this, g_conf->osd_op_thread_timeout, &map_advance_tp),
   watch_lock("OSD::watch_lock"),
-  watch_timer(external_messenger->cct, watch_lock)
+  watch_timer(external_messenger->cct, watch_lock),
+  notify_queue_lock("OSD::notify_queue_lock"),
+  notify_stop(false),
+  notify_thread(this)
 {
   monc->set_messenger(client_messenger);
 
   map_in_progress_cond = new Cond();
-  
+
+  op_sched = OpSched::create(g_conf->osd_op_scheduler);
+  if (!op_sched) {
+    derr << "unknown osd_op_scheduler '" << g_conf->osd_op_scheduler
+	 << "', using fifo" << dendl;
+    op_sched = OpSched::create("fifo");
+  }
+  update_op_sched();
 }
 
 OSD::~OSD()
@@ -685,6 +714,7 @@ OSD::~OSD()
   delete authorize_handler_registry;
   delete map_in_progress_cond;
   delete class_handler;
+  delete op_sched;
   g_ceph_context->get_perfcounters_collection()->remove(logger);
   delete logger;
   delete store;
@@ -725,7 +755,12 @@ public:
   OpsFlightSocketHook(OSD *o) : osd(o) {}
   bool call(std::string command, std::string args, bufferlist& out) {
     stringstream ss;
-    osd->dump_ops_in_flight(ss);
+    if (command == "dump_op_scheduler")
+      osd->dump_op_sched(ss);
+    else if (command == "dump_pg_removal")
+      osd->dump_pg_removal(ss);
+    else
+      osd->dump_ops_in_flight(ss);
     out.append(ss);
     return true;
   }
@@ -737,6 +772,9 @@ int OSD::init()
 
   timer.init();
   watch_timer.init();
+  snap_trim_timer_lock.Lock();
+  snap_trim_timer.init();
+  snap_trim_timer_lock.Unlock();
   watch = new Watch();
 
   // mount.
@@ -771,6 +809,7 @@ int OSD::init()
     return -EINVAL;
   }
   osdmap = get_map(superblock.current_epoch);
+  oldest_map_epoch = superblock.oldest_map;
 
   bind_epoch = osdmap->get_epoch();
 
@@ -820,10 +859,13 @@ int OSD::init()
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
+  map_advance_tp.start();
 
   // start the heartbeat
   heartbeat_thread.create();
 
+  notify_thread.create();
+
   // tick
   timer.add_event_after(g_conf->osd_heartbeat_interval, new C_Tick(this));
 
@@ -841,6 +883,14 @@ int OSD::init()
   r = admin_socket->register_command("dump_ops_in_flight", admin_ops_hook,
                                          "show the ops currently in flight");
   assert(r == 0);
+  r = admin_socket->register_command("dump_op_scheduler", admin_ops_hook,
+				     "show op scheduler shares and queues");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_pg_removal", admin_ops_hook,
+				     "show removed pg collections still being reaped");
+  assert(r == 0);
+
+  g_ceph_context->_conf->add_observer(this);
 
   return 0;
 }
@@ -853,6 +903,7 @@ void OSD::create_logger()
 
   osd_plb.add_u64(l_osd_opq, "opq");       // op queue length (waiting to be processed yet)
   osd_plb.add_u64(l_osd_op_wip, "op_wip");   // rep ops currently being processed (primary)
+  osd_plb.add_u64_counter(l_osd_op_fast, "op_fast_dispatch");   // ops queued without osd_lock
 
   osd_plb.add_u64_counter(l_osd_op,       "op");           // client ops
   osd_plb.add_u64_counter(l_osd_op_inb,   "op_in_bytes");       // client op in bytes (writes)
@@ -862,6 +913,8 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
   osd_plb.add_fl_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_u64_counter(l_osd_op_r_replica, "op_r_replica");  // client reads served as a replica
+  osd_plb.add_u64_counter(l_osd_op_r_bounce, "op_r_bounce");    // replica reads sent back to the primary
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_fl_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
@@ -891,6 +944,30 @@ void OSD::create_logger()
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  // op scheduler, per class: queued in op_wq, dequeued or admitted, queue wait
+  osd_plb.add_u64(l_osd_opq_client, "opq_client");
+  osd_plb.add_u64(l_osd_opq_recovery, "opq_recovery");
+  osd_plb.add_u64(l_osd_opq_scrub, "opq_scrub");
+  osd_plb.add_u64(l_osd_opq_snaptrim, "opq_snaptrim");
+  osd_plb.add_u64(l_osd_opq_removal, "opq_removal");
+  osd_plb.add_u64_counter(l_osd_sched_client, "sched_client");
+  osd_plb.add_u64_counter(l_osd_sched_recovery, "sched_recovery");
+  osd_plb.add_u64_counter(l_osd_sched_scrub, "sched_scrub");
+  osd_plb.add_u64_counter(l_osd_sched_snaptrim, "sched_snaptrim");
+  osd_plb.add_u64_counter(l_osd_sched_removal, "sched_removal");
+  osd_plb.add_fl_avg(l_osd_sched_client_wait, "sched_client_wait");
+  osd_plb.add_fl_avg(l_osd_sched_recovery_wait, "sched_recovery_wait");
+  osd_plb.add_fl_avg(l_osd_sched_scrub_wait, "sched_scrub_wait");
+  osd_plb.add_fl_avg(l_osd_sched_snaptrim_wait, "sched_snaptrim_wait");
+  osd_plb.add_fl_avg(l_osd_sched_removal_wait, "sched_removal_wait");
+
+  // object/snapset context lookups served from the pg cache or from disk
+  osd_plb.add_u64_counter(l_osd_obc_hit, "object_ctx_cache_hit");
+  osd_plb.add_u64_counter(l_osd_obc_miss, "object_ctx_cache_miss");
+  osd_plb.add_u64_counter(l_osd_ssc_hit, "snapset_ctx_cache_hit");
+  osd_plb.add_u64_counter(l_osd_ssc_miss, "snapset_ctx_cache_miss");
+  osd_plb.add_u64(l_osd_ctx_cached, "ctx_cached");   // idle contexts cached
+
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -898,6 +975,10 @@ void OSD::create_logger()
   osd_plb.add_u64(l_osd_pg_primary, "numpg_primary"); // num primary pgs
   osd_plb.add_u64(l_osd_pg_replica, "numpg_replica"); // num replica pgs
   osd_plb.add_u64(l_osd_pg_stray, "numpg_stray");   // num stray pgs
+  osd_plb.add_u64(l_osd_pg_removing, "numpg_removing");   // removed pg collections not yet reaped
+  osd_plb.add_u64_counter(l_osd_pg_removed_objects, "pg_removed_objects");  // objects reaped from them
+  osd_plb.add_u64_counter(l_osd_notify_batches, "notify_batches");  // watch notify batches sent
+  osd_plb.add_u64_counter(l_osd_notify_batched, "notify_batched");  // notifies sent in them
   osd_plb.add_u64(l_osd_hb_to, "heartbeat_to_peers");     // heartbeat peers we send to
   osd_plb.add_u64(l_osd_hb_from, "heartbeat_from_peers"); // heartbeat peers we recv from
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
@@ -906,6 +987,7 @@ void OSD::create_logger()
 
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
+  logger->set(l_osd_pg_removing, reap_queue.size());
 }
 
 void OSD::suicide(int exitcode)
@@ -920,6 +1002,7 @@ void OSD::suicide(int exitcode)
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
+  map_advance_tp.pause();
 
   derr << " flushing io" << dendl;
   store->sync_and_flush();
@@ -949,6 +1032,12 @@ int OSD::shutdown()
   watch_timer.shutdown();
   watch_lock.Unlock();
 
+  notify_queue_lock.Lock();
+  notify_stop = true;
+  notify_queue_cond.Signal();
+  notify_queue_lock.Unlock();
+  notify_thread.join();
+
   heartbeat_lock.Lock();
   heartbeat_stop = true;
   heartbeat_cond.Signal();
@@ -956,12 +1045,18 @@ int OSD::shutdown()
   heartbeat_thread.join();
 
   command_tp.stop();
+  map_advance_tp.stop();
+  dout(10) << "map advance tp stopped" << dendl;
 
   // finish ops
   op_wq.drain();
   dout(10) << "no ops" << dendl;
 
+  g_ceph_context->_conf->remove_observer(this);
+
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_op_scheduler");
+  cct->get_admin_socket()->unregister_command("dump_pg_removal");
   delete admin_ops_hook;
   admin_ops_hook = NULL;
 
@@ -988,6 +1083,11 @@ int OSD::shutdown()
   // then stop thread.
   disk_tp.stop();
   dout(10) << "disk tp stopped" << dendl;
+  snap_trim_timer_lock.Lock();
+  snap_trim_timer.shutdown();
+  snap_trim_kick = NULL;
+  snap_trim_timer_lock.Unlock();
+  reap_wq.clear();  // load_pgs finds what's left next time
 
   // tell pgs we're shutting down
   for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
@@ -1033,6 +1133,7 @@ int OSD::shutdown()
   clear_pg_stat_queue();
 
   // close pgs
+  pg_map_lock.get_write();
   for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
        p != pg_map.end();
        p++) {
@@ -1040,6 +1141,7 @@ int OSD::shutdown()
     pg->put();
   }
   pg_map.clear();
+  pg_map_lock.put_write();
 
   client_messenger->shutdown();
   cluster_messenger->shutdown();
@@ -1178,7 +1280,7 @@ void OSD::_put_pool(PGPool *p)
   }
 }
 
-PG *OSD::_open_lock_pg(pg_t pgid, bool no_lockdep_check, bool hold_map_lock)
+PG *OSD::_open_lock_pg(pg_t pgid, bool no_lockdep_check)
 {
   assert(osd_lock.is_locked());
 
@@ -1192,21 +1294,25 @@ PG *OSD::_open_lock_pg(pg_t pgid, bool no_lockdep_check, bool hold_map_lock)
   hobject_t infooid = make_pg_biginfo_oid(pgid);
   if (osdmap->get_pg_type(pgid) == pg_pool_t::TYPE_REP)
     pg = new ReplicatedPG(this, pool, pgid, logoid, infooid);
+  else if (osdmap->get_pg_type(pgid) == pg_pool_t::TYPE_ERASURE)
+    pg = new ErasureCodedPG(this, pool, pgid, logoid, infooid);
   else 
     assert(0);
 
   assert(pg_map.count(pgid) == 0);
+  pg_map_lock.get_write();
   pg_map[pgid] = pg;
+  pg_map_lock.put_write();
 
-  if (hold_map_lock)
-    pg->lock_with_map_lock_held(no_lockdep_check);
-  else
-    pg->lock(no_lockdep_check);
+  pg->lock(no_lockdep_check);
   pg->get();  // because it's in pg_map
+  pg->update_osdmap_ref(osdmap);
+  pg->oldest_map = oldest_map_epoch;
+  pg_role_count(pg->get_role()).inc();
   return pg;
 }
 
-PG *OSD::_create_lock_pg(pg_t pgid, bool newly_created, bool hold_map_lock,
+PG *OSD::_create_lock_pg(pg_t pgid, bool newly_created,
 			 int role, vector<int>& up, vector<int>& acting, pg_history_t history,
 			 pg_interval_map_t& pi,
 			 ObjectStore::Transaction& t)
@@ -1214,7 +1320,9 @@ PG *OSD::_create_lock_pg(pg_t pgid, bool newly_created, bool hold_map_lock,
   assert(osd_lock.is_locked());
   dout(20) << "_create_lock_pg pgid " << pgid << dendl;
 
-  PG *pg = _open_lock_pg(pgid, true, hold_map_lock);
+  finish_reaping(pgid);
+
+  PG *pg = _open_lock_pg(pgid, true);
 
   assert(!store->collection_exists(coll_t(pgid)));
   t.create_collection(coll_t(pgid));
@@ -1248,15 +1356,7 @@ PG *OSD::_lookup_lock_pg(pg_t pgid)
     return NULL;
   PG *pg = pg_map[pgid];
   pg->lock();
-  return pg;
-}
-
-PG *OSD::_lookup_lock_pg_with_map_lock_held(pg_t pgid)
-{
-  assert(osd_lock.is_locked());
-  assert(pg_map.count(pgid));
-  PG *pg = pg_map[pgid];
-  pg->lock_with_map_lock_held();
+  advance_pg(pg, oldest_map_epoch);
   return pg;
 }
 
@@ -1274,12 +1374,58 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * Reads pg state for load_pgs() from several threads at once.  Each
+ * item is a pg that is already in pg_map; nothing else can look at it
+ * until load_pgs() returns.
+ */
+struct LoadPGWQ : public ThreadPool::WorkQueue<PG> {
+  ObjectStore *store;
+  bool lazy;
+  list<PG*> pgs;
+  LoadPGWQ(ObjectStore *s, bool l, time_t ti, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGWQ", ti, 0, tp),
+      store(s), lazy(l) {}
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    pgs.remove(pg);
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  bool _empty() {
+    return pgs.empty();
+  }
+  void _process(PG *pg) {
+    pg->lock();
+    pg->read_state(store, lazy);
+    pg->unlock();
+  }
+  void _clear() {
+    assert(pgs.empty());
+  }
+};
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
   dout(10) << "load_pgs" << dendl;
   assert(pg_map.empty());
 
+  bool lazy = g_conf->osd_load_pgs_lazy;
+  ThreadPool load_tp(g_ceph_context, "OSD::load_tp",
+		     MAX(g_conf->osd_load_pgs_threads, 1));
+  LoadPGWQ load_wq(store, lazy, g_conf->osd_op_thread_timeout, &load_tp);
+  load_tp.start();
+  vector<PG*> loaded;
+
   vector<coll_t> ls;
   int r = store->list_collections(ls);
   if (r < 0) {
@@ -1291,6 +1437,14 @@ void OSD::load_pgs()
        it++) {
     pg_t pgid;
     snapid_t snap;
+    uint64_t seq;
+    if (it->is_removal(&seq, &pgid)) {
+      if (seq >= next_removal_seq)
+	next_removal_seq = seq + 1;
+      dout(10) << "load_pgs resuming removal of " << *it << dendl;
+      queue_removal_coll(*it);
+      continue;
+    }
     if (!it->is_pg(pgid, snap)) {
       if (it->is_temp(pgid))
 	clear_temp(store, *it);
@@ -1316,14 +1470,28 @@ void OSD::load_pgs()
     }
 
     PG *pg = _open_lock_pg(pgid);
+    pg->unlock();
 
     // read pg state, log
-    pg->read_state(store);
+    loaded.push_back(pg);
+    load_wq.queue(pg);
+  }
+
+  load_wq.drain();
+  load_tp.stop();
+  dout(10) << "load_pgs read " << loaded.size() << " pgs"
+	   << (lazy ? ", deferring logs" : "") << dendl;
+
+  for (vector<PG*>::iterator it = loaded.begin();
+       it != loaded.end();
+       ++it) {
+    PG *pg = *it;
+    pg->lock();
 
     reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
     // generate state for current mapping
-    osdmap->pg_to_up_acting_osds(pgid, pg->up, pg->acting);
+    osdmap->pg_to_up_acting_osds(pg->info.pgid, pg->up, pg->acting);
     int role = osdmap->calc_pg_role(whoami, pg->acting);
     pg->set_role(role);
 
@@ -1332,6 +1500,10 @@ void OSD::load_pgs()
 
     dout(10) << "load_pgs loaded " << *pg << " " << pg->log << dendl;
     pg->unlock();
+
+    // map_advance_tp reads deferred logs once it starts, off osd_lock
+    if (lazy)
+      map_advance_wq.queue(pg);
   }
   dout(10) << "load_pgs done" << dendl;
 }
@@ -1391,7 +1563,7 @@ PG *OSD::get_or_create_pg(const pg_info_t& info, pg_interval_map_t& pi,
     // ok, create PG locally using provided Info and History
     *pt = new ObjectStore::Transaction;
     *pfin = new C_Contexts(g_ceph_context);
-    pg = _create_lock_pg(info.pgid, create, false, role, up, acting, history, pi, **pt);
+    pg = _create_lock_pg(info.pgid, create, role, up, acting, history, pi, **pt);
       
     created++;
     dout(10) << *pg << " is new" << dendl;
@@ -1819,6 +1991,10 @@ void OSD::tick()
   dout(5) << "tick" << dendl;
 
   logger->set(l_osd_buf, buffer::get_total_alloc());
+  logger->set(l_osd_pg, pg_map.size());
+  logger->set(l_osd_pg_primary, num_pg_primary.read());
+  logger->set(l_osd_pg_replica, num_pg_replica.read());
+  logger->set(l_osd_pg_stray, num_pg_stray.read());
 
   // periodically kick recovery work queue
   recovery_tp.kick();
@@ -1839,11 +2015,14 @@ void OSD::tick()
 
   // mon report?
   utime_t now = ceph_clock_now(g_ceph_context);
+  mon_report_lock.Lock();
+  utime_t last_report = last_mon_report;
+  mon_report_lock.Unlock();
   if (now - last_pg_stats_sent > g_conf->osd_mon_report_interval_max) {
     osd_stat_updated = true;
     do_mon_report();
   }
-  else if (now - last_mon_report > g_conf->osd_mon_report_interval_min) {
+  else if (now - last_report > g_conf->osd_mon_report_interval_min) {
     do_mon_report();
   }
 
@@ -1913,7 +2092,9 @@ void OSD::do_mon_report()
   dout(7) << "do_mon_report" << dendl;
 
   utime_t now(ceph_clock_now(g_ceph_context));
+  mon_report_lock.Lock();
   last_mon_report = now;
+  mon_report_lock.Unlock();
 
   // do any pending reports
   send_alive();
@@ -2051,6 +2232,128 @@ bool OSD::ms_handle_reset(Connection *con)
   return true;
 }
 
+void OSD::queue_notify_fanout(NotifyFanout *f)
+{
+  Mutex::Locker l(notify_queue_lock);
+  if ((f->targets.empty() && f->watchers.empty()) || notify_stop) {
+    for (unsigned i = 0; i < f->targets.size(); i++)
+      f->targets[i].first->put();
+    delete f;
+    return;
+  }
+  notify_queue.push_back(f);
+  notify_queue_cond.Signal();
+}
+
+void OSD::notify_entry()
+{
+  notify_queue_lock.Lock();
+  while (!notify_stop) {
+    if (notify_queue.empty()) {
+      notify_queue_cond.Wait(notify_queue_lock);
+      continue;
+    }
+    list<NotifyFanout*> q;
+    q.swap(notify_queue);
+    notify_queue_lock.Unlock();
+    resolve_notify_fanouts(q);
+    send_notify_fanouts(q);
+    notify_queue_lock.Lock();
+  }
+
+  // shutting down; nobody will hear these
+  for (list<NotifyFanout*>::iterator p = notify_queue.begin();
+       p != notify_queue.end();
+       ++p) {
+    for (unsigned i = 0; i < (*p)->targets.size(); i++)
+      (*p)->targets[i].first->put();
+    delete *p;
+  }
+  notify_queue.clear();
+  notify_queue_lock.Unlock();
+}
+
+/*
+ * turn watcher names into connections.  a notify that completed or
+ * timed out since it was queued is gone from watch; a watcher that has
+ * acked (say, by unwatching) or isn't connected is skipped, the latter
+ * gets it when it reconnects.
+ */
+void OSD::resolve_notify_fanouts(list<NotifyFanout*>& q)
+{
+  Mutex::Locker l(watch_lock);
+  for (list<NotifyFanout*>::iterator p = q.begin(); p != q.end(); ++p) {
+    NotifyFanout *f = *p;
+    if (f->watchers.empty())
+      continue;
+    Watch::Notification *notif = watch->get_notif(f->notify_id);
+    if (!notif) {
+      f->watchers.clear();
+      continue;
+    }
+    ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)notif->obc;
+    assert(obc);
+    for (unsigned i = 0; i < f->watchers.size(); i++) {
+      entity_name_t& name = f->watchers[i].first;
+      if (!notif->is_pending(name))
+	continue;
+      map<entity_name_t, Session*>::iterator s = obc->watchers.find(name);
+      if (s == obc->watchers.end())
+	continue;
+      s->second->add_notif(notif, name);
+      f->add_target(s->second->con, f->watchers[i].second);
+    }
+    f->watchers.clear();
+  }
+}
+
+void OSD::send_notify_fanouts(list<NotifyFanout*>& q)
+{
+  // group by connection, keeping each connection's notifies in order
+  map<Connection*, list<Message*> > by_con;
+  unsigned n = 0;
+  for (list<NotifyFanout*>::iterator p = q.begin(); p != q.end(); ++p) {
+    NotifyFanout *f = *p;
+    for (unsigned i = 0; i < f->targets.size(); i++) {
+      Connection *con = f->targets[i].first;
+      list<Message*>& ls = by_con[con];
+      if (!ls.empty())
+	con->put();   // by_con already holds a ref
+      ls.push_back(new MWatchNotify(f->targets[i].second, f->ver, f->notify_id,
+				    f->opcode, f->bl));
+      n++;
+    }
+    delete f;
+  }
+  dout(20) << "send_notify_fanouts " << n << " notifies to " << by_con.size()
+	   << " connections" << dendl;
+
+  unsigned max = MAX(g_conf->osd_notify_batch_max, 1);
+  for (map<Connection*, list<Message*> >::iterator p = by_con.begin();
+       p != by_con.end();
+       ++p) {
+    Connection *con = p->first;
+    list<Message*>& ls = p->second;
+    if (ls.size() == 1 || max == 1 ||
+	!con->has_feature(CEPH_FEATURE_WATCH_NOTIFY_BATCH)) {
+      for (list<Message*>::iterator m = ls.begin(); m != ls.end(); ++m)
+	client_messenger->send_message(*m, con);
+    } else {
+      while (!ls.empty()) {
+	MWatchNotifyBatch *b = new MWatchNotifyBatch;
+	while (!ls.empty() && b->notifies.size() < max) {
+	  b->notifies.push_back(ls.front());
+	  ls.pop_front();
+	}
+	logger->inc(l_osd_notify_batches);
+	logger->inc(l_osd_notify_batched, b->notifies.size());
+	client_messenger->send_message(b, con);
+      }
+    }
+    con->put();
+  }
+}
+
 void OSD::handle_notify_timeout(void *_notif)
 {
   assert(watch_lock.is_locked());
@@ -2135,6 +2438,7 @@ void OSD::send_boot()
 
 void OSD::queue_want_up_thru(epoch_t want)
 {
+  Mutex::Locker l(mon_report_lock);
   epoch_t cur = osdmap->get_up_thru(whoami);
   if (want > up_thru_wanted) {
     dout(10) << "queue_want_up_thru now " << want << " (was " << up_thru_wanted << ")" 
@@ -2144,7 +2448,7 @@ void OSD::queue_want_up_thru(epoch_t want)
 
     // expedite, a bit.  WARNING this will somewhat delay other mon queries.
     last_mon_report = ceph_clock_now(g_ceph_context);
-    send_alive();
+    _send_alive();
   } else {
     dout(10) << "queue_want_up_thru want " << want << " <= queued " << up_thru_wanted 
 	     << ", currently " << cur
@@ -2154,6 +2458,13 @@ void OSD::queue_want_up_thru(epoch_t want)
 
 void OSD::send_alive()
 {
+  Mutex::Locker l(mon_report_lock);
+  _send_alive();
+}
+
+void OSD::_send_alive()
+{
+  assert(mon_report_lock.is_locked());
   if (!osdmap->exists(whoami))
     return;
   epoch_t up_thru = osdmap->get_up_thru(whoami);
@@ -2167,11 +2478,19 @@ void OSD::send_alive()
 
 void OSD::queue_want_pg_temp(pg_t pgid, vector<int>& want)
 {
+  Mutex::Locker l(pg_temp_lock);
   pg_temp_wanted[pgid] = want;
 }
 
+void OSD::remove_want_pg_temp(pg_t pgid)
+{
+  Mutex::Locker l(pg_temp_lock);
+  pg_temp_wanted.erase(pgid);
+}
+
 void OSD::send_pg_temp()
 {
+  Mutex::Locker l(pg_temp_lock);
   if (pg_temp_wanted.empty())
     return;
   dout(10) << "send_pg_temp " << pg_temp_wanted << dendl;
@@ -2699,6 +3018,14 @@ bool OSD::heartbeat_dispatch(Message *m)
 
 bool OSD::ms_dispatch(Message *m)
 {
+  if (m->get_type() == MSG_OSD_OP_BATCH) {
+    handle_op_batch(static_cast<MOSDOpBatch*>(m));
+    return true;
+  }
+
+  if (fast_dispatch(m))
+    return true;
+
   // lock!
   osd_lock.Lock();
   while (dispatch_running) {
@@ -2710,6 +3037,7 @@ bool OSD::ms_dispatch(Message *m)
   do_waiters();
   _dispatch(m);
   do_waiters();
+  update_fast_dispatch_safe();
 
   dispatch_running = false;
   dispatch_cond.Signal();
@@ -2718,6 +3046,179 @@ bool OSD::ms_dispatch(Message *m)
   return true;
 }
 
+/*
+ * unpack a client's batch and dispatch each op, in order, as if it had
+ * arrived on its own.  the ops reply individually.
+ */
+void OSD::handle_op_batch(MOSDOpBatch *m)
+{
+  dout(15) << "handle_op_batch " << *m << " from " << m->get_source_inst() << dendl;
+
+  // each op takes its share of the batch's policy throttle with it, so
+  // those bytes stay reserved until the op itself is done
+  Throttle *throttler = m->get_throttler();
+  uint64_t reserved = m->get_payload().length() + m->get_middle().length() +
+    m->get_data().length();
+  uint64_t moved = 0;
+
+  while (!m->ops.empty()) {
+    Message *op = m->ops.front();
+    m->ops.pop_front();
+    if (op->get_type() != CEPH_MSG_OSD_OP) {
+      dout(0) << "handle_op_batch dropping unexpected " << *op << dendl;
+      op->put();
+      continue;
+    }
+    op->set_connection(m->get_connection()->get());
+    op->get_header().src = m->get_header().src;
+    op->set_recv_stamp(m->get_recv_stamp());
+    op->set_throttle_stamp(m->get_throttle_stamp());
+    op->set_dispatch_stamp(m->get_dispatch_stamp());
+    if (throttler) {
+      op->set_throttler(throttler);
+      moved += op->get_payload().length() + op->get_middle().length() +
+	op->get_data().length();
+    }
+    ms_dispatch(op);
+  }
+
+  // the rest (framing, dropped ops) goes back now
+  if (throttler) {
+    assert(moved <= reserved);
+    m->set_throttler(NULL);
+    throttler->put(reserved - moved);
+  }
+  m->put();
+}
+
+void OSD::update_fast_dispatch_safe()
+{
+  assert(osd_lock.is_locked());
+  Mutex::Locker l(finished_lock);
+  fast_dispatch_safe.set(waiting_for_osdmap.empty() &&
+			 waiting_for_pg.empty() &&
+			 finished.empty());
+}
+
+/*
+ * Queue client ops and replica ops/replies to their pg without taking
+ * osd_lock.  We hold map_lock (read) so the map, our state and up_epoch
+ * cannot change underneath us.  Only the common case is handled here:
+ * the sender has our current map and the pg exists.  Anything else
+ * (waiting for a map or pg, sharing a map, replying with an error) is
+ * left to the normal _dispatch() path.
+ */
+bool OSD::fast_dispatch(Message *m)
+{
+  int type = m->get_type();
+  if (type != CEPH_MSG_OSD_OP &&
+      type != MSG_OSD_SUBOP &&
+      type != MSG_OSD_SUBOPREPLY)
+    return false;
+  if (!g_conf->osd_fast_dispatch || !fast_dispatch_safe.read())
+    return false;
+
+  map_lock.get_read();
+  bool r = _fast_dispatch(m);
+  map_lock.put_read();
+  return r;
+}
+
+bool OSD::_fast_dispatch(Message *m)
+{
+  int type = m->get_type();
+  if (!osdmap || !is_active())
+    return false;
+
+  pg_t pgid;
+  epoch_t epoch;
+  switch (type) {
+  case CEPH_MSG_OSD_OP:
+    {
+      MOSDOp *op = static_cast<MOSDOp*>(m);
+      epoch = op->get_map_epoch();
+      if (epoch != osdmap->get_epoch() ||
+	  !op->get_connection()->is_connected() ||
+	  op->get_oid().name.size() > MAX_CEPH_OBJECT_NAME_LEN ||
+	  osdmap->is_blacklisted(op->get_source_addr()))
+	return false;
+      if (init_op_flags(op))
+	return false;
+      if (op->may_write() &&
+	  (osdmap->test_flag(CEPH_OSDMAP_FULL) ||
+	   op->get_snapid() != CEPH_NOSNAP ||
+	   (g_conf->osd_max_write_size &&
+	    op->get_data_len() > g_conf->osd_max_write_size << 20)))
+	return false;
+      pgid = op->get_pg();
+      if ((op->get_flags() & CEPH_OSD_FLAG_PGOP) == 0 &&
+	  osdmap->have_pg_pool(pgid.pool()))
+	pgid = osdmap->raw_pg_to_pg(pgid);
+    }
+    break;
+
+  case MSG_OSD_SUBOP:
+    epoch = static_cast<MOSDSubOp*>(m)->map_epoch;
+    pgid = static_cast<MOSDSubOp*>(m)->pgid;
+    break;
+
+  case MSG_OSD_SUBOPREPLY:
+    epoch = static_cast<MOSDSubOpReply*>(m)->get_map_epoch();
+    pgid = static_cast<MOSDSubOpReply*>(m)->get_pg();
+    break;
+
+  default:
+    return false;
+  }
+
+  if (type != CEPH_MSG_OSD_OP) {
+    // replica traffic: from a live peer with our map (nothing to share)
+    if (epoch != osdmap->get_epoch() || epoch < up_epoch ||
+	!m->get_connection()->peer_is_osd())
+      return false;
+    int from = m->get_source().num();
+    if (!osdmap->have_inst(from) ||
+	osdmap->get_cluster_addr(from) != m->get_source_inst().addr)
+      return false;
+  }
+
+  PG *pg = NULL;
+  pg_map_lock.get_read();
+  hash_map<pg_t, PG*>::iterator p = pg_map.find(pgid);
+  if (p != pg_map.end()) {
+    pg = p->second;
+    pg->get();
+  }
+  pg_map_lock.put_read();
+  if (!pg)
+    return false;
+
+  // recheck; the pg may have been removed before we got its lock.  a pg
+  // that has not caught up with our map yet goes the slow way, which
+  // advances it first.
+  pg->lock();
+  pg_map_lock.get_read();
+  p = pg_map.find(pgid);
+  bool removed = (p == pg_map.end() || p->second != pg);
+  pg_map_lock.put_read();
+  if (removed ||
+      pg->get_osdmap()->get_epoch() != osdmap->get_epoch()) {
+    pg->unlock();
+    pg->put();
+    return false;
+  }
+
+  dout(20) << "fast_dispatch " << m << " " << *m << dendl;
+  if (type == CEPH_MSG_OSD_OP)
+    m->clear_payload();
+  OpRequestRef op = op_tracker.create_request(m);
+  enqueue_op(pg, op);
+  pg->unlock();
+  pg->put();
+  logger->inc(l_osd_op_fast);
+  return true;
+}
+
 bool OSD::ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new)
 {
   dout(10) << "OSD::ms_get_authorizer type=" << ceph_entity_type_name(dest_type) << dendl;
@@ -2976,6 +3477,8 @@ void OSD::handle_scrub(MOSDScrub *m)
       if (pg->is_primary()) {
 	if (m->repair)
 	  pg->state_set(PG_STATE_REPAIR);
+	if (m->deep && !pg->is_scrubbing())
+	  pg->state_set(PG_STATE_DEEP_SCRUB);
 	if (pg->queue_scrub()) {
 	  dout(10) << "queueing " << *pg << " for scrub" << dendl;
 	}
@@ -2992,6 +3495,8 @@ void OSD::handle_scrub(MOSDScrub *m)
 	if (pg->is_primary()) {
 	  if (m->repair)
 	    pg->state_set(PG_STATE_REPAIR);
+	  if (m->deep && !pg->is_scrubbing())
+	    pg->state_set(PG_STATE_DEEP_SCRUB);
 	  if (pg->queue_scrub()) {
 	    dout(10) << "queueing " << *pg << " for scrub" << dendl;
 	  }
@@ -3003,6 +3508,32 @@ void OSD::handle_scrub(MOSDScrub *m)
   m->put();
 }
 
+/*
+ * object context cache: pgs index themselves by the stamp of their
+ * oldest idle context, so whoever is over the cap can evict the oldest
+ * context on the osd.  called with pg locked.
+ */
+void OSD::context_cache_reindex(PG *pg, uint64_t from, uint64_t to)
+{
+  Mutex::Locker l(context_cache_lock);
+  if (from)
+    context_cache_oldest.erase(make_pair(from, pg));
+  if (to)
+    context_cache_oldest.insert(make_pair(to, pg));
+}
+
+/// @return the pg with the oldest idle context, with a ref, or NULL
+PG *OSD::context_cache_oldest_pg()
+{
+  Mutex::Locker l(context_cache_lock);
+  if (context_cache_oldest.empty())
+    return NULL;
+  // it can't go away: it drops out of the index under its lock first
+  PG *pg = context_cache_oldest.begin()->second;
+  pg->get();
+  return pg;
+}
+
 bool OSD::scrub_should_schedule()
 {
   double loadavgs[1];
@@ -3254,12 +3785,7 @@ void OSD::handle_osd_map(MOSDMap *m)
     pg->lock();
     op_wq.lock();
 
-    // we should still have something in op_queue, unless a racing
-    // thread did something very strange :/
-    assert(!pg->op_queue.empty());
-
-    OpRequestRef op = pg->op_queue.front();
-    pg->op_queue.pop_front();
+    OpRequestRef op = _take_queued_op(pg);
     pg->unlock();
     pg->put();
     dout(15) << " will requeue " << *op->request << dendl;
@@ -3352,8 +3878,13 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   assert(osd_lock.is_locked());
 
+  // keep any maps a pg still has to advance through
+  epoch_t trim_to = m->oldest_map;
+  epoch_t min_pg_epoch = get_min_pg_epoch();
+  if (min_pg_epoch && min_pg_epoch < trim_to)
+    trim_to = min_pg_epoch;
   if (superblock.oldest_map) {
-    for (epoch_t e = superblock.oldest_map; e < m->oldest_map; ++e) {
+    for (epoch_t e = superblock.oldest_map; e < trim_to; ++e) {
       dout(20) << " removing old osdmap epoch " << e << dendl;
       t.remove(coll_t::META_COLL, get_osdmap_pobject_name(e));
       t.remove(coll_t::META_COLL, get_inc_osdmap_pobject_name(e));
@@ -3366,20 +3897,17 @@ void OSD::handle_osd_map(MOSDMap *m)
   superblock.newest_map = last;
 
  
-  // finally, take map_lock _after_ we do this flush, to avoid deadlock
+  // finally, take map_lock _after_ we do this flush, to avoid deadlock.
+  // the map advance workers hold it for read; stop them first so we
+  // are not starved.
+  map_advance_tp.pause();
   map_lock.get_write();
+  oldest_map_epoch = superblock.oldest_map;
 
   C_Contexts *fin = new C_Contexts(g_ceph_context);
 
-  // lock all pgs
-  for (hash_map<pg_t,PG*>::iterator i = pg_map.begin();
-       i != pg_map.end();
-       i++) {
-    PG *pg = i->second;
-    pg->lock_with_map_lock_held(true);
-  }
-
-  // advance through the new maps
+  // advance through the new maps.  pgs follow on their own, either in
+  // the map advance workers or when they are next looked up.
   for (epoch_t cur = start; cur <= superblock.newest_map; cur++) {
     dout(10) << " advance to epoch " << cur << " (<= newest " << superblock.newest_map << ")" << dendl;
 
@@ -3413,16 +3941,8 @@ void OSD::handle_osd_map(MOSDMap *m)
       
     // yay!
     activate_map(t, fin->contexts);
-  }
-
-  // write and unlock pgs
-  for (hash_map<pg_t,PG*>::iterator i = pg_map.begin();
-       i != pg_map.end();
-       i++) {
-    PG *pg = i->second;
-    //pg->lock_with_map_lock_held();
-    pg->write_if_dirty(t);
-    pg->unlock();
+  } else {
+    map_activated = false;
   }
 
   bool do_shutdown = false;
@@ -3494,6 +4014,7 @@ void OSD::handle_osd_map(MOSDMap *m)
   int r = store->apply_transaction(t, fin);
   if (r) {
     map_lock.put_write();
+    map_advance_tp.unpause();
     derr << "error writing map: " << cpp_strerror(-r) << dendl;
     m->put();
     shutdown();
@@ -3501,6 +4022,16 @@ void OSD::handle_osd_map(MOSDMap *m)
   }
 
   map_lock.put_write();
+
+  // and let the pgs catch up
+  pg_map_lock.get_read();
+  for (hash_map<pg_t,PG*>::iterator i = pg_map.begin();
+       i != pg_map.end();
+       i++)
+    map_advance_wq.queue(i->second);
+  pg_map_lock.put_read();
+  map_advance_tp.unpause();
+
   clear_map_bl_cache_pins();
 
   /*
@@ -3550,8 +4081,8 @@ void OSD::handle_osd_map(MOSDMap *m)
 
 
 /** 
- * scan placement groups, initiate any replication
- * activities.
+ * update osd-wide state (pools, pg creations, waiters) for the new
+ * map.  the pgs themselves are advanced by advance_pg().
  */
 void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
 {
@@ -3656,30 +4187,6 @@ void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
     }
   }
 
-  // if we skipped a discontinuity and are the first epoch, we won't have a previous map.
-  OSDMapRef lastmap;
-  if (osdmap->get_epoch() > superblock.oldest_map)
-    lastmap = get_map(osdmap->get_epoch() - 1);
-
-  // scan existing pg's
-  for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
-       it != pg_map.end();
-       it++) {
-    PG *pg = it->second;
-
-    vector<int> newup, newacting;
-    osdmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
-
-    //pg->lock_with_map_lock_held();
-
-    // update pg's osdmap ref, assert lock is held
-    pg->reassert_lock_with_map_lock_held();
-
-    dout(10) << "Scanning pg " << *pg << dendl;
-    pg->handle_advance_map(osdmap, lastmap, newup, newacting, 0);
-    //pg->unlock();
-  }
-
   // scan pgs with waiters
   map<pg_t, list<OpRequestRef> >::iterator p = waiting_for_pg.begin();
   while (p != waiting_for_pg.end()) {
@@ -3707,65 +4214,135 @@ void OSD::activate_map(ObjectStore::Transaction& t, list<Context*>& tfin)
 
   dout(7) << "activate_map version " << osdmap->get_epoch() << dendl;
 
-  map< int, vector<pair<pg_info_t,pg_interval_map_t> > >  notify_list;  // primary -> list
-  map< int, map<pg_t,pg_query_t> > query_map;    // peer -> PG -> get_summary_since
-  map<int,MOSDPGInfo*> info_map;  // peer -> message
+  // pgs activate as they advance to this map
+  map_activated = true;
 
-  int num_pg_primary = 0, num_pg_replica = 0, num_pg_stray = 0;
+  wake_all_pg_waiters();   // the pg mapping may have shifted
+  maybe_update_heartbeat_peers();
 
-  epoch_t oldest_last_clean = osdmap->get_epoch();
+  send_pg_temp();
 
-  // scan pg's
-  for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
-       it != pg_map.end();
-       it++) {
-    PG *pg = it->second;
-    //pg->lock_with_map_lock_held();
+  if (osdmap->test_flag(CEPH_OSDMAP_FULL)) {
+    dout(10) << " osdmap flagged full, doing onetime osdmap subscribe" << dendl;
+    monc->sub_want("osdmap", osdmap->get_epoch() + 1, CEPH_SUBSCRIBE_ONETIME);
+    monc->renew_subs();
+  }
+}
 
-    if (pg->is_primary())
-      num_pg_primary++;
-    else if (pg->is_replica())
-      num_pg_replica++;
-    else
-      num_pg_stray++;
+/*
+ * bring a pg up to date with our osdmap, one epoch at a time, and
+ * activate it if the osd has activated that map.  the caller holds the
+ * pg lock and either osd_lock or map_lock (read), so osdmap is stable,
+ * and passes oldest_map_epoch as it read it under that lock.
+ * returns false if the pg was already current.
+ */
+bool OSD::advance_pg(PG *pg, epoch_t oldest)
+{
+  pg->assert_locked();
+  pg->oldest_map = oldest;
+  OSDMapRef lastmap = pg->get_osdmap();
+  epoch_t target = osdmap->get_epoch();
+  if (lastmap->get_epoch() >= target)
+    return false;
 
-    if (pg->is_primary() && pg->info.history.last_epoch_clean < oldest_last_clean)
-      oldest_last_clean = pg->info.history.last_epoch_clean;
-    
-    if (!osdmap->have_pg_pool(pg->info.pgid.pool())) {
-      //pool is deleted!
-      queue_pg_for_deletion(pg);
-      //pg->unlock();
-      continue;
-    }
+  epoch_t e = lastmap->get_epoch() + 1;
+  if (e < oldest) {
+    // we skipped a discontinuity; there is no previous map
+    dout(10) << "advance_pg " << *pg << " jumping to " << oldest << dendl;
+    e = oldest;
+    lastmap.reset();
+  }
+
+  for (; e <= target; e++) {
+    OSDMapRef nextmap = get_map(e);
+    vector<int> newup, newacting;
+    nextmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
+    dout(10) << "advance_pg " << *pg << " to " << e << dendl;
+    pg->handle_advance_map(nextmap, lastmap, newup, newacting, 0);
+    lastmap = nextmap;
+  }
 
-    PG::RecoveryCtx rctx(&query_map, &info_map, &notify_list, &tfin, &t);
+  map< int, vector<pair<pg_info_t,pg_interval_map_t> > >  notify_list;  // primary -> list
+  map< int, map<pg_t,pg_query_t> > query_map;    // peer -> PG -> get_summary_since
+  map<int,MOSDPGInfo*> info_map;  // peer -> message
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  C_Contexts *fin = new C_Contexts(g_ceph_context);
+
+  bool deleted = !osdmap->have_pg_pool(pg->info.pgid.pool());
+  if (map_activated && !deleted) {
+    PG::RecoveryCtx rctx(&query_map, &info_map, &notify_list, &fin->contexts, t);
     pg->handle_activate_map(&rctx);
+  }
 
-    //pg->write_if_dirty(t);
-    
-    //pg->unlock();
-  }  
+  // the new maps may have dirtied the pg even if we do not activate
+  pg->write_if_dirty(*t);
+  int tr = store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t), fin);
+  assert(tr == 0);
 
-  do_notifies(notify_list, osdmap->get_epoch());  // notify? (residual|replica)
+  if (map_activated && deleted) {
+    //pool is deleted!
+    queue_pg_for_deletion(pg);
+    return true;
+  }
+
+  do_notifies(notify_list, target);  // notify? (residual|replica)
   do_queries(query_map);
   do_infos(info_map);
+  return true;
+}
 
-  logger->set(l_osd_pg, pg_map.size());
-  logger->set(l_osd_pg_primary, num_pg_primary);
-  logger->set(l_osd_pg_replica, num_pg_replica);
-  logger->set(l_osd_pg_stray, num_pg_stray);
+void OSD::_advance_pg(PG *pg)
+{
+  map_lock.get_read();
+  epoch_t oldest = oldest_map_epoch;
 
-  wake_all_pg_waiters();   // the pg mapping may have shifted
-  maybe_update_heartbeat_peers();
+  pg->lock();
+  pg_map_lock.get_read();
+  hash_map<pg_t, PG*>::iterator p = pg_map.find(pg->info.pgid);
+  bool removed = (p == pg_map.end() || p->second != pg);
+  pg_map_lock.put_read();
+  if (!removed && !pg->deleting) {
+    pg->load_deferred_log();
+    advance_pg(pg, oldest);
+  }
+  pg->unlock();
 
-  send_pg_temp();
+  map_lock.put_read();
+}
 
-  if (osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    dout(10) << " osdmap flagged full, doing onetime osdmap subscribe" << dendl;
-    monc->sub_want("osdmap", osdmap->get_epoch() + 1, CEPH_SUBSCRIBE_ONETIME);
-    monc->renew_subs();
+void OSD::note_pg_epoch(pg_t pgid, epoch_t e)
+{
+  Mutex::Locker l(pg_epoch_lock);
+  map<pg_t, epoch_t>::iterator p = pg_epoch.find(pgid);
+  if (p != pg_epoch.end()) {
+    if (p->second == e)
+      return;
+    pg_epochs.erase(pg_epochs.find(p->second));
+    p->second = e;
+  } else {
+    pg_epoch[pgid] = e;
   }
+  pg_epochs.insert(e);
+}
+
+void OSD::forget_pg_epoch(pg_t pgid)
+{
+  Mutex::Locker l(pg_epoch_lock);
+  map<pg_t, epoch_t>::iterator p = pg_epoch.find(pgid);
+  if (p == pg_epoch.end())
+    return;
+  pg_epochs.erase(pg_epochs.find(p->second));
+  pg_epoch.erase(p);
+}
+
+/// oldest epoch any pg is at, or 0 if we have no pgs
+epoch_t OSD::get_min_pg_epoch()
+{
+  Mutex::Locker l(pg_epoch_lock);
+  if (pg_epochs.empty())
+    return 0;
+  return *pg_epochs.begin();
 }
 
 
@@ -4022,7 +4599,7 @@ void OSD::do_split(PG *parent, set<pg_t>& childpgids, ObjectStore::Transaction&
 {
   dout(10) << "do_split to " << childpgids << " on " << *parent << dendl;
 
-  parent->lock_with_map_lock_held();
+  parent->lock();
  
   // create and lock children
   map<pg_t,PG*> children;
@@ -4034,7 +4611,7 @@ void OSD::do_split(PG *parent, set<pg_t>& childpgids, ObjectStore::Transaction&
       history.same_interval_since = history.same_primary_since =
       osdmap->get_epoch();
     pg_interval_map_t pi;
-    PG *pg = _create_lock_pg(*q, true, true,
+    PG *pg = _create_lock_pg(*q, true,
 			     parent->get_role(), parent->up, parent->acting, history, pi, t);
     children[*q] = pg;
     dout(10) << "  child " << *pg << dendl;
@@ -4071,6 +4648,7 @@ void OSD::split_pg(PG *parent, map<pg_t,PG*>& children, ObjectStore::Transaction
 {
   dout(10) << "split_pg " << *parent << dendl;
   pg_t parentid = parent->info.pgid;
+  parent->load_deferred_log();
 
   // split objects
   vector<hobject_t> olist;
@@ -4274,7 +4852,7 @@ void OSD::handle_pg_create(OpRequestRef op)
       ObjectStore::Transaction *t = new ObjectStore::Transaction;
       C_Contexts *fin = new C_Contexts(g_ceph_context);
       pg_interval_map_t pi;
-      PG *pg = _create_lock_pg(pgid, true, false,
+      PG *pg = _create_lock_pg(pgid, true,
 			       0, creating_pgs[pgid].acting, creating_pgs[pgid].acting, history, pi,
 			       *t);
       creating_pgs.erase(pgid);
@@ -4882,120 +5460,62 @@ void OSD::queue_pg_for_deletion(PG *pg)
   }
 }
 
+/*
+ * move the pg's collections aside for reap_wq to empty later and drop
+ * the pg.  the renames are one transaction, so we're quick no matter
+ * how many objects the pg had, and a crash leaves either the pg or its
+ * removal collections.
+ */
 void OSD::_remove_pg(PG *pg)
 {
   pg_t pgid = pg->info.pgid;
   dout(10) << "_remove_pg " << pgid << dendl;
-  
+
+  // let the pg's queued transactions land before we take osd_lock...
   pg->lock();
   if (!pg->deleting) {
     pg->unlock();
     return;
   }
-  
-  // reset log, last_complete, in case deletion gets canceled
-  pg->info.last_complete = eversion_t();
-  pg->info.last_update = eversion_t();
-  pg->info.log_tail = eversion_t();
-  pg->log.zero();
-  pg->ondisklog.zero();
+  pg->osr.flush();
+  pg->unlock();
 
-  {
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    pg->write_info(*t);
-    pg->write_log(*t);
-    int tr = store->queue_transaction(&pg->osr, t);
-    assert(tr == 0);
+  osd_lock.Lock();
+  pg->lock();
+  if (!pg->deleting) {
+    osd_lock.Unlock();
+    pg->unlock();
+    return;
   }
-  
-  // flush all pg operations to the fs, so we can rely on
-  // collection_list below.
-  pg->osr.flush();
 
-  int n = 0;
+  // ...and anything queued since, before we move the collections
+  pg->osr.flush();
 
+  uint64_t seq = next_removal_seq++;
+  list<coll_t> colls;
   ObjectStore::Transaction *rmt = new ObjectStore::Transaction;
-
-  // snap collections
   for (interval_set<snapid_t>::iterator p = pg->snap_collections.begin();
        p != pg->snap_collections.end();
        p++) {
     for (snapid_t cur = p.get_start();
 	 cur < p.get_start() + p.get_len();
 	 ++cur) {
-      vector<hobject_t> olist;      
-      store->collection_list(coll_t(pgid, cur), olist);
-      dout(10) << "_remove_pg " << pgid << " snap " << cur << " " << olist.size() << " objects" << dendl;
-      for (vector<hobject_t>::iterator q = olist.begin();
-	   q != olist.end();
-	   q++) {
-	ObjectStore::Transaction *t = new ObjectStore::Transaction;
-	t->remove(coll_t(pgid, cur), *q);
-	t->remove(coll_t(pgid), *q);          // we may hit this twice, but it's harmless
-	int tr = store->queue_transaction(&pg->osr, t);
-	assert(tr == 0);
-	
-	if ((++n & 0xff) == 0) {
-	  pg->unlock();
-	  pg->lock();
-	  if (!pg->deleting) {
-	    dout(10) << "_remove_pg aborted on " << *pg << dendl;
-	    pg->unlock();
-	    return;
-	  }
-	}
-      }
-      rmt->remove_collection(coll_t(pgid, cur));
-    }
-  }
-
-  // (what remains of the) main collection
-  vector<hobject_t> olist;
-  store->collection_list(coll_t(pgid), olist);
-  dout(10) << "_remove_pg " << pgid << " " << olist.size() << " objects" << dendl;
-  for (vector<hobject_t>::iterator p = olist.begin();
-       p != olist.end();
-       p++) {
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->remove(coll_t(pgid), *p);
-    int tr = store->queue_transaction(&pg->osr, t);
-    assert(tr == 0);
-
-    if ((++n & 0xff) == 0) {
-      pg->unlock();
-      pg->lock();
-      if (!pg->deleting) {
-	dout(10) << "_remove_pg aborted on " << *pg << dendl;
-	pg->unlock();
-	return;
-      }
+      coll_t c = coll_t::make_removal_coll(seq, pgid, cur);
+      rmt->collection_rename(coll_t(pgid, cur), c);
+      colls.push_back(c);
     }
   }
+  coll_t c = coll_t::make_removal_coll(seq, pgid);
+  rmt->collection_rename(coll_t(pgid), c);
+  colls.push_back(c);
+  rmt->remove(coll_t::META_COLL, pg->log_oid);
+  rmt->remove(coll_t::META_COLL, pg->biginfo_oid);
+  dout(10) << "_remove_pg " << pgid << " moving " << colls << dendl;
+  int tr = store->queue_transaction(&removal_osr, rmt);
+  assert(tr == 0);
 
-  pg->unlock();
-
-  dout(10) << "_remove_pg " << pgid << " flushing store" << dendl;
-  store->flush();
-  
-  dout(10) << "_remove_pg " << pgid << " taking osd_lock" << dendl;
-  osd_lock.Lock();
-  pg->lock();
-  
-  if (!pg->deleting) {
-    osd_lock.Unlock();
-    pg->unlock();
-    return;
-  }
-
-  dout(10) << "_remove_pg " << pgid << " removing final" << dendl;
-
-  {
-    rmt->remove(coll_t::META_COLL, pg->log_oid);
-    rmt->remove(coll_t::META_COLL, pg->biginfo_oid);
-    rmt->remove_collection(coll_t(pgid));
-    int tr = store->queue_transaction(NULL, rmt);
-    assert(tr == 0);
-  }
+  for (list<coll_t>::iterator p = colls.begin(); p != colls.end(); ++p)
+    queue_removal_coll(*p);
 
   if (store->collection_exists(coll_t::make_temp_coll(pg->get_pgid()))) {
     clear_temp(store, coll_t::make_temp_coll(pg->get_pgid()));
@@ -5008,8 +5528,13 @@ void OSD::_remove_pg(PG *pg)
   pg->on_removal();
 
   // remove from map
+  pg_map_lock.get_write();
   pg_map.erase(pgid);
+  pg_map_lock.put_write();
   pg->put(); // since we've taken it out of map
+  map_advance_wq.dequeue(pg);
+  forget_pg_epoch(pgid);
+  pg_role_count(pg->get_role()).dec();
   unreg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
   _put_pool(pg->pool);
@@ -5021,6 +5546,146 @@ void OSD::_remove_pg(PG *pg)
   dout(10) << "_remove_pg " << pgid << " all done" << dendl;
 }
 
+void OSD::queue_removal_coll(coll_t cid)
+{
+  dout(10) << "queue_removal_coll " << cid << dendl;
+  reap_wq.lock();
+  reap_queue.push_back(new RemovalColl(cid));
+  if (logger)  // not yet, from load_pgs
+    logger->set(l_osd_pg_removing, reap_queue.size() + reaping.size());
+  reap_wq.kick();
+  reap_wq.unlock();
+}
+
+/*
+ * remove one batch of objects from a removal collection, or the
+ * collection itself once it's empty.  the op scheduler has admitted
+ * us; applying synchronously keeps one batch in the store at a time.
+ */
+void OSD::reap_removal_coll(RemovalColl *rc)
+{
+  removal_osr.flush();  // the rename has landed
+
+  vector<hobject_t> ls;
+  hobject_t next;
+  int r = store->collection_list_partial(rc->cid, hobject_t(),
+					 g_conf->osd_remove_batch,
+					 g_conf->osd_remove_batch,
+					 0, &ls, &next);
+  if (r < 0) {
+    derr << "reap_removal_coll " << rc->cid << " list got " << cpp_strerror(r) << dendl;
+    rc->done = true;
+    return;
+  }
+
+  ObjectStore::Transaction t;
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p)
+    t.remove(rc->cid, *p);
+  if (ls.size() < (unsigned)g_conf->osd_remove_batch) {
+    t.remove_collection(rc->cid);
+    rc->done = true;
+  }
+  r = store->apply_transaction(t);
+  assert(r == 0);
+
+  rc->removed += ls.size();
+  logger->inc(l_osd_pg_removed_objects, ls.size());
+  dout(10) << "reap_removal_coll " << rc->cid << " removed " << ls.size()
+	   << ", " << rc->removed << " total" << (rc->done ? ", done" : "") << dendl;
+}
+
+/*
+ * the store keeps an object's omap under its hobject_t alone, whatever
+ * collection it's in.  objects of a recreated pg would pick up the old
+ * ones' omap, and reaping the old ones would clear the new ones', so
+ * before @pgid comes back we reap whatever is left of it here.
+ */
+void OSD::finish_reaping(pg_t pgid)
+{
+  list<RemovalColl*> ours;
+  reap_wq.lock();
+  while (true) {
+    // wait out a batch in progress...
+    bool busy = false;
+    for (set<RemovalColl*>::iterator p = reaping.begin(); p != reaping.end(); ++p) {
+      uint64_t seq;
+      pg_t rpgid;
+      if ((*p)->cid.is_removal(&seq, &rpgid) && rpgid == pgid) {
+	busy = true;
+	break;
+      }
+    }
+    if (!busy)
+      break;
+    disk_tp.wait(reap_cond);
+  }
+  // ...then take the rest from reap_wq
+  list<RemovalColl*>::iterator p = reap_queue.begin();
+  while (p != reap_queue.end()) {
+    uint64_t seq;
+    pg_t rpgid;
+    if ((*p)->cid.is_removal(&seq, &rpgid) && rpgid == pgid) {
+      ours.push_back(*p);
+      reap_queue.erase(p++);
+    } else {
+      ++p;
+    }
+  }
+  reap_wq.unlock();
+
+  if (ours.empty())
+    return;
+  dout(1) << "finish_reaping " << pgid << ": " << ours.size()
+	  << " collections left to reap before we recreate it" << dendl;
+  while (!ours.empty()) {
+    RemovalColl *rc = ours.front();
+    while (!rc->done)
+      reap_removal_coll(rc);
+    ours.pop_front();
+    delete rc;
+  }
+
+  reap_wq.lock();
+  logger->set(l_osd_pg_removing, reap_queue.size() + reaping.size());
+  reap_wq.unlock();
+}
+
+void OSD::ReapWQ::_process_finish(RemovalColl *rc)
+{
+  osd->reaping.erase(rc);
+  osd->reap_cond.Signal();
+  if (rc->done) {
+    delete rc;
+    osd->logger->set(l_osd_pg_removing, osd->reap_queue.size() + osd->reaping.size());
+  } else {
+    osd->reap_queue.push_back(rc);  // round robin with the others
+  }
+}
+
+void OSD::dump_pg_removal(ostream& ss)
+{
+  JSONFormatter jf(true);
+  jf.open_array_section("pg_removal");
+  reap_wq.lock();
+  for (set<RemovalColl*>::iterator p = reaping.begin(); p != reaping.end(); ++p) {
+    jf.open_object_section("collection");
+    jf.dump_stream("cid") << (*p)->cid;
+    jf.dump_unsigned("removed", (*p)->removed);
+    jf.dump_string("state", "reaping");
+    jf.close_section();
+  }
+  for (list<RemovalColl*>::iterator p = reap_queue.begin(); p != reap_queue.end(); ++p) {
+    jf.open_object_section("collection");
+    jf.dump_stream("cid") << (*p)->cid;
+    jf.dump_unsigned("removed", (*p)->removed);
+    jf.dump_string("state", "queued");
+    jf.close_section();
+  }
+  reap_wq.unlock();
+  jf.close_section();
+  jf.flush(ss);
+}
+
 
 // =========================================================
 // RECOVERY
@@ -5045,7 +5710,7 @@ void OSD::check_replay_queue()
   for (list< pair<pg_t,utime_t> >::iterator p = pgids.begin(); p != pgids.end(); p++) {
     pg_t pgid = p->first;
     if (pg_map.count(pgid)) {
-      PG *pg = _lookup_lock_pg_with_map_lock_held(pgid);
+      PG *pg = _lookup_lock_pg(pgid);
       dout(10) << "check_replay_queue " << *pg << dendl;
       if (pg->is_active() &&
 	  pg->is_replay() &&
@@ -5064,6 +5729,51 @@ void OSD::check_replay_queue()
 }
 
 
+// -- snap trim budget --
+
+/*
+ * charge a batch of trimmed clones against the trim budget.  the
+ * objects and bytes limits are separate; whichever is further behind
+ * sets when trimming may resume.
+ */
+void OSD::snap_trim_charge(unsigned objects, uint64_t bytes)
+{
+  uint64_t orate = g_conf->osd_snap_trim_max_objects_per_sec;
+  uint64_t brate = g_conf->osd_snap_trim_max_bytes_per_sec;
+  double secs = 0;
+  if (orate)
+    secs = MAX(secs, (double)objects / (double)orate);
+  if (brate)
+    secs = MAX(secs, (double)bytes / (double)brate);
+  if (secs == 0)
+    return;
+
+  utime_t now = ceph_clock_now(g_ceph_context);
+  utime_t d;
+  d.set_from_double(secs);
+  snap_trim_budget_lock.Lock();
+  if (snap_trim_next < now)
+    snap_trim_next = now;
+  snap_trim_next += d;
+  utime_t next = snap_trim_next;
+  snap_trim_budget_lock.Unlock();
+  dout(20) << "snap_trim_charge " << objects << " objects " << bytes
+	   << " bytes, next trim at " << next << dendl;
+
+  Mutex::Locker l(snap_trim_timer_lock);
+  if (snap_trim_kick)
+    snap_trim_timer.cancel_event(snap_trim_kick);
+  snap_trim_kick = new C_SnapTrimKick(this);
+  snap_trim_timer.add_event_at(next, snap_trim_kick);
+}
+
+bool OSD::snap_trim_budget_ok()
+{
+  Mutex::Locker l(snap_trim_budget_lock);
+  return snap_trim_next <= ceph_clock_now(g_ceph_context);
+}
+
+
 bool OSD::queue_for_recovery(PG *pg)
 {
   bool b = recovery_wq.queue(pg);
@@ -5612,32 +6322,196 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
 
   // add to pg's op_queue
   pg->op_queue.push_back(op);
-  
-  op_wq.queue(pg);
+
+  unsigned cost;
+  uint64_t owner;
+  int c = classify_op(op, &cost, &owner);
+  op_wq.queue(pg, c, cost, owner);
 
   op->mark_queued_for_pg();
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+/*
+ * which class an op is scheduled as, and what it costs.  the pg still
+ * does its ops of one class and owner, and everything from one peer
+ * osd, in order; see _take_queued_op().
+ */
+int OSD::classify_op(OpRequestRef op, unsigned *cost, uint64_t *owner)
+{
+  Message *m = op->request;
+  uint64_t c = g_conf->osd_op_sched_cost_per_io + m->get_data_len();
+  int cls = OP_CLASS_CLIENT;
+  *owner = 0;
+
+  switch (m->get_type()) {
+  case CEPH_MSG_OSD_OP:
+    {
+      MOSDOp *o = (MOSDOp*)m;
+      *owner = m->get_source().num();
+      for (vector<OSDOp>::iterator p = o->ops.begin(); p != o->ops.end(); ++p)
+	if (p->op.op == CEPH_OSD_OP_READ ||
+	    p->op.op == CEPH_OSD_OP_SPARSE_READ)
+	  c += p->op.extent.length;
+    }
+    break;
+
+  case MSG_OSD_SUBOP:
+    {
+      MOSDSubOp *o = (MOSDSubOp*)m;
+      if (o->ops.size() == 1 &&
+	  (o->ops[0].op.op == CEPH_OSD_OP_PUSH ||
+	   o->ops[0].op.op == CEPH_OSD_OP_PULL))
+	cls = OP_CLASS_RECOVERY;
+    }
+    break;
+
+  case MSG_OSD_SUBOPREPLY:
+    {
+      MOSDSubOpReply *o = (MOSDSubOpReply*)m;
+      if (o->ops.size() == 1 &&
+	  (o->ops[0].op.op == CEPH_OSD_OP_PUSH ||
+	   o->ops[0].op.op == CEPH_OSD_OP_PULL))
+	cls = OP_CLASS_RECOVERY;
+    }
+    break;
+
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+    cls = OP_CLASS_RECOVERY;
+    break;
+  }
+
+  *cost = MIN(c, (uint64_t)UINT_MAX);
+  return cls;
+}
+
+bool OSD::OpWQ::_enqueue(PG *pg, int c, unsigned cost, uint64_t owner)
 {
   pg->get();
-  osd->op_queue.push_back(pg);
+  osd->op_sched->enqueue(c, owner, cost, make_pair(pg, owner),
+			ceph_clock_now(g_ceph_context));
   osd->op_queue_len++;
   osd->logger->set(l_osd_opq, osd->op_queue_len);
+  osd->logger->set(l_osd_opq_client + c, osd->op_sched->get_stats(c).queued);
   return true;
 }
 
 PG *OSD::OpWQ::_dequeue()
 {
-  if (osd->op_queue.empty())
+  if (osd->op_sched->empty())
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
+  int c;
+  utime_t waited;
+  pair<PG*, uint64_t> item = osd->op_sched->dequeue(
+    ceph_clock_now(g_ceph_context), &c, &waited);
+  PG *pg = item.first;
+  pg->op_queue_turns.push_back(make_pair(c, item.second));
   osd->op_queue_len--;
   osd->logger->set(l_osd_opq, osd->op_queue_len);
+  osd->logger->set(l_osd_opq_client + c, osd->op_sched->get_stats(c).queued);
+  osd->logger->inc(l_osd_sched_client + c);
+  osd->logger->finc(l_osd_sched_client_wait + c, (double)waited);
+
+  // background work we turned away may have a turn now
+  unsigned deferred = osd->op_sched->take_deferred();
+  if (deferred & (1 << OP_CLASS_RECOVERY))
+    osd->recovery_wq.kick();
+  if (deferred & (1 << OP_CLASS_SCRUB))
+    osd->scrub_wq.kick();
+  if (deferred & (1 << OP_CLASS_SNAPTRIM))
+    osd->snap_trim_wq.kick();
+  if (deferred & (1 << OP_CLASS_REMOVAL))
+    osd->reap_wq.kick();
   return pg;
 }
 
+/*
+ * admission for background work run from its own work queue.  called
+ * with that queue's lock held.
+ */
+bool OSD::op_sched_start(int c, unsigned cost)
+{
+  if (!op_sched->start(c, cost, ceph_clock_now(g_ceph_context)))
+    return false;
+  logger->inc(l_osd_sched_client + c);
+  return true;
+}
+
+/*
+ * background work of class c that was turned away is gone; it no longer
+ * holds a place in line.
+ */
+void OSD::op_sched_cancel(int c)
+{
+  op_sched->cancel(c);
+}
+
+void OSD::update_op_sched()
+{
+  op_sched->set_per_owner(g_conf->osd_op_sched_per_client);
+  op_sched->set_class_info(OP_CLASS_CLIENT, OpSched::ClassInfo(
+			     g_conf->osd_op_sched_client_res,
+			     g_conf->osd_op_sched_client_wgt,
+			     g_conf->osd_op_sched_client_lim));
+  op_sched->set_class_info(OP_CLASS_RECOVERY, OpSched::ClassInfo(
+			     g_conf->osd_op_sched_recovery_res,
+			     g_conf->osd_op_sched_recovery_wgt,
+			     g_conf->osd_op_sched_recovery_lim));
+  op_sched->set_class_info(OP_CLASS_SCRUB, OpSched::ClassInfo(
+			     g_conf->osd_op_sched_scrub_res,
+			     g_conf->osd_op_sched_scrub_wgt,
+			     g_conf->osd_op_sched_scrub_lim));
+  op_sched->set_class_info(OP_CLASS_SNAPTRIM, OpSched::ClassInfo(
+			     g_conf->osd_op_sched_snaptrim_res,
+			     g_conf->osd_op_sched_snaptrim_wgt,
+			     g_conf->osd_op_sched_snaptrim_lim));
+  op_sched->set_class_info(OP_CLASS_REMOVAL, OpSched::ClassInfo(
+			     g_conf->osd_op_sched_removal_res,
+			     g_conf->osd_op_sched_removal_wgt,
+			     g_conf->osd_op_sched_removal_lim));
+}
+
+void OSD::dump_op_sched(ostream& ss)
+{
+  JSONFormatter jf(true);
+  jf.open_object_section("op_scheduler");
+  op_sched->dump(&jf);
+  jf.close_section();
+  jf.flush(ss);
+}
+
+const char** OSD::get_tracked_conf_keys() const
+{
+  static const char* KEYS[] = {
+    "osd_op_sched_per_client",
+    "osd_op_sched_client_res",
+    "osd_op_sched_client_wgt",
+    "osd_op_sched_client_lim",
+    "osd_op_sched_recovery_res",
+    "osd_op_sched_recovery_wgt",
+    "osd_op_sched_recovery_lim",
+    "osd_op_sched_scrub_res",
+    "osd_op_sched_scrub_wgt",
+    "osd_op_sched_scrub_lim",
+    "osd_op_sched_snaptrim_res",
+    "osd_op_sched_snaptrim_wgt",
+    "osd_op_sched_snaptrim_lim",
+    "osd_op_sched_removal_res",
+    "osd_op_sched_removal_wgt",
+    "osd_op_sched_removal_lim",
+    NULL
+  };
+  return KEYS;
+}
+
+void OSD::handle_conf_change(const struct md_config_t *conf,
+			     const std::set <std::string> &changed)
+{
+  // the scheduler locks itself; any change just reloads all shares
+  dout(10) << "handle_conf_change updating op scheduler shares" << dendl;
+  update_op_sched();
+}
+
 /*
  * requeue ops at _front_ of queue.  these are previously queued
  * operations that need to get requeued ahead of anything the dispatch
@@ -5672,6 +6546,50 @@ void OSD::requeue_ops(PG *pg, list<OpRequestRef>& ls)
   pg->op_queue.splice(pg->op_queue.end(), orig_queue);
 }
 
+/*
+ * the op for the next turn op_wq gave this pg: its first queued op of
+ * the class and owner the turn was scheduled for.  ops of one class and
+ * owner run in order; a turn for recovery runs recovery work even if
+ * client ops are queued ahead of it.
+ *
+ * messages from a peer osd are the exception: a push must not overtake
+ * a repop for the same object, so everything one peer sent this pg runs
+ * in the order it arrived, whatever its class.  a turn that lands on
+ * such a message runs that peer's oldest queued one instead, and a turn
+ * whose op already ran that way runs the pg's oldest op.  every op
+ * still gets exactly one turn.  called with pg and op_wq locked.
+ */
+OpRequestRef OSD::_take_queued_op(PG *pg)
+{
+  assert(!pg->op_queue_turns.empty());
+  pair<int, uint64_t> turn = pg->op_queue_turns.front();
+  pg->op_queue_turns.pop_front();
+  assert(!pg->op_queue.empty());
+
+  list<OpRequestRef>::iterator p = pg->op_queue.begin();
+  for (; p != pg->op_queue.end(); ++p) {
+    unsigned cost;
+    uint64_t owner;
+    if (classify_op(*p, &cost, &owner) == turn.first && owner == turn.second)
+      break;
+  }
+  if (p == pg->op_queue.end()) {
+    p = pg->op_queue.begin();
+  } else if ((*p)->request->get_type() != CEPH_MSG_OSD_OP) {
+    entity_inst_t peer = (*p)->request->get_source_inst();
+    for (list<OpRequestRef>::iterator q = pg->op_queue.begin(); q != p; ++q) {
+      if ((*q)->request->get_type() != CEPH_MSG_OSD_OP &&
+	  (*q)->request->get_source_inst() == peer) {
+	p = q;
+	break;
+      }
+    }
+  }
+  OpRequestRef op = *p;
+  pg->op_queue.erase(p);
+  return op;
+}
+
 /*
  * NOTE: dequeue called in worker thread, without osd_lock
  */
@@ -5684,10 +6602,10 @@ void OSD::dequeue_op(PG *pg)
     // lock pg and get pending op
     pg->lock();
 
-    assert(!pg->op_queue.empty());
-    op = pg->op_queue.front();
-    pg->op_queue.pop_front();
-    
+    op_wq.lock();
+    op = _take_queued_op(pg);
+    op_wq.unlock();
+
     dout(10) << "dequeue_op " << *op->request << " pg " << *pg << dendl;
 
     // share map?
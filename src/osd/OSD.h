@@ -47,6 +47,8 @@ using namespace std;
 using namespace __gnu_cxx;
 
 #include "OpRequest.h"
+#include "OpScheduler.h"
+#include "common/config_obs.h"
 #include "common/shared_cache.hpp"
 #include "common/simple_cache.hpp"
 
@@ -57,6 +59,7 @@ enum {
   l_osd_first = 10000,
   l_osd_opq,
   l_osd_op_wip,
+  l_osd_op_fast,
   l_osd_op,
   l_osd_op_inb,
   l_osd_op_outb,
@@ -64,6 +67,8 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_replica,
+  l_osd_op_r_bounce,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
@@ -92,6 +97,28 @@ enum {
 
   l_osd_rop,
 
+  l_osd_opq_client,       // per op class; same order as OP_CLASS_*
+  l_osd_opq_recovery,
+  l_osd_opq_scrub,
+  l_osd_opq_snaptrim,
+  l_osd_opq_removal,
+  l_osd_sched_client,
+  l_osd_sched_recovery,
+  l_osd_sched_scrub,
+  l_osd_sched_snaptrim,
+  l_osd_sched_removal,
+  l_osd_sched_client_wait,
+  l_osd_sched_recovery_wait,
+  l_osd_sched_scrub_wait,
+  l_osd_sched_snaptrim_wait,
+  l_osd_sched_removal_wait,
+
+  l_osd_obc_hit,
+  l_osd_obc_miss,
+  l_osd_ssc_hit,
+  l_osd_ssc_miss,
+  l_osd_ctx_cached,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -99,6 +126,10 @@ enum {
   l_osd_pg_primary,
   l_osd_pg_replica,
   l_osd_pg_stray,
+  l_osd_pg_removing,
+  l_osd_pg_removed_objects,
+  l_osd_notify_batches,
+  l_osd_notify_batched,
   l_osd_hb_to,
   l_osd_hb_from,
   l_osd_map,
@@ -128,7 +159,8 @@ class OpsFlightSocketHook;
 
 extern const coll_t meta_coll;
 
-class OSD : public Dispatcher {
+class OSD : public Dispatcher,
+	    public md_config_obs_t {
   /** OSD **/
 protected:
   Mutex osd_lock;			// global lock
@@ -163,8 +195,18 @@ protected:
   Cond dispatch_cond;
   int dispatch_running;
 
+  /**
+   * nonzero when no op is parked at the OSD level (waiting_for_osdmap,
+   * waiting_for_pg, finished), so fast_dispatch() cannot overtake an
+   * earlier op from the same connection
+   */
+  atomic_t fast_dispatch_safe;
+  void update_fast_dispatch_safe();
+
   void create_logger();
   void tick();
+  bool fast_dispatch(Message *m);
+  bool _fast_dispatch(Message *m);
   void _dispatch(Message *m);
   void dispatch_op(OpRequestRef op);
 
@@ -233,6 +275,7 @@ private:
   ThreadPool recovery_tp;
   ThreadPool disk_tp;
   ThreadPool command_tp;
+  ThreadPool map_advance_tp;
 
   // -- sessions --
 public:
@@ -325,17 +368,20 @@ private:
   void take_waiters(list<OpRequestRef>& ls) {
     finished_lock.Lock();
     finished.splice(finished.end(), ls);
+    fast_dispatch_safe.set(0);
     finished_lock.Unlock();
   }
   void take_waiter(OpRequestRef op) {
     finished_lock.Lock();
     finished.push_back(op);
+    fast_dispatch_safe.set(0);
     finished_lock.Unlock();
   }
   void push_waiters(list<OpRequestRef>& ls) {
     assert(osd_lock.is_locked());   // currently, at least.  be careful if we change this (see #743)
     finished_lock.Lock();
     finished.splice(finished.begin(), ls);
+    fast_dispatch_safe.set(0);
     finished_lock.Unlock();
   }
   void do_waiters();
@@ -348,32 +394,49 @@ private:
   OpsFlightSocketHook *admin_ops_hook;
 
   // -- op queue --
-  deque<PG*> op_queue;
+  typedef OpScheduler<pair<PG*, uint64_t> > OpSched; ///< items are (pg, owner)
+  OpSched *op_sched;   ///< orders op_wq, admits background work
   int op_queue_len;
 
+  void update_op_sched();
+  void dump_op_sched(ostream& ss);
+  bool op_sched_start(int c, unsigned cost);
+  void op_sched_cancel(int c);
+
   struct OpWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
     OpWQ(OSD *o, time_t ti, ThreadPool *tp)
       : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
 
-    bool _enqueue(PG *pg);
+    void queue(PG *pg, int c, unsigned cost, uint64_t owner) {
+      lock();
+      _enqueue(pg, c, cost, owner);
+      kick();
+      unlock();
+    }
+    bool _enqueue(PG *pg, int c, unsigned cost, uint64_t owner);
+    bool _enqueue(PG *pg) {
+      return _enqueue(pg, OP_CLASS_CLIENT, g_conf->osd_op_sched_cost_per_io, 0);
+    }
     void _dequeue(PG *pg) {
       assert(0);
     }
     bool _empty() {
-      return osd->op_queue.empty();
+      return osd->op_sched->empty();
     }
     PG *_dequeue();
     void _process(PG *pg) {
       osd->dequeue_op(pg);
     }
     void _clear() {
-      assert(osd->op_queue.empty());
+      assert(osd->op_sched->empty());
     }
   } op_wq;
 
   void enqueue_op(PG *pg, OpRequestRef op);
+  int classify_op(OpRequestRef op, unsigned *cost, uint64_t *owner);
   void requeue_ops(PG *pg, list<OpRequestRef>& ls);
+  OpRequestRef _take_queued_op(PG *pg);
   void dequeue_op(PG *pg);
   static void static_dequeueop(OSD *o, PG *pg) {
     o->dequeue_op(pg);
@@ -382,6 +445,7 @@ private:
 
   friend class PG;
   friend class ReplicatedPG;
+  friend class ErasureCodedPG;
 
 
  protected:
@@ -411,6 +475,25 @@ private:
   void advance_map(ObjectStore::Transaction& t, C_Contexts *tfin);
   void activate_map(ObjectStore::Transaction& t, list<Context*>& tfin);
 
+  /// true if pgs should activate (ActMap) at the current osdmap
+  bool map_activated;
+
+  /// superblock.oldest_map as of osdmap; set under osd_lock and map_lock (write)
+  epoch_t oldest_map_epoch;
+
+  /// bring a locked pg up to osdmap; caller holds osd_lock or map_lock (read)
+  bool advance_pg(PG *pg, epoch_t oldest);
+  void _advance_pg(PG *pg);
+
+  // epochs pgs have advanced to; we must keep the maps after the oldest
+  Mutex pg_epoch_lock;
+  map<pg_t, epoch_t> pg_epoch;
+  multiset<epoch_t> pg_epochs;
+
+  void note_pg_epoch(pg_t pgid, epoch_t e);
+  void forget_pg_epoch(pg_t pgid);
+  epoch_t get_min_pg_epoch();
+
   // osd map cache (past osd maps)
   Mutex map_cache_lock;
   SharedLRU<epoch_t, OSDMap> map_cache;
@@ -459,18 +542,31 @@ protected:
 protected:
   // -- placement groups --
   map<int, PGPool*> pool_map;
+  /// pg_map is modified with osd_lock and pg_map_lock (write) held;
+  /// fast_dispatch() reads it with only pg_map_lock (read)
+  RWLock pg_map_lock;
   hash_map<pg_t, PG*> pg_map;
   map<pg_t, list<OpRequestRef> > waiting_for_pg;
   PGRecoveryStats pg_recovery_stats;
 
+  atomic_t num_pg_primary, num_pg_replica, num_pg_stray;
+  atomic_t& pg_role_count(int role) {
+    if (role == 0)
+      return num_pg_primary;
+    return role > 0 ? num_pg_replica : num_pg_stray;
+  }
+  void pg_role_changed(int oldrole, int newrole) {
+    pg_role_count(oldrole).dec();
+    pg_role_count(newrole).inc();
+  }
+
   PGPool *_get_pool(int id);
   void _put_pool(PGPool *p);
 
   bool  _have_pg(pg_t pgid);
   PG   *_lookup_lock_pg(pg_t pgid);
-  PG   *_lookup_lock_pg_with_map_lock_held(pg_t pgid);
-  PG   *_open_lock_pg(pg_t pg, bool no_lockdep_check=false, bool hold_map_lock=false);
-  PG   *_create_lock_pg(pg_t pgid, bool newly_created, bool hold_map_lock,
+  PG   *_open_lock_pg(pg_t pg, bool no_lockdep_check=false);
+  PG   *_create_lock_pg(pg_t pgid, bool newly_created,
 			int role, vector<int>& up, vector<int>& acting, pg_history_t history,
 			pg_interval_map_t& pi, ObjectStore::Transaction& t);
 
@@ -519,6 +615,7 @@ protected:
 
 
   // == monitor interaction ==
+  Mutex mon_report_lock;  // protects last_mon_report, up_thru_*
   utime_t last_mon_report;
   utime_t last_pg_stats_sent;
 
@@ -548,11 +645,14 @@ protected:
 
   void queue_want_up_thru(epoch_t want);
   void send_alive();
+  void _send_alive();
 
   // -- pg_temp --
+  Mutex pg_temp_lock;
   map<pg_t, vector<int> > pg_temp_wanted;
 
   void queue_want_pg_temp(pg_t pgid, vector<int>& want);
+  void remove_want_pg_temp(pg_t pgid);
   void send_pg_temp();
 
   // -- failures --
@@ -738,6 +838,8 @@ protected:
     void _dequeue(PG *pg) {
       if (pg->recovery_item.remove_myself())
 	pg->put();
+      if (osd->recovery_queue.empty())
+	osd->op_sched_cancel(OP_CLASS_RECOVERY);
     }
     PG *_dequeue() {
       if (osd->recovery_queue.empty())
@@ -745,6 +847,9 @@ protected:
       
       if (!osd->_recover_now())
 	return NULL;
+      if (!osd->op_sched_start(OP_CLASS_RECOVERY,
+			       g_conf->osd_recovery_max_chunk))
+	return NULL;
 
       PG *pg = osd->recovery_queue.front();
       osd->recovery_queue.pop_front();
@@ -759,6 +864,7 @@ protected:
 	osd->recovery_queue.pop_front();
 	pg->put();
       }
+      osd->op_sched_cancel(OP_CLASS_RECOVERY);
     }
   } recovery_wq;
 
@@ -787,6 +893,30 @@ protected:
 
   // -- snap trimming --
   xlist<PG*> snap_trim_queue;
+
+  /*
+   * osd_snap_trim_max_{objects,bytes}_per_sec: each batch trimmed
+   * pushes snap_trim_next out by the time it is worth at those rates,
+   * and the trim queue hands out no pgs until the clock passes it.
+   */
+  Mutex snap_trim_budget_lock;
+  utime_t snap_trim_next;
+  void snap_trim_charge(unsigned objects, uint64_t bytes);
+  bool snap_trim_budget_ok();
+
+  // nothing else wakes the queue once the budget runs out, so kick it
+  // at snap_trim_next.  timer lock is taken before disk_tp's.
+  Mutex snap_trim_timer_lock;
+  SafeTimer snap_trim_timer;
+  Context *snap_trim_kick;  ///< pending wakeup
+  struct C_SnapTrimKick : public Context {
+    OSD *osd;
+    C_SnapTrimKick(OSD *o) : osd(o) {}
+    void finish(int r) {
+      osd->snap_trim_kick = NULL;
+      osd->snap_trim_wq.kick();
+    }
+  };
   
   struct SnapTrimWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
@@ -806,10 +936,18 @@ protected:
     void _dequeue(PG *pg) {
       if (pg->snap_trim_item.remove_myself())
 	pg->put();
+      if (osd->snap_trim_queue.empty())
+	osd->op_sched_cancel(OP_CLASS_SNAPTRIM);
     }
     PG *_dequeue() {
       if (osd->snap_trim_queue.empty())
 	return NULL;
+      // over budget; snap_trim_kick wakes us when it's not
+      if (!osd->snap_trim_budget_ok())
+	return NULL;
+      if (!osd->op_sched_start(OP_CLASS_SNAPTRIM,
+			       g_conf->osd_op_sched_snaptrim_cost))
+	return NULL;
       PG *pg = osd->snap_trim_queue.front();
       osd->snap_trim_queue.pop_front();
       return pg;
@@ -819,6 +957,7 @@ protected:
     }
     void _clear() {
       osd->snap_trim_queue.clear();
+      osd->op_sched_cancel(OP_CLASS_SNAPTRIM);
     }
   } snap_trim_wq;
 
@@ -826,6 +965,15 @@ protected:
   Mutex sched_scrub_lock;
   int scrubs_pending;
   int scrubs_active;
+
+  // -- object context cache --
+  atomic_t context_cache_size;  // idle obcs and sscs cached by all pgs
+  atomic_t context_cache_seq;   // stamps contexts as they go idle
+  Mutex context_cache_lock;
+  set< pair<uint64_t, PG*> > context_cache_oldest;  // pgs by their oldest idle context
+
+  void context_cache_reindex(PG *pg, uint64_t from, uint64_t to);
+  PG *context_cache_oldest_pg();
   set< pair<utime_t,pg_t> > last_scrub_pg;
 
   bool scrub_should_schedule();
@@ -870,16 +1018,22 @@ protected:
       if (pg->scrub_item.remove_myself()) {
 	pg->put();
       }
+      if (osd->scrub_queue.empty())
+	osd->op_sched_cancel(OP_CLASS_SCRUB);
     }
     PG *_dequeue() {
       if (osd->scrub_queue.empty())
 	return NULL;
+      if (!osd->op_sched_start(OP_CLASS_SCRUB,
+			       g_conf->osd_op_sched_scrub_cost))
+	return NULL;
       PG *pg = osd->scrub_queue.front();
       osd->scrub_queue.pop_front();
       return pg;
     }
     void _process(PG *pg) {
       pg->scrub();
+      pg->put();
     }
     void _clear() {
       while (!osd->scrub_queue.empty()) {
@@ -887,54 +1041,10 @@ protected:
 	osd->scrub_queue.pop_front();
 	pg->put();
       }
+      osd->op_sched_cancel(OP_CLASS_SCRUB);
     }
   } scrub_wq;
 
-  struct ScrubFinalizeWQ : public ThreadPool::WorkQueue<PG> {
-  private:
-    OSD *osd;
-    xlist<PG*> scrub_finalize_queue;
-
-  public:
-    ScrubFinalizeWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::ScrubFinalizeWQ", ti, ti*10, tp), osd(o) {}
-
-    bool _empty() {
-      return scrub_finalize_queue.empty();
-    }
-    bool _enqueue(PG *pg) {
-      if (pg->scrub_finalize_item.is_on_list()) {
-	return false;
-      }
-      pg->get();
-      scrub_finalize_queue.push_back(&pg->scrub_finalize_item);
-      return true;
-    }
-    void _dequeue(PG *pg) {
-      if (pg->scrub_finalize_item.remove_myself()) {
-	pg->put();
-      }
-    }
-    PG *_dequeue() {
-      if (scrub_finalize_queue.empty())
-	return NULL;
-      PG *pg = scrub_finalize_queue.front();
-      scrub_finalize_queue.pop_front();
-      return pg;
-    }
-    void _process(PG *pg) {
-      pg->scrub_finalize();
-      pg->put();
-    }
-    void _clear() {
-      while (!scrub_finalize_queue.empty()) {
-	PG *pg = scrub_finalize_queue.front();
-	scrub_finalize_queue.pop_front();
-	pg->put();
-      }
-    }
-  } scrub_finalize_wq;
-
   struct RepScrubWQ : public ThreadPool::WorkQueue<MOSDRepScrub> {
   private: 
     OSD *osd;
@@ -1024,6 +1134,110 @@ protected:
     }
   } remove_wq;
 
+  /*
+   * a removed pg's collections are renamed out of the way in one
+   * transaction, and their objects reaped here later, a batch at a
+   * time, as the op scheduler admits OP_CLASS_REMOVAL work.  anything
+   * left at shutdown is found again by load_pgs.
+   */
+  struct RemovalColl {
+    coll_t cid;
+    uint64_t removed;  ///< objects reaped so far
+    bool done;
+    RemovalColl(coll_t c) : cid(c), removed(0), done(false) {}
+  };
+  list<RemovalColl*> reap_queue;
+  set<RemovalColl*> reaping;            ///< being worked on; both under disk_tp's lock
+  Cond reap_cond;                       ///< a batch of reaping finished
+  uint64_t next_removal_seq;            ///< protected by osd_lock
+  ObjectStore::Sequencer removal_osr;   ///< the renames and the reaping
+
+  struct ReapWQ : public ThreadPool::WorkQueue<RemovalColl> {
+    OSD *osd;
+    ReapWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<RemovalColl>("OSD::ReapWQ", ti, 0, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->reap_queue.empty();
+    }
+    bool _enqueue(RemovalColl *rc) {
+      osd->reap_queue.push_back(rc);
+      return true;
+    }
+    void _dequeue(RemovalColl *rc) {
+      assert(0);
+    }
+    RemovalColl *_dequeue() {
+      if (osd->reap_queue.empty())
+	return NULL;
+      if (!osd->op_sched_start(OP_CLASS_REMOVAL,
+			       g_conf->osd_op_sched_removal_cost))
+	return NULL;
+      RemovalColl *rc = osd->reap_queue.front();
+      osd->reap_queue.pop_front();
+      osd->reaping.insert(rc);
+      return rc;
+    }
+    void _process(RemovalColl *rc) {
+      osd->reap_removal_coll(rc);
+    }
+    void _process_finish(RemovalColl *rc);
+    void _clear() {
+      while (!osd->reap_queue.empty()) {
+	delete osd->reap_queue.front();
+	osd->reap_queue.pop_front();
+      }
+      osd->op_sched_cancel(OP_CLASS_REMOVAL);
+    }
+  } reap_wq;
+
+  void queue_removal_coll(coll_t cid);
+  void reap_removal_coll(RemovalColl *rc);
+  void finish_reaping(pg_t pgid);
+  void dump_pg_removal(ostream& ss);
+
+  // -- map advance --
+  xlist<PG*> map_advance_queue;
+
+  struct MapAdvanceWQ : public ThreadPool::WorkQueue<PG> {
+    OSD *osd;
+    MapAdvanceWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::MapAdvanceWQ", ti, 0, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->map_advance_queue.empty();
+    }
+    bool _enqueue(PG *pg) {
+      if (pg->map_advance_item.is_on_list())
+	return false;
+      pg->get();
+      osd->map_advance_queue.push_back(&pg->map_advance_item);
+      return true;
+    }
+    void _dequeue(PG *pg) {
+      if (pg->map_advance_item.remove_myself())
+	pg->put();
+    }
+    PG *_dequeue() {
+      if (osd->map_advance_queue.empty())
+	return NULL;
+      PG *pg = osd->map_advance_queue.front();
+      osd->map_advance_queue.pop_front();
+      return pg;
+    }
+    void _process(PG *pg) {
+      osd->_advance_pg(pg);
+      pg->put();
+    }
+    void _clear() {
+      while (!osd->map_advance_queue.empty()) {
+	PG *pg = osd->map_advance_queue.front();
+	osd->map_advance_queue.pop_front();
+	pg->put();
+      }
+    }
+  } map_advance_wq;
+
  private:
   bool ms_dispatch(Message *m);
   bool ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new);
@@ -1041,6 +1255,11 @@ protected:
       MonClient *mc, const std::string &dev, const std::string &jdev);
   ~OSD();
 
+  // config observer
+  virtual const char** get_tracked_conf_keys() const;
+  virtual void handle_conf_change(const struct md_config_t *conf,
+				  const std::set <std::string> &changed);
+
   // static bits
   static int find_osd_dev(char *result, int whoami);
   static ObjectStore *create_object_store(const std::string &dev, const std::string &jdev);
@@ -1093,6 +1312,7 @@ public:
   void handle_scrub(class MOSDScrub *m);
   void handle_osd_ping(class MOSDPing *m);
   void handle_op(OpRequestRef op);
+  void handle_op_batch(class MOSDOpBatch *m);
   void handle_sub_op(OpRequestRef op);
   void handle_sub_op_reply(OpRequestRef op);
 
@@ -1118,6 +1338,58 @@ public:
 			ReplicatedPG *pg);
   Mutex watch_lock;
   SafeTimer watch_timer;
+
+  // -- notify fan-out --
+  /**
+   * one notify's messages, sent by notify_thread.  a new notify only
+   * names its watchers; the notify thread looks up their sessions
+   * under watch_lock, so the pg lock isn't held for it.  holds a ref on
+   * each connection in targets.
+   */
+  struct NotifyFanout {
+    uint64_t notify_id;
+    uint64_t ver;
+    uint8_t opcode;
+    bufferlist bl;
+    vector<pair<entity_name_t, uint64_t> > watchers; ///< name, watch cookie
+    vector<pair<Connection*, uint64_t> > targets;   ///< connection, watch cookie
+
+    NotifyFanout(uint64_t i, uint64_t v, uint8_t o, bufferlist& b)
+      : notify_id(i), ver(v), opcode(o), bl(b) {}
+    void add_target(Connection *con, uint64_t cookie) {
+      con->get();
+      targets.push_back(make_pair(con, cookie));
+    }
+    void add_watcher(const entity_name_t& name, uint64_t cookie) {
+      watchers.push_back(make_pair(name, cookie));
+    }
+  };
+  void queue_notify_fanout(NotifyFanout *f);
+private:
+  /*
+   * notify_thread takes everything queued at once, so a burst of
+   * notifies to the same clients goes out as one MWatchNotifyBatch per
+   * connection (up to osd_notify_batch_max each) where the client
+   * supports it.
+   */
+  Mutex notify_queue_lock;
+  Cond notify_queue_cond;
+  bool notify_stop;
+  list<NotifyFanout*> notify_queue;
+  void notify_entry();
+  void resolve_notify_fanouts(list<NotifyFanout*>& q);
+  void send_notify_fanouts(list<NotifyFanout*>& q);
+
+  struct T_Notify : public Thread {
+    OSD *osd;
+    T_Notify(OSD *o) : osd(o) {}
+    void *entry() {
+      osd->notify_entry();
+      return 0;
+    }
+  } notify_thread;
+
+public:
   void handle_notify_timeout(void *notif);
   void disconnect_session_watches(Session *session);
   void handle_watch_timeout(void *obc,
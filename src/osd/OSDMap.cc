@@ -82,6 +82,40 @@ ostream& operator<<(ostream& out, const osd_info_t& info)
   return out;
 }
 
+// ----------------------------------
+// osd_xinfo_t
+
+void osd_xinfo_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("features", features);
+}
+
+void osd_xinfo_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(features, bl);
+  ENCODE_FINISH(bl);
+}
+
+void osd_xinfo_t::decode(bufferlist::iterator& bl)
+{
+  DECODE_START(1, bl);
+  ::decode(features, bl);
+  DECODE_FINISH(bl);
+}
+
+void osd_xinfo_t::generate_test_instances(list<osd_xinfo_t*>& o)
+{
+  o.push_back(new osd_xinfo_t);
+  o.push_back(new osd_xinfo_t);
+  o.back()->features = CEPH_FEATURES_ALL;
+}
+
+ostream& operator<<(ostream& out, const osd_xinfo_t& xi)
+{
+  return out << "features " << hex << xi.features << dec;
+}
+
 
 // ----------------------------------
 // OSDMap::Incremental
@@ -208,7 +242,7 @@ void OSDMap::Incremental::encode(bufferlist& bl, uint64_t features) const
   ::encode(new_pg_temp, bl);
 
   // extended
-  __u16 ev = 8;
+  __u16 ev = 9;
   ::encode(ev, bl);
   ::encode(new_hb_up, bl);
   ::encode(new_up_thru, bl);
@@ -219,6 +253,7 @@ void OSDMap::Incremental::encode(bufferlist& bl, uint64_t features) const
   ::encode(new_up_internal, bl);
   ::encode(cluster_snapshot, bl);
   ::encode(new_uuid, bl);
+  ::encode(new_xinfo, bl);
 }
 
 void OSDMap::Incremental::decode(bufferlist::iterator &p)
@@ -308,6 +343,8 @@ void OSDMap::Incremental::decode(bufferlist::iterator &p)
     ::decode(cluster_snapshot, p);
   if (ev >= 8)
     ::decode(new_uuid, p);
+  if (ev >= 9)
+    ::decode(new_xinfo, p);
 }
 
 void OSDMap::Incremental::dump(Formatter *f) const
@@ -455,6 +492,15 @@ void OSDMap::Incremental::dump(Formatter *f) const
     f->close_section();
   }
   f->close_section();
+
+  f->open_array_section("new_xinfo");
+  for (map<int32_t,osd_xinfo_t>::const_iterator p = new_xinfo.begin(); p != new_xinfo.end(); ++p) {
+    f->open_object_section("xinfo");
+    f->dump_int("osd", p->first);
+    p->second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
 }
 
 void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
@@ -501,11 +547,13 @@ void OSDMap::set_max_osd(int m)
     osd_weight[o] = CEPH_OSD_OUT;
   }
   osd_info.resize(m);
+  osd_xinfo.resize(m);
   osd_addrs->client_addr.resize(m);
   osd_addrs->cluster_addr.resize(m);
   osd_addrs->hb_addr.resize(m);
   osd_uuid->resize(m);
 
+  _invalidate_pg_mappings();
   calc_num_osds();
 }
 
@@ -643,6 +691,66 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   if (o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
     n->osd_uuid = o->osd_uuid;
+
+  // can we share the crush results?  they depend on crush, the weights,
+  // which osds exist and the pool's placement parameters.
+  bool same_placement = (n->crush == o->crush &&
+			 n->osd_weight == o->osd_weight);
+  for (int i = 0; same_placement && i < n->max_osd; i++)
+    if (n->exists(i) != o->exists(i))
+      same_placement = false;
+  if (same_placement) {
+    for (map<int64_t,std::tr1::shared_ptr<PoolMapping> >::iterator p = n->pg_mappings.begin();
+	 p != n->pg_mappings.end();
+	 ++p) {
+      map<int64_t,std::tr1::shared_ptr<PoolMapping> >::const_iterator q =
+	o->pg_mappings.find(p->first);
+      if (q != o->pg_mappings.end() &&
+	  q->second->matches(n->pools[p->first]))
+	p->second = q->second;
+    }
+  }
+}
+
+bool OSDMap::PoolMapping::get(unsigned seed, vector<int>& out)
+{
+  Mutex::Locker l(lock);
+  if (seed >= len.size() || len[seed] < 0)
+    return false;
+  vector<int32_t>::iterator p = osds.begin() + seed * size;
+  out.assign(p, p + len[seed]);
+  return true;
+}
+
+void OSDMap::PoolMapping::set(unsigned seed, const vector<int>& in)
+{
+  if (in.size() > size || in.size() > 127)
+    return;
+  Mutex::Locker l(lock);
+  if (len.empty()) {
+    len.resize(pgp_num, -1);
+    osds.resize(pgp_num * size);
+  }
+  if (seed >= len.size())
+    return;
+  std::copy(in.begin(), in.end(), osds.begin() + seed * size);
+  len[seed] = in.size();
+}
+
+void OSDMap::_update_pg_mappings()
+{
+  map<int64_t,std::tr1::shared_ptr<PoolMapping> >::iterator m = pg_mappings.begin();
+  while (m != pg_mappings.end()) {
+    if (pools.count(m->first))
+      ++m;
+    else
+      pg_mappings.erase(m++);
+  }
+  for (map<int64_t,pg_pool_t>::iterator p = pools.begin(); p != pools.end(); ++p) {
+    std::tr1::shared_ptr<PoolMapping>& t = pg_mappings[p->first];
+    if (!t || !t->matches(p->second))
+      t.reset(new PoolMapping(p->second));
+  }
 }
 
 int OSDMap::apply_incremental(Incremental &inc)
@@ -716,11 +824,15 @@ int OSDMap::apply_incremental(Incremental &inc)
     if ((osd_state[i->first] & CEPH_OSD_EXISTS) &&
 	(s & CEPH_OSD_EXISTS))
       (*osd_uuid)[i->first] = uuid_d();
+    if (s & CEPH_OSD_EXISTS)
+      _invalidate_pg_mappings();
     osd_state[i->first] ^= s;
   }
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_client.begin();
        i != inc.new_up_client.end();
        i++) {
+    if (!exists(i->first))
+      _invalidate_pg_mappings();
     osd_state[i->first] |= CEPH_OSD_EXISTS | CEPH_OSD_UP;
     osd_addrs->client_addr[i->first].reset(new entity_addr_t(i->second));
     if (inc.new_hb_up.empty())
@@ -747,6 +859,8 @@ int OSDMap::apply_incremental(Incremental &inc)
   }
   for (map<int32_t,epoch_t>::iterator p = inc.new_lost.begin(); p != inc.new_lost.end(); p++)
     osd_info[p->first].lost_at = p->second;
+  for (map<int32_t,osd_xinfo_t>::iterator p = inc.new_xinfo.begin(); p != inc.new_xinfo.end(); ++p)
+    osd_xinfo[p->first] = p->second;
 
   // uuid
   for (map<int32_t,uuid_d>::iterator p = inc.new_uuid.begin(); p != inc.new_uuid.end(); ++p) 
@@ -784,8 +898,13 @@ int OSDMap::apply_incremental(Incremental &inc)
     bufferlist::iterator blp = inc.crush.begin();
     crush.reset(new CrushWrapper);
     crush->decode(blp);
+    _invalidate_pg_mappings();
   }
 
+  // pools with new placement parameters get a fresh table; everything
+  // else keeps what we have computed so far.
+  _update_pg_mappings();
+
   calc_num_osds();
   return 0;
 }
@@ -835,6 +954,22 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
 }
 
 int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+{
+  map<int64_t,std::tr1::shared_ptr<PoolMapping> >::const_iterator p =
+    pg_mappings.find(pg.pool());
+  if (p == pg_mappings.end() || !p->second->matches(pool))
+    return _calc_pg_to_osds(pool, pg, osds);
+
+  unsigned seed = ceph_stable_mod(pg.ps(), pool.get_pgp_num(), pool.get_pgp_num_mask());
+  if (!p->second->get(seed, osds)) {
+    osds.clear();
+    _calc_pg_to_osds(pool, pg, osds);
+    p->second->set(seed, osds);
+  }
+  return osds.size();
+}
+
+int OSDMap::_calc_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
 {
   // map to osds[]
   ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
@@ -842,6 +977,10 @@ int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
 
   // what crush rule?
   int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  if (ruleno < 0 && pool.is_erasure())
+    // no rule just for erasure pools in this ruleset; chunks can go
+    // wherever replicas would.
+    ruleno = crush->find_rule(pool.get_crush_ruleset(), pg_pool_t::TYPE_REP, size);
   if (ruleno >= 0)
     crush->do_rule(ruleno, pps, osds, size, osd_weight);
 
@@ -1032,7 +1171,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(cbl, bl);
 
   // extended
-  __u16 ev = 8;
+  __u16 ev = 9;
   ::encode(ev, bl);
   ::encode(osd_addrs->hb_addr, bl);
   ::encode(osd_info, bl);
@@ -1041,6 +1180,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(cluster_snapshot_epoch, bl);
   ::encode(cluster_snapshot, bl);
   ::encode(*osd_uuid, bl);
+  ::encode(osd_xinfo, bl);
 }
 
 void OSDMap::decode(bufferlist& bl)
@@ -1146,11 +1286,19 @@ void OSDMap::decode(bufferlist::iterator& p)
     osd_uuid->resize(max_osd);
   }
 
+  if (ev >= 9)
+    ::decode(osd_xinfo, p);
+  else
+    osd_xinfo.resize(max_osd);
+
   // index pool names
   name_pool.clear();
   for (map<int64_t,string>::iterator i = pool_name.begin(); i != pool_name.end(); i++)
     name_pool[i->second] = i->first;
 
+  _invalidate_pg_mappings();
+  _update_pg_mappings();
+
   calc_num_osds();
 }
 
@@ -1194,6 +1342,7 @@ void OSDMap::dump(Formatter *f) const
       f->dump_int("up", is_up(i));
       f->dump_int("in", is_in(i));
       get_info(i).dump(f);
+      get_xinfo(i).dump(f);
       f->dump_stream("public_addr") << get_addr(i);
       f->dump_stream("cluster_addr") << get_cluster_addr(i);
       f->dump_stream("heartbeat_addr") << get_hb_addr(i);
@@ -1468,6 +1617,9 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
     set_state(i, 0);
     set_weight(i, CEPH_OSD_OUT);
   }
+
+  _invalidate_pg_mappings();
+  _update_pg_mappings();
 }
 
 
@@ -1584,6 +1736,9 @@ void OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
     set_state(i, 0);
     set_weight(i, CEPH_OSD_OUT);
   }
+
+  _invalidate_pg_mappings();
+  _update_pg_mappings();
 }
 
 void OSDMap::build_simple_crush_map_from_conf(CephContext *cct, CrushWrapper& crush,
@@ -87,6 +87,26 @@ WRITE_CLASS_ENCODER(osd_info_t)
 ostream& operator<<(ostream& out, const osd_info_t& info);
 
 
+/*
+ * what the monitor knows about an osd beyond its map state.  features
+ * is what the osd supported when it last booted, so the monitor can
+ * refuse map changes that an up osd could not cope with.
+ */
+struct osd_xinfo_t {
+  uint64_t features;  ///< CEPH_FEATURE_* as of the osd's last boot
+
+  osd_xinfo_t() : features(0) {}
+
+  void dump(Formatter *f) const;
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& bl);
+  static void generate_test_instances(list<osd_xinfo_t*>& o);
+};
+WRITE_CLASS_ENCODER(osd_xinfo_t)
+
+ostream& operator<<(ostream& out, const osd_xinfo_t& xi);
+
+
 /** OSDMap
  */
 class OSDMap {
@@ -118,6 +138,7 @@ public:
     map<int32_t,pair<epoch_t,epoch_t> > new_last_clean_interval;
     map<int32_t,epoch_t> new_lost;
     map<int32_t,uuid_d> new_uuid;
+    map<int32_t,osd_xinfo_t> new_xinfo;
 
     map<entity_addr_t,utime_t> new_blacklist;
     vector<entity_addr_t> old_blacklist;
@@ -170,6 +191,7 @@ private:
 
   vector<__u32>   osd_weight;   // 16.16 fixed point, 0x10000 = "in", 0 = "out"
   vector<osd_info_t> osd_info;
+  vector<osd_xinfo_t> osd_xinfo;
   std::tr1::shared_ptr< map<pg_t,vector<int> > > pg_temp;  // temp pg mapping (e.g. while we rebuild)
 
   map<int64_t,pg_pool_t> pools;
@@ -183,6 +205,40 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * raw crush output for each placement seed of a pool, filled in
+   * lazily as pgs are mapped.  it depends only on the crush map, the
+   * osd weights, which osds exist and the pool's placement parameters,
+   * so successive epochs share a table (see dedup()) until one of
+   * those changes.
+   */
+  struct PoolMapping {
+    Mutex lock;
+    unsigned pgp_num, size;
+    int crush_ruleset;
+    unsigned type;
+    vector<int32_t> osds;  // size slots per seed
+    vector<int8_t> len;    // osds used per seed, -1 if not yet computed
+
+    PoolMapping(const pg_pool_t& pool)
+      : lock("OSDMap::PoolMapping::lock", false, false),
+	pgp_num(pool.get_pgp_num()), size(pool.get_size()),
+	crush_ruleset(pool.get_crush_ruleset()), type(pool.get_type()) {}
+
+    bool matches(const pg_pool_t& pool) const {
+      return pgp_num == pool.get_pgp_num() && size == pool.get_size() &&
+	crush_ruleset == pool.get_crush_ruleset() && type == pool.get_type();
+    }
+    bool get(unsigned seed, vector<int>& out);
+    void set(unsigned seed, const vector<int>& in);
+  };
+  map<int64_t,std::tr1::shared_ptr<PoolMapping> > pg_mappings;
+
+  void _invalidate_pg_mappings() {
+    pg_mappings.clear();
+  }
+  void _update_pg_mappings();
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
@@ -257,6 +313,8 @@ private:
   }
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
+    if ((osd_state[o] ^ s) & CEPH_OSD_EXISTS)
+      _invalidate_pg_mappings();
     osd_state[o] = s;
   }
   void set_weightf(int o, float w) {
@@ -264,6 +322,9 @@ private:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    if (osd_weight[o] != w ||
+	(w && !(osd_state[o] & CEPH_OSD_EXISTS)))
+      _invalidate_pg_mappings();
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -356,6 +417,11 @@ private:
     assert(osd < max_osd);
     return osd_info[osd];
   }
+
+  const osd_xinfo_t& get_xinfo(int osd) const {
+    assert(osd < max_osd);
+    return osd_xinfo[osd];
+  }
   
   int get_any_up_osd() const {
     for (int i=0; i<max_osd; i++)
@@ -407,6 +473,7 @@ public:
 private:
   /// pg -> (raw osd list)
   int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const;
+  int _calc_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const;
   void _remove_nonexistent_osds(vector<int>& osds) const;
 
   /// pg -> (up osd list)
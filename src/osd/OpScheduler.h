@@ -0,0 +1,447 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 New Dream Network/Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_OSD_OPSCHEDULER_H
+#define CEPH_OSD_OPSCHEDULER_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+#include "include/utime.h"
+#include "include/assert.h"
+#include "include/intarith.h"
+#include "common/Mutex.h"
+#include "common/Formatter.h"
+
+/// classes of work sharing the osd
+enum {
+  OP_CLASS_CLIENT = 0,   ///< client ops and their replication
+  OP_CLASS_RECOVERY,     ///< recovery and backfill
+  OP_CLASS_SCRUB,        ///< scrub
+  OP_CLASS_SNAPTRIM,     ///< snap trimming
+  OP_CLASS_REMOVAL,      ///< reaping removed pgs' objects
+  OP_CLASS_MAX
+};
+
+static inline const char *op_class_name(int c)
+{
+  switch (c) {
+  case OP_CLASS_CLIENT: return "client";
+  case OP_CLASS_RECOVERY: return "recovery";
+  case OP_CLASS_SCRUB: return "scrub";
+  case OP_CLASS_SNAPTRIM: return "snaptrim";
+  case OP_CLASS_REMOVAL: return "removal";
+  default: return "???";
+  }
+}
+
+/**
+ * OpScheduler - decides which class of work the osd does next
+ *
+ * Items are queued with a class, an owner (e.g. the client) and a cost
+ * (bytes plus a per-io charge) and dequeued in the order the scheduler
+ * picks.  Work of a class that is run from its own queue elsewhere asks
+ * for admission with start(); a refusal means "not yet, try again when
+ * kicked", see take_deferred().
+ *
+ * Internally locked.
+ */
+template <typename T>
+class OpScheduler {
+public:
+  struct ClassInfo {
+    double reservation; ///< cost/sec guaranteed, 0 for none
+    double weight;      ///< share of what is left over
+    double limit;       ///< cost/sec cap while others wait, 0 for none
+    ClassInfo(double r = 0, double w = 1, double l = 0)
+      : reservation(r), weight(w), limit(l) {}
+  };
+
+  struct ClassStats {
+    unsigned queued;    ///< items currently queued
+    uint64_t ops;       ///< items dequeued or admitted
+    uint64_t cost;      ///< cost dequeued or admitted
+    uint64_t deferred;  ///< refused start() calls
+    ClassStats() : queued(0), ops(0), cost(0), deferred(0) {}
+  };
+
+  virtual ~OpScheduler() {}
+
+  virtual void set_class_info(int c, const ClassInfo &info) = 0;
+  /// queue items of the same class and owner fairly against each other
+  virtual void set_per_owner(bool per_owner) = 0;
+
+  virtual void enqueue(int c, uint64_t owner, unsigned cost, T item,
+		       utime_t now) = 0;
+  virtual bool empty() = 0;
+  /// @return next item; class and time spent queued in *c and *waited
+  virtual T dequeue(utime_t now, int *c, utime_t *waited) = 0;
+
+  /// @return true if work of class c and this cost may start now
+  virtual bool start(int c, unsigned cost, utime_t now) = 0;
+  /// @return bitmask of classes refused by start() since the last call
+  virtual unsigned take_deferred() = 0;
+  /// class c has nothing left to start(); drop any place it was holding
+  virtual void cancel(int c) = 0;
+
+  virtual ClassStats get_stats(int c) = 0;
+  virtual void dump(Formatter *f) = 0;
+
+  static OpScheduler<T> *create(const std::string &type);
+};
+
+/**
+ * FifoOpScheduler - the old behaviour: one queue, everything admitted
+ */
+template <typename T>
+class FifoOpScheduler : public OpScheduler<T> {
+  typedef typename OpScheduler<T>::ClassInfo ClassInfo;
+  typedef typename OpScheduler<T>::ClassStats ClassStats;
+
+  struct Item {
+    int c;
+    utime_t stamp;
+    T item;
+    Item(int c, utime_t s, T i) : c(c), stamp(s), item(i) {}
+  };
+
+  Mutex lock;
+  std::list<Item> q;
+  ClassStats stats[OP_CLASS_MAX];
+
+public:
+  FifoOpScheduler() : lock("FifoOpScheduler::lock") {}
+
+  void set_class_info(int c, const ClassInfo &info) {}
+  void set_per_owner(bool per_owner) {}
+
+  void enqueue(int c, uint64_t owner, unsigned cost, T item, utime_t now) {
+    Mutex::Locker l(lock);
+    assert(c >= 0 && c < OP_CLASS_MAX);
+    q.push_back(Item(c, now, item));
+    stats[c].queued++;
+  }
+  bool empty() {
+    Mutex::Locker l(lock);
+    return q.empty();
+  }
+  T dequeue(utime_t now, int *c, utime_t *waited) {
+    Mutex::Locker l(lock);
+    assert(!q.empty());
+    Item i = q.front();
+    q.pop_front();
+    stats[i.c].queued--;
+    stats[i.c].ops++;
+    *c = i.c;
+    *waited = now - i.stamp;
+    return i.item;
+  }
+
+  bool start(int c, unsigned cost, utime_t now) {
+    Mutex::Locker l(lock);
+    stats[c].ops++;
+    stats[c].cost += cost;
+    return true;
+  }
+  unsigned take_deferred() {
+    return 0;
+  }
+  void cancel(int c) {}
+
+  ClassStats get_stats(int c) {
+    Mutex::Locker l(lock);
+    return stats[c];
+  }
+  void dump(Formatter *f) {
+    Mutex::Locker l(lock);
+    f->dump_string("type", "fifo");
+    f->open_array_section("classes");
+    for (int c = 0; c < OP_CLASS_MAX; ++c) {
+      f->open_object_section("class");
+      f->dump_string("name", op_class_name(c));
+      f->dump_unsigned("queued", stats[c].queued);
+      f->dump_unsigned("ops", stats[c].ops);
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+/**
+ * WeightedFairOpScheduler - reservation/weight/limit shares by cost
+ *
+ * Each class has
+ *  - a reservation: cost/sec it is served at ahead of everything else,
+ *  - a weight: its share of the remaining capacity, by start-time fair
+ *    queueing on cost/weight, and
+ *  - a limit: cost/sec above which it only runs if nothing else wants to.
+ *    Limits are work conserving since the thread pools cannot idle with
+ *    work queued.
+ *
+ * A class competes if it has queued items or is asking start().  Work
+ * admitted through start() is charged exactly like dequeued items, and a
+ * class turned away keeps its place as if it were queued (until it is
+ * admitted or cancel()s), so background work done outside the queue takes
+ * its turn fairly against queued client work.
+ */
+template <typename T>
+class WeightedFairOpScheduler : public OpScheduler<T> {
+  typedef typename OpScheduler<T>::ClassInfo ClassInfo;
+  typedef typename OpScheduler<T>::ClassStats ClassStats;
+
+  struct Item {
+    unsigned cost;
+    utime_t stamp;
+    T item;
+    Item(unsigned c, utime_t s, T i) : cost(c), stamp(s), item(i) {}
+  };
+
+  struct Class {
+    ClassInfo info;
+    ClassStats stats;
+    std::map<uint64_t, std::list<Item> > queues; ///< by owner
+    std::list<uint64_t> owners;                  ///< round robin order
+    bool waiting;        ///< refused by start() and not yet admitted
+    double start;        ///< virtual start tag of the head item, if queued
+    double finish;       ///< virtual finish tag of the last item served
+    double next_res;     ///< time the reservation is next due
+    double next_lim;     ///< time the limit next allows work
+    Class() : waiting(false), start(0), finish(0), next_res(0), next_lim(0) {}
+
+    unsigned head_cost() {
+      assert(!owners.empty());
+      return queues[owners.front()].front().cost;
+    }
+  };
+
+  Mutex lock;
+  Class classes[OP_CLASS_MAX];
+  bool per_owner;
+  double vtime;          ///< virtual time, start tag of the last item served
+  unsigned total;        ///< queued items
+  unsigned deferred;     ///< classes refused by start(), bitmask
+
+  /// start tag if class c were served next; a backlogged class keeps its own
+  double start_tag(int c) {
+    Class &k = classes[c];
+    if (k.stats.queued || k.waiting)
+      return k.start;
+    return MAX(k.finish, vtime);
+  }
+  /// finish tag if class c were served next with cost
+  double tag(int c, unsigned cost) {
+    return start_tag(c) + (double)cost / MAX(classes[c].info.weight, 0.0001);
+  }
+
+  /**
+   * Pick the class to serve next
+   *
+   * @param extra class asking start() (-1 for none) and its cost
+   */
+  int pick(double now, int extra, unsigned extra_cost) {
+    int best = -1;
+    double best_tag = 0;
+
+    // reservations that are due, earliest first
+    for (int c = 0; c < OP_CLASS_MAX; ++c) {
+      Class &k = classes[c];
+      if (!k.stats.queued && c != extra)
+	continue;
+      if (k.info.reservation <= 0 || k.next_res > now)
+	continue;
+      if (best < 0 || k.next_res < best_tag) {
+	best = c;
+	best_tag = k.next_res;
+      }
+    }
+    if (best >= 0)
+      return best;
+
+    // weighted share among classes under their limit
+    for (int c = 0; c < OP_CLASS_MAX; ++c) {
+      Class &k = classes[c];
+      if (!k.stats.queued && c != extra)
+	continue;
+      if (k.info.limit > 0 && k.next_lim > now)
+	continue;
+      double t = tag(c, c == extra ? extra_cost : k.head_cost());
+      if (best < 0 || t < best_tag) {
+	best = c;
+	best_tag = t;
+      }
+    }
+    if (best >= 0)
+      return best;
+
+    // everyone is over their limit; whoever gets under it first
+    for (int c = 0; c < OP_CLASS_MAX; ++c) {
+      Class &k = classes[c];
+      if (!k.stats.queued && c != extra)
+	continue;
+      if (best < 0 || k.next_lim < best_tag) {
+	best = c;
+	best_tag = k.next_lim;
+      }
+    }
+    return best;
+  }
+
+  void charge(int c, unsigned cost, double now) {
+    Class &k = classes[c];
+    double start = start_tag(c);
+    k.finish = tag(c, cost);
+    vtime = MAX(vtime, start);
+    k.start = k.finish;
+    if (k.info.reservation > 0)
+      k.next_res = MAX(k.next_res, now) + (double)cost / k.info.reservation;
+    if (k.info.limit > 0)
+      k.next_lim = MAX(k.next_lim, now) + (double)cost / k.info.limit;
+    k.stats.ops++;
+    k.stats.cost += cost;
+  }
+
+public:
+  WeightedFairOpScheduler()
+    : lock("WeightedFairOpScheduler::lock"),
+      per_owner(false), vtime(0), total(0), deferred(0) {}
+
+  void set_class_info(int c, const ClassInfo &info) {
+    Mutex::Locker l(lock);
+    assert(c >= 0 && c < OP_CLASS_MAX);
+    classes[c].info = info;
+  }
+  void set_per_owner(bool po) {
+    Mutex::Locker l(lock);
+    per_owner = po;
+  }
+
+  void enqueue(int c, uint64_t owner, unsigned cost, T item, utime_t now) {
+    Mutex::Locker l(lock);
+    assert(c >= 0 && c < OP_CLASS_MAX);
+    Class &k = classes[c];
+    if (!per_owner)
+      owner = 0;
+    if (!k.stats.queued && !k.waiting)
+      k.start = MAX(k.finish, vtime);
+    std::list<Item> &q = k.queues[owner];
+    if (q.empty())
+      k.owners.push_back(owner);
+    q.push_back(Item(cost, now, item));
+    k.stats.queued++;
+    total++;
+  }
+
+  bool empty() {
+    Mutex::Locker l(lock);
+    return total == 0;
+  }
+
+  T dequeue(utime_t now, int *c, utime_t *waited) {
+    Mutex::Locker l(lock);
+    assert(total);
+    int best = pick((double)now, -1, 0);
+    assert(best >= 0);
+    Class &k = classes[best];
+
+    uint64_t owner = k.owners.front();
+    k.owners.pop_front();
+    typename std::map<uint64_t, std::list<Item> >::iterator p =
+      k.queues.find(owner);
+    Item i = p->second.front();
+    p->second.pop_front();
+    if (p->second.empty())
+      k.queues.erase(p);
+    else
+      k.owners.push_back(owner);
+    charge(best, i.cost, (double)now);
+    k.stats.queued--;
+    total--;
+    *c = best;
+    *waited = now - i.stamp;
+    return i.item;
+  }
+
+  bool start(int c, unsigned cost, utime_t now) {
+    Mutex::Locker l(lock);
+    assert(c >= 0 && c < OP_CLASS_MAX);
+    Class &k = classes[c];
+    if (pick((double)now, c, cost) != c) {
+      if (!k.waiting && !k.stats.queued)
+	k.start = MAX(k.finish, vtime);
+      k.waiting = true;
+      k.stats.deferred++;
+      deferred |= 1 << c;
+      return false;
+    }
+    charge(c, cost, (double)now);
+    k.waiting = false;
+    return true;
+  }
+
+  unsigned take_deferred() {
+    Mutex::Locker l(lock);
+    unsigned r = deferred;
+    deferred = 0;
+    return r;
+  }
+
+  void cancel(int c) {
+    Mutex::Locker l(lock);
+    assert(c >= 0 && c < OP_CLASS_MAX);
+    Class &k = classes[c];
+    k.waiting = false;
+    deferred &= ~(1 << c);
+  }
+
+  ClassStats get_stats(int c) {
+    Mutex::Locker l(lock);
+    return classes[c].stats;
+  }
+
+  void dump(Formatter *f) {
+    Mutex::Locker l(lock);
+    f->dump_string("type", "wfq");
+    f->dump_float("vtime", vtime);
+    f->open_array_section("classes");
+    for (int c = 0; c < OP_CLASS_MAX; ++c) {
+      Class &k = classes[c];
+      f->open_object_section("class");
+      f->dump_string("name", op_class_name(c));
+      f->dump_float("reservation", k.info.reservation);
+      f->dump_float("weight", k.info.weight);
+      f->dump_float("limit", k.info.limit);
+      f->dump_unsigned("queued", k.stats.queued);
+      f->dump_unsigned("owners", k.owners.size());
+      f->dump_unsigned("ops", k.stats.ops);
+      f->dump_unsigned("cost", k.stats.cost);
+      f->dump_unsigned("deferred", k.stats.deferred);
+      f->dump_float("finish", k.finish);
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+template <typename T>
+OpScheduler<T> *OpScheduler<T>::create(const std::string &type)
+{
+  if (type == "wfq")
+    return new WeightedFairOpScheduler<T>;
+  if (type == "fifo")
+    return new FifoOpScheduler<T>;
+  return NULL;
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "include/ceph_features.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -38,16 +39,9 @@ static ostream& _prefix(std::ostream *_dout, const PG *pg) {
   return *_dout << pg->gen_prefix();
 }
 
-/*
- * take osd->map_lock to get a valid osdmap reference
- */
 void PG::lock(bool no_lockdep)
 {
-  osd->map_lock.get_read();
-  OSDMapRef map = osd->osdmap;
-  osd->map_lock.put_read();
   _lock.Lock(no_lockdep);
-  osdmap_ref.swap(map);
 
   // if we have unrecorded dirty state with the lock dropped, there is a bug
   assert(!dirty_info);
@@ -56,28 +50,14 @@ void PG::lock(bool no_lockdep)
   dout(30) << "lock" << dendl;
 }
 
-/*
- * caller holds osd->map_lock, no need to take it to get a valid
- * osdmap reference.
- */
-void PG::lock_with_map_lock_held(bool no_lockdep)
+bool PG::try_lock()
 {
-  _lock.Lock(no_lockdep);
-  osdmap_ref = osd->osdmap;
-
-  // if we have unrecorded dirty state with the lock dropped, there is a bug
+  if (!_lock.TryLock())
+    return false;
   assert(!dirty_info);
   assert(!dirty_log);
-
-  dout(30) << "lock_with_map_lock_held" << dendl;
-}
-
-void PG::reassert_lock_with_map_lock_held()
-{
-  assert(_lock.is_locked());
-  osdmap_ref = osd->osdmap;
-
-  dout(30) << "reassert_lock_with_map_lock_held" << dendl;
+  dout(30) << "try_lock" << dendl;
+  return true;
 }
 
 void PG::unlock()
@@ -85,10 +65,22 @@ void PG::unlock()
   dout(30) << "unlock" << dendl;
   assert(!dirty_info);
   assert(!dirty_log);
-  osdmap_ref.reset();
   _lock.Unlock();
 }
 
+void PG::update_osdmap_ref(OSDMapRef newmap)
+{
+  assert(_lock.is_locked());
+  osdmap_ref = newmap;
+  osd->note_pg_epoch(info.pgid, newmap->get_epoch());
+}
+
+void PG::set_role(int r)
+{
+  osd->pg_role_changed(role, r);
+  role = r;
+}
+
 std::string PG::gen_prefix() const
 {
   stringstream out;
@@ -169,6 +161,7 @@ void PG::proc_replica_log(ObjectStore::Transaction& t,
 
   list<pg_log_entry_t>::const_reverse_iterator pp = olog.log.rbegin();
   eversion_t lu(oinfo.last_update);
+  map<hobject_t, const pg_log_entry_t*> rollback;  // oldest divergent entry
   while (true) {
     if (pp == olog.log.rend()) {
       if (pp != olog.log.rbegin())   // no last_update adjustment if we discard nothing!
@@ -203,6 +196,9 @@ void PG::proc_replica_log(ObjectStore::Transaction& t,
 
     if (ne.version > oe.version) {
       dout(10) << " had " << oe << " new " << ne << " : new will supercede" << dendl;
+    } else if (rolls_back_divergent_entries()) {
+      // sorted out below, once we know where the peer will roll back to
+      rollback[oe.soid] = &oe;
     } else {
       if (oe.is_delete()) {
 	if (ne.is_delete()) {
@@ -229,6 +225,23 @@ void PG::proc_replica_log(ObjectStore::Transaction& t,
     ++pp;
   }    
 
+  for (map<hobject_t, const pg_log_entry_t*>::iterator p = rollback.begin();
+       p != rollback.end();
+       ++p) {
+    const pg_log_entry_t& oe = *p->second;
+    pg_log_entry_t& ne = *log.objects[oe.soid];
+    if (oe.prior_version == ne.version) {
+      dout(10) << " had " << oe << " new " << ne << " : peer will roll back" << dendl;
+    } else if (ne.is_delete()) {
+      dout(10) << " had " << oe << " new " << ne << " : new will supercede" << dendl;
+      if (!oe.is_delete())
+	omissing.rm(oe.soid, oe.version);
+    } else {
+      dout(10) << " had " << oe << " new " << ne << " : missing" << dendl;
+      omissing.revise_need(ne.soid, ne.version);
+    }
+  }
+
   if (lu < oinfo.last_update) {
     dout(10) << " peer osd." << from << " last_update now " << lu << dendl;
     oinfo.last_update = lu;
@@ -400,6 +413,7 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
   if (info.last_complete > newhead)
     info.last_complete = newhead;
 
+  rollback_divergent_entries(t, divergent);
   for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++)
     merge_old_entry(t, *d);
 
@@ -526,6 +540,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
       info.stats = oinfo.stats;
 
     // process divergent items
+    rollback_divergent_entries(t, divergent);
     if (!divergent.empty()) {
       for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++)
 	merge_old_entry(t, *d);
@@ -745,7 +760,7 @@ void PG::generate_past_intervals()
 
   epoch_t cur_epoch = MAX(MAX(info.history.epoch_created,
 			      info.history.last_epoch_clean),
-			  osd->superblock.oldest_map);
+			  oldest_map);
   OSDMapRef last_map, cur_map;
   if (cur_epoch >= end_epoch) {
     dout(10) << __func__ << " start epoch " << cur_epoch
@@ -941,7 +956,7 @@ void PG::clear_primary_state()
  * find_best_info
  *
  * Returns an iterator to the best info in infos sorted by:
- *  1) Prefer newer last_update
+ *  1) Prefer newer last_update, up to what min_peers_for_update() peers have
  *  2) Prefer longer tail if it brings another info into contiguity
  *  3) Prefer current primary
  */
@@ -963,6 +978,27 @@ map<int, pg_info_t>::const_iterator PG::find_best_info(const map<int, pg_info_t>
   }
   assert(min_last_update_acceptable != eversion_t::max());
 
+  // a write fewer than min_peers_for_update() peers have can't be
+  // read back; pick a log without it, and peers that have it roll back
+  eversion_t max_last_update_acceptable = eversion_t::max();
+  unsigned need = min_peers_for_update();
+  if (need > 1) {
+    vector<eversion_t> updates;
+    for (map<int, pg_info_t>::const_iterator i = infos.begin();
+	 i != infos.end();
+	 ++i) {
+      if (!i->second.is_incomplete() &&
+	  i->second.last_update >= min_last_update_acceptable)
+	updates.push_back(i->second.last_update);
+    }
+    if (updates.size() >= need) {
+      sort(updates.begin(), updates.end());
+      max_last_update_acceptable = updates[updates.size() - need];
+      dout(10) << "find_best_info " << need << " peers have "
+	       << max_last_update_acceptable << dendl;
+    }
+  }
+
   map<int, pg_info_t>::const_iterator best = infos.end();
   // find osd with newest last_update.  if there are multiples, prefer
   //  - a longer tail, if it brings another peer into log contiguity
@@ -973,6 +1009,9 @@ map<int, pg_info_t>::const_iterator PG::find_best_info(const map<int, pg_info_t>
     // Only consider peers with last_update >= min_last_update_acceptable
     if (p->second.last_update < min_last_update_acceptable)
       continue;
+    // ...and <= max_last_update_acceptable
+    if (p->second.last_update > max_last_update_acceptable)
+      continue;
     // Disquality anyone who is incomplete (not fully backfilled)
     if (p->second.is_incomplete())
       continue;
@@ -1294,6 +1333,9 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
   // Check local snaps
   adjust_local_snaps();
 
+  if (is_primary())
+    mark_misplaced_objects();
+
   // init complete pointer
   if (missing.num_missing() == 0) {
     dout(10) << "activate - no missing, moving last_complete " << info.last_complete 
@@ -1698,6 +1740,99 @@ void PG::finish_recovery_op(const hobject_t& soid, bool dequeue)
   osd->finish_recovery_op(this, soid, dequeue);
 }
 
+void PG::recover_got(hobject_t oid, eversion_t v)
+{
+  if (missing.is_missing(oid, v)) {
+    dout(10) << "got missing " << oid << " v " << v << dendl;
+    missing.got(oid, v);
+    if (is_primary())
+      missing_loc.erase(oid);
+      
+    // raise last_complete?
+    if (missing.missing.empty()) {
+      log.complete_to = log.log.end();
+      info.last_complete = info.last_update;
+    }
+    while (log.complete_to != log.log.end()) {
+      if (missing.missing[missing.rmissing.begin()->second].need <=
+	  log.complete_to->version)
+	break;
+      if (info.last_complete < log.complete_to->version)
+	info.last_complete = log.complete_to->version;
+      log.complete_to++;
+    }
+    if (log.complete_to != log.log.end()) {
+      dout(10) << "last_complete now " << info.last_complete
+	       << " log.complete_to " << log.complete_to->version
+	       << dendl;
+    } else {
+      dout(10) << "last_complete now " << info.last_complete
+	       << " log.complete_to at end" << dendl;
+      assert(missing.num_missing() == 0);  // otherwise, complete_to was wrong.
+      assert(info.last_complete == info.last_update);
+    }
+  }
+}
+
+
+int PG::do_xattr_cmp_u64(int op, __u64 v1, bufferlist& xattr)
+{
+  __u64 v2;
+  if (xattr.length())
+    v2 = atoll(xattr.c_str());
+  else
+    v2 = 0;
+
+  dout(20) << "do_xattr_cmp_u64 '" << v1 << "' vs '" << v2 << "' op " << op << dendl;
+
+  switch (op) {
+  case CEPH_OSD_CMPXATTR_OP_EQ:
+    return (v1 == v2);
+  case CEPH_OSD_CMPXATTR_OP_NE:
+    return (v1 != v2);
+  case CEPH_OSD_CMPXATTR_OP_GT:
+    return (v1 > v2);
+  case CEPH_OSD_CMPXATTR_OP_GTE:
+    return (v1 >= v2);
+  case CEPH_OSD_CMPXATTR_OP_LT:
+    return (v1 < v2);
+  case CEPH_OSD_CMPXATTR_OP_LTE:
+    return (v1 <= v2);
+  default:
+    return -EINVAL;
+  }
+}
+
+int PG::do_xattr_cmp_str(int op, string& v1s, bufferlist& xattr)
+{
+  const char *v1, *v2;
+  v1 = v1s.data();
+  string v2s;
+  if (xattr.length()) {
+    v2s = string(xattr.c_str(), xattr.length());
+    v2 = v2s.c_str();
+  } else
+    v2 = "";
+
+  dout(20) << "do_xattr_cmp_str '" << v1s << "' vs '" << v2 << "' op " << op << dendl;
+
+  switch (op) {
+  case CEPH_OSD_CMPXATTR_OP_EQ:
+    return (strcmp(v1, v2) == 0);
+  case CEPH_OSD_CMPXATTR_OP_NE:
+    return (strcmp(v1, v2) != 0);
+  case CEPH_OSD_CMPXATTR_OP_GT:
+    return (strcmp(v1, v2) > 0);
+  case CEPH_OSD_CMPXATTR_OP_GTE:
+    return (strcmp(v1, v2) >= 0);
+  case CEPH_OSD_CMPXATTR_OP_LT:
+    return (strcmp(v1, v2) < 0);
+  case CEPH_OSD_CMPXATTR_OP_LTE:
+    return (strcmp(v1, v2) <= 0);
+  default:
+    return -EINVAL;
+  }
+}
 
 void PG::defer_recovery()
 {
@@ -1816,6 +1951,8 @@ void PG::update_stats()
     info.stats.created = info.history.epoch_created;
     info.stats.last_scrub = info.history.last_scrub;
     info.stats.last_scrub_stamp = info.history.last_scrub_stamp;
+    info.stats.last_deep_scrub = info.history.last_deep_scrub;
+    info.stats.last_deep_scrub_stamp = info.history.last_deep_scrub_stamp;
     info.stats.last_epoch_clean = info.history.last_epoch_clean;
 
     utime_t now = ceph_clock_now(g_ceph_context);
@@ -1830,10 +1967,14 @@ void PG::update_stats()
       info.stats.last_active = now;
     info.stats.last_unstale = now;
 
-    info.stats.log_size = ondisklog.length();
-    info.stats.ondisk_log_size = ondisklog.length();
-    info.stats.log_start = log.tail;
-    info.stats.ondisk_log_start = log.tail;
+    if (!log_deferred) {
+      // otherwise keep the log stats we read with info
+      info.stats.log_size = log_bytes;
+      info.stats.ondisk_log_size = log_bytes;
+      info.stats.log_start = log.tail;
+      info.stats.ondisk_log_start = log.tail;
+    }
+    info.stats.snaptrimq_len = snap_trimq.size();
 
     pg_stats_valid = true;
     pg_stats_stable = info.stats;
@@ -1954,37 +2095,32 @@ void PG::write_info(ObjectStore::Transaction& t)
 void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
+  assert(!log_deferred);
 
-  // assemble buffer
-  bufferlist bl;
-
-  // build buffer
-  ondisklog.tail = 0;
+  // one omap key per entry, keyed by version
+  map<string,bufferlist> keys;
+  log_bytes = 0;
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end();
        p++) {
-    uint64_t startoff = bl.length();
-
-    bufferlist ebl(sizeof(*p)*2);
-    ::encode(*p, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, bl);
-    ::encode(crc, bl);
-
-    p->offset = startoff;
+    bufferlist bl(sizeof(*p) * 2);
+    ::encode(*p, bl);
+    log_bytes += bl.length();
+    keys[p->version.get_key_name()].claim(bl);
   }
-  ondisklog.head = bl.length();
-  ondisklog.has_checksums = true;
 
-  // write it
-  t.remove(coll_t::META_COLL, log_oid );
-  t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+  // drop any old sequential log (and its keys) and start over
+  t.remove(coll_t::META_COLL, log_oid);
+  t.touch(coll_t::META_COLL, log_oid);
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
+  ondisklog.zero();
+  ondisklog.has_checksums = true;
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
   t.collection_setattr(coll, "ondisklog", blb);
-  
-  dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+
+  dout(10) << "write_log " << keys.size() << " keys" << dendl;
   dirty_log = false;
 }
 
@@ -2004,45 +2140,21 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
+    set<string> keys;
+    for (list<pg_log_entry_t>::iterator p = log.log.begin();
+	 p != log.log.end() && p->version <= trim_to;
+	 ++p) {
+      bufferlist bl(sizeof(*p) * 2);
+      ::encode(*p, bl);
+      log_bytes -= MIN(log_bytes, bl.length());
+      if (!g_conf->osd_preserve_trimmed_log)
+	keys.insert(p->version.get_key_name());
+    }
     log.trim(t, trim_to);
     info.log_tail = log.tail;
-    trim_ondisklog(t);
-  }
-}
-
-void PG::trim_ondisklog(ObjectStore::Transaction& t) 
-{
-  uint64_t new_tail;
-  if (log.empty()) {
-    new_tail = ondisklog.head;
-  } else {
-    new_tail = log.log.front().offset;
-  }
-  bool same_block = (new_tail & ~4095) == (ondisklog.tail & ~4095);
-  dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
-	   << ", now " << new_tail << "~" << (ondisklog.head - new_tail)
-	   << " " << (same_block ? "(same block)" : "(different block)")
-	   << dendl;
-  assert(new_tail >= ondisklog.tail);
-  
-  if (same_block)
-    return;
-
-  ondisklog.tail = new_tail;
-
-  if (!g_conf->osd_preserve_trimmed_log) {
-    uint64_t zt = new_tail & ~4095;
-    if (zt > ondisklog.zero_to) {
-      t.zero(coll_t::META_COLL, log_oid, ondisklog.zero_to, zt);
-      dout(15) << "trim_ondisklog zeroing from " << ondisklog.zero_to
-	       << " to " << zt << dendl;
-      ondisklog.zero_to = zt;
-    }
+    if (!keys.empty())
+      t.omap_rmkeys(coll_t::META_COLL, log_oid, keys);
   }
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
 }
 
 void PG::trim_peers()
@@ -2057,7 +2169,7 @@ void PG::trim_peers()
   }
 }
 
-void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
+void PG::add_log_entry(pg_log_entry_t& e, map<string,bufferlist>& log_keys)
 {
   // raise last_complete only if we were previously up to date
   if (info.last_complete == info.last_update)
@@ -2069,15 +2181,10 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
 
   // log mutation
   log.add(e);
-  if (ondisklog.has_checksums) {
-    bufferlist ebl(sizeof(e)*2);
-    ::encode(e, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, log_bl);
-    ::encode(crc, log_bl);
-  } else {
-    ::encode(e, log_bl);
-  }
+  bufferlist bl(sizeof(e) * 2);
+  ::encode(e, bl);
+  log_bytes += bl.length();
+  log_keys[e.version.get_key_name()].claim(bl);
   dout(10) << "add_log_entry " << e << dendl;
 }
 
@@ -2086,24 +2193,13 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
 {
   dout(10) << "append_log " << log << " " << logv << dendl;
 
-  bufferlist bl;
+  map<string,bufferlist> keys;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
        p++) {
-    p->offset = ondisklog.head + bl.length();
-    add_log_entry(*p, bl);
+    add_log_entry(*p, keys);
   }
-
-  dout(10) << "append_log  " << ondisklog.tail << "~" << ondisklog.length()
-	   << " adding " << bl.length() << dendl;
-
-  t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
-  ondisklog.head += bl.length();
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
-  dout(10) << "append_log  now " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
   trim(t, trim_to);
 
@@ -2111,7 +2207,11 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
   write_info(t);
 }
 
-void PG::read_log(ObjectStore *store)
+/*
+ * Returns true if the log was found in the old sequential log object
+ * format and must be rewritten (write_log) into omap.
+ */
+bool PG::read_log(ObjectStore *store)
 {
   // load bounds
   ondisklog.tail = ondisklog.head = 0;
@@ -2121,10 +2221,55 @@ void PG::read_log(ObjectStore *store)
   bufferlist::iterator p = blb.begin();
   ::decode(ondisklog, p);
 
-  dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
-
   log.tail = info.log_tail;
+  log_bytes = 0;
 
+  bool legacy = ondisklog.head > 0;
+  if (legacy) {
+    dout(10) << "read_log legacy " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+    read_log_old(store);
+    log_bytes = ondisklog.length();  // until write_log moves it to omap
+  } else {
+    dout(10) << "read_log from omap" << dendl;
+    assert(log.empty());
+    ObjectMap::ObjectMapIterator it = store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (it) {
+      for (it->seek_to_first(); it->valid(); it->next()) {
+	bufferlist bl = it->value();
+	bufferlist::iterator bp = bl.begin();
+	pg_log_entry_t e;
+	::decode(e, bp);
+	dout(20) << "read_log " << it->key() << " " << e << dendl;
+
+	if (e.version <= log.tail) {
+	  dout(20) << "read_log  ignoring entry " << e.version << " below log.tail" << dendl;
+	  continue;
+	}
+	if (e.version > info.last_update) {
+	  osd->clog.error() << info.pgid << " log has extra entry " << e
+			    << " after " << info.last_update << "\n";
+	  dout(0) << "read_log *** extra entry " << e.version << " after last_update "
+		  << info.last_update << ", ignoring" << dendl;
+	  break;
+	}
+	if (e.invalid_pool)
+	  e.soid.pool = info.pgid.pool();
+	log.log.push_back(e);
+	log_bytes += bl.length();
+      }
+    }
+  }
+
+  log.head = info.last_update;
+  log.index();
+
+  // build missing
+  read_log_missing(store);
+  return legacy;
+}
+
+void PG::read_log_old(ObjectStore *store)
+{
   // In case of sobject_t based encoding, may need to list objects in the store
   // to find hashes
   bool listed_collection = false;
@@ -2244,11 +2389,10 @@ void PG::read_log(ObjectStore *store)
 	log.log.push_back(p->second);
     }
   }
+}
 
-  log.head = info.last_update;
-  log.index();
-
-  // build missing
+void PG::read_log_missing(ObjectStore *store)
+{
   if (info.last_complete < info.last_update) {
     dout(10) << "read_log checking for missing items over interval (" << info.last_complete
 	     << "," << info.last_update << "]" << dendl;
@@ -2334,6 +2478,42 @@ bool PG::check_log_for_corruption(ObjectStore *store)
 	dout(30) << " " << pos << " " << e << dendl;
       }
     }
+  } else {
+    // omap log: every entry must decode, sit under its own version's
+    // key, and follow the one before it
+    ObjectMap::ObjectMapIterator it = store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    eversion_t last;
+    if (it) {
+      for (it->seek_to_first(); ok && it->valid(); it->next()) {
+	pg_log_entry_t e;
+	try {
+	  bufferlist bl = it->value();
+	  bufferlist::iterator bp = bl.begin();
+	  ::decode(e, bp);
+	}
+	catch (const buffer::error &err) {
+	  ss << "corrupt entry at key " << it->key();
+	  ok = false;
+	  break;
+	}
+	catch (const std::bad_alloc &a) {
+	  ss << "corrupt entry at key " << it->key();
+	  ok = false;
+	  break;
+	}
+	dout(30) << " " << it->key() << " " << e << dendl;
+	if (it->key() != e.version.get_key_name()) {
+	  ss << "entry " << e.version << " stored under key " << it->key();
+	  ok = false;
+	} else if (e.version <= last) {
+	  ss << "out of order entry " << e.version << " follows " << last;
+	  ok = false;
+	}
+	last = e.version;
+      }
+    }
+    if (!ok)
+      dout(0) << "check_log_for_corruption: " << ss.str() << dendl;
   }
   if (!ok) {
     stringstream f;
@@ -2364,7 +2544,7 @@ std::string PG::get_corrupt_pg_log_name() const
   return buf;
 }
 
-void PG::read_state(ObjectStore *store)
+void PG::read_state(ObjectStore *store, bool lazy)
 {
   bufferlist bl;
   bufferlist::iterator p;
@@ -2403,8 +2583,35 @@ void PG::read_state(ObjectStore *store)
     ::decode(snap_collections, p);
   }
 
+  if (lazy) {
+    // defer the log and missing set until the pg first peers
+    dout(10) << "read_state deferring log" << dendl;
+    log.tail = info.log_tail;
+    log.head = info.last_update;
+    log_deferred = true;
+    return;
+  }
+  load_log(store);
+}
+
+void PG::load_deferred_log()
+{
+  if (!log_deferred)
+    return;
+  log_deferred = false;
+  dout(10) << "load_deferred_log" << dendl;
+  load_log(osd->store);
+}
+
+void PG::load_log(ObjectStore *store)
+{
   try {
-    read_log(store);
+    if (read_log(store)) {
+      dout(1) << "converting legacy pg log to omap" << dendl;
+      ObjectStore::Transaction t;
+      write_log(t);
+      store->apply_transaction(t);
+    }
   }
   catch (const buffer::error &e) {
     string cr_log_coll_name(get_corrupt_pg_log_name());
@@ -2426,6 +2633,7 @@ void PG::read_state(ObjectStore *store)
     t.create_collection(cr_log_coll);
     t.collection_move(cr_log_coll, coll_t::META_COLL, log_oid);
     t.touch(coll_t::META_COLL, log_oid);
+    t.omap_clear(coll_t::META_COLL, log_oid);
     write_info(t);
     store->apply_transaction(t);
 
@@ -2613,6 +2821,13 @@ bool PG::sched_scrub()
       ret = true;
     } else if (scrub_reserved_peers.size() == acting.size()) {
       dout(20) << "sched_scrub: success, reserved self and replicas" << dendl;
+      // due for a deep scrub?
+      if (info.history.is_deep_scrub_due(ceph_clock_now(g_ceph_context),
+					 g_conf->osd_deep_scrub_interval)) {
+	dout(20) << "sched_scrub: last deep scrub " << info.history.last_deep_scrub_stamp
+		 << ", scrubbing deep" << dendl;
+	state_set(PG_STATE_DEEP_SCRUB);
+      }
       queue_scrub();
       ret = true;
     } else {
@@ -2641,42 +2856,43 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 
   int from = m->get_source().num();
 
+  // maps may arrive while we are still building our own
+  if (!scrub_active ||
+      (scrub_state != SCRUB_BUILDING_MAP &&
+       scrub_state != SCRUB_WAIT_REPLICAS) ||
+      !scrub_waiting_on_whom.count(from)) {
+    dout(10) << "sub_op_scrub_map ignoring unexpected map from osd." << from
+	     << dendl;
+    return;
+  }
+
   dout(10) << " got osd." << from << " scrub map" << dendl;
   bufferlist::iterator p = m->get_data().begin();
-  if (scrub_received_maps.count(from)) {
-    ScrubMap incoming;
-    incoming.decode(p, info.pgid.pool());
-    dout(10) << "from replica " << from << dendl;
-    dout(10) << "map version is " << incoming.valid_through << dendl;
-    scrub_received_maps[from].merge_incr(incoming);
-  } else {
-    scrub_received_maps[from].decode(p, info.pgid.pool());
-  }
+  ScrubMap map;
+  map.decode(p, info.pgid.pool());
+  if (map.incr_since != eversion_t())
+    scrub_received_maps[from].merge_incr(map);  // see scrub_request_incremental_maps
+  else
+    scrub_received_maps[from] = map;
 
   --scrub_waiting_on;
   scrub_waiting_on_whom.erase(from);
-  if (scrub_waiting_on == 0) {
-    if (finalizing_scrub) { // incremental lists received
-      osd->scrub_finalize_wq.queue(this);
-    } else {                // initial lists received
-      scrub_block_writes = true;
-      if (last_update_applied == info.last_update) {
-        finalizing_scrub = true;
-        scrub_gather_replica_maps();
-        ++scrub_waiting_on;
-        scrub_waiting_on_whom.insert(osd->whoami);
-        osd->scrub_wq.queue(this);
-      }
-    }
+  if (scrub_waiting_on == 0 && scrub_state == SCRUB_WAIT_REPLICAS) {
+    dout(10) << "sub_op_scrub_map got all replica maps" << dendl;
+    osd->scrub_wq.queue(this);
   }
 }
 
 /* 
- * pg lock may or may not be held
+ * pg lock may or may not be held; it must not be if deep, since deep
+ * scans read all of the data at osd_deep_scrub_bytes_per_sec.
  */
-void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
+void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 {
-  dout(10) << "_scan_list scanning " << ls.size() << " objects" << dendl;
+  dout(10) << "_scan_list scanning " << ls.size() << " objects"
+	   << (deep ? " deeply" : "") << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint64_t bytes = 0;
   int i = 0;
   for (vector<hobject_t>::iterator p = ls.begin(); 
        p != ls.end(); 
@@ -2690,6 +2906,8 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
       o.size = st.st_size;
       assert(!o.negative);
       osd->store->getattrs(coll, poid, o.attrs);
+      if (deep)
+	_scan_digest(poid, o, start, &bytes);
       dout(25) << "_scan_list  " << poid << dendl;
     } else {
       dout(25) << "_scan_list  " << poid << " got " << r << ", skipping" << dendl;
@@ -2697,13 +2915,96 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
   }
 }
 
-void PG::_request_scrub_map(int replica, eversion_t version)
+/*
+ * crc32c the object data, in osd_deep_scrub_stride reads, and the omap
+ * header, keys and values.  sleeps to hold the scan to
+ * osd_deep_scrub_bytes_per_sec; *bytes is the total read since start.
+ */
+void PG::_scan_digest(const hobject_t &poid, ScrubMap::object &o,
+		      utime_t start, uint64_t *bytes)
+{
+  uint64_t rate = g_conf->osd_deep_scrub_bytes_per_sec;
+  uint64_t stride = g_conf->osd_deep_scrub_stride;
+  uint64_t before = *bytes;
+
+  __u32 crc = -1;
+  uint64_t pos = 0;
+  while (true) {
+    bufferlist bl;
+    int r = osd->store->read(coll, poid, pos, stride, bl);
+    if (r < 0) {
+      stringstream ss;
+      ss << info.pgid << " deep-scrub " << poid << " read error " << r
+	 << " at " << pos << "\n";
+      osd->clog.error(ss);
+      o.read_error = true;
+      return;
+    }
+    crc = bl.crc32c(crc);
+    pos += r;
+    *bytes += r;
+
+    if (rate) {
+      utime_t want;
+      want.set_from_double((double)*bytes / (double)rate);
+      utime_t took = ceph_clock_now(g_ceph_context) - start;
+      if (took < want) {
+	utime_t wait = want - took;
+	usleep(wait.sec() * 1000000ull + wait.usec());
+      }
+    }
+    if ((uint64_t)r < stride)
+      break;
+  }
+  o.digest = crc;
+
+  // header first: the omap iterator holds off other store access to coll
+  bufferlist hdrbl;
+  osd->store->omap_get_header(coll, poid, &hdrbl);
+  __u32 ocrc = hdrbl.crc32c(-1);
+  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(coll, poid);
+  if (iter) {
+    for (iter->seek_to_first(); iter->valid(); iter->next()) {
+      bufferlist bl;
+      ::encode(iter->key(), bl);
+      ::encode(iter->value(), bl);
+      ocrc = bl.crc32c(ocrc);
+      *bytes += bl.length();
+    }
+  }
+  o.omap_digest = ocrc;
+  o.digest_present = true;
+
+  dout(25) << "_scan_digest " << poid << " digest " << o.digest
+	   << " omap_digest " << o.omap_digest
+	   << " (" << (*bytes - before) << " bytes)" << dendl;
+}
+
+void PG::_request_scrub_map(int replica, eversion_t version,
+			    hobject_t start, hobject_t end, bool deep)
 {
   assert(replica != osd->whoami);
-  dout(10) << "scrub  requesting scrubmap from osd." << replica << dendl;
+  dout(10) << "scrub  requesting scrubmap from osd." << replica
+	   << " for " << start << "-" << end << dendl;
   MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
-					      last_update_applied,
-                                              get_osdmap()->get_epoch());
+                                              get_osdmap()->get_epoch(),
+					      start, end, deep);
+  osd->cluster_messenger->send_message(repscrubop,
+                                       get_osdmap()->get_cluster_inst(replica));
+}
+
+/*
+ * ask an osd without chunky scrub for a map of the whole pg, or for the
+ * changes to it since @since, once our last write to the pg has applied.
+ */
+void PG::_request_scrub_map_classic(int replica, eversion_t since, bool deep)
+{
+  assert(replica != osd->whoami);
+  dout(10) << "scrub  requesting whole-pg scrubmap from osd." << replica
+	   << " since " << since << dendl;
+  MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, since,
+					      scrub_subset_last_update,
+					      get_osdmap()->get_epoch(), deep);
   osd->cluster_messenger->send_message(repscrubop,
                                        get_osdmap()->get_cluster_inst(replica));
 }
@@ -2834,9 +3135,9 @@ void PG::scrub_unreserve_replicas()
  * build a (sorted) summary of pg content for purposes of scrubbing
  * called while holding pg lock
  */ 
-void PG::build_scrub_map(ScrubMap &map)
+void PG::build_scrub_map(ScrubMap &map, bool deep)
 {
-  dout(10) << "build_scrub_map" << dendl;
+  dout(10) << "build_scrub_map" << (deep ? " deep" : "") << dendl;
 
   map.valid_through = info.last_update;
   epoch_t epoch = info.history.same_interval_since;
@@ -2851,7 +3152,7 @@ void PG::build_scrub_map(ScrubMap &map)
   vector<hobject_t> ls;
   osd->store->collection_list(coll, ls);
 
-  _scan_list(map, ls);
+  _scan_list(map, ls, deep);
   lock();
 
   if (epoch != info.history.same_interval_since) {
@@ -2871,6 +3172,51 @@ void PG::build_scrub_map(ScrubMap &map)
 }
 
 
+/*
+ * build a summary of pg objects in [start, end) for purposes of scrubbing
+ * called while holding pg lock; drops it while scanning
+ */
+void PG::build_scrub_map_chunk(ScrubMap &map, hobject_t start, hobject_t end,
+			       bool deep)
+{
+  dout(10) << "build_scrub_map_chunk " << start << "-" << end
+	   << (deep ? " deep" : "") << dendl;
+
+  map.valid_through = info.last_update;
+
+  unlock();
+
+  // wait for any writes to the chunk to flush to disk first.
+  osr.flush();
+
+  // objects
+  vector<hobject_t> ls;
+  hobject_t pos = start;
+  while (pos < end) {
+    vector<hobject_t> batch;
+    int r = osd->store->collection_list_partial(coll, pos,
+						osd->store->get_ideal_list_min(),
+						osd->store->get_ideal_list_max(),
+						0, &batch, &pos);
+    assert(r == 0);
+    for (vector<hobject_t>::iterator p = batch.begin(); p != batch.end(); ++p) {
+      if (*p >= end)
+	break;
+      ls.push_back(*p);
+    }
+    if (batch.empty())
+      break;
+  }
+
+  _scan_list(map, ls, deep);
+  lock();
+
+  // pg attrs
+  osd->store->collection_getattrs(coll, map.attrs);
+  dout(10) << " done.  " << map.objects.size() << " objects" << dendl;
+}
+
+
 /* 
  * build a summary of pg content changed starting after v
  * called while holding pg lock
@@ -2899,7 +3245,9 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
     }
   }
 
-  _scan_list(map, ls);
+  // changed objects are only checked shallowly; _compare_scrub_objects
+  // ignores digests unless both copies have one.
+  _scan_list(map, ls, false);
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
@@ -2929,6 +3277,13 @@ void PG::repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer
 }
 
 /* replica_scrub
+ *
+ * If msg->chunky is set, replica_scrub waits for last_update_applied
+ * to reach msg->scrub_to (requeued by sub_op_modify_applied), then
+ * builds a map of the objects in [msg->start, msg->end) with the pg
+ * lock dropped.  The primary blocks writes to those objects meanwhile.
+ *
+ * Otherwise the request is from an older primary:
  *
  * If msg->scrub_from is not set, replica_scrub calls build_scrubmap to
  * build a complete map (with the pg lock dropped).
@@ -2958,7 +3313,15 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   }
 
   ScrubMap map;
-  if (msg->scrub_from > eversion_t()) {
+  if (msg->chunky) {
+    if (last_update_applied < msg->scrub_to) {
+      dout(10) << "replica_scrub waiting for " << msg->scrub_to
+	       << " to apply" << dendl;
+      active_rep_scrub = msg;
+      return;
+    }
+    build_scrub_map_chunk(map, msg->start, msg->end, msg->deep);
+  } else if (msg->scrub_from > eversion_t()) {
     if (finalizing_scrub) {
       assert(last_update_applied == info.last_update);
       assert(last_update_applied == msg->scrub_to);
@@ -2972,7 +3335,7 @@ void PG::replica_scrub(MOSDRepScrub *msg)
     build_inc_scrub_map(map, msg->scrub_from);
     finalizing_scrub = 0;
   } else {
-    build_scrub_map(map);
+    build_scrub_map(map, msg->deep);
   }
 
   if (msg->map_epoch < info.history.same_interval_since) {
@@ -2996,139 +3359,342 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   msg->put();
 }
 
+const char *PG::get_scrub_state_name(ScrubState s)
+{
+  switch (s) {
+  case SCRUB_INACTIVE: return "inactive";
+  case SCRUB_NEW_CHUNK: return "new_chunk";
+  case SCRUB_WAIT_LAST_UPDATE: return "wait_last_update";
+  case SCRUB_BUILD_MAP: return "build_map";
+  case SCRUB_BUILDING_MAP: return "building_map";
+  case SCRUB_WAIT_REPLICAS: return "wait_replicas";
+  case SCRUB_COMPARE_MAPS: return "compare_maps";
+  case SCRUB_FINISH: return "finish";
+  default: return "???";
+  }
+}
+
 /* Scrub:
  * PG_STATE_SCRUBBING is set when the scrub is queued
- * 
- * Once the initial scrub has completed and the requests have gone out to 
- * replicas for maps, we set scrub_active and wait for the replicas to
- * complete their maps. Once the maps are received, scrub_block_writes is set.
- * scrub_waiting_on is set to the number of maps outstanding (active.size()).
  *
- * If last_update_applied is behind the head of the log, scrub returns to be
- * requeued by op_applied.
+ * The pg is scrubbed a chunk of objects at a time, in hobject_t order,
+ * by a state machine that runs from the scrub work queue:
  *
- * Once last_update_applied == info.last_update, scrub catches itself up and
- * decrements scrub_waiting_on.
+ * NEW_CHUNK picks [scrub_start, scrub_end): osd_scrub_chunk_min to
+ * osd_scrub_chunk_max objects, never separating a head from its clones.
+ * From here until the chunk is compared, do_op holds writes to objects
+ * in the chunk on waiting_for_active; the rest of the pg stays writeable.
  *
- * sub_op_scrub_map similarly decrements scrub_waiting_on for each map received.
- * 
- * Once scrub_waiting_on hits 0 (either in scrub or sub_op_scrub_map) 
- * scrub_finalize is queued.
- * 
- * In scrub_finalize, if any replica maps are too old, new ones are requested,
- * scrub_waiting_on is reset, and scrub_finalize returns to be requeued by
- * sub_op_scrub_map.  If all maps are up to date, scrub_finalize checks 
- * the maps and performs repairs.
+ * WAIT_LAST_UPDATE waits for the last logged write to the chunk to be
+ * applied; op_applied requeues us.
+ *
+ * BUILD_MAP asks the replicas for maps of the chunk (they likewise wait
+ * for that write to apply) and scans our own copy.  The pg lock is
+ * dropped for the scan, so we sit in BUILDING_MAP until it is done:
+ * replica maps that arrive meanwhile are stored but don't requeue us,
+ * and a scrub() from another thread leaves the chunk alone.
+ *
+ * WAIT_REPLICAS waits for the replica maps; sub_op_scrub_map requeues us.
+ *
+ * COMPARE_MAPS compares and repairs the chunk, unblocks its writes,
+ * records scrub_end in info.scrub_cursor, and requeues us for the next
+ * chunk so that other pgs get a turn.  A pass interrupted by an interval
+ * change or restart resumes from the cursor.
+ *
+ * FINISH checks the pg stats and updates the scrub stamps.
+ *
+ * If a replica predates chunky scrub (scrub_classic), the whole pg is a
+ * single chunk and the replicas are asked for whole-pg maps, as before:
+ * writes wait for the entire pass, and a replica whose map is behind our
+ * last write is then asked for an incremental map to bring it up to date.
  */
 void PG::scrub()
 {
 
   lock();
 
-  if (!is_primary() || !is_active() || !is_clean() || !is_scrubbing()) {
+  if (!is_primary() || !is_active() || !is_scrubbing() ||
+      (!scrub_active && !is_clean())) {
     dout(10) << "scrub -- not primary or active or not clean" << dendl;
-    state_clear(PG_STATE_REPAIR);
-    state_clear(PG_STATE_SCRUBBING);
+    if (scrub_active) {
+      scrub_clear_state();
+      scrub_unreserve_replicas();
+    } else {
+      state_clear(PG_STATE_REPAIR);
+      state_clear(PG_STATE_DEEP_SCRUB);
+      state_clear(PG_STATE_SCRUBBING);
+    }
     clear_scrub_reserved();
     unlock();
     return;
   }
 
-  if (!scrub_active) {
-    dout(10) << "scrub start" << dendl;
-    scrub_active = true;
+  if (!scrub_active)
+    scrub_start_pass();
 
-    update_stats();
-    scrub_received_maps.clear();
-    scrub_epoch_start = info.history.same_interval_since;
-
-    osd->sched_scrub_lock.Lock();
-    if (scrub_reserved) {
-      --(osd->scrubs_pending);
-      assert(osd->scrubs_pending >= 0);
-      scrub_reserved = false;
-      scrub_reserved_peers.clear();
-    }
-    ++(osd->scrubs_active);
-    osd->sched_scrub_lock.Unlock();
-
-    /* scrub_waiting_on == 0 iff all replicas have sent the requested maps and
-     * the primary has done a final scrub (which in turn can only happen if
-     * last_update_applied == info.last_update)
-     */
-    scrub_waiting_on = acting.size();
-    scrub_waiting_on_whom.insert(acting.begin(), acting.end());
-
-    // request maps from replicas
-    for (unsigned i=1; i<acting.size(); i++) {
-      _request_scrub_map(acting[i], eversion_t());
-    }
+  bool done = false;
+  while (!done) {
+    dout(20) << "scrub state " << get_scrub_state_name(scrub_state)
+	     << " chunk " << scrub_start << "-" << scrub_end << dendl;
 
-    // Unlocks and relocks...
-    primary_scrubmap = ScrubMap();
-    build_scrub_map(primary_scrubmap);
+    switch (scrub_state) {
+    case SCRUB_NEW_CHUNK:
+      if (scrub_start.is_max()) {
+	scrub_state = SCRUB_FINISH;
+	break;
+      }
+      scrub_end = scrub_classic ? hobject_t::get_max() :
+	scrub_chunk_end(scrub_start);
+      scrub_subset_last_update = scrub_chunk_last_update();
+      scrub_state = SCRUB_WAIT_LAST_UPDATE;
+      break;
 
-    if (scrub_epoch_start != info.history.same_interval_since) {
-      dout(10) << "scrub  pg changed, aborting" << dendl;
-      scrub_clear_state();
-      scrub_unreserve_replicas();
-      unlock();
-      return;
+    case SCRUB_WAIT_LAST_UPDATE:
+      if (last_update_applied < scrub_subset_last_update) {
+	dout(10) << "scrub waiting for " << scrub_subset_last_update
+		 << " to apply" << dendl;
+	done = true;
+	break;
+      }
+      scrub_state = SCRUB_BUILD_MAP;
+      break;
+
+    case SCRUB_BUILD_MAP:
+      if (!scrub_build_chunk()) {
+	unlock();
+	return;
+      }
+      break;
+
+    case SCRUB_BUILDING_MAP:
+      dout(10) << "scrub still building our map" << dendl;
+      done = true;
+      break;
+
+    case SCRUB_WAIT_REPLICAS:
+      if (scrub_waiting_on) {
+	dout(10) << "scrub waiting for maps from " << scrub_waiting_on_whom
+		 << dendl;
+	done = true;
+	break;
+      }
+      if (scrub_classic && scrub_request_incremental_maps()) {
+	done = true;
+	break;
+      }
+      scrub_state = SCRUB_COMPARE_MAPS;
+      break;
+
+    case SCRUB_COMPARE_MAPS:
+      scrub_compare_maps();
+
+      // checkpoint, let writes to the chunk through, and yield
+      scrub_start = scrub_end;
+      info.scrub_cursor = scrub_start;
+      info.scrub_cursor_deep = state_test(PG_STATE_DEEP_SCRUB);
+      info.scrub_cursor_errors = scrub_errors;
+      info.scrub_cursor_fixed = scrub_fixed;
+      {
+	ObjectStore::Transaction *t = new ObjectStore::Transaction;
+	write_info(*t);
+	int tr = osd->store->queue_transaction(&osr, t);
+	assert(tr == 0);
+      }
+      osd->requeue_ops(this, waiting_for_active);
+      scrub_state = SCRUB_NEW_CHUNK;
+      osd->scrub_wq.queue(this);
+      done = true;
+      break;
+
+    case SCRUB_FINISH:
+      scrub_finish();
+      done = true;
+      break;
+
+    default:
+      assert(0);
     }
+  }
+
+  unlock();
+}
+
+/*
+ * begin a pass, from info.scrub_cursor if an earlier pass of the same
+ * or greater depth was interrupted.
+ */
+void PG::scrub_start_pass()
+{
+  dout(10) << "scrub start" << dendl;
+  scrub_active = true;
+
+  update_stats();
+  scrub_received_maps.clear();
+  scrub_epoch_start = info.history.same_interval_since;
+
+  osd->sched_scrub_lock.Lock();
+  if (scrub_reserved) {
+    --(osd->scrubs_pending);
+    assert(osd->scrubs_pending >= 0);
+    scrub_reserved = false;
+    scrub_reserved_peers.clear();
+  }
+  ++(osd->scrubs_active);
+  osd->sched_scrub_lock.Unlock();
 
-    --scrub_waiting_on;
-    scrub_waiting_on_whom.erase(osd->whoami);
+  scrub_start = hobject_t();
+  scrub_resumed = false;
+  scrub_errors = 0;
+  scrub_fixed = 0;
 
-    if (scrub_waiting_on == 0) {
-      // the replicas have completed their scrub map, so lock out writes
-      scrub_block_writes = true;
+  scrub_classic = false;
+  for (unsigned i=1; i<acting.size(); i++) {
+    Connection *con = osd->cluster_messenger->get_connection(
+      get_osdmap()->get_cluster_inst(acting[i]));
+    if (!con->has_feature(CEPH_FEATURE_CHUNKY_SCRUB)) {
+      dout(10) << "scrub osd." << acting[i] << " can't do chunky scrub,"
+	       << " scrubbing the whole pg at once" << dendl;
+      scrub_classic = true;
+    }
+    con->put();
+  }
+
+  if (scrub_classic) {
+    // replicas send whole-pg maps, so a chunk must cover the whole pg
+    if (info.scrub_cursor != hobject_t())
+      dout(10) << "scrub not resuming pass at " << info.scrub_cursor << dendl;
+  } else if (info.scrub_cursor != hobject_t()) {
+    if (info.scrub_cursor_deep || !state_test(PG_STATE_DEEP_SCRUB)) {
+      dout(10) << "scrub resuming " << (info.scrub_cursor_deep ? "deep " : "")
+	       << "pass at " << info.scrub_cursor << dendl;
+      scrub_start = info.scrub_cursor;
+      scrub_resumed = true;
+      // so the end of the pass still knows about errors found before
+      scrub_errors = info.scrub_cursor_errors;
+      scrub_fixed = info.scrub_cursor_fixed;
+      if (info.scrub_cursor_deep)
+	state_set(PG_STATE_DEEP_SCRUB);
     } else {
-      dout(10) << "wait for replicas to build initial scrub map" << dendl;
-      unlock();
-      return;
+      dout(10) << "scrub not resuming shallow pass at " << info.scrub_cursor
+	       << ", deep scrub is due" << dendl;
     }
+  }
+  scrub_end = scrub_start;
+  scrub_cstat = object_stat_collection_t();
+  scrub_state = SCRUB_NEW_CHUNK;
+}
 
-    if (last_update_applied != info.last_update) {
-      dout(10) << "wait for cleanup" << dendl;
-      unlock();
-      return;
+/*
+ * the end of the chunk beginning at start: the chunk holds at least
+ * osd_scrub_chunk_min objects (unless the pg runs out) and, unless one
+ * object has more clones than that, at most osd_scrub_chunk_max.  a head,
+ * its clones and snapdir always land in the same chunk, since _scrub
+ * checks them against each other.
+ */
+hobject_t PG::scrub_chunk_end(const hobject_t &start)
+{
+  hobject_t pos = start;
+  while (true) {
+    vector<hobject_t> ls;
+    hobject_t next;
+    int r = osd->store->collection_list_partial(coll, pos,
+						g_conf->osd_scrub_chunk_min,
+						g_conf->osd_scrub_chunk_max,
+						0, &ls, &next);
+    assert(r == 0);
+    if (ls.empty() || next.is_max())
+      return hobject_t::get_max();
+
+    // back up to the last boundary between two objects
+    ls.push_back(next);
+    while (ls.size() > 1) {
+      hobject_t end = ls.back();
+      ls.pop_back();
+      const hobject_t &last = ls.back();
+      if (last.hash != end.hash ||
+	  last.get_effective_key() != end.get_effective_key() ||
+	  last.oid != end.oid)
+	return end;
     }
+    pos = next;
+  }
+}
 
-    // fall through if last_update_applied == info.last_update and scrub_waiting_on == 0
+/*
+ * the newest logged write to an object in the current chunk; the chunk
+ * can't be scanned until it is applied.
+ */
+eversion_t PG::scrub_chunk_last_update() const
+{
+  for (list<pg_log_entry_t>::const_reverse_iterator p = log.log.rbegin();
+       p != log.log.rend();
+       ++p) {
+    if (p->soid >= scrub_start && p->soid < scrub_end)
+      return p->version;
+  }
+  return eversion_t();
+}
+
+/*
+ * request maps of the current chunk from the replicas and build our own.
+ * returns false if the pg changed while the lock was dropped.
+ */
+bool PG::scrub_build_chunk()
+{
+  bool deep = state_test(PG_STATE_DEEP_SCRUB);
 
-    // request incrementals from replicas
-    scrub_gather_replica_maps();
+  scrub_received_maps.clear();
+  scrub_waiting_on = 0;
+  scrub_waiting_on_whom.clear();
+  for (unsigned i=1; i<acting.size(); i++) {
+    if (scrub_classic)
+      _request_scrub_map_classic(acting[i], eversion_t(), deep);
+    else
+      _request_scrub_map(acting[i], scrub_subset_last_update,
+			 scrub_start, scrub_end, deep);
     ++scrub_waiting_on;
-    scrub_waiting_on_whom.insert(osd->whoami);
+    scrub_waiting_on_whom.insert(acting[i]);
   }
-    
-  dout(10) << "clean up scrub" << dendl;
-  assert(last_update_applied == info.last_update);
 
-  finalizing_scrub = true;
+  // Unlocks and relocks...
+  scrub_state = SCRUB_BUILDING_MAP;
+  primary_scrubmap = ScrubMap();
+  build_scrub_map_chunk(primary_scrubmap, scrub_start, scrub_end, deep);
 
+  if (!scrub_active || scrub_state != SCRUB_BUILDING_MAP) {
+    dout(10) << "scrub  pg changed, aborted" << dendl;
+    return false;
+  }
   if (scrub_epoch_start != info.history.same_interval_since) {
     dout(10) << "scrub  pg changed, aborting" << dendl;
     scrub_clear_state();
     scrub_unreserve_replicas();
-    unlock();
-    return;
-  }
-  
-  if (primary_scrubmap.valid_through != log.head) {
-    ScrubMap incr;
-    build_inc_scrub_map(incr, primary_scrubmap.valid_through);
-    primary_scrubmap.merge_incr(incr);
+    return false;
   }
-  
-  --scrub_waiting_on;
-  scrub_waiting_on_whom.erase(osd->whoami);
-  if (scrub_waiting_on == 0) {
-    assert(last_update_applied == info.last_update);
-    osd->scrub_finalize_wq.queue(this);
+  scrub_state = SCRUB_WAIT_REPLICAS;
+  return true;
+}
+
+/*
+ * classic scrub: a whole-pg replica map may be older than our last write
+ * to the pg, since the replica scans without waiting for its writes to
+ * apply.  ask those replicas for an incremental map up to that write,
+ * which they build once it has applied.  returns true if we asked.
+ */
+bool PG::scrub_request_incremental_maps()
+{
+  for (unsigned i=1; i<acting.size(); i++) {
+    ScrubMap &map = scrub_received_maps[acting[i]];
+    if (map.valid_through >= scrub_subset_last_update)
+      continue;
+    dout(10) << "scrub osd." << acting[i] << " map is valid through "
+	     << map.valid_through << " < " << scrub_subset_last_update << dendl;
+    _request_scrub_map_classic(acting[i], map.valid_through,
+			       state_test(PG_STATE_DEEP_SCRUB));
+    ++scrub_waiting_on;
+    scrub_waiting_on_whom.insert(acting[i]);
   }
-  
-  unlock();
+  return scrub_waiting_on > 0;
 }
 
 void PG::scrub_clear_state()
@@ -3136,6 +3702,7 @@ void PG::scrub_clear_state()
   assert(_lock.is_locked());
   state_clear(PG_STATE_SCRUBBING);
   state_clear(PG_STATE_REPAIR);
+  state_clear(PG_STATE_DEEP_SCRUB);
   update_stats();
 
   // active -> nothing.
@@ -3144,8 +3711,10 @@ void PG::scrub_clear_state()
   osd->requeue_ops(this, waiting_for_active);
 
   finalizing_scrub = false;
-  scrub_block_writes = false;
   scrub_active = false;
+  scrub_state = SCRUB_INACTIVE;
+  scrub_classic = false;
+  scrub_start = scrub_end = hobject_t();
   scrub_waiting_on = 0;
   scrub_waiting_on_whom.clear();
   if (active_rep_scrub) {
@@ -3153,29 +3722,11 @@ void PG::scrub_clear_state()
     active_rep_scrub = NULL;
   }
   scrub_received_maps.clear();
-}
+  primary_scrubmap = ScrubMap();
 
-bool PG::scrub_gather_replica_maps() {
-  assert(scrub_waiting_on == 0);
-  assert(_lock.is_locked());
-
-  for (map<int,ScrubMap>::iterator p = scrub_received_maps.begin();
-       p != scrub_received_maps.end();
-       p++) {
-    
-    if (scrub_received_maps[p->first].valid_through != log.head) {
-      scrub_waiting_on++;
-      scrub_waiting_on_whom.insert(p->first);
-      // Need to request another incremental map
-      _request_scrub_map(p->first, p->second.valid_through);
-    }
-  }
-  
-  if (scrub_waiting_on > 0) {
-    return false;
-  } else {
-    return true;
-  }
+  // the snap trimmer waits for us
+  if (is_primary() && is_clean() && !snap_trimq.empty())
+    queue_snap_trim();
 }
 
 bool PG::_compare_scrub_objects(ScrubMap::object &auth,
@@ -3213,6 +3764,22 @@ bool PG::_compare_scrub_objects(ScrubMap::object &auth,
       errorstream << "extra attr " << i->first;
     }
   }
+  if (auth.digest_present && candidate.digest_present) {
+    if (auth.digest != candidate.digest) {
+      if (!ok)
+	errorstream << ", ";
+      ok = false;
+      errorstream << "digest " << candidate.digest
+		  << " != known digest " << auth.digest;
+    }
+    if (auth.omap_digest != candidate.omap_digest) {
+      if (!ok)
+	errorstream << ", ";
+      ok = false;
+      errorstream << "omap_digest " << candidate.omap_digest
+		  << " != known omap_digest " << auth.omap_digest;
+    }
+  }
   return ok;
 }
 
@@ -3240,12 +3807,29 @@ void PG::_compare_scrubmaps(const map<int,ScrubMap*> &maps,
     map<int, ScrubMap *>::const_iterator auth = maps.end();
     set<int> cur_missing;
     set<int> cur_inconsistent;
+
+    // Take first osd that has it and could read it as authoritative
+    for (j = maps.begin(); j != maps.end(); j++) {
+      map<hobject_t,ScrubMap::object>::const_iterator o =
+	j->second->objects.find(*k);
+      if (o == j->second->objects.end())
+	continue;
+      if (auth == maps.end() || !o->second.read_error) {
+	auth = j;
+	if (!o->second.read_error)
+	  break;
+      }
+    }
+
     for (j = maps.begin(); j != maps.end(); j++) {
       if (j->second->objects.count(*k)) {
-	if (auth == maps.end()) {
-	  // Take first osd to have it as authoritative
-	  auth = j;
-	} else {
+	if (j->second->objects[*k].read_error) {
+	  // auth only has one if every copy does; nothing to repair from
+	  if (j != auth)
+	    cur_inconsistent.insert(j->first);
+	  errorstream << info.pgid << " osd." << acting[j->first]
+		      << ": soid " << *k << " read error" << std::endl;
+	} else if (j != auth) {
 	  // Compare 
 	  stringstream ss;
 	  if (!_compare_scrub_objects(auth->second->objects[*k],
@@ -3269,34 +3853,19 @@ void PG::_compare_scrubmaps(const map<int,ScrubMap*> &maps,
     if (cur_inconsistent.size()) {
       inconsistent[*k] = cur_inconsistent;
     }
-    if (cur_inconsistent.size() || cur_missing.size()) {
+    if (cur_inconsistent.size() || cur_missing.size() ||
+	auth->second->objects[*k].read_error) {
       authoritative[*k] = auth->first;
     }
   }
 }
 
-void PG::scrub_finalize() {
-  lock();
-  assert(last_update_applied == info.last_update);
-
-  if (scrub_epoch_start != info.history.same_interval_since) {
-    dout(10) << "scrub  pg changed, aborting" << dendl;
-    scrub_clear_state();
-    scrub_unreserve_replicas();
-    unlock();
-    return;
-  }
-  
-  if (!scrub_gather_replica_maps()) {
-    dout(10) << "maps not yet up to date, sent out new requests" << dendl;
-    unlock();
-    return;
-  }
-
-  dout(10) << "scrub_finalize has maps, analyzing" << dendl;
-  int errors = 0, fixed = 0;
+void PG::scrub_compare_maps()
+{
+  dout(10) << "scrub_compare_maps has maps, analyzing" << dendl;
   bool repair = state_test(PG_STATE_REPAIR);
-  const char *mode = repair ? "repair":"scrub";
+  bool deep = state_test(PG_STATE_DEEP_SCRUB);
+  const char *mode = repair ? "repair" : (deep ? "deep-scrub" : "scrub");
   if (acting.size() > 1) {
     dout(10) << "scrub  comparing replica scrub maps" << dendl;
 
@@ -3327,12 +3896,16 @@ void PG::scrub_finalize() {
       dout(2) << ss.str() << dendl;
       osd->clog.error(ss);
       state_set(PG_STATE_INCONSISTENT);
+      scrub_errors += authoritative.size();
       if (repair) {
 	state_clear(PG_STATE_CLEAN);
 	for (map<hobject_t, int>::iterator i = authoritative.begin();
 	     i != authoritative.end();
 	     i++) {
 	  set<int>::iterator j;
+	  if (maps[i->second]->objects[i->first].read_error)
+	    continue;  // no good copy
+	  scrub_fixed++;
 	  
 	  if (missing.count(i->first)) {
 	    for (j = missing[i->first].begin();
@@ -3358,35 +3931,67 @@ void PG::scrub_finalize() {
 	}
       }
     }
+  } else {
+    // no replicas to compare against, but a copy we can't read is still bad
+    for (map<hobject_t,ScrubMap::object>::iterator p =
+	   primary_scrubmap.objects.begin();
+	 p != primary_scrubmap.objects.end();
+	 ++p) {
+      if (p->second.read_error) {
+	state_set(PG_STATE_INCONSISTENT);
+	scrub_errors++;
+      }
+    }
   }
 
   // ok, do the pg-type specific scrubbing
-  _scrub(primary_scrubmap, errors, fixed);
+  _scrub(primary_scrubmap, scrub_errors, scrub_fixed);
+}
+
+void PG::scrub_finish()
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  bool deep = state_test(PG_STATE_DEEP_SCRUB);
+  const char *mode = repair ? "repair" : (deep ? "deep-scrub" : "scrub");
+
+  // the object stats only add up over a whole pass
+  if (scrub_resumed)
+    dout(10) << "scrub pass was resumed, not checking pg stats" << dendl;
+  else
+    _scrub_finish(scrub_errors, scrub_fixed);
 
   {
     stringstream oss;
     oss << info.pgid << " " << mode << " ";
-    if (errors)
-      oss << errors << " errors";
+    if (scrub_errors)
+      oss << scrub_errors << " errors";
     else
       oss << "ok";
     if (repair)
-      oss << ", " << fixed << " fixed";
+      oss << ", " << scrub_fixed << " fixed";
     oss << "\n";
-    if (errors)
+    if (scrub_errors)
       osd->clog.error(oss);
     else
       osd->clog.info(oss);
   }
 
-  if (errors == 0 || (repair && (errors - fixed) == 0))
+  if (scrub_errors == 0 || (repair && (scrub_errors - scrub_fixed) == 0))
     state_clear(PG_STATE_INCONSISTENT);
 
   // finish up
   osd->unreg_last_pg_scrub(info.pgid, info.history.last_scrub_stamp);
   info.history.last_scrub = info.last_update;
   info.history.last_scrub_stamp = ceph_clock_now(g_ceph_context);
+  if (deep) {
+    info.history.last_deep_scrub = info.history.last_scrub;
+    info.history.last_deep_scrub_stamp = info.history.last_scrub_stamp;
+  }
   osd->reg_last_pg_scrub(info.pgid, info.history.last_scrub_stamp);
+  info.scrub_cursor = hobject_t();
+  info.scrub_cursor_deep = false;
+  info.scrub_cursor_errors = 0;
+  info.scrub_cursor_fixed = 0;
 
   {
     ObjectStore::Transaction *t = new ObjectStore::Transaction;
@@ -3403,7 +4008,6 @@ void PG::scrub_finalize() {
   }
 
   dout(10) << "scrub done" << dendl;
-  unlock();
 }
 
 void PG::share_pg_info()
@@ -3591,12 +4195,12 @@ void PG::on_removal()
 {
   osd->recovery_wq.dequeue(this);
   osd->scrub_wq.dequeue(this);
-  osd->scrub_finalize_wq.dequeue(this);
   osd->snap_trim_wq.dequeue(this);
   osd->remove_wq.dequeue(this);
   osd->pg_stat_queue_dequeue(this);
 
   remove_watchers_and_notifies();
+  clear_context_cache();
 }
 
 void PG::set_last_peering_reset()
@@ -3750,7 +4354,7 @@ void PG::start_peering_interval(const OSDMapRef lastmap,
     }
   }
   // make sure we clear out any pg_temp change requests
-  osd->pg_temp_wanted.erase(info.pgid);
+  osd->remove_want_pg_temp(info.pgid);
   cancel_recovery();
 
   if (acting.empty() && up.size() && up[0] == osd->whoami) {
@@ -3932,6 +4536,11 @@ PG::RecoveryState::Started::Started(my_context ctx)
 {
   state_name = "Started";
   context< RecoveryMachine >().log_enter(state_name);
+
+  // a lazily loaded pg sits in Reset without its log until
+  // map_advance_tp gets to it; everything from here on (peering,
+  // recovery, client io) needs it, so read it now if it hasn't.
+  context< RecoveryMachine >().pg->load_deferred_log();
 }
 
 boost::statechart::result PG::RecoveryState::Started::react(const AdvMap& advmap)
@@ -4180,10 +4789,29 @@ boost::statechart::result PG::RecoveryState::Active::react(const AdvMap& advmap)
 {
   PG *pg = context< RecoveryMachine >().pg;
   dout(10) << "Active advmap" << dendl;
-  if (!pg->pool->newly_removed_snaps.empty()) {
-    pg->snap_trimq.union_of(pg->pool->newly_removed_snaps);
-    dout(10) << *pg << " snap_trimq now " << pg->snap_trimq << dendl;
-    pg->dirty_info = true;
+
+  // snaps removed in this epoch.  we may be behind the osd, so work
+  // this out from the maps rather than from the osd's pool state.
+  const pg_pool_t *pi = advmap.osdmap->get_pg_pool(pg->info.pgid.pool());
+  if (pi && pi->get_snap_epoch() == advmap.osdmap->get_epoch()) {
+    interval_set<snapid_t> removed, done;
+    pi->build_removed_snaps(removed);
+    const pg_pool_t *prev = advmap.lastmap ?
+      advmap.lastmap->get_pg_pool(pg->info.pgid.pool()) : NULL;
+    if (prev) {
+      interval_set<snapid_t> was;
+      prev->build_removed_snaps(was);
+      done.intersection_of(removed, was);
+      removed.subtract(done);
+    }
+    done.intersection_of(removed, pg->info.purged_snaps);
+    removed.subtract(done);
+    if (!removed.empty()) {
+      pg->snap_trimq.union_of(removed);
+      dout(10) << *pg << " snap_trimq now " << pg->snap_trimq << dendl;
+      pg->dirty_info = true;
+      pg->update_stats();
+    }
   }
   pg->check_recovery_sources(pg->get_osdmap());
   return forward_event();
@@ -4345,8 +4973,10 @@ boost::statechart::result PG::RecoveryState::Active::react(const QueryState& q)
   q.f->open_object_section("scrub");
   q.f->dump_stream("scrub_epoch_start") << pg->scrub_epoch_start;
   q.f->dump_int("scrub_active", pg->scrub_active);
-  q.f->dump_int("scrub_block_writes", pg->scrub_block_writes);
-  q.f->dump_int("finalizing_scrub", pg->finalizing_scrub);
+  q.f->dump_string("scrub_state", PG::get_scrub_state_name(pg->scrub_state));
+  q.f->dump_stream("scrub_start") << pg->scrub_start;
+  q.f->dump_stream("scrub_end") << pg->scrub_end;
+  q.f->dump_int("scrub_resumed", pg->scrub_resumed);
   q.f->dump_int("scrub_waiting_on", pg->scrub_waiting_on);
   q.f->open_array_section("scrub_waiting_on_whom");
   for (set<int>::iterator p = pg->scrub_waiting_on_whom.begin();
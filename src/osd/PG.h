@@ -275,7 +275,11 @@ public:
   
 
   /**
-   * OndiskLog - some info about how we store the log on disk.
+   * OndiskLog - bounds of the legacy sequential on-disk log.
+   *
+   * The log is now stored as one omap key per entry on log_oid (see
+   * write_log); a non-zero head means the log object still holds the
+   * old format and needs to be converted.
    */
   class OndiskLog {
   public:
@@ -336,12 +340,19 @@ protected:
   OSD *osd;
   PGPool *pool;
 
+  /*
+   * the last map we have processed.  it lags the osd's map until
+   * OSD::advance_pg() walks us through the epochs in between.
+   */
   OSDMapRef osdmap_ref;
+  /// the osd's oldest stored map when we last advanced; protected by our lock
+  epoch_t oldest_map;
   OSDMapRef get_osdmap() const {
     assert(is_locked());
     assert(osdmap_ref);
     return osdmap_ref;
   }
+  void update_osdmap_ref(OSDMapRef newmap);
 
   /** locking and reference counting.
    * I destroy myself when the reference count hits zero.
@@ -358,15 +369,9 @@ public:
   bool deleting;  // true while RemoveWQ should be chewing on us
 
   void lock(bool no_lockdep = false);
+  bool try_lock();
   void unlock();
 
-  /* During handle_osd_map, the osd holds a write lock to the osdmap.
-   * *_with_map_lock_held assume that the map_lock is already held */
-  void lock_with_map_lock_held(bool no_lockdep = false);
-
-  // assert we still have lock held, and update our map ref
-  void reassert_lock_with_map_lock_held();
-
   void assert_locked() {
     assert(_lock.is_locked());
   }
@@ -395,8 +400,11 @@ public:
 
 
   list<OpRequestRef> op_queue;  // op queue
+  /// (class, owner) of each turn op_wq has dequeued for us; op_wq lock
+  list<pair<int, uint64_t> > op_queue_turns;
 
   bool dirty_info, dirty_log;
+  bool log_deferred;  ///< log and missing not read yet (lazy load_pgs)
 
 public:
   // pg state
@@ -406,6 +414,7 @@ public:
   hobject_t    log_oid;
   hobject_t    biginfo_oid;
   OndiskLog   ondisklog;
+  uint64_t    log_bytes;    ///< encoded size of the entries in log, for stats
   pg_missing_t     missing;
   map<hobject_t, set<int> > missing_loc;
   set<int> missing_loc_sources;           // superset of missing_loc locations
@@ -417,7 +426,8 @@ public:
 
   /* You should not use these items without taking their respective queue locks
    * (if they have one) */
-  xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, remove_item, stat_queue_item;
+  xlist<PG*>::item recovery_item, scrub_item, snap_trim_item, remove_item, stat_queue_item;
+  xlist<PG*>::item map_advance_item;
   int recovery_ops_active;
   bool waiting_on_backfill;
 #ifdef DEBUG_RECOVERY_OIDS
@@ -668,6 +678,17 @@ public:
 
   virtual void calc_trim_to() = 0;
 
+  /// how many peers must have a write before peering will keep it
+  virtual unsigned min_peers_for_update() const { return 1; }
+  /// do peers undo divergent writes themselves (rather than recover)?
+  virtual bool rolls_back_divergent_entries() const { return false; }
+  /**
+   * undo what we can of @divergent in @t, removing those entries; the
+   * rest are left to merge_old_entry()
+   */
+  virtual void rollback_divergent_entries(ObjectStore::Transaction& t,
+					  list<pg_log_entry_t>& divergent) { }
+
   void proc_replica_log(ObjectStore::Transaction& t, pg_info_t &oinfo, pg_log_t &olog,
 			pg_missing_t& omissing, int from);
   void proc_master_log(ObjectStore::Transaction& t, pg_info_t &oinfo, pg_log_t &olog,
@@ -707,6 +728,8 @@ public:
   }
 
   virtual void clean_up_local(ObjectStore::Transaction& t) = 0;
+  /// primary, on activation: note objects peers must have rebuilt in place
+  virtual void mark_misplaced_objects() { }
 
   virtual int start_recovery_ops(int max, RecoveryCtx *prctx) = 0;
 
@@ -725,6 +748,10 @@ public:
   virtual void check_recovery_sources(const OSDMapRef newmap) = 0;
   void start_recovery_op(const hobject_t& soid);
   void finish_recovery_op(const hobject_t& soid, bool dequeue=false);
+  void recover_got(hobject_t oid, eversion_t v);
+
+  int do_xattr_cmp_u64(int op, __u64 v1, bufferlist& xattr);
+  int do_xattr_cmp_str(int op, string& v1s, bufferlist& xattr);
 
   loff_t get_log_write_pos() {
     return 0;
@@ -736,8 +763,7 @@ public:
   // -- scrub --
   set<int> scrub_reserved_peers;
   map<int,ScrubMap> scrub_received_maps;
-  bool finalizing_scrub;
-  bool scrub_block_writes;
+  bool finalizing_scrub;     // replica: building a legacy incremental map
   bool scrub_active;
   bool scrub_reserved, scrub_reserve_failed;
   int scrub_waiting_on;
@@ -746,24 +772,64 @@ public:
   ScrubMap primary_scrubmap;
   MOSDRepScrub *active_rep_scrub;
 
+  /*
+   * the primary scrubs the pg a chunk at a time: objects in
+   * [scrub_start, scrub_end) are compared across the acting set while
+   * writes to them wait; everything else stays writeable.
+   */
+  enum ScrubState {
+    SCRUB_INACTIVE,
+    SCRUB_NEW_CHUNK,         // pick the next chunk
+    SCRUB_WAIT_LAST_UPDATE,  // wait for writes to the chunk to apply
+    SCRUB_BUILD_MAP,         // request replica maps, scan our copy
+    SCRUB_BUILDING_MAP,      // our scan is running with the pg lock dropped
+    SCRUB_WAIT_REPLICAS,     // wait for replica maps
+    SCRUB_COMPARE_MAPS,      // compare and repair the chunk
+    SCRUB_FINISH,
+  } scrub_state;
+  hobject_t scrub_start, scrub_end;
+  eversion_t scrub_subset_last_update;  // last write to the current chunk
+  int scrub_errors, scrub_fixed;
+  object_stat_collection_t scrub_cstat; // stats of objects < scrub_start
+  bool scrub_resumed;                   // pass started from info.scrub_cursor
+  bool scrub_classic;                   // a replica can't map chunks; see scrub()
+
+  static const char *get_scrub_state_name(ScrubState s);
+
+  bool write_blocked_by_scrub(const hobject_t &soid) const {
+    return scrub_active && soid >= scrub_start && soid < scrub_end;
+  }
+
   void repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer);
-  bool _compare_scrub_objects(ScrubMap::object &auth,
-			      ScrubMap::object &candidate,
-			      ostream &errorstream);
-  void _compare_scrubmaps(const map<int,ScrubMap*> &maps,  
-			  map<hobject_t, set<int> > &missing,
-			  map<hobject_t, set<int> > &inconsistent,
-			  map<hobject_t, int> &authoritative,
-			  ostream &errorstream);
+  virtual bool _compare_scrub_objects(ScrubMap::object &auth,
+				      ScrubMap::object &candidate,
+				      ostream &errorstream);
+  virtual void _compare_scrubmaps(const map<int,ScrubMap*> &maps,
+				  map<hobject_t, set<int> > &missing,
+				  map<hobject_t, set<int> > &inconsistent,
+				  map<hobject_t, int> &authoritative,
+				  ostream &errorstream);
   void scrub();
-  void scrub_finalize();
   void scrub_clear_state();
-  bool scrub_gather_replica_maps();
-  void _scan_list(ScrubMap &map, vector<hobject_t> &ls);
-  void _request_scrub_map(int replica, eversion_t version);
-  void build_scrub_map(ScrubMap &map);
+  void scrub_start_pass();
+  hobject_t scrub_chunk_end(const hobject_t &start);
+  eversion_t scrub_chunk_last_update() const;
+  bool scrub_build_chunk();
+  bool scrub_request_incremental_maps();
+  void scrub_compare_maps();
+  void scrub_finish();
+  void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep);
+  void _scan_digest(const hobject_t &poid, ScrubMap::object &o,
+		    utime_t start, uint64_t *bytes);
+  void _request_scrub_map(int replica, eversion_t version,
+			  hobject_t start, hobject_t end, bool deep);
+  void _request_scrub_map_classic(int replica, eversion_t since, bool deep);
+  void build_scrub_map(ScrubMap &map, bool deep);
+  void build_scrub_map_chunk(ScrubMap &map, hobject_t start, hobject_t end,
+			     bool deep);
   void build_inc_scrub_map(ScrubMap &map, eversion_t v);
   virtual int _scrub(ScrubMap &map, int& errors, int& fixed) { return 0; }
+  virtual void _scrub_finish(int& errors, int& fixed) { }
   void clear_scrub_reserved();
   void scrub_reserve_replicas();
   void scrub_unreserve_replicas();
@@ -1227,11 +1293,12 @@ public:
 
  public:  
   PG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& loid, const hobject_t& ioid) : 
-    osd(o), pool(_pool),
+    osd(o), pool(_pool), oldest_map(0),
     _lock("PG::_lock"),
-    ref(0), deleting(false), dirty_info(false), dirty_log(false),
-    info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
-    recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), remove_item(this), stat_queue_item(this),
+    ref(0), deleting(false), dirty_info(false), dirty_log(false), log_deferred(false),
+    info(p), coll(p), log_oid(loid), biginfo_oid(ioid), log_bytes(0),
+    recovery_item(this), scrub_item(this), snap_trim_item(this), remove_item(this), stat_queue_item(this),
+    map_advance_item(this),
     recovery_ops_active(0),
     waiting_on_backfill(0),
     role(0),
@@ -1246,11 +1313,13 @@ public:
     osr(stringify(p)),
     finish_sync_event(NULL),
     finalizing_scrub(false),
-    scrub_block_writes(false),
     scrub_active(false),
     scrub_reserved(false), scrub_reserve_failed(false),
     scrub_waiting_on(0),
     active_rep_scrub(0),
+    scrub_state(SCRUB_INACTIVE),
+    scrub_errors(0), scrub_fixed(0),
+    scrub_resumed(false), scrub_classic(false),
     recovery_state(this)
   {
     pool->get();
@@ -1271,7 +1340,7 @@ public:
   int        get_primary() { return acting.empty() ? -1:acting[0]; }
   
   int        get_role() const { return role; }
-  void       set_role(int r) { role = r; }
+  void       set_role(int r);
 
   bool       is_primary() const { return role == 0; }
   bool       is_replica() const { return role > 0; }
@@ -1309,17 +1378,20 @@ public:
 
   void write_if_dirty(ObjectStore::Transaction& t);
 
-  void add_log_entry(pg_log_entry_t& e, bufferlist& log_bl);
+  void add_log_entry(pg_log_entry_t& e, map<string,bufferlist>& log_keys);
   void append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStore::Transaction &t);
 
-  void read_log(ObjectStore *store);
+  bool read_log(ObjectStore *store);
+  void read_log_old(ObjectStore *store);
+  void read_log_missing(ObjectStore *store);
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
-  void trim_ondisklog(ObjectStore::Transaction& t);
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
-  void read_state(ObjectStore *store);
+  void read_state(ObjectStore *store, bool lazy=false);
+  void load_log(ObjectStore *store);
+  void load_deferred_log();
   coll_t make_snap_collection(ObjectStore::Transaction& t, snapid_t sn);
   void update_snap_collections(vector<pg_log_entry_t> &log_entries,
 			       ObjectStore::Transaction& t);
@@ -1365,6 +1437,7 @@ public:
   void handle_advance_map(OSDMapRef osdmap, OSDMapRef lastmap,
 			  vector<int>& newup, vector<int>& newacting,
 			  RecoveryCtx *rctx) {
+    update_osdmap_ref(osdmap);
     recovery_state.handle_advance_map(osdmap, lastmap, newup, newacting, rctx);
   }
   void handle_activate_map(RecoveryCtx *rctx) {
@@ -1405,6 +1478,8 @@ public:
   virtual void on_activate() = 0;
   virtual void on_shutdown() = 0;
   virtual void remove_watchers_and_notifies() = 0;
+  virtual void clear_context_cache() = 0;
+  virtual bool evict_oldest_context() = 0;
 
   virtual void register_unconnected_watcher(void *obc,
 					    entity_name_t entity,
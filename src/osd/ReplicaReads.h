@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_REPLICAREADS_H
+#define CEPH_OSD_REPLICAREADS_H
+
+#include <map>
+
+#include "osd_types.h"
+#include "include/assert.h"
+
+/**
+ * ReplicaReads - what a replica may read on behalf of a client
+ *
+ * A read served by a replica must not see a write the primary has not
+ * acked: the client could read data that peering later rolls back.
+ * The primary sends the version up to which every replica has
+ * committed (its min_last_complete_ondisk) with each sub op.  Writes at
+ * or below that are durable everywhere; anything newer is pending until
+ * a later sub op says otherwise.  Since that only travels with the next
+ * write, the last write to an idle pg stays pending and reads of it
+ * simply go to the primary.
+ *
+ * Not locked; the pg lock covers it.
+ */
+class ReplicaReads {
+  struct write_t {
+    int applying;        ///< transactions not yet readable here
+    eversion_t version;  ///< newest write to the object
+    write_t() : applying(0) {}
+  };
+  std::map<hobject_t, write_t> writes;
+  eversion_t acked;      ///< every replica has committed up to here
+
+public:
+  /// a replicated write to @soid at @v was queued here
+  void start_write(const hobject_t& soid, eversion_t v) {
+    write_t& w = writes[soid];
+    w.applying++;
+    if (v > w.version)
+      w.version = v;
+  }
+
+  /// the write queued with start_write() is readable here
+  void applied(const hobject_t& soid) {
+    std::map<hobject_t, write_t>::iterator p = writes.find(soid);
+    assert(p != writes.end());
+    assert(p->second.applying > 0);
+    if (--p->second.applying == 0 && p->second.version <= acked)
+      writes.erase(p);
+  }
+
+  /// the primary says every replica has committed up to @v
+  void acked_to(eversion_t v) {
+    if (v <= acked)
+      return;
+    acked = v;
+    std::map<hobject_t, write_t>::iterator p = writes.begin();
+    while (p != writes.end()) {
+      if (p->second.applying == 0 && p->second.version <= acked)
+	writes.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  eversion_t get_acked() const { return acked; }
+
+  /**
+   * is a write to @head still pending?  one on the snapdir or any clone
+   * counts too, since a read may resolve to any of them.
+   */
+  bool is_writing(const hobject_t& head) const {
+    // clones sort just before their snapdir and head
+    hobject_t first = head;
+    first.snap = 0;
+    std::map<hobject_t, write_t>::const_iterator p = writes.lower_bound(first);
+    return p != writes.end() &&
+      p->first.oid == head.oid &&
+      p->first.get_key() == head.get_key();
+  }
+};
+
+#endif
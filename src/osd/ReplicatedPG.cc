@@ -399,6 +399,32 @@ bool ReplicatedPG::pg_op_must_wait(MOSDOp *op)
   return false;
 }
 
+/*
+ * A replica may serve a read (CEPH_OSD_FLAG_BALANCE_READS or
+ * LOCALIZE_READS) only if it would see what the primary sees: the pg is
+ * active here, the object is neither missing nor past last_backfill, and
+ * no write to it is still pending (see ReplicaReads).  do_op also checks
+ * the object's version against what the primary has acked once it has
+ * the context.
+ * Anything else gets -EAGAIN and the client resends to the primary.
+ */
+bool ReplicatedPG::can_serve_replica_read(MOSDOp *m, const hobject_t& head)
+{
+  if (!is_replica() || !is_active())
+    return false;
+  if (m->may_write() || (m->get_rmw_flags() & CEPH_OSD_FLAG_PGOP))
+    return false;
+  if (!(head < info.last_backfill))
+    return false;
+
+  hobject_t snapdir = head;
+  snapdir.snap = CEPH_SNAPDIR;
+  if (is_missing_object(head) || is_missing_object(snapdir))
+    return false;
+
+  return !replica_reads.is_writing(head);
+}
+
 void ReplicatedPG::do_pg_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp *)op->request;
@@ -583,7 +609,9 @@ void ReplicatedPG::calc_trim_to()
 }
 
 ReplicatedPG::ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid) : 
-  PG(o, _pool, p, oid, ioid), temp_created(false),
+  PG(o, _pool, p, oid, ioid),
+  context_cache_key(0), trimming_context_cache(false),
+  temp_created(false),
   temp_coll(coll_t::make_temp_coll(p)), snap_trimmer_machine(this)
 { 
   snap_trimmer_machine.initiate();
@@ -604,6 +632,18 @@ void ReplicatedPG::do_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp*)op->request;
   assert(m->get_header().type == CEPH_MSG_OSD_OP);
+
+  hobject_t head(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(),
+		 info.pgid.pool());
+
+  if (!is_primary() && !can_serve_replica_read(m, head)) {
+    dout(10) << "do_op can't serve " << *m << " as a replica, bouncing" << dendl;
+    osd->logger->inc(l_osd_op_r_bounce);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
   if ((m->get_rmw_flags() & CEPH_OSD_FLAG_PGOP)) {
     if (pg_op_must_wait(m)) {
       wait_for_all_missing(op);
@@ -614,7 +654,7 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   dout(10) << "do_op " << *m << (m->may_write() ? " may_write" : "") << dendl;
 
-  if (scrub_block_writes && m->may_write()) {
+  if (m->may_write() && write_blocked_by_scrub(head)) {
     dout(20) << __func__ << ": waiting for scrub" << dendl;
     waiting_for_active.push_back(op);
     op->mark_delayed();
@@ -622,9 +662,6 @@ void ReplicatedPG::do_op(OpRequestRef op)
   }
 
   // missing object?
-  hobject_t head(m->get_oid(), m->get_object_locator().key,
-		 CEPH_NOSNAP, m->get_pg().ps(),
-		 info.pgid.pool());
   if (is_missing_object(head)) {
     wait_for_missing_object(head, op);
     return;
@@ -665,10 +702,9 @@ void ReplicatedPG::do_op(OpRequestRef op)
     &obc, can_create, &snapid);
   if (r) {
     if (r == -EAGAIN) {
-      // If we're not the primary of this OSD, and we have
-      // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
-      // we have to wait for the object.
-      if (is_primary() || (!(m->get_rmw_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      // A replica just returns -EAGAIN and the client retries on the
+      // primary.  Otherwise, we have to wait for the object.
+      if (is_primary()) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(m->get_oid(), m->get_object_locator().key,
@@ -693,6 +729,16 @@ void ReplicatedPG::do_op(OpRequestRef op)
 		     << " op " << *m << "\n";
   }
 
+  if (!is_primary() && obc->obs.oi.version > replica_reads.get_acked()) {
+    dout(10) << "do_op " << obc->obs.oi.soid << " v " << obc->obs.oi.version
+	     << " > primary acked " << replica_reads.get_acked()
+	     << ", bouncing replica read" << dendl;
+    put_object_context(obc);
+    osd->logger->inc(l_osd_op_r_bounce);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
   if ((m->may_read()) && (obc->obs.oi.lost)) {
     // This object is lost. Reading from it returns an error.
     dout(20) << __func__ << ": object " << obc->obs.oi.soid
@@ -1014,6 +1060,8 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->finc(l_osd_op_r_lat, latency);
+    if (!is_primary())
+      osd->logger->inc(l_osd_op_r_replica);
   } else if (m->may_write()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
@@ -1250,7 +1298,9 @@ bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
 }
 
 ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
-						   const snapid_t &sn)
+						   const snapid_t &sn,
+						   RepGather *batch,
+						   uint64_t *freed)
 {
   // load clone info
   bufferlist bl;
@@ -1277,17 +1327,27 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   dout(10) << coid << " snaps " << snaps << " old snapset " << snapset << dendl;
   assert(snapset.seq);
 
-  vector<OSDOp> ops;
-  tid_t rep_tid = osd->get_tid();
-  osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
-  OpContext *ctx = new OpContext(OpRequestRef(), reqid, ops, &obc->obs, ssc, this);
-  ctx->mtime = ceph_clock_now(g_ceph_context);
-
-  ctx->at_version.epoch = get_osdmap()->get_epoch();
-  ctx->at_version.version = log.head.version + 1;
+  RepGather *repop;
+  OpContext *ctx;
+  if (batch) {
+    // the batch holds our obc ref; its last log entry took at_version
+    repop = batch;
+    ctx = repop->ctx;
+    ctx->at_version.version++;
+    assert(!repop->src_obc.count(coid));
+    repop->src_obc[coid] = obc;
+  } else {
+    vector<OSDOp> ops;
+    tid_t rep_tid = osd->get_tid();
+    osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
+    ctx = new OpContext(OpRequestRef(), reqid, ops, &obc->obs, ssc, this);
+    ctx->mtime = ceph_clock_now(g_ceph_context);
 
+    ctx->at_version.epoch = get_osdmap()->get_epoch();
+    ctx->at_version.version = log.head.version + 1;
 
-  RepGather *repop = new_repop(ctx, obc, rep_tid);
+    repop = new_repop(ctx, obc, rep_tid);
+  }
 
   ObjectStore::Transaction *t = &ctx->op_t;
     
@@ -1326,12 +1386,13 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     delta.num_object_clones--;
     delta.num_bytes -= snapset.clone_size[last];
     info.stats.stats.add(delta, obc->obs.oi.category);
+    *freed += snapset.clone_size[last];
 
     snapset.clones.erase(p);
     snapset.clone_overlap.erase(last);
     snapset.clone_size.erase(last);
 	
-    ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, coid, ctx->at_version, ctx->obs->oi.version,
+    ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, coid, ctx->at_version, coi.version,
 				  osd_reqid_t(), ctx->mtime));
     ctx->at_version.version++;
   } else {
@@ -1368,29 +1429,36 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   hobject_t snapoid(coid.oid, coid.get_key(),
 		    snapset.head_exists ? CEPH_NOSNAP:CEPH_SNAPDIR, coid.hash,
 		    info.pgid.pool());
-  ctx->snapset_obc = get_object_context(snapoid, coi.oloc, false);
-  assert(ctx->snapset_obc->registered);
+  ObjectContext *snapset_obc = get_object_context(snapoid, coi.oloc, false);
+  assert(snapset_obc->registered);
+  if (!ctx->snapset_obc) {
+    ctx->snapset_obc = snapset_obc;
+  } else {
+    // clones in one snap collection all belong to different heads
+    assert(!repop->src_obc.count(snapoid));
+    repop->src_obc[snapoid] = snapset_obc;
+  }
   if (snapset.clones.empty() && !snapset.head_exists) {
     dout(10) << coid << " removing " << snapoid << dendl;
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, snapoid, ctx->at_version, 
-				  ctx->snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
-    ctx->snapset_obc->obs.exists = false;
+				  snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
+    snapset_obc->obs.exists = false;
 
     t->remove(coll, snapoid);
   } else {
     dout(10) << coid << " updating snapset on " << snapoid << dendl;
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::MODIFY, snapoid, ctx->at_version, 
-				  ctx->snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
+				  snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
 
-    ctx->snapset_obc->obs.oi.prior_version = ctx->snapset_obc->obs.oi.version;
-    ctx->snapset_obc->obs.oi.version = ctx->at_version;
+    snapset_obc->obs.oi.prior_version = snapset_obc->obs.oi.version;
+    snapset_obc->obs.oi.version = ctx->at_version;
 
     bl.clear();
     ::encode(snapset, bl);
     t->setattr(coll, snapoid, SS_ATTR, bl);
 
     bl.clear();
-    ::encode(ctx->snapset_obc->obs.oi, bl);
+    ::encode(snapset_obc->obs.oi, bl);
     t->setattr(coll, snapoid, OI_ATTR, bl);
   }
 
@@ -1410,7 +1478,7 @@ bool ReplicatedPG::snap_trimmer()
       put();
       return true;
     }
-    if (!scrub_block_writes) {
+    if (!scrub_active) {
       dout(10) << "snap_trimmer posting" << dendl;
       snap_trimmer_machine.process_event(SnapTrim());
     }
@@ -1434,65 +1502,6 @@ bool ReplicatedPG::snap_trimmer()
   return true;
 }
 
-int ReplicatedPG::do_xattr_cmp_u64(int op, __u64 v1, bufferlist& xattr)
-{
-  __u64 v2;
-  if (xattr.length())
-    v2 = atoll(xattr.c_str());
-  else
-    v2 = 0;
-
-  dout(20) << "do_xattr_cmp_u64 '" << v1 << "' vs '" << v2 << "' op " << op << dendl;
-
-  switch (op) {
-  case CEPH_OSD_CMPXATTR_OP_EQ:
-    return (v1 == v2);
-  case CEPH_OSD_CMPXATTR_OP_NE:
-    return (v1 != v2);
-  case CEPH_OSD_CMPXATTR_OP_GT:
-    return (v1 > v2);
-  case CEPH_OSD_CMPXATTR_OP_GTE:
-    return (v1 >= v2);
-  case CEPH_OSD_CMPXATTR_OP_LT:
-    return (v1 < v2);
-  case CEPH_OSD_CMPXATTR_OP_LTE:
-    return (v1 <= v2);
-  default:
-    return -EINVAL;
-  }
-}
-
-int ReplicatedPG::do_xattr_cmp_str(int op, string& v1s, bufferlist& xattr)
-{
-  const char *v1, *v2;
-  v1 = v1s.data();
-  string v2s;
-  if (xattr.length()) {
-    v2s = string(xattr.c_str(), xattr.length());
-    v2 = v2s.c_str();
-  } else
-    v2 = "";
-
-  dout(20) << "do_xattr_cmp_str '" << v1s << "' vs '" << v2 << "' op " << op << dendl;
-
-  switch (op) {
-  case CEPH_OSD_CMPXATTR_OP_EQ:
-    return (strcmp(v1, v2) == 0);
-  case CEPH_OSD_CMPXATTR_OP_NE:
-    return (strcmp(v1, v2) != 0);
-  case CEPH_OSD_CMPXATTR_OP_GT:
-    return (strcmp(v1, v2) > 0);
-  case CEPH_OSD_CMPXATTR_OP_GTE:
-    return (strcmp(v1, v2) >= 0);
-  case CEPH_OSD_CMPXATTR_OP_LT:
-    return (strcmp(v1, v2) < 0);
-  case CEPH_OSD_CMPXATTR_OP_LTE:
-    return (strcmp(v1, v2) <= 0);
-  default:
-    return -EINVAL;
-  }
-}
-
 void ReplicatedPG::dump_watchers(ObjectContext *obc)
 {
   assert(osd->watch_lock.is_locked());
@@ -1556,12 +1565,23 @@ void ReplicatedPG::remove_watchers_and_notifies()
   dout(10) << "remove_watchers" << dendl;
 
   osd->watch_lock.Lock();
+  // take refs first: putting them back may trim the context cache
+  list<ObjectContext*> obcs;
   for (map<hobject_t, ObjectContext*>::iterator oiter = object_contexts.begin();
        oiter != object_contexts.end();
-       ) {
-    map<hobject_t, ObjectContext *>::iterator iter = oiter++;
-    ObjectContext *obc = iter->second;
+       ++oiter) {
+    ObjectContext *obc = oiter->second;
+    if (obc->watchers.empty() && obc->unconnected_watchers.empty() &&
+	obc->notifs.empty())
+      continue;
+    uncache_object_context(obc);
     obc->ref++;
+    obcs.push_back(obc);
+  }
+  for (list<ObjectContext*>::iterator oiter = obcs.begin();
+       oiter != obcs.end();
+       ++oiter) {
+    ObjectContext *obc = *oiter;
     for (map<entity_name_t, OSD::Session *>::iterator witer = obc->watchers.begin();
 	 witer != obc->watchers.end();
 	 remove_watcher(obc, (witer++)->first)) ;
@@ -2008,6 +2028,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		     << ", truncating to " << op.extent.truncate_size << dendl;
 	    t.truncate(coll, soid, op.extent.truncate_size);
+	    if (oi.size > op.extent.truncate_size)
+	      ctx->note_data_extent(op.extent.truncate_size,
+				    oi.size - op.extent.truncate_size);
 	    oi.truncate_seq = op.extent.truncate_seq;
 	    oi.truncate_size = op.extent.truncate_size;
 	    if (op.extent.truncate_size != oi.size) {
@@ -2025,6 +2048,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bufferlist nbl;
 	bp.copy(op.extent.length, nbl);
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	ctx->note_data_extent(op.extent.offset, op.extent.length);
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
 				    op.extent.offset, op.extent.length, true);
 	if (!obs.exists) {
@@ -2045,6 +2069,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  obs.exists = true;
 	}
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	ctx->note_data_extent(0, MAX(oi.size, op.extent.offset + op.extent.length));
 	interval_set<uint64_t> ch;
 	if (oi.size > 0)
 	  ch.insert(0, oi.size);
@@ -2060,6 +2085,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       break;
 
     case CEPH_OSD_OP_ROLLBACK :
+      ctx->data_extents_valid = false;
       result = _rollback_to(ctx, op);
       break;
 
@@ -2068,6 +2094,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	assert(op.extent.length);
 	if (obs.exists) {
 	  t.zero(coll, soid, op.extent.offset, op.extent.length);
+	  ctx->note_data_extent(op.extent.offset, op.extent.length);
 	  interval_set<uint64_t> ch;
 	  ch.insert(op.extent.offset, op.extent.length);
 	  ctx->modified_ranges.union_of(ch);
@@ -2135,6 +2162,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  interval_set<uint64_t> trim;
 	  trim.insert(op.extent.offset, oi.size-op.extent.offset);
 	  ctx->modified_ranges.union_of(trim);
+	  ctx->data_extents.union_of(trim);
 	}
 	if (op.extent.offset != oi.size) {
 	  ctx->delta_stats.num_bytes -= oi.size;
@@ -2172,6 +2200,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	t.clone_range(coll, src_obc->obs.oi.soid,
 		      obs.oi.soid, op.clonerange.src_offset,
 		      op.clonerange.length, op.clonerange.offset);
+	ctx->note_data_extent(op.clonerange.offset, op.clonerange.length);
 		      
 
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
@@ -2246,6 +2275,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bp.copy(op.xattr.name_len, aname);
 	string name = "_" + aname;
 	t.rmattr(coll, soid, name);
+	ctx->data_extents_valid = false;
  	ctx->delta_stats.num_wr++;
       }
       break;
@@ -2624,6 +2654,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       // OMAP Write ops
     case CEPH_OSD_OP_OMAPSETVALS:
       {
+	ctx->data_extents_valid = false;
 	if (oi.uses_tmap && g_conf->osd_auto_upgrade_tmap) {
 	  _copy_up_tmap(ctx);
 	}
@@ -2645,6 +2676,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       break;
     case CEPH_OSD_OP_OMAPSETHEADER:
       {
+	ctx->data_extents_valid = false;
 	if (oi.uses_tmap && g_conf->osd_auto_upgrade_tmap) {
 	  _copy_up_tmap(ctx);
 	}
@@ -2662,6 +2694,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  result = -ENOENT;
 	  break;
 	}
+	ctx->data_extents_valid = false;
 	if (oi.uses_tmap && g_conf->osd_auto_upgrade_tmap) {
 	  _copy_up_tmap(ctx);
 	}
@@ -2675,6 +2708,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  result = -ENOENT;
 	  break;
 	}
+	ctx->data_extents_valid = false;
 	if (oi.uses_tmap && g_conf->osd_auto_upgrade_tmap) {
 	  _copy_up_tmap(ctx);
 	}
@@ -2752,6 +2786,7 @@ inline int ReplicatedPG::_delete_head(OpContext *ctx)
     return -ENOENT;
   
   t.remove(coll, soid);
+  ctx->data_extents_valid = false;
 
   if (oi.size > 0) {
     interval_set<uint64_t> ch;
@@ -3059,12 +3094,13 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
       map<Watch::Notification *, bool>::iterator niter;
       for (niter = obc->notifs.begin(); niter != obc->notifs.end(); ++niter) {
 	Watch::Notification *notif = niter->first;
-	map<entity_name_t, Watch::WatcherState>::iterator iter = notif->watchers.find(entity);
-	if (iter != notif->watchers.end()) {
+	if (notif->is_pending(entity)) {
 	  /* there is a pending notification for this watcher, we should resend it anyway
 	     even if we already sent it as it might not have received it */
-	  MWatchNotify *notify_msg = new MWatchNotify(w.cookie, oi.user_version.version, notif->id, WATCH_NOTIFY, notif->bl);
-	  osd->client_messenger->send_message(notify_msg, session->con);
+	  OSD::NotifyFanout *f = new OSD::NotifyFanout(notif->id, oi.user_version.version,
+						       WATCH_NOTIFY, notif->bl);
+	  f->add_target(session->con, w.cookie);
+	  osd->queue_notify_fanout(f);
 	}
       }
     }
@@ -3089,6 +3125,17 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	  osd->ack_notification(entity, notif, obc, this);
 	}
       }
+      // and any the notify thread hasn't sent us yet
+      list<Watch::Notification*> unsent;
+      for (map<Watch::Notification*, bool>::iterator n = obc->notifs.begin();
+	   n != obc->notifs.end();
+	   ++n)
+	if (n->first->is_pending(entity))
+	  unsent.push_back(n->first);
+      for (list<Watch::Notification*>::iterator n = unsent.begin(); n != unsent.end(); ++n) {
+	dout(10) << " acking unsent notif " << (*n)->id << " by " << entity << dendl;
+	osd->ack_notification(entity, *n, obc, this);
+      }
     }
 
     for (list<notify_info_t>::iterator p = ctx->notifies.begin();
@@ -3104,30 +3151,23 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 
       osd->watch->add_notification(notif);
 
-      // connected
+      // the osd's notify thread finds the watchers' sessions and sends
+      // the messages, not under our lock
+      OSD::NotifyFanout *fanout = new OSD::NotifyFanout(notif->id, oi.user_version.version,
+							 WATCH_NOTIFY, notif->bl);
+
+      // watchers come out of the map in order, as add_watcher wants.
+      // unconnected ones are notified when they reconnect.
       for (map<entity_name_t, watch_info_t>::iterator i = obc->obs.oi.watchers.begin();
 	   i != obc->obs.oi.watchers.end();
 	   ++i) {
-	map<entity_name_t, OSD::Session*>::iterator q = obc->watchers.find(i->first);
-	if (q != obc->watchers.end()) {
-	  entity_name_t name = q->first;
-	  OSD::Session *s = q->second;
-	  watch_info_t& w = obc->obs.oi.watchers[q->first];
-
-	  notif->add_watcher(name, Watch::WATCHER_NOTIFIED); // adding before send_message to avoid race
-	  s->add_notif(notif, name);
-
-	  MWatchNotify *notify_msg = new MWatchNotify(w.cookie, oi.user_version.version, notif->id, WATCH_NOTIFY, notif->bl);
-	  osd->client_messenger->send_message(notify_msg, s->con);
-	} else {
-	  // unconnected
-	  entity_name_t name = i->first;
-	  notif->add_watcher(name, Watch::WATCHER_PENDING);
-	}
+	notif->add_watcher(i->first); // adding before the send to avoid race
+	fanout->add_watcher(i->first, i->second.cookie);
       }
+      osd->queue_notify_fanout(fanout);
 
       notif->reply = new MWatchNotify(p->cookie, oi.user_version.version, notif->id, WATCH_NOTIFY_COMPLETE, notif->bl);
-      if (notif->watchers.empty()) {
+      if (notif->complete()) {
 	osd->complete_notify(notif, obc);
       } else {
 	obc->notifs[notif] = true;
@@ -3225,6 +3265,11 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (logopcode == pg_log_entry_t::MODIFY &&
+      ctx->obs->exists && ctx->data_extents_valid) {
+    ctx->log.back().have_extents = true;
+    ctx->log.back().extents = ctx->data_extents;
+  }
 
   if (ctx->new_obs.exists) {
     ctx->new_obs.oi.version = ctx->at_version;
@@ -3291,6 +3336,10 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
   ctx->obc->ssc->snapset = ctx->new_snapset;
   info.stats.stats.add(ctx->delta_stats, ctx->obc->obs.oi.category);
 
+  // the scrub in progress has already counted objects before its chunk
+  if (scrub_active && soid < scrub_start)
+    scrub_cstat.add(ctx->delta_stats, ctx->obc->obs.oi.category);
+
   if (backfill_target >= 0) {
     pg_info_t& pinfo = peer_info[backfill_target];
     if (soid < pinfo.last_backfill)
@@ -3408,12 +3457,9 @@ void ReplicatedPG::op_applied(RepGather *repop)
   assert(info.last_update >= repop->v);
   assert(last_update_applied < repop->v);
   last_update_applied = repop->v;
-  if (last_update_applied == info.last_update && scrub_block_writes) {
-    dout(10) << "requeueing scrub for cleanup" << dendl;
-    finalizing_scrub = true;
-    scrub_gather_replica_maps();
-    ++scrub_waiting_on;
-    scrub_waiting_on_whom.insert(osd->whoami);
+  if (scrub_active && scrub_state == SCRUB_WAIT_LAST_UPDATE &&
+      last_update_applied >= scrub_subset_last_update) {
+    dout(10) << "requeueing scrub, chunk writes applied" << dendl;
     osd->scrub_wq.queue(this);
   }
 
@@ -3626,6 +3672,7 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
+    wr->pg_acked_to = min_last_complete_ondisk;
     osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
 
     // keep peer_info up to date
@@ -3861,8 +3908,11 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
     obc = p->second;
     dout(10) << "get_object_context " << obc << " " << soid << " " << obc->ref
 	     << " -> " << (obc->ref+1) << dendl;
+    uncache_object_context(obc);
+    osd->logger->inc(l_osd_obc_hit);
   } else {
     // check disk
+    osd->logger->inc(l_osd_obc_miss);
     bufferlist bv;
     int r = osd->store->getattr(coll, soid, OI_ATTR, bv);
     if (r < 0) {
@@ -3904,6 +3954,7 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
 void ReplicatedPG::context_registry_on_change()
 {
   remove_watchers_and_notifies();
+  clear_context_cache();
   if (object_contexts.size()) {
     for (map<hobject_t, ObjectContext *>::iterator p = object_contexts.begin();
 	 p != object_contexts.end();
@@ -4027,14 +4078,24 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
-    if (obc->ssc)
-      put_snapset_context(obc->ssc);
+    if (obc->registered && obc->obs.exists && is_primary() &&
+	g_conf->osd_object_context_cache_size > 0) {
+      // keep it around for the next op
+      obc->lru_stamp = osd->context_cache_seq.inc();
+      obc_lru.push_back(&obc->lru_item);
+      osd->context_cache_size.inc();
+      update_context_cache_index();
+      trim_context_cache();
+    } else {
+      if (obc->ssc)
+	put_snapset_context(obc->ssc);
 
-    if (obc->registered)
-      object_contexts.erase(obc->obs.oi.soid);
-    delete obc;
+      if (obc->registered)
+	object_contexts.erase(obc->obs.oi.soid);
+      delete obc;
+    }
 
-    if (object_contexts.empty())
+    if (object_contexts.size() == (unsigned)obc_lru.size())
       kick();
   }
 }
@@ -4105,7 +4166,10 @@ ReplicatedPG::SnapSetContext *ReplicatedPG::get_snapset_context(const object_t&
   map<object_t, SnapSetContext*>::iterator p = snapset_contexts.find(oid);
   if (p != snapset_contexts.end()) {
     ssc = p->second;
+    uncache_snapset_context(ssc);
+    osd->logger->inc(l_osd_ssc_hit);
   } else {
+    osd->logger->inc(l_osd_ssc_miss);
     bufferlist bv;
     hobject_t head(oid, key, CEPH_NOSNAP, seed,
 		   info.pgid.pool());
@@ -4132,17 +4196,142 @@ ReplicatedPG::SnapSetContext *ReplicatedPG::get_snapset_context(const object_t&
   return ssc;
 }
 
-void ReplicatedPG::put_snapset_context(SnapSetContext *ssc)
+void ReplicatedPG::put_snapset_context(SnapSetContext *ssc, bool cache)
 {
   dout(10) << "put_snapset_context " << ssc->oid << " "
 	   << ssc->ref << " -> " << (ssc->ref-1) << dendl;
 
   --ssc->ref;
   if (ssc->ref == 0) {
-    if (ssc->registered)
-      snapset_contexts.erase(ssc->oid);
-    delete ssc;
+    if (cache && ssc->registered && is_primary() &&
+	g_conf->osd_object_context_cache_size > 0) {
+      ssc->lru_stamp = osd->context_cache_seq.inc();
+      ssc_lru.push_back(&ssc->lru_item);
+      osd->context_cache_size.inc();
+      update_context_cache_index();
+      trim_context_cache();
+    } else {
+      if (ssc->registered)
+	snapset_contexts.erase(ssc->oid);
+      delete ssc;
+    }
+  }
+}
+
+/*
+ * keep our entry in the osd's index of each pg's oldest idle context
+ * current.  the lrus only change at the ends, so this is a comparison
+ * unless our oldest entry changed.
+ */
+void ReplicatedPG::update_context_cache_index()
+{
+  uint64_t oldest = 0;
+  if (!obc_lru.empty())
+    oldest = obc_lru.front()->lru_stamp;
+  if (!ssc_lru.empty() && (!oldest || ssc_lru.front()->lru_stamp < oldest))
+    oldest = ssc_lru.front()->lru_stamp;
+  if (oldest == context_cache_key)
+    return;
+  osd->context_cache_reindex(this, context_cache_key, oldest);
+  context_cache_key = oldest;
+}
+
+void ReplicatedPG::evict_object_context(ObjectContext *obc)
+{
+  assert(obc->ref == 0);
+  dout(20) << "evict_object_context " << obc->obs.oi.soid << dendl;
+  uncache_object_context(obc);
+  object_contexts.erase(obc->obs.oi.soid);
+  // its snapset goes with it rather than back on the lru
+  if (obc->ssc)
+    put_snapset_context(obc->ssc, false);
+  delete obc;
+}
+
+void ReplicatedPG::evict_snapset_context(SnapSetContext *ssc)
+{
+  assert(ssc->ref == 0);
+  dout(20) << "evict_snapset_context " << ssc->oid << dendl;
+  uncache_snapset_context(ssc);
+  snapset_contexts.erase(ssc->oid);
+  delete ssc;
+}
+
+/*
+ * evict our oldest idle context
+ *
+ * @return false if we have none
+ */
+bool ReplicatedPG::evict_oldest_context()
+{
+  if (!obc_lru.empty() &&
+      (ssc_lru.empty() ||
+       obc_lru.front()->lru_stamp < ssc_lru.front()->lru_stamp)) {
+    evict_object_context(obc_lru.front());
+  } else if (!ssc_lru.empty()) {
+    evict_snapset_context(ssc_lru.front());
+  } else {
+    return false;
   }
+  return true;
+}
+
+/*
+ * while the osd as a whole is over osd_object_context_cache_size, evict
+ * the oldest idle contexts of whichever pg holds them.  a pg we can't
+ * lock without waiting (it's busy, or its lock is ordered after ours)
+ * is skipped in favour of our own oldest.
+ */
+void ReplicatedPG::trim_context_cache()
+{
+  if (trimming_context_cache)
+    return;  // evicting a context put its snapset; the outer loop goes on
+  trimming_context_cache = true;
+
+  int conf_max = g_conf->osd_object_context_cache_size;
+  unsigned max = conf_max > 0 ? (unsigned)conf_max : 0;
+  while (osd->context_cache_size.read() > max) {
+    PG *pg = osd->context_cache_oldest_pg();
+    if (!pg)
+      break;
+    bool evicted = false;
+    if (pg != this && pg->try_lock()) {
+      evicted = pg->evict_oldest_context();
+      pg->unlock();
+    }
+    pg->put();
+    if (!evicted && !evict_oldest_context())
+      break;
+  }
+
+  trimming_context_cache = false;
+  osd->logger->set(l_osd_ctx_cached, osd->context_cache_size.read());
+}
+
+/*
+ * forget what we had cached about soid (and its snapset), if nobody is
+ * using it, because its on-disk state is about to change underneath us.
+ */
+void ReplicatedPG::drop_cached_contexts(const hobject_t& soid)
+{
+  map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(soid);
+  if (p != object_contexts.end() && p->second->ref == 0)
+    evict_object_context(p->second);
+  map<object_t, SnapSetContext*>::iterator q = snapset_contexts.find(soid.oid);
+  if (q != snapset_contexts.end() && q->second->ref == 0)
+    evict_snapset_context(q->second);
+}
+
+void ReplicatedPG::clear_context_cache()
+{
+  dout(10) << "clear_context_cache " << obc_lru.size() << " objects, "
+	   << ssc_lru.size() << " snapsets" << dendl;
+  while (!obc_lru.empty())
+    evict_object_context(obc_lru.front());
+  while (!ssc_lru.empty())
+    evict_snapset_context(ssc_lru.front());
+  assert(context_cache_key == 0);
+  osd->logger->set(l_osd_ctx_cached, osd->context_cache_size.read());
 }
 
 // sub op modify
@@ -4182,6 +4371,8 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   
   op->mark_started();
 
+  replica_reads.acked_to(m->pg_acked_to);
+
   RepModify *rm = new RepModify;
   rm->pg = this;
   get();
@@ -4210,6 +4401,13 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
 	rm->opt.set_pool_override(info.pgid.pool());
       }
       
+      for (vector<pg_log_entry_t>::iterator i = log.begin();
+	   i != log.end();
+	   ++i) {
+	rm->objects.push_back(i->soid);
+	replica_reads.start_write(i->soid, i->version);
+      }
+
       info.stats = m->pg_stats;
       update_snap_collections(log, rm->localt);
       append_log(log, m->pg_trim_to, rm->localt);
@@ -4284,6 +4482,10 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 
   rm->applied = true;
   bool done = rm->applied && rm->committed;
+  for (vector<hobject_t>::iterator p = rm->objects.begin();
+       p != rm->objects.end();
+       ++p)
+    replica_reads.applied(*p);
 
   assert(info.last_update >= m->version);
   assert(last_update_applied < m->version);
@@ -4295,6 +4497,10 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
       osd->rep_scrub_wq.queue(active_rep_scrub);
       active_rep_scrub = 0;
     }
+  } else if (active_rep_scrub &&
+	     last_update_applied >= active_rep_scrub->scrub_to) {
+    osd->rep_scrub_wq.queue(active_rep_scrub);
+    active_rep_scrub = 0;
   }
 
   unlock();
@@ -4484,6 +4690,33 @@ void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
 	   << "  clone_subsets " << clone_subsets << dendl;
 }
 
+/*
+ * work out which data extents of a head object changed between the
+ * version a peer has and the one it needs, from the modified extents
+ * recorded in our log.  returns false if we can't tell, in which case
+ * the whole object must be sent.
+ */
+bool ReplicatedPG::calc_delta_subset(const hobject_t& soid, eversion_t have, eversion_t need,
+				     interval_set<uint64_t>& data_subset)
+{
+  if (!g_conf->osd_recover_delta ||
+      soid.snap != CEPH_NOSNAP ||
+      have == eversion_t())
+    return false;
+
+  interval_set<uint64_t> dirty;
+  if (!log.get_dirty_extents(soid, have, need, dirty)) {
+    dout(15) << "calc_delta_subset " << soid << " log does not cover "
+	     << have << ".." << need << " with extents" << dendl;
+    return false;
+  }
+
+  dout(10) << "calc_delta_subset " << soid << " " << have << ".." << need
+	   << " dirty " << dirty << dendl;
+  data_subset.swap(dirty);
+  return true;
+}
+
 
 /** pull - request object from a peer
  */
@@ -4567,6 +4800,14 @@ int ReplicatedPG::pull(const hobject_t& soid, eversion_t v)
     put_snapset_context(ssc);
     // FIXME: this may overestimate if we are pulling multiple clones in parallel...
     dout(10) << " pulling " << recovery_info << dendl;
+  } else if (calc_delta_subset(soid, missing.have_old(soid), v,
+				recovery_info.copy_subset)) {
+    // we have an older copy; pull just what changed since.  the
+    // peer fills in the size.
+    recovery_info.base_version = missing.have_old(soid);
+    recovery_info.size = ((uint64_t)-1);
+    dout(10) << " pulling delta on " << recovery_info.base_version
+	     << " " << recovery_info.copy_subset << dendl;
   } else {
     // pulling head or unversioned object.
     // always pull the whole thing.
@@ -4660,6 +4901,27 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		       data_subset, clone_subsets);
     put_snapset_context(ssc);
   } else if (soid.snap == CEPH_NOSNAP) {
+    // does the replica have an older copy we can patch up?
+    eversion_t have = peer_missing[peer].have_old(soid);
+    if (have != eversion_t() &&
+	calc_delta_subset(soid, have, oi.version, data_subset)) {
+      Connection *con = osd->cluster_messenger->get_connection(
+	get_osdmap()->get_cluster_inst(peer));
+      bool delta_ok = con->has_feature(CEPH_FEATURE_DELTA_RECOVERY);
+      con->put();
+      if (delta_ok) {
+	interval_set<uint64_t> whole;
+	if (size)
+	  whole.insert(0, size);
+	data_subset.intersection_of(whole);
+	dout(10) << "push_to_replica osd." << peer << " has " << soid << " v" << have
+		 << ", pushing delta " << data_subset << dendl;
+	push_start(obc, soid, peer, oi.version, data_subset, clone_subsets, have);
+	return;
+      }
+      data_subset.clear();
+    }
+
     // pushing head or unversioned object.
     // base this on partially on replica's clones?
     SnapSetContext *ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
@@ -4689,7 +4951,8 @@ void ReplicatedPG::push_start(
   const hobject_t& soid, int peer,
   eversion_t version,
   interval_set<uint64_t> &data_subset,
-  map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+  eversion_t base_version)
 {
   peer_missing[peer].revise_have(soid, eversion_t());
   // take note.
@@ -4697,6 +4960,7 @@ void ReplicatedPG::push_start(
   pi.recovery_info.size = obc->obs.oi.size;
   pi.recovery_info.copy_subset = data_subset;
   pi.recovery_info.clone_subset = clone_subsets;
+  pi.recovery_info.base_version = base_version;
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
@@ -4741,6 +5005,28 @@ int ReplicatedPG::send_pull(int peer,
   return 0;
 }
 
+/*
+ * a delta push patches our own copy, so it had better be at the
+ * version the delta was computed against.
+ */
+bool ReplicatedPG::have_recovery_base(const ObjectRecoveryInfo &recovery_info)
+{
+  bufferlist bv;
+  int r = osd->store->getattr(coll, recovery_info.soid, OI_ATTR, bv);
+  if (r < 0) {
+    dout(10) << "have_recovery_base " << recovery_info.soid << " got " << r
+	     << " reading our copy, need " << recovery_info.base_version << dendl;
+    return false;
+  }
+  object_info_t oi(bv);
+  if (oi.version != recovery_info.base_version) {
+    dout(10) << "have_recovery_base " << recovery_info.soid << " is at " << oi.version
+	     << ", need " << recovery_info.base_version << dendl;
+    return false;
+  }
+  return true;
+}
+
 void ReplicatedPG::submit_push_data(
   const ObjectRecoveryInfo &recovery_info,
   bool first,
@@ -4752,10 +5038,19 @@ void ReplicatedPG::submit_push_data(
   ObjectStore::Transaction *t)
 {
   if (first) {
+    drop_cached_contexts(recovery_info.soid);
     missing.revise_have(recovery_info.soid, eversion_t());
-    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
     t->remove(get_temp_coll(t), recovery_info.soid);
-    t->touch(get_temp_coll(t), recovery_info.soid);
+    if (recovery_info.base_version != eversion_t()) {
+      // delta: start from our copy at base_version and patch it
+      dout(10) << "submit_push_data " << recovery_info.soid << " on our "
+	       << recovery_info.base_version << dendl;
+      t->collection_move(get_temp_coll(t), coll, recovery_info.soid);
+      t->truncate(get_temp_coll(t), recovery_info.soid, recovery_info.size);
+    } else {
+      remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+      t->touch(get_temp_coll(t), recovery_info.soid);
+    }
     t->omap_setheader(get_temp_coll(t), recovery_info.soid, omap_header);
   }
   uint64_t off = 0;
@@ -4778,6 +5073,7 @@ void ReplicatedPG::submit_push_data(
 void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
 					ObjectStore::Transaction *t)
 {
+  drop_cached_contexts(recovery_info.soid);
   remove_object_with_snap_hardlinks(*t, recovery_info.soid);
   t->collection_move(coll, get_temp_coll(t), recovery_info.soid);
   for (map<hobject_t, interval_set<uint64_t> >::const_iterator p =
@@ -4877,6 +5173,20 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
   }
 
   PullInfo &pi = pulling[hoid];
+  if (pi.recovery_progress.first &&
+      pi.recovery_info.base_version != eversion_t() &&
+      !have_recovery_base(pi.recovery_info)) {
+    // our copy is not what the delta applies to; pull the whole thing
+    dout(10) << " can't apply delta on " << pi.recovery_info.base_version
+	     << ", pulling all of " << hoid << dendl;
+    missing.revise_have(hoid, eversion_t());
+    pi.recovery_info.base_version = eversion_t();
+    pi.recovery_info.copy_subset.clear();
+    pi.recovery_info.copy_subset.insert(0, (uint64_t)-1);
+    pi.recovery_info.size = ((uint64_t)-1);
+    send_pull(m->get_source().num(), pi.recovery_info, pi.recovery_progress);
+    return;
+  }
   if (pi.recovery_info.size == (uint64_t(-1))) {
     pi.recovery_info.size = m->recovery_info.size;
     pi.recovery_info.copy_subset.intersection_of(
@@ -4994,6 +5304,17 @@ void ReplicatedPG::handle_push(OpRequestRef op)
   bool first = m->current_progress.first;
   bool complete = m->recovery_progress.data_complete &&
     m->recovery_progress.omap_complete;
+
+  if (first && m->recovery_info.base_version != eversion_t() &&
+      !have_recovery_base(m->recovery_info)) {
+    // tell the primary to send the whole object instead
+    MOSDSubOpReply *reply = new MOSDSubOpReply(
+      m, -ESTALE, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
+    osd->cluster_messenger->send_message(reply, m->get_connection());
+    return;
+  }
+
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   Context *onreadable = new ObjectStore::C_DeleteTransaction(t);
   Context *onreadable_sync = 0;
@@ -5164,7 +5485,19 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
   } else {
     PushInfo *pi = &pushing[soid][peer];
 
-    if (!pi->recovery_progress.data_complete) {
+    if (reply->get_result() == -ESTALE &&
+	pi->recovery_info.base_version != eversion_t()) {
+      // the replica's copy is not what we computed the delta against
+      dout(10) << " osd." << peer << " can't apply delta on "
+	       << pi->recovery_info.base_version << ", pushing all of " << soid << dendl;
+      pushing[soid].erase(peer);
+      ObjectContext *obc = get_object_context(soid, OLOC_BLANK, false);
+      assert(obc);
+      obc->ondisk_read_lock();
+      push_to_replica(obc, soid, peer);
+      obc->ondisk_read_unlock();
+      put_object_context(obc);
+    } else if (!pi->recovery_progress.data_complete) {
       dout(10) << " pushing more from, "
 	       << pi->recovery_progress.data_recovered_to
 	       << " of " << pi->recovery_info.copy_subset << dendl;
@@ -5206,6 +5539,7 @@ void ReplicatedPG::finish_degraded_object(const hobject_t& oid)
   dout(10) << "finish_degraded_object " << oid << dendl;
   map<hobject_t, ObjectContext *>::iterator i = object_contexts.find(oid);
   if (i != object_contexts.end()) {
+    uncache_object_context(i->second);
     i->second->get();
     for (set<ObjectContext*>::iterator j = i->second->blocking.begin();
 	 j != i->second->blocking.end();
@@ -5250,9 +5584,13 @@ void ReplicatedPG::sub_op_pull(OpRequestRef op)
     if (progress.first && recovery_info.size == ((uint64_t)-1)) {
       // Adjust size and copy_subset
       recovery_info.size = st.st_size;
-      recovery_info.copy_subset.clear();
+      interval_set<uint64_t> whole;
       if (st.st_size)
-	recovery_info.copy_subset.insert(0, st.st_size);
+	whole.insert(0, st.st_size);
+      if (recovery_info.base_version != eversion_t())
+	recovery_info.copy_subset.intersection_of(whole);  // just the delta
+      else
+	recovery_info.copy_subset.swap(whole);
       assert(recovery_info.clone_subset.empty());
     }
 
@@ -5309,41 +5647,6 @@ void ReplicatedPG::_applied_recovered_object(ObjectStore::Transaction *t, Object
   delete t;
 }
 
-void ReplicatedPG::recover_got(hobject_t oid, eversion_t v)
-{
-  if (missing.is_missing(oid, v)) {
-    dout(10) << "got missing " << oid << " v " << v << dendl;
-    missing.got(oid, v);
-    if (is_primary())
-      missing_loc.erase(oid);
-      
-    // raise last_complete?
-    if (missing.missing.empty()) {
-      log.complete_to = log.log.end();
-      info.last_complete = info.last_update;
-    }
-    while (log.complete_to != log.log.end()) {
-      if (missing.missing[missing.rmissing.begin()->second].need <=
-	  log.complete_to->version)
-	break;
-      if (info.last_complete < log.complete_to->version)
-	info.last_complete = log.complete_to->version;
-      log.complete_to++;
-    }
-    if (log.complete_to != log.log.end()) {
-      dout(10) << "last_complete now " << info.last_complete
-	       << " log.complete_to " << log.complete_to->version
-	       << dendl;
-    } else {
-      dout(10) << "last_complete now " << info.last_complete
-	       << " log.complete_to at end" << dendl;
-      assert(missing.num_missing() == 0);  // otherwise, complete_to was wrong.
-      assert(info.last_complete == info.last_update);
-    }
-  }
-}
-
-
 /**
  * trim received data to remove what we don't want
  *
@@ -5655,8 +5958,9 @@ void ReplicatedPG::apply_and_flush_repops(bool requeue)
     remove_repop(repop);
   }
 
+  // requeue at the pg; we may be advancing maps without osd_lock
   if (requeue)
-    osd->push_waiters(rq);
+    osd->requeue_ops(this, rq);
 }
 
 void ReplicatedPG::on_shutdown()
@@ -5664,6 +5968,7 @@ void ReplicatedPG::on_shutdown()
   dout(10) << "on_shutdown" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  clear_context_cache();
 }
 
 void ReplicatedPG::on_activate()
@@ -5689,13 +5994,19 @@ void ReplicatedPG::on_change()
   // clear reserved scrub state
   clear_scrub_reserved();
 
-  // clear scrub state
-  if (scrub_block_writes) {
+  // clear scrub state; an unfinished pass resumes from info.scrub_cursor
+  if (scrub_active) {
     scrub_clear_state();
   } else if (is_scrubbing()) {
     state_clear(PG_STATE_SCRUBBING);
     state_clear(PG_STATE_REPAIR);
+    state_clear(PG_STATE_DEEP_SCRUB);
+  }
+  if (active_rep_scrub) {
+    active_rep_scrub->put();
+    active_rep_scrub = NULL;
   }
+  finalizing_scrub = false;
 
   context_registry_on_change();
 
@@ -6581,6 +6892,18 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     cstat.add(stat, cat);
   }  
   
+  scrub_cstat.add(cstat);
+
+  dout(10) << "_scrub (" << mode << ") finish" << dendl;
+  return errors;
+}
+
+void ReplicatedPG::_scrub_finish(int& errors, int& fixed)
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair":"scrub";
+  const object_stat_collection_t &cstat = scrub_cstat;
+
   dout(10) << mode << " got "
 	   << cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
 	   << cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
@@ -6610,9 +6933,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
       }
     }
   }
-
-  dout(10) << "_scrub (" << mode << ") finish" << dendl;
-  return errors;
 }
 
 /*---SnapTrimmer Logging---*/
@@ -6660,9 +6980,8 @@ boost::statechart::result ReplicatedPG::NotTrimming::react(const SnapTrim&)
   } else if (!pg->is_primary() || !pg->is_active() || !pg->is_clean()) {
     dout(10) << "NotTrimming not primary, active, clean" << dendl;
     return discard_event();
-  } else if (pg->scrub_block_writes) {
-    dout(10) << "NotTrimming finalizing scrub" << dendl;
-    pg->queue_snap_trim();
+  } else if (pg->scrub_active) {
+    dout(10) << "NotTrimming scrubbing, will be requeued" << dendl;
     return discard_event();
   }
 
@@ -6682,6 +7001,7 @@ boost::statechart::result ReplicatedPG::NotTrimming::react(const SnapTrim&)
     // Nothing to actually trim, just update info and try again
     pg->info.purged_snaps.insert(snap_to_trim);
     pg->snap_trimq.erase(snap_to_trim);
+    pg->update_stats();
     dout(10) << "NotTrimming: obs_to_trim empty!" << dendl;
     dout(10) << "purged_snaps now " << pg->info.purged_snaps << ", snap_trimq now " 
 	     << pg->snap_trimq << dendl;
@@ -6773,10 +7093,47 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
     return transit< WaitingOnReplicas >();
   }
 
-  dout(10) << "TrimmingObjects react trimming " << *position << dendl;
-  RepGather *repop = pg->trim_object(*position, snap_to_trim);
+  /*
+   * trim up to osd_snap_trim_batch clones in one repop.  a backfill
+   * peer gets an empty transaction for a repop past backfill_pos, so
+   * a batch doesn't straddle it.
+   */
+  coll_t col_to_trim(pg->info.pgid, snap_to_trim);
+  ObjectStore::Transaction *extra_t = 0;
+  RepGather *repop = 0;
+  bool beyond_backfill = false;
+  unsigned max = MAX(g_conf->osd_snap_trim_batch, 1);
+  unsigned n = 0;
+  uint64_t freed = 0;
+  for (; position != obs_to_trim.end() && n < max; ++position) {
+    if (repop && pg->backfill_target >= 0 &&
+	(*position >= pg->backfill_pos) != beyond_backfill)
+      break;
+    dout(10) << "TrimmingObjects react trimming " << *position << dendl;
+    RepGather *r = pg->trim_object(*position, snap_to_trim, repop, &freed);
+    if (!r) {
+      // object has already been trimmed, this is an extra
+      if (!extra_t)
+	extra_t = new ObjectStore::Transaction;
+      extra_t->collection_remove(col_to_trim, *position);
+      continue;
+    }
+    if (!repop) {
+      repop = r;
+      beyond_backfill = *position >= pg->backfill_pos;
+    }
+    ++n;
+  }
+
+  if (extra_t) {
+    int r = pg->osd->store->queue_transaction(NULL, extra_t,
+					      new ObjectStore::C_DeleteTransaction(extra_t));
+    assert(r == 0);
+  }
 
   if (repop) {
+    dout(10) << "TrimmingObjects react trimmed " << n << " objects, freed "
+	     << freed << " bytes in " << *repop << dendl;
     repop->queue_snap_trimmer = true;
     eversion_t old_last_update = pg->log.head;
     bool old_exists = repop->obc->obs.exists;
@@ -6788,14 +7145,7 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
     pg->eval_repop(repop);
     
     repops.insert(repop);
-    ++position;
-  } else {
-    // object has already been trimmed, this is an extra
-    coll_t col_to_trim(pg->info.pgid, snap_to_trim);
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->collection_remove(col_to_trim, *position);
-    int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
-    assert(r == 0);
+    pg->osd->snap_trim_charge(n, freed);
   }
   return discard_event();
 }
@@ -6842,6 +7192,7 @@ boost::statechart::result ReplicatedPG::WaitingOnReplicas::react(const SnapTrim&
 
   pg->info.purged_snaps.insert(sn);
   pg->snap_trimq.erase(sn);
+  pg->update_stats();
   dout(10) << "purged_snaps now " << pg->info.purged_snaps << ", snap_trimq now " 
 	   << pg->snap_trimq << dendl;
   
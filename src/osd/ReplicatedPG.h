@@ -19,6 +19,7 @@
 #include "OSD.h"
 #include "Watch.h"
 #include "OpRequest.h"
+#include "ReplicaReads.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -100,8 +101,11 @@ public:
     int ref;
     bool registered; 
     SnapSet snapset;
+    xlist<SnapSetContext*>::item lru_item;  // on ssc_lru while idle
+    uint64_t lru_stamp;                     // when it went idle
 
-    SnapSetContext(const object_t& o) : oid(o), ref(0), registered(false) { }
+    SnapSetContext(const object_t& o)
+      : oid(o), ref(0), registered(false), lru_item(this), lru_stamp(0) { }
   };
 
   struct ObjectState {
@@ -283,11 +287,14 @@ public:
     map<entity_name_t, Watch::C_WatchTimeout *> unconnected_watchers;
     map<Watch::Notification *, bool> notifs;
 
+    xlist<ObjectContext*>::item lru_item;  // on obc_lru while idle
+    uint64_t lru_stamp;                    // when it went idle
+
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
       : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0),
-	blocked_by(0) {}
+	blocked_by(0), lru_item(this), lru_stamp(0) {}
     
     void get() { ++ref; }
 
@@ -365,6 +372,20 @@ public:
     vector<pg_log_entry_t> log;
 
     interval_set<uint64_t> modified_ranges;
+
+    // data extents we wrote, logged for delta recovery.  invalid if the
+    // op changed the object in a way extents can't describe (omap, rmxattr..)
+    interval_set<uint64_t> data_extents;
+    bool data_extents_valid;
+
+    void note_data_extent(uint64_t off, uint64_t len) {
+      if (!len)
+	return;
+      interval_set<uint64_t> ch;
+      ch.insert(off, len);
+      data_extents.union_of(ch);
+    }
+
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -388,6 +409,7 @@ public:
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
       bytes_written(0), bytes_read(0),
+      data_extents_valid(true),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
@@ -491,6 +513,39 @@ protected:
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  /*
+   * contexts nobody references stay registered above, on these lrus,
+   * so the next op on a hot object needn't re-read and decode its
+   * OI_ATTR and SS_ATTR.  the osd-wide total is held to
+   * osd_object_context_cache_size by evicting the oldest idle contexts
+   * of any pg (see OSD::context_cache_oldest); the cache is dropped on
+   * interval change, and per object when recovery rewrites it.
+   */
+  xlist<ObjectContext*> obc_lru;
+  xlist<SnapSetContext*> ssc_lru;
+  uint64_t context_cache_key;   // our stamp in osd->context_cache_oldest, 0 if none
+  bool trimming_context_cache;
+
+  void uncache_object_context(ObjectContext *obc) {
+    if (obc->lru_item.remove_myself()) {
+      osd->context_cache_size.dec();
+      update_context_cache_index();
+    }
+  }
+  void uncache_snapset_context(SnapSetContext *ssc) {
+    if (ssc->lru_item.remove_myself()) {
+      osd->context_cache_size.dec();
+      update_context_cache_index();
+    }
+  }
+  void update_context_cache_index();
+  void evict_object_context(ObjectContext *obc);
+  void evict_snapset_context(SnapSetContext *ssc);
+  bool evict_oldest_context();
+  void trim_context_cache();
+  void drop_cached_contexts(const hobject_t& soid);
+  void clear_context_cache();
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -504,6 +559,7 @@ protected:
   ObjectContext *lookup_object_context(const hobject_t& soid) {
     if (object_contexts.count(soid)) {
       ObjectContext *obc = object_contexts[soid];
+      uncache_object_context(obc);
       obc->ref++;
       return obc;
     }
@@ -545,7 +601,7 @@ protected:
       snapset_contexts[ssc->oid] = ssc;
     }
   }
-  void put_snapset_context(SnapSetContext *ssc);
+  void put_snapset_context(SnapSetContext *ssc, bool cache=true);
 
   // push
   struct PushInfo {
@@ -590,6 +646,7 @@ protected:
 			ObjectStore::Transaction *t);
   void submit_push_complete(ObjectRecoveryInfo &recovery_info,
 			    ObjectStore::Transaction *t);
+  bool have_recovery_base(const ObjectRecoveryInfo &recovery_info);
 
   /*
    * Backfill
@@ -624,6 +681,8 @@ protected:
 			  const hobject_t &last_backfill,
 			  interval_set<uint64_t>& data_subset,
 			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+  bool calc_delta_subset(const hobject_t& soid, eversion_t have, eversion_t need,
+			 interval_set<uint64_t>& data_subset);
   void push_to_replica(ObjectContext *obc, const hobject_t& oid, int dest);
   void push_start(ObjectContext *obc,
 		  const hobject_t& oid, int dest);
@@ -631,7 +690,8 @@ protected:
 		  const hobject_t& soid, int peer,
 		  eversion_t version,
 		  interval_set<uint64_t> &data_subset,
-		  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+		  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+		  eversion_t base_version = eversion_t());
   void send_push_op_blank(const hobject_t& soid, int peer);
 
   void finish_degraded_object(const hobject_t& oid);
@@ -693,6 +753,7 @@ protected:
     bool applied, committed;
     int ackerosd;
     eversion_t last_complete;
+    vector<hobject_t> objects;   ///< touched by the log entries, in replica_reads
 
     uint64_t bytes_written;
 
@@ -703,6 +764,9 @@ protected:
 		  bytes_written(0) {}
   };
 
+  ReplicaReads replica_reads;
+  bool can_serve_replica_read(MOSDOp *m, const hobject_t& head);
+
   struct C_OSD_RepModifyApply : public Context {
     RepModify *rm;
     C_OSD_RepModifyApply(RepModify *r) : rm(r) { }
@@ -766,7 +830,6 @@ protected:
   void sub_op_modify_reply(OpRequestRef op);
   void _applied_recovered_object(ObjectStore::Transaction *t, ObjectContext *obc);
   void _committed_pushed_object(OpRequestRef op, epoch_t same_since, eversion_t lc);
-  void recover_got(hobject_t oid, eversion_t v);
   void sub_op_push(OpRequestRef op);
   void _failed_push(OpRequestRef op);
   void sub_op_push_reply(OpRequestRef op);
@@ -777,12 +840,11 @@ protected:
 
   // -- scrub --
   virtual int _scrub(ScrubMap& map, int& errors, int& fixed);
+  virtual void _scrub_finish(int& errors, int& fixed);
 
   void apply_and_flush_repops(bool requeue);
 
   void calc_trim_to();
-  int do_xattr_cmp_u64(int op, __u64 v1, bufferlist& xattr);
-  int do_xattr_cmp_str(int op, string& v1s, bufferlist& xattr);
 
   bool pgls_filter(PGLSFilter *filter, hobject_t& sobj, bufferlist& outdata);
   int get_pgls_filter(bufferlist::iterator& iter, PGLSFilter **pfilter);
@@ -803,7 +865,15 @@ public:
   bool get_obs_to_trim(snapid_t &snap_to_trim,
 		       coll_t &col_to_trim,
 		       vector<hobject_t> &obs_to_trim);
-  RepGather *trim_object(const hobject_t &coid, const snapid_t &sn);
+  /**
+   * trim sn from clone coid.  with batch NULL a new repop is started;
+   * otherwise the trim is appended to batch's transaction and log.
+   *
+   * @param freed [out] incremented by the size of the clone if it is removed
+   * @return the repop the trim went into, or NULL if coid was already trimmed
+   */
+  RepGather *trim_object(const hobject_t &coid, const snapid_t &sn,
+			 RepGather *batch, uint64_t *freed);
   bool snap_trimmer();
   int do_osd_ops(OpContext *ctx, vector<OSDOp>& ops);
   void do_osd_op_effects(OpContext *ctx);
@@ -13,14 +13,10 @@
 
 bool Watch::ack_notification(entity_name_t& watcher, Notification *notif)
 {
-  map<entity_name_t, WatcherState>::iterator iter = notif->watchers.find(watcher);
-
-  if (iter == notif->watchers.end()) // client was not suppose to ack this notification
+  if (!notif->ack(watcher)) // client was not suppose to ack this notification
     return false;
 
-  notif->watchers.erase(iter);
-
-  return notif->watchers.empty(); // true if there are no more watchers
+  return notif->complete(); // true if there are no more watchers
 }
 
 void Watch::C_NotifyTimeout::finish(int r)
@@ -17,6 +17,8 @@
 #define CEPH_WATCH_H
 
 #include <map>
+#include <vector>
+#include <algorithm>
 
 #include "OSD.h"
 #include "common/config.h"
@@ -28,13 +30,15 @@ class Watch {
   uint64_t notif_id;
 
 public:
-  enum WatcherState {
-    WATCHER_PENDING,
-    WATCHER_NOTIFIED,
-  };
-
+  /*
+   * a notify waiting on its watchers.  a hot object (an rbd header,
+   * rgw's control objects) can have hundreds, so the watchers owing us
+   * an ack are a bitmap over a sorted array of names rather than a map.
+   */
   struct Notification {
-    std::map<entity_name_t, WatcherState> watchers;
+    vector<entity_name_t> watchers;   ///< sorted
+    vector<uint64_t> pending;         ///< bit i set until watchers[i] acks
+    unsigned num_pending;
     entity_name_t name;
     uint64_t id;
     OSD::Session *session;
@@ -45,11 +49,44 @@ public:
     pg_t pgid;
     bufferlist bl;
 
-    void add_watcher(const entity_name_t& name, WatcherState state) {
-      watchers[name] = state;
+    /// watchers must be added in order
+    void add_watcher(const entity_name_t& name) {
+      assert(watchers.empty() || watchers.back() < name);
+      unsigned i = watchers.size();
+      watchers.push_back(name);
+      if (pending.size() * 64 <= i)
+	pending.push_back(0);
+      pending[i / 64] |= 1ull << (i % 64);
+      num_pending++;
+    }
+    /// @return the watcher's index, or -1 if it isn't one of ours
+    int find_watcher(const entity_name_t& name) const {
+      vector<entity_name_t>::const_iterator p =
+	std::lower_bound(watchers.begin(), watchers.end(), name);
+      if (p == watchers.end() || *p != name)
+	return -1;
+      return p - watchers.begin();
+    }
+    bool is_pending(const entity_name_t& name) const {
+      int i = find_watcher(name);
+      return i >= 0 && (pending[i / 64] & (1ull << (i % 64)));
+    }
+    /// @return false if name didn't owe us an ack
+    bool ack(const entity_name_t& name) {
+      int i = find_watcher(name);
+      if (i < 0 || !(pending[i / 64] & (1ull << (i % 64))))
+	return false;
+      pending[i / 64] &= ~(1ull << (i % 64));
+      num_pending--;
+      return true;
+    }
+    bool complete() const {
+      return num_pending == 0;
     }
 
-    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b) : name(n), session(s), cookie(c), bl(b) { }
+    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b)
+      : num_pending(0), name(n), session(s), cookie(c), reply(NULL),
+	timeout(NULL), obc(NULL), bl(b) { }
   };
 
   class C_NotifyTimeout : public Context {
@@ -264,6 +264,18 @@ bool coll_t::is_temp(pg_t& pgid) const
   return false;
 }
 
+bool coll_t::is_removal(uint64_t *seq, pg_t *pgid) const
+{
+  if (str.compare(0, 11, "FORREMOVAL_") != 0)
+    return false;
+  const char *cstr = str.c_str() + 11;
+  char *end;
+  *seq = strtoull(cstr, &end, 10);
+  if (end == cstr || *end != '_')
+    return false;
+  return pgid->parse(end + 1);
+}
+
 bool coll_t::is_pg(pg_t& pgid, snapid_t& snap) const
 {
   const char *cstr(str.c_str());
@@ -392,6 +404,8 @@ std::string pg_state_string(int state)
     oss << "scrubbing+";
   if (state & PG_STATE_SCRUBQ)
     oss << "scrubq+";
+  if (state & PG_STATE_DEEP_SCRUB)
+    oss << "deep+";
   if (state & PG_STATE_INCONSISTENT)
     oss << "inconsistent+";
   if (state & PG_STATE_PEERING)
@@ -473,6 +487,11 @@ void pg_pool_t::dump(Formatter *f) const
   }
   f->close_section();
   f->dump_stream("removed_snaps") << removed_snaps;
+  if (is_erasure()) {
+    f->dump_string("erasure_code_technique", get_erasure_code_technique());
+    f->dump_unsigned("erasure_k", get_data_chunk_count());
+    f->dump_unsigned("stripe_unit", get_stripe_unit());
+  }
 }
 
 
@@ -664,7 +683,7 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
     return;
   }
 
-  ENCODE_START(6, 5, bl);
+  ENCODE_START(7, 5, bl);
   ::encode(type, bl);
   ::encode(size, bl);
   ::encode(crush_ruleset, bl);
@@ -682,12 +701,15 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   ::encode(auid, bl);
   ::encode(flags, bl);
   ::encode(crash_replay_interval, bl);
+  ::encode(erasure_code_technique, bl);
+  ::encode(erasure_k, bl);
+  ::encode(stripe_unit, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_pool_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(6, 5, 5, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
   ::decode(type, bl);
   ::decode(size, bl);
   ::decode(crush_ruleset, bl);
@@ -731,6 +753,11 @@ void pg_pool_t::decode(bufferlist::iterator& bl)
     else
       crash_replay_interval = 0;
   }
+  if (struct_v >= 7) {
+    ::decode(erasure_code_technique, bl);
+    ::decode(erasure_k, bl);
+    ::decode(stripe_unit, bl);
+  }
   DECODE_FINISH(bl);
   calc_pg_masks();
 }
@@ -763,6 +790,16 @@ void pg_pool_t::generate_test_instances(list<pg_pool_t*>& o)
 
   a.removed_snaps.insert(2);   // not quite valid to combine with snaps!
   o.push_back(new pg_pool_t(a));
+
+  pg_pool_t b;
+  b.type = TYPE_ERASURE;
+  b.size = 6;
+  b.pg_num = 8;
+  b.pgp_num = 8;
+  b.erasure_code_technique = "reed_solomon";
+  b.erasure_k = 4;
+  b.stripe_unit = 4096;
+  o.push_back(new pg_pool_t(b));
 }
 
 ostream& operator<<(ostream& out, const pg_pool_t& p)
@@ -779,6 +816,11 @@ ostream& operator<<(ostream& out, const pg_pool_t& p)
     out << " flags " << p.flags;
   if (p.crash_replay_interval)
     out << " crash_replay_interval " << p.crash_replay_interval;
+  if (p.is_erasure())
+    out << " " << p.get_erasure_code_technique()
+	<< " k " << p.get_data_chunk_count()
+	<< " m " << p.get_coding_chunk_count()
+	<< " stripe_unit " << p.get_stripe_unit();
   return out;
 }
 
@@ -955,8 +997,11 @@ void pg_stat_t::dump(Formatter *f) const
   f->dump_unsigned("parent_split_bits", parent_split_bits);
   f->dump_stream("last_scrub") << last_scrub;
   f->dump_stream("last_scrub_stamp") << last_scrub_stamp;
+  f->dump_stream("last_deep_scrub") << last_deep_scrub;
+  f->dump_stream("last_deep_scrub_stamp") << last_deep_scrub_stamp;
   f->dump_unsigned("log_size", log_size);
   f->dump_unsigned("ondisk_log_size", ondisk_log_size);
+  f->dump_unsigned("snaptrimq_len", snaptrimq_len);
   stats.dump(f);
   f->open_array_section("up");
   for (vector<int>::const_iterator p = up.begin(); p != up.end(); ++p)
@@ -970,7 +1015,7 @@ void pg_stat_t::dump(Formatter *f) const
 
 void pg_stat_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(9, 8, bl);
+  ENCODE_START(11, 8, bl);
   ::encode(version, bl);
   ::encode(reported, bl);
   ::encode(state, bl);
@@ -993,12 +1038,15 @@ void pg_stat_t::encode(bufferlist &bl) const
   ::encode(last_clean, bl);
   ::encode(last_unstale, bl);
   ::encode(mapping_epoch, bl);
+  ::encode(last_deep_scrub, bl);
+  ::encode(last_deep_scrub_stamp, bl);
+  ::encode(snaptrimq_len, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_stat_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(9, 8, 8, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(11, 8, 8, bl);
   ::decode(version, bl);
   ::decode(reported, bl);
   ::decode(state, bl);
@@ -1019,6 +1067,11 @@ void pg_stat_t::decode(bufferlist::iterator &bl)
   ::decode(parent_split_bits, bl);
   ::decode(last_scrub, bl);
   ::decode(last_scrub_stamp, bl);
+  if (struct_v < 10) {
+    // see pg_history_t::decode
+    last_deep_scrub = last_scrub;
+    last_deep_scrub_stamp = last_scrub_stamp;
+  }
   if (struct_v <= 4) {
     ::decode(stats.sum.num_bytes, bl);
     uint64_t num_kb;
@@ -1057,6 +1110,14 @@ void pg_stat_t::decode(bufferlist::iterator &bl)
       ::decode(last_unstale, bl);
       ::decode(mapping_epoch, bl);
     }
+    if (struct_v >= 10) {
+      ::decode(last_deep_scrub, bl);
+      ::decode(last_deep_scrub_stamp, bl);
+    }
+    if (struct_v >= 11)
+      ::decode(snaptrimq_len, bl);
+    else
+      snaptrimq_len = 0;
   }
   DECODE_FINISH(bl);
 }
@@ -1083,6 +1144,8 @@ void pg_stat_t::generate_test_instances(list<pg_stat_t*>& o)
   a.parent_split_bits = 12;
   a.last_scrub = eversion_t(9, 10);
   a.last_scrub_stamp = utime_t(11, 12);
+  a.last_deep_scrub = eversion_t(13, 14);
+  a.last_deep_scrub_stamp = utime_t(15, 16);
   list<object_stat_collection_t*> l;
   object_stat_collection_t::generate_test_instances(l);
   a.stats = *l.back();
@@ -1090,6 +1153,7 @@ void pg_stat_t::generate_test_instances(list<pg_stat_t*>& o)
   a.ondisk_log_size = 88;
   a.up.push_back(123);
   a.acting.push_back(456);
+  a.snaptrimq_len = 5;
   o.push_back(new pg_stat_t(a));
 }
 
@@ -1161,7 +1225,7 @@ void pool_stat_t::generate_test_instances(list<pool_stat_t*>& o)
 
 void pg_history_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(4, 4, bl);
+  ENCODE_START(5, 4, bl);
   ::encode(epoch_created, bl);
   ::encode(last_epoch_started, bl);
   ::encode(last_epoch_clean, bl);
@@ -1171,12 +1235,14 @@ void pg_history_t::encode(bufferlist &bl) const
   ::encode(same_primary_since, bl);
   ::encode(last_scrub, bl);
   ::encode(last_scrub_stamp, bl);
+  ::encode(last_deep_scrub, bl);
+  ::encode(last_deep_scrub_stamp, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_history_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(4, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
   ::decode(epoch_created, bl);
   ::decode(last_epoch_started, bl);
   if (struct_v >= 3)
@@ -1191,6 +1257,15 @@ void pg_history_t::decode(bufferlist::iterator &bl)
     ::decode(last_scrub, bl);
     ::decode(last_scrub_stamp, bl);
   }
+  if (struct_v >= 5) {
+    ::decode(last_deep_scrub, bl);
+    ::decode(last_deep_scrub_stamp, bl);
+  } else {
+    // pretend the last scrub was deep, so that upgraded pgs come due for
+    // a deep scrub as their scrubs did instead of all at once
+    last_deep_scrub = last_scrub;
+    last_deep_scrub_stamp = last_scrub_stamp;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1205,6 +1280,8 @@ void pg_history_t::dump(Formatter *f) const
   f->dump_int("same_primary_since", same_primary_since);
   f->dump_stream("last_scrub") << last_scrub;
   f->dump_stream("last_scrub_stamp") << last_scrub_stamp;
+  f->dump_stream("last_deep_scrub") << last_deep_scrub;
+  f->dump_stream("last_deep_scrub_stamp") << last_deep_scrub_stamp;
 }
 
 void pg_history_t::generate_test_instances(list<pg_history_t*>& o)
@@ -1220,6 +1297,8 @@ void pg_history_t::generate_test_instances(list<pg_history_t*>& o)
   o.back()->same_primary_since = 7;
   o.back()->last_scrub = eversion_t(8, 9);
   o.back()->last_scrub_stamp = utime_t(10, 11);  
+  o.back()->last_deep_scrub = eversion_t(12, 13);
+  o.back()->last_deep_scrub_stamp = utime_t(14, 15);
 }
 
 
@@ -1227,7 +1306,7 @@ void pg_history_t::generate_test_instances(list<pg_history_t*>& o)
 
 void pg_info_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(26, 26, bl);
+  ENCODE_START(28, 26, bl);
   ::encode(pgid, bl);
   ::encode(last_update, bl);
   ::encode(last_complete, bl);
@@ -1236,12 +1315,16 @@ void pg_info_t::encode(bufferlist &bl) const
   ::encode(stats, bl);
   history.encode(bl);
   ::encode(purged_snaps, bl);
+  ::encode(scrub_cursor, bl);
+  ::encode(scrub_cursor_deep, bl);
+  ::encode(scrub_cursor_errors, bl);
+  ::encode(scrub_cursor_fixed, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_info_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(26, 26, 26, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(28, 26, 26, bl);
   if (struct_v < 23) {
     old_pg_t opgid;
     ::decode(opgid, bl);
@@ -1266,6 +1349,14 @@ void pg_info_t::decode(bufferlist::iterator &bl)
     set<snapid_t> snap_trimq;
     ::decode(snap_trimq, bl);
   }
+  if (struct_v >= 27) {
+    ::decode(scrub_cursor, bl);
+    ::decode(scrub_cursor_deep, bl);
+  }
+  if (struct_v >= 28) {
+    ::decode(scrub_cursor_errors, bl);
+    ::decode(scrub_cursor_fixed, bl);
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1279,6 +1370,10 @@ void pg_info_t::dump(Formatter *f) const
   f->dump_stream("log_tail") << log_tail;
   f->dump_stream("last_backfill") << last_backfill;
   f->dump_stream("purged_snaps") << purged_snaps;
+  f->dump_stream("scrub_cursor") << scrub_cursor;
+  f->dump_int("scrub_cursor_deep", scrub_cursor_deep);
+  f->dump_int("scrub_cursor_errors", scrub_cursor_errors);
+  f->dump_int("scrub_cursor_fixed", scrub_cursor_fixed);
   f->open_object_section("history");
   history.dump(f);
   f->close_section();
@@ -1306,6 +1401,10 @@ void pg_info_t::generate_test_instances(list<pg_info_t*>& o)
   list<pg_stat_t*> s;
   pg_stat_t::generate_test_instances(s);
   o.back()->stats = *s.back();
+  o.back()->scrub_cursor = hobject_t(object_t("scrubbed"), "", 12, 345, -1);
+  o.back()->scrub_cursor_deep = true;
+  o.back()->scrub_cursor_errors = 3;
+  o.back()->scrub_cursor_fixed = 2;
 }
 
 
@@ -1461,7 +1560,7 @@ void pg_query_t::generate_test_instances(list<pg_query_t*>& o)
 
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(5, 4, bl);
+  ENCODE_START(6, 4, bl);
   ::encode(op, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
@@ -1470,12 +1569,14 @@ void pg_log_entry_t::encode(bufferlist &bl) const
   ::encode(mtime, bl);
   if (op == CLONE)
     ::encode(snaps, bl);
+  ::encode(have_extents, bl);
+  ::encode(extents, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(6, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
     sobject_t old_soid;
@@ -1496,6 +1597,12 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
     ::decode(snaps, bl);
   if (struct_v < 5)
     invalid_pool = true;
+  if (struct_v >= 6) {
+    ::decode(have_extents, bl);
+    ::decode(extents, bl);
+  } else {
+    have_extents = false;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1507,6 +1614,8 @@ void pg_log_entry_t::dump(Formatter *f) const
   f->dump_stream("prior_version") << version;
   f->dump_stream("reqid") << reqid;
   f->dump_stream("mtime") << mtime;
+  if (have_extents)
+    f->dump_stream("extents") << extents;
 }
 
 void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
@@ -1515,6 +1624,10 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   hobject_t oid(object_t("objname"), "key", 123, 456, 0);
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 osd_reqid_t(entity_name_t::CLIENT(777), 8, 999), utime_t(8,9)));
+  o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+				 osd_reqid_t(entity_name_t::CLIENT(777), 9, 999), utime_t(8,9)));
+  o.back()->have_extents = true;
+  o.back()->extents.insert(4096, 8192);
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -1637,6 +1750,34 @@ void pg_log_t::copy_up_to(const pg_log_t &other, int max)
   }
 }
 
+bool pg_log_t::get_dirty_extents(const hobject_t& soid, eversion_t have, eversion_t need,
+				 interval_set<uint64_t>& extents) const
+{
+  if (have < tail)
+    return false;
+
+  interval_set<uint64_t> dirty;
+  eversion_t newest, oldest;
+  for (list<pg_log_entry_t>::const_reverse_iterator p = log.rbegin();
+       p != log.rend() && p->version > have;
+       ++p) {
+    if (p->version > need || p->soid != soid)
+      continue;
+    if (!p->have_extents)
+      return false;
+    if (newest == eversion_t())
+      newest = p->version;
+    else if (p->version != oldest)
+      return false;   // a gap in the object's history
+    oldest = p->prior_version;
+    dirty.union_of(p->extents);
+  }
+  if (newest != need || oldest != have)
+    return false;
+  extents.swap(dirty);
+  return true;
+}
+
 ostream& pg_log_t::print(ostream& out) const 
 {
   out << *this << std::endl;
@@ -2314,7 +2455,7 @@ void ObjectRecoveryProgress::dump(Formatter *f) const
 
 void ObjectRecoveryInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(2, 1, bl);
+  ENCODE_START(3, 1, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
   ::encode(size, bl);
@@ -2322,13 +2463,14 @@ void ObjectRecoveryInfo::encode(bufferlist &bl) const
   ::encode(ss, bl);
   ::encode(copy_subset, bl);
   ::encode(clone_subset, bl);
+  ::encode(base_version, bl);
   ENCODE_FINISH(bl);
 }
 
 void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
 				int64_t pool)
 {
-  DECODE_START(2, bl);
+  DECODE_START(3, bl);
   ::decode(soid, bl);
   ::decode(version, bl);
   ::decode(size, bl);
@@ -2336,6 +2478,8 @@ void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
   ::decode(ss, bl);
   ::decode(copy_subset, bl);
   ::decode(clone_subset, bl);
+  if (struct_v >= 3)
+    ::decode(base_version, bl);
   DECODE_FINISH(bl);
 
   if (struct_v < 2) {
@@ -2381,6 +2525,7 @@ void ObjectRecoveryInfo::dump(Formatter *f) const
   }
   f->dump_stream("copy_subset") << copy_subset;
   f->dump_stream("clone_subset") << clone_subset;
+  f->dump_stream("base_version") << base_version;
 }
 
 ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
@@ -2394,6 +2539,7 @@ ostream &ObjectRecoveryInfo::print(ostream &out) const
 	     << soid << "@" << version
 	     << ", copy_subset: " << copy_subset
 	     << ", clone_subset: " << clone_subset
+	     << ", base_version: " << base_version
 	     << ")";
 }
 
@@ -2500,19 +2646,32 @@ void ScrubMap::generate_test_instances(list<ScrubMap*>& o)
 
 void ScrubMap::object::encode(bufferlist& bl) const
 {
-  ENCODE_START(2, 2, bl);
+  ENCODE_START(4, 2, bl);
   ::encode(size, bl);
   ::encode(negative, bl);
   ::encode(attrs, bl);
+  ::encode(digest, bl);
+  ::encode(omap_digest, bl);
+  ::encode(digest_present, bl);
+  ::encode(read_error, bl);
   ENCODE_FINISH(bl);
 }
 
 void ScrubMap::object::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(2, 2, 2, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(4, 2, 2, bl);
   ::decode(size, bl);
   ::decode(negative, bl);
   ::decode(attrs, bl);
+  if (struct_v >= 3) {
+    ::decode(digest, bl);
+    ::decode(omap_digest, bl);
+    ::decode(digest_present, bl);
+  }
+  if (struct_v >= 4)
+    ::decode(read_error, bl);
+  else
+    read_error = false;
   DECODE_FINISH(bl);
 }
 
@@ -2520,6 +2679,11 @@ void ScrubMap::object::dump(Formatter *f) const
 {
   f->dump_int("size", size);
   f->dump_int("negative", negative);
+  if (digest_present) {
+    f->dump_unsigned("digest", digest);
+    f->dump_unsigned("omap_digest", omap_digest);
+  }
+  f->dump_int("read_error", read_error);
   f->open_array_section("attrs");
   for (map<string,bufferptr>::const_iterator p = attrs.begin(); p != attrs.end(); ++p) {
     f->open_object_section("attr");
@@ -2539,6 +2703,14 @@ void ScrubMap::object::generate_test_instances(list<object*>& o)
   o.back()->size = 123;
   o.back()->attrs["foo"] = buffer::copy("foo", 3);
   o.back()->attrs["bar"] = buffer::copy("barval", 6);
+  o.push_back(new object);
+  o.back()->size = 456;
+  o.back()->digest = 0x1234;
+  o.back()->omap_digest = 0x5678;
+  o.back()->digest_present = true;
+  o.push_back(new object);
+  o.back()->size = 789;
+  o.back()->read_error = true;
 }
 
 // -- OSDOp --
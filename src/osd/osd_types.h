@@ -323,6 +323,12 @@ public:
     return coll_t(pg_to_tmp_str(pgid));
   }
 
+  /// where a removed pg's collection waits for its objects to be reaped
+  static coll_t make_removal_coll(uint64_t seq, pg_t pgid,
+				  snapid_t snap = CEPH_NOSNAP) {
+    return coll_t(seq_to_removal_str(seq, pgid, snap));
+  }
+
   const std::string& to_str() const {
     return str;
   }
@@ -337,6 +343,7 @@ public:
 
   bool is_pg(pg_t& pgid, snapid_t& snap) const;
   bool is_temp(pg_t& pgid) const;
+  bool is_removal(uint64_t *seq, pg_t *pgid) const;
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& bl);
   inline bool operator==(const coll_t& rhs) const {
@@ -360,6 +367,11 @@ private:
     oss << p << "_TEMP";
     return oss.str();
   }
+  static std::string seq_to_removal_str(uint64_t seq, pg_t p, snapid_t s) {
+    std::ostringstream oss;
+    oss << "FORREMOVAL_" << seq << "_" << p << "_" << s;
+    return oss.str();
+  }
 
   std::string str;
 };
@@ -437,6 +449,13 @@ public:
     version++;
   }
 
+  /// key that sorts in version order; used for the omap pg log
+  string get_key_name() const {
+    char key[40];
+    snprintf(key, sizeof(key), "%010u.%020llu", epoch, (long long unsigned)version);
+    return string(key);
+  }
+
   void encode(bufferlist &bl) const {
     ::encode(version, bl);
     ::encode(epoch, bl);
@@ -553,6 +572,7 @@ inline ostream& operator<<(ostream& out, const osd_stat_t& s) {
 #define PG_STATE_INCOMPLETE   (1<<16) // incomplete content, peering failed.
 #define PG_STATE_STALE        (1<<17) // our state for this pg is stale, unknown.
 #define PG_STATE_REMAPPED     (1<<18) // pg is explicitly remapped to different OSDs than CRUSH
+#define PG_STATE_DEEP_SCRUB   (1<<19) // deep scrub: check object data and omap digests
 
 std::string pg_state_string(int state);
 
@@ -586,12 +606,14 @@ struct pg_pool_t {
   enum {
     TYPE_REP = 1,     // replication
     TYPE_RAID4 = 2,   // raid4 (never implemented)
+    TYPE_ERASURE = 3, // k data + m parity chunks per object
   };
 
   static const char *get_type_name(int t) {
     switch (t) {
     case TYPE_REP: return "rep";
     case TYPE_RAID4: return "raid4";
+    case TYPE_ERASURE: return "erasure";
     default: return "???";
     }
   }
@@ -627,6 +649,15 @@ public:
    */
   interval_set<snapid_t> removed_snaps;
 
+  /*
+   * TYPE_ERASURE: each object is striped over erasure_k data chunks
+   * in stripe_unit pieces and coded into size - erasure_k parity
+   * chunks, one chunk per osd in the pg.
+   */
+  string erasure_code_technique;
+  __u32 erasure_k;
+  __u32 stripe_unit;
+
   int pg_num_mask, pgp_num_mask;
 
   pg_pool_t()
@@ -636,6 +667,7 @@ public:
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      erasure_k(0), stripe_unit(0),
       pg_num_mask(0), pgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
@@ -659,6 +691,13 @@ public:
 
   bool is_rep()   const { return get_type() == TYPE_REP; }
   bool is_raid4() const { return get_type() == TYPE_RAID4; }
+  bool is_erasure() const { return get_type() == TYPE_ERASURE; }
+
+  const string& get_erasure_code_technique() const { return erasure_code_technique; }
+  unsigned get_data_chunk_count() const { return erasure_k; }
+  unsigned get_coding_chunk_count() const { return size - erasure_k; }
+  unsigned get_stripe_unit() const { return stripe_unit; }
+  uint64_t get_stripe_width() const { return (uint64_t)erasure_k * stripe_unit; }
 
   unsigned get_pg_num() const { return pg_num; }
   unsigned get_pgp_num() const { return pgp_num; }
@@ -852,32 +891,39 @@ struct pg_stat_t {
 
   eversion_t last_scrub;
   utime_t last_scrub_stamp;
+  eversion_t last_deep_scrub;
+  utime_t last_deep_scrub_stamp;
 
   object_stat_collection_t stats;
 
-  int64_t log_size;
+  int64_t log_size;           // bytes
   int64_t ondisk_log_size;    // >= active_log_size
 
   vector<int> up, acting;
   epoch_t mapping_epoch;
 
+  uint32_t snaptrimq_len;     // removed snaps not yet trimmed
+
   pg_stat_t()
     : state(0),
       created(0), last_epoch_clean(0),
       parent_split_bits(0), 
       log_size(0), ondisk_log_size(0),
-      mapping_epoch(0)
+      mapping_epoch(0),
+      snaptrimq_len(0)
   { }
 
   void add(const pg_stat_t& o) {
     stats.add(o.stats);
     log_size += o.log_size;
     ondisk_log_size += o.ondisk_log_size;
+    snaptrimq_len += o.snaptrimq_len;
   }
   void sub(const pg_stat_t& o) {
     stats.sub(o.stats);
     log_size -= o.log_size;
     ondisk_log_size -= o.ondisk_log_size;
+    snaptrimq_len -= o.snaptrimq_len;
   }
 
   void dump(Formatter *f) const;
@@ -941,6 +987,8 @@ struct pg_history_t {
 
   eversion_t last_scrub;
   utime_t last_scrub_stamp;
+  eversion_t last_deep_scrub;
+  utime_t last_deep_scrub_stamp;
 
   pg_history_t()
     : epoch_created(0),
@@ -974,9 +1022,24 @@ struct pg_history_t {
       last_scrub_stamp = other.last_scrub_stamp;
       modified = true;
     }
+    if (other.last_deep_scrub > last_deep_scrub) {
+      last_deep_scrub = other.last_deep_scrub;
+      modified = true;
+    }
+    if (other.last_deep_scrub_stamp > last_deep_scrub_stamp) {
+      last_deep_scrub_stamp = other.last_deep_scrub_stamp;
+      modified = true;
+    }
     return modified;
   }
 
+  /// has it been @interval seconds since the last deep scrub?
+  bool is_deep_scrub_due(utime_t now, double interval) const {
+    utime_t due = last_deep_scrub_stamp;
+    due += interval;
+    return due <= now;
+  }
+
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& p);
   void dump(Formatter *f) const;
@@ -1015,12 +1078,19 @@ struct pg_info_t {
 
   pg_history_t history;
 
+  hobject_t scrub_cursor;    // objects < this were checked by an unfinished scrub
+  bool scrub_cursor_deep;    // ...deeply
+  int32_t scrub_cursor_errors; // ...finding this many errors
+  int32_t scrub_cursor_fixed;  // ...and repairing this many
+
   pg_info_t()
-    : last_backfill(hobject_t::get_max())
+    : last_backfill(hobject_t::get_max()),
+      scrub_cursor_deep(false), scrub_cursor_errors(0), scrub_cursor_fixed(0)
   { }
   pg_info_t(pg_t p)
     : pgid(p),
-      last_backfill(hobject_t::get_max())
+      last_backfill(hobject_t::get_max()),
+      scrub_cursor_deep(false), scrub_cursor_errors(0), scrub_cursor_fixed(0)
   { }
   
   bool is_empty() const { return last_update.version == 0; }
@@ -1205,17 +1275,23 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
+  /// data extents this modify changed; if set, nothing else about the
+  /// object changed but its size and xattrs, so recovery may push just these
+  bool have_extents;
+  interval_set<uint64_t> extents;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), offset(0) {}
+    : op(0), invalid_hash(false), invalid_pool(false), have_extents(false),
+      offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      have_extents(false), offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1327,6 +1403,18 @@ struct pg_log_t {
    */
   void copy_up_to(const pg_log_t &other, int max);
 
+  /**
+   * data extents of an object modified between two of its versions
+   *
+   * @param soid object
+   * @param have version the stale copy is at
+   * @param need version to bring it up to
+   * @param extents [out] union of the extents logged in between
+   * @return false if the log does not cover have..need with extents
+   */
+  bool get_dirty_extents(const hobject_t& soid, eversion_t have, eversion_t need,
+			 interval_set<uint64_t>& extents) const;
+
   ostream& print(ostream& out) const;
 
   void encode(bufferlist &bl) const;
@@ -1601,6 +1689,7 @@ ostream& operator<<(ostream& out, const SnapSet& cs);
 
 #define OI_ATTR "_"
 #define SS_ATTR "snapset"
+#define EC_SHARD_ATTR "ec_shard"   // erasure pools: which chunk of the object this is
 
 struct watch_info_t {
   uint64_t cookie;
@@ -1700,6 +1789,7 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subset;
+  eversion_t base_version;  // if set, copy_subset applies on top of this version
 
   ObjectRecoveryInfo() : size(0) { }
 
@@ -1749,8 +1839,13 @@ struct ScrubMap {
     uint64_t size;
     bool negative;
     map<string,bufferptr> attrs;
+    __u32 digest;          ///< crc32c of the data, if digest_present
+    __u32 omap_digest;     ///< crc32c of omap header, keys and values
+    bool digest_present;   ///< set by a deep scrub
+    bool read_error;       ///< a deep scrub could not read the data
 
-    object(): size(0), negative(false) {}
+    object(): size(0), negative(false), digest(0), omap_digest(0),
+	      digest_present(false), read_error(false) {}
 
     void encode(bufferlist& bl) const;
     void decode(bufferlist::iterator& bl);
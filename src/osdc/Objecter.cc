@@ -23,6 +23,7 @@
 #include "messages/MPing.h"
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
+#include "messages/MOSDOpBatch.h"
 #include "messages/MOSDMap.h"
 
 #include "messages/MPoolOp.h"
@@ -55,6 +56,8 @@ enum {
   l_osdc_op_resend,
   l_osdc_op_ack,
   l_osdc_op_commit,
+  l_osdc_op_batch,
+  l_osdc_op_batched,
 
   l_osdc_op,
   l_osdc_op_r,
@@ -135,6 +138,8 @@ void Objecter::init()
     pcb.add_u64_counter(l_osdc_op_resend, "op_resend");
     pcb.add_u64_counter(l_osdc_op_ack, "op_ack");
     pcb.add_u64_counter(l_osdc_op_commit, "op_commit");
+    pcb.add_u64_counter(l_osdc_op_batch, "op_batch");      // batch messages sent
+    pcb.add_u64_counter(l_osdc_op_batched, "op_batched");  // ops sent in them
 
     pcb.add_u64_counter(l_osdc_op, "op");
     pcb.add_u64_counter(l_osdc_op_r, "op_r");
@@ -209,8 +214,12 @@ void Objecter::init()
 	       << cpp_strerror(-ret) << dendl;
   }
 
+  batch_timer.init();
+
   schedule_tick();
+  rwlock.get_read();
   maybe_request_map();
+  rwlock.unlock();
 
   initialized = true;
 }
@@ -219,6 +228,8 @@ void Objecter::shutdown()
 {
   assert(client_lock.is_locked());
   assert(initialized);
+
+  rwlock.get_write();
   initialized = false;
 
   map<int,OSDSession*>::iterator p;
@@ -226,6 +237,11 @@ void Objecter::shutdown()
     p = osd_sessions.begin();
     close_session(p->second);
   }
+  rwlock.unlock();
+
+  batch_lock.Lock();
+  batch_timer.shutdown();
+  batch_lock.Unlock();
 
   if (tick_event) {
     timer.cancel_event(tick_event);
@@ -246,8 +262,9 @@ void Objecter::shutdown()
   }
 }
 
-void Objecter::send_linger(LingerOp *info, bool first_send)
+void Objecter::send_linger(LingerOp *info)
 {
+  // rwlock is held for write
   if (!info->registering) {
     ldout(cct, 15) << "send_linger " << info->linger_id << dendl;
     vector<OSDOp> ops = info->ops; // need to pass a copy to ops
@@ -259,19 +276,16 @@ void Objecter::send_linger(LingerOp *info, bool first_send)
     o->snapid = info->snap;
 
     if (info->session) {
-      int r = recalc_op_target(o);
-      if (r == RECALC_OP_TARGET_POOL_DNE) {
+      pg_t pgid;
+      if (osdmap->object_locator_to_pg(info->oid, info->oloc, pgid) == -ENOENT)
 	linger_check_for_latest_map(info);
-      }
     }
 
-    if (first_send) {
-      op_submit(o);
-    } else {
-      _op_submit(o);
-    }
+    // there are few lingering ops and we can't block with rwlock
+    // held, so they don't take budget.
+    _op_submit(o, true);
 
-    OSDSession *s = o->session;
+    OSDSession *s = o->session == homeless_session ? NULL : o->session;
     if (info->session != s) {
       info->session_item.remove_myself();
       info->session = s;
@@ -289,29 +303,44 @@ void Objecter::send_linger(LingerOp *info, bool first_send)
 void Objecter::_linger_ack(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_ack " << info->linger_id << dendl;
-  if (info->on_reg_ack) {
-    info->on_reg_ack->finish(r);
-    delete info->on_reg_ack;
-    info->on_reg_ack = NULL;
+  rwlock.get_write();
+  Context *onack = info->on_reg_ack;
+  info->on_reg_ack = NULL;
+  rwlock.unlock();
+
+  if (onack) {
+    onack->finish(r);
+    delete onack;
   }
 }
 
 void Objecter::_linger_commit(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_commit " << info->linger_id << dendl;
-  if (info->on_reg_commit) {
-    info->on_reg_commit->finish(r);
-    delete info->on_reg_commit;
-    info->on_reg_commit = NULL;
-  }
+  rwlock.get_write();
+  Context *oncommit = info->on_reg_commit;
+  info->on_reg_commit = NULL;
 
   // only tell the user the first time we do this
   info->registered = true;
   info->registering = false;
   info->pobjver = NULL;
+  rwlock.unlock();
+
+  if (oncommit) {
+    oncommit->finish(r);
+    delete oncommit;
+  }
 }
 
 void Objecter::unregister_linger(uint64_t linger_id)
+{
+  rwlock.get_write();
+  _unregister_linger(linger_id);
+  rwlock.unlock();
+}
+
+void Objecter::_unregister_linger(uint64_t linger_id)
 {
   map<uint64_t, LingerOp*>::iterator iter = linger_ops.find(linger_id);
   if (iter != linger_ops.end()) {
@@ -343,14 +372,17 @@ tid_t Objecter::linger(const object_t& oid, const object_locator_t& oloc,
   info->on_reg_ack = onack;
   info->on_reg_commit = onfinish;
 
+  rwlock.get_write();
   info->linger_id = ++max_linger_id;
   linger_ops[info->linger_id] = info;
 
   logger->set(l_osdc_linger_active, linger_ops.size());
 
-  send_linger(info, true);
+  send_linger(info);
+  uint64_t linger_id = info->linger_id;
+  rwlock.unlock();
 
-  return info->linger_id;
+  return linger_id;
 }
 
 void Objecter::dispatch(Message *m)
@@ -394,6 +426,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  rwlock.get_write();
+
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || osdmap->test_flag(CEPH_OSDMAP_FULL);
   
@@ -444,6 +478,20 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  continue;
 	}
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
+
+	// osd addr changes?  ops on a closed session go homeless and
+	// are retargeted below.
+	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+	     p != osd_sessions.end(); ) {
+	  OSDSession *s = p->second;
+	  p++;
+	  if (osdmap->is_up(s->osd)) {
+	    if (s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr)
+	      close_session(s);
+	  } else {
+	    close_session(s);
+	  }
+	}
 	
 	// check for changed linger mappings (_before_ regular ops)
 	for (map<tid_t,LingerOp*>::iterator p = linger_ops.begin();
@@ -468,11 +516,14 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	}
 
 	// check for changed request mappings
-	for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	     p != ops.end();
-	     ++p) {
-	  Op *op = p->second;
-	  int r = recalc_op_target(op);
+	vector<Op*> ls;
+	if (skipped_map)
+	  get_all_ops(ls);
+	else
+	  get_moved_ops(ls);
+	for (vector<Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+	  Op *op = *p;
+	  int r = recalc_op_target(op, true);
 	  if (skipped_map)
 	    r = RECALC_OP_TARGET_NEED_RESEND;
 	  switch (r) {
@@ -489,19 +540,6 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  }
 	}
 
-	// osd addr changes?
-	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
-	     p != osd_sessions.end(); ) {
-	  OSDSession *s = p->second;
-	  p++;
-	  if (osdmap->is_up(s->osd)) {
-	    if (s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr)
-	      close_session(s);
-	  } else {
-	    close_session(s);
-	  }
-	}
-
 	assert(e == osdmap->get_epoch());
       }
       
@@ -527,21 +565,22 @@ void Objecter::handle_osd_map(MOSDMap *m)
   
   // unpause requests?
   if ((was_pauserd && !pauserd) ||
-      (was_pausewr && !pausewr))
-    for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	 p != ops.end();
-	 p++) {
-      Op *op = p->second;
+      (was_pausewr && !pausewr)) {
+    vector<Op*> ls;
+    get_all_ops(ls);
+    for (vector<Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+      Op *op = *p;
       if (op->paused &&
 	  !((op->flags & CEPH_OSD_FLAG_READ) && pauserd) &&   // not still paused as a read
 	  !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
 	need_resend[op->tid] = op;
     }
+  }
 
   // resend requests
   for (map<tid_t, Op*>::iterator p = need_resend.begin(); p != need_resend.end(); p++) {
     Op *op = p->second;
-    if (op->session) {
+    if (op->session != homeless_session) {
       logger->inc(l_osdc_op_resend);
       send_op(op);
     }
@@ -550,29 +589,35 @@ void Objecter::handle_osd_map(MOSDMap *m)
     LingerOp *op = *p;
     if (op->session) {
       logger->inc(l_osdc_linger_resend);
-      send_linger(op, false);
+      send_linger(op);
     }
   }
 
   dump_active();
   
-  // finish any Contexts that were waiting on a map update
+  // finish any Contexts that were waiting on a map update, once we
+  // have dropped rwlock
+  epoch_t epoch = osdmap->get_epoch();
+  list<pair<Context*, int> > waiters;
   map<epoch_t,list< pair< Context*, int > > >::iterator p =
     waiting_for_map.begin();
   while (p != waiting_for_map.end() &&
-	 p->first <= osdmap->get_epoch()) {
-    //go through the list and call the onfinish methods
-    for (list<pair<Context*, int> >::iterator i = p->second.begin();
-	 i != p->second.end(); ++i) {
-      i->first->finish(i->second);
-      delete i->first;
-    }
+	 p->first <= epoch) {
+    waiters.splice(waiters.end(), p->second);
     waiting_for_map.erase(p++);
   }
+  rwlock.unlock();
+
+  //go through the list and call the onfinish methods
+  for (list<pair<Context*, int> >::iterator i = waiters.begin();
+       i != waiters.end(); ++i) {
+    i->first->finish(i->second);
+    delete i->first;
+  }
 
   m->put();
 
-  monc->sub_got("osdmap", osdmap->get_epoch());
+  monc->sub_got("osdmap", epoch);
 }
 
 void Objecter::C_Op_Map_Latest::finish(int r)
@@ -581,27 +626,43 @@ void Objecter::C_Op_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<tid_t, Op*>::iterator iter =
     objecter->check_latest_map_ops.find(tid);
   if (iter == objecter->check_latest_map_ops.end()) {
+    objecter->rwlock.unlock();
     return;
   }
 
   Op *op = iter->second;
   objecter->check_latest_map_ops.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->onack) {
-      op->onack->complete(-ENOENT);
-    }
-    if (op->oncommit) {
-      op->oncommit->complete(-ENOENT);
+    onack = op->onack;
+    oncommit = op->oncommit;
+    if (onack)
+      objecter->num_unacked.dec();
+    if (oncommit)
+      objecter->num_uncommitted.dec();
+    objecter->session_op_remove(op);
+    objecter->num_in_flight.dec();
+    if (op->budgeted)
+      objecter->put_op_budget(op);
+    if (op->con) {
+      // the caller may free the buffer we posted as soon as we call back
+      op->con->revoke_rx_buffer(op->tid);
+      op->con->put();
     }
-    op->session_item.remove_myself();
-    objecter->ops.erase(op->tid);
     delete op;
   }
+  objecter->rwlock.unlock();
+
+  if (onack)
+    onack->complete(-ENOENT);
+  if (oncommit)
+    oncommit->complete(-ENOENT);
 }
 
 void Objecter::C_Linger_Map_Latest::finish(int r)
@@ -610,26 +671,33 @@ void Objecter::C_Linger_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<uint64_t, LingerOp*>::iterator iter =
     objecter->check_latest_map_lingers.find(linger_id);
   if (iter == objecter->check_latest_map_lingers.end()) {
+    objecter->rwlock.unlock();
     return;
   }
 
   LingerOp *op = iter->second;
   objecter->check_latest_map_lingers.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->on_reg_ack) {
-      op->on_reg_ack->complete(-ENOENT);
-    }
-    if (op->on_reg_commit) {
-      op->on_reg_commit->complete(-ENOENT);
-    }
-    objecter->unregister_linger(op->linger_id);
+    onack = op->on_reg_ack;
+    oncommit = op->on_reg_commit;
+    op->on_reg_ack = NULL;
+    op->on_reg_commit = NULL;
+    objecter->_unregister_linger(op->linger_id);
   }
   op->put();
+  objecter->rwlock.unlock();
+
+  if (onack)
+    onack->complete(-ENOENT);
+  if (oncommit)
+    oncommit->complete(-ENOENT);
 }
 
 void Objecter::op_check_for_latest_map(Op *op)
@@ -667,6 +735,15 @@ void Objecter::linger_cancel_map_check(LingerOp *op)
   }
 }
 
+Objecter::OSDSession *Objecter::lookup_session(int osd)
+{
+  map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
+  if (p == osd_sessions.end())
+    return NULL;
+  return p->second;
+}
+
+/* rwlock must be held for write */
 Objecter::OSDSession *Objecter::get_session(int osd)
 {
   map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
@@ -684,6 +761,9 @@ void Objecter::reopen_session(OSDSession *s)
 {
   entity_inst_t inst = osdmap->get_inst(s->osd);
   ldout(cct, 10) << "reopen_session osd." << s->osd << " session, addr now " << inst << dendl;
+  batch_lock.Lock();
+  _discard_batch(s->osd);
+  batch_lock.Unlock();
   if (s->con) {
     messenger->mark_down(s->con);
     s->con->put();
@@ -697,13 +777,31 @@ void Objecter::reopen_session(OSDSession *s)
 void Objecter::close_session(OSDSession *s)
 {
   ldout(cct, 10) << "close_session for osd." << s->osd << dendl;
+  batch_lock.Lock();
+  _discard_batch(s->osd);
+  batch_lock.Unlock();
   if (s->con) {
     messenger->mark_down(s->con);
     s->con->put();
     logger->inc(l_osdc_osd_session_close);
   }
+
+  // its ops and lingers go homeless; clearing acting makes the next
+  // recalc find them a new target
+  for (map<tid_t,Op*>::iterator p = s->ops.begin(); p != s->ops.end(); ++p) {
+    Op *op = p->second;
+    op->acting.clear();
+    op->session = homeless_session;
+    homeless_session->ops[op->tid] = op;
+  }
   s->ops.clear();
-  s->linger_ops.clear();
+  s->ops_by_pg.clear();
+  while (!s->linger_ops.empty()) {
+    LingerOp *info = s->linger_ops.front();
+    info->acting.clear();
+    info->session = NULL;
+    info->session_item.remove_myself();
+  }
   osd_sessions.erase(s->osd);
   delete s;
 
@@ -712,13 +810,18 @@ void Objecter::close_session(OSDSession *s)
 
 void Objecter::wait_for_osd_map()
 {
-  if (osdmap->get_epoch()) return;
+  rwlock.get_write();
+  if (osdmap->get_epoch()) {
+    rwlock.unlock();
+    return;
+  }
   Mutex lock("");
   Cond cond;
   bool done;
   lock.Lock();
   C_SafeCond *context = new C_SafeCond(&lock, &cond, &done, NULL);
   waiting_for_map[0].push_back(pair<Context*, int>(context, 0));
+  rwlock.unlock();
   while (!done)
     cond.Wait(lock);
   lock.Unlock();
@@ -747,16 +850,67 @@ void Objecter::kick_requests(OSDSession *session)
   ldout(cct, 10) << "kick_requests for osd." << session->osd << dendl;
 
   // resend ops
-  for (xlist<Op*>::iterator p = session->ops.begin(); !p.end(); ++p) {
+  for (map<tid_t,Op*>::iterator p = session->ops.begin(); p != session->ops.end(); ++p) {
     logger->inc(l_osdc_op_resend);
-    send_op(*p);
+    send_op(p->second);
   }
 
   // resend lingers
   for (xlist<LingerOp*>::iterator j = session->linger_ops.begin(); !j.end(); ++j) {
     logger->inc(l_osdc_linger_resend);
-    send_linger(*j, false);
+    send_linger(*j);
+  }
+}
+
+/*
+ * the ops whose pg may have a new acting set: those in pgs whose
+ * acting set changed or whose pool was resized or removed, and
+ * everything without a target.  rwlock must be held for write.
+ */
+void Objecter::get_moved_ops(vector<Op*>& ls)
+{
+  unsigned pgs = 0, moved = 0;
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p) {
+    OSDSession *s = p->second;
+    for (map<pg_t,OSDSession::PGOps>::iterator q = s->ops_by_pg.begin();
+	 q != s->ops_by_pg.end();
+	 ++q) {
+      ++pgs;
+      const pg_pool_t *pool = osdmap->get_pg_pool(q->first.pool());
+      if (pool && pool->get_pg_num() == q->second.pg_num) {
+	vector<int> acting;
+	osdmap->pg_to_acting_osds(q->first, acting);
+	if (acting == q->second.acting)
+	  continue;
+      }
+      ++moved;
+      ls.insert(ls.end(), q->second.ops.begin(), q->second.ops.end());
+    }
   }
+  for (map<tid_t,Op*>::iterator q = homeless_session->ops.begin();
+       q != homeless_session->ops.end();
+       ++q)
+    ls.push_back(q->second);
+  ldout(cct, 10) << "get_moved_ops " << moved << " of " << pgs << " pgs moved, "
+		 << ls.size() << " ops to check" << dendl;
+}
+
+/* rwlock must be held for write */
+void Objecter::get_all_ops(vector<Op*>& ls)
+{
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p)
+    for (map<tid_t,Op*>::iterator q = p->second->ops.begin();
+	 q != p->second->ops.end();
+	 ++q)
+      ls.push_back(q->second);
+  for (map<tid_t,Op*>::iterator q = homeless_session->ops.begin();
+       q != homeless_session->ops.end();
+       ++q)
+    ls.push_back(q->second);
 }
 
 void Objecter::schedule_tick()
@@ -782,16 +936,25 @@ void Objecter::tick()
   utime_t cutoff = ceph_clock_now(cct);
   cutoff -= cct->_conf->objecter_timeout;  // timeout
 
+  rwlock.get_read();
+
   unsigned laggy_ops = 0;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       p++) {
-    Op *op = p->second;
-    if (op->session && op->stamp < cutoff) {
-      ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
-      toping.insert(op->session);
-      ++laggy_ops;
+  for (map<int,OSDSession*>::iterator s = osd_sessions.begin();
+       s != osd_sessions.end();
+       ++s) {
+    OSDSession *session = s->second;
+    session->lock.Lock();
+    for (map<tid_t,Op*>::iterator p = session->ops.begin();
+	 p != session->ops.end();
+	 p++) {
+      Op *op = p->second;
+      if (op->stamp < cutoff) {
+	ldout(cct, 2) << " tid " << p->first << " on osd." << session->osd << " is laggy" << dendl;
+	toping.insert(session);
+	++laggy_ops;
+      }
     }
+    session->lock.Unlock();
   }
   for (map<uint64_t,LingerOp*>::iterator p = linger_ops.begin();
        p != linger_ops.end();
@@ -807,7 +970,11 @@ void Objecter::tick()
   logger->set(l_osdc_op_laggy, laggy_ops);
   logger->set(l_osdc_osd_laggy, toping.size());
 
-  if (num_homeless_ops || !toping.empty())
+  homeless_session->lock.Lock();
+  bool have_homeless = !homeless_session->ops.empty();
+  homeless_session->lock.Unlock();
+
+  if (have_homeless || !toping.empty())
     maybe_request_map();
 
   if (!toping.empty()) {
@@ -819,6 +986,7 @@ void Objecter::tick()
       messenger->send_message(new MPing, (*i)->con);
     }
   }
+  rwlock.unlock();
     
   // reschedule
   schedule_tick();
@@ -858,47 +1026,68 @@ void Objecter::resend_mon_ops()
 
 tid_t Objecter::op_submit(Op *op)
 {
-  assert(client_lock.is_locked());
   assert(initialized);
 
   assert(op->ops.size() == op->out_bl.size());
   assert(op->ops.size() == op->out_rval.size());
   assert(op->ops.size() == op->out_handler.size());
 
-  // throttle.  before we look at any state, because
-  // take_op_budget() may drop our lock while it blocks.
+  // throttle.  before we take any of our locks, because
+  // take_op_budget() may block (dropping client_lock if we hold it).
   take_op_budget(op);
 
-  return _op_submit(op);
+  rwlock.get_read();
+  tid_t tid = _op_submit(op, false);
+  if (!tid) {
+    // we need to open a session or check the pool; do it again with
+    // the write lock
+    rwlock.unlock();
+    rwlock.get_write();
+    tid = _op_submit(op, true);
+    assert(tid);
+  }
+  rwlock.unlock();
+  return tid;
 }
 
-tid_t Objecter::_op_submit(Op *op)
+/*
+ * Called with rwlock held.  With only the read lock we can't open a
+ * session or start a map check; in that case we return 0 without
+ * having queued the op and the caller retries with the write lock.
+ * Otherwise returns the op's tid.  The op may complete as soon as it
+ * is sent, so the caller must not touch it afterwards unless it holds
+ * the write lock.
+ */
+tid_t Objecter::_op_submit(Op *op, bool wlocked)
 {
-  // pick tid
-  tid_t mytid = ++last_tid;
-  op->tid = mytid;
   assert(client_inc >= 0);
 
-  // pick target
-  bool check_for_latest_map = false;
-  num_homeless_ops++;  // initially; recalc_op_target() will decrement if it finds a target
-  int r = recalc_op_target(op);
-  check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
+  // pick tid and target
+  tid_t tid = last_tid.inc();
+  op->tid = tid;
+  int r = recalc_op_target(op, wlocked);
+  if (!wlocked &&
+      (r == RECALC_OP_TARGET_NEED_SESSION || r == RECALC_OP_TARGET_POOL_DNE))
+    return 0;
+  assert(r != RECALC_OP_TARGET_NEED_SESSION);
+  bool check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
+  if (check_for_latest_map)
+    session_op_assign(homeless_session, op);
 
   // add to gather set(s)
   if (op->onack) {
-    ++num_unacked;
+    num_unacked.inc();
   } else {
     ldout(cct, 20) << " note: not requesting ack" << dendl;
   }
   if (op->oncommit) {
-    ++num_uncommitted;
+    num_uncommitted.inc();
   } else {
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
-  ops[op->tid] = op;
+  num_in_flight.inc();
 
-  logger->set(l_osdc_op_active, ops.size());
+  logger->set(l_osdc_op_active, num_in_flight.read());
 
   logger->inc(l_osdc_op);
   if ((op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE)) == (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE))
@@ -944,42 +1133,48 @@ tid_t Objecter::_op_submit(Op *op)
   }
 
   // send?
+  OSDSession *s = op->session;
   ldout(cct, 10) << "op_submit oid " << op->oid
            << " " << op->oloc 
-	   << " " << op->ops << " tid " << op->tid
-           << " osd." << (op->session ? op->session->osd : -1)
+	   << " " << op->ops << " tid " << tid
+           << " osd." << s->osd
            << dendl;
 
   assert(op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE));
 
+  if (check_for_latest_map) {
+    op_check_for_latest_map(op);
+  }
+
+  bool paused = false;
   if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
       osdmap->test_flag(CEPH_OSDMAP_PAUSEWR)) {
-    ldout(cct, 10) << " paused modify " << op << " tid " << last_tid << dendl;
-    op->paused = true;
-    maybe_request_map();
+    ldout(cct, 10) << " paused modify " << op << " tid " << tid << dendl;
+    paused = true;
   } else if ((op->flags & CEPH_OSD_FLAG_READ) &&
 	     osdmap->test_flag(CEPH_OSDMAP_PAUSERD)) {
-    ldout(cct, 10) << " paused read " << op << " tid " << last_tid << dendl;
-    op->paused = true;
-    maybe_request_map();
+    ldout(cct, 10) << " paused read " << op << " tid " << tid << dendl;
+    paused = true;
   } else if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
 	     osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << tid << dendl;
+    paused = true;
+  }
+
+  s->lock.Lock();
+  if (paused)
     op->paused = true;
-    maybe_request_map();
-  } else if (op->session) {
+  else if (s != homeless_session)
     send_op(op);
-  } else {
-    maybe_request_map();
-  }
+  s->lock.Unlock();
+  // op may be gone now
 
-  if (check_for_latest_map) {
-    op_check_for_latest_map(op);
-  }
+  if (paused || s == homeless_session)
+    maybe_request_map();
 
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
   
-  return op->tid;
+  return tid;
 }
 
 bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
@@ -995,8 +1190,15 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
-int Objecter::recalc_op_target(Op *op)
+/*
+ * Called with rwlock held.  Only a new op (not yet on any session)
+ * may be targeted with just the read lock, and then only to an osd
+ * we already have a session with.
+ */
+int Objecter::recalc_op_target(Op *op, bool wlocked)
 {
+  assert(wlocked || !op->session);
+
   vector<int> acting;
   pg_t pgid = op->pgid;
   if (!op->precalc_pgid) {
@@ -1006,21 +1208,17 @@ int Objecter::recalc_op_target(Op *op)
   }
   osdmap->pg_to_acting_osds(pgid, acting);
 
+  int r = RECALC_OP_TARGET_NO_ACTION;
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
-    op->pgid = pgid;
-    op->acting = acting;
-    ldout(cct, 10) << "recalc_op_target tid " << op->tid
-	     << " pgid " << pgid << " acting " << acting << dendl;
-
-    OSDSession *s = NULL;
-    op->used_replica = false;
+    OSDSession *s = homeless_session;
+    bool used_replica = false;
     if (acting.size()) {
       int osd;
       bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
       if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
 	int p = rand() % acting.size();
 	if (p)
-	  op->used_replica = true;
+	  used_replica = true;
 	osd = acting[p];
 	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
@@ -1032,7 +1230,7 @@ int Objecter::recalc_op_target(Op *op)
          * order.) */
 	for (i = acting.size()-1; i > 0; --i) {
 	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
-	    op->used_replica = true;
+	    used_replica = true;
 	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
 	    break;
 	  }
@@ -1040,22 +1238,80 @@ int Objecter::recalc_op_target(Op *op)
 	osd = acting[i];
       } else
 	osd = acting[0];
-      s = get_session(osd);
+      s = wlocked ? get_session(osd) : lookup_session(osd);
+      if (!s)
+	return RECALC_OP_TARGET_NEED_SESSION;
     }
 
+    op->pgid = pgid;
+    op->acting = acting;
+    op->used_replica = used_replica;
+    ldout(cct, 10) << "recalc_op_target tid " << op->tid
+	     << " pgid " << pgid << " acting " << acting << dendl;
+
     if (op->session != s) {
-      if (!op->session)
-	num_homeless_ops--;
-      op->session_item.remove_myself();
-      op->session = s;
-      if (s)
-	s->ops.push_back(&op->session_item);
-      else
-	num_homeless_ops++;
+      if (op->session)
+	session_op_remove(op);
+      session_op_assign(s, op);
     }
-    return RECALC_OP_TARGET_NEED_RESEND;
+    r = RECALC_OP_TARGET_NEED_RESEND;
+  } else if (!op->session) {
+    session_op_assign(homeless_session, op);
   }
-  return RECALC_OP_TARGET_NO_ACTION;
+
+  const pg_pool_t *pool = osdmap->get_pg_pool(pgid.pool());
+  if (op->session != homeless_session && pool) {
+    op->session->lock.Lock();
+    _index_op(op, pool->raw_pg_to_pg(pgid), acting, pool->get_pg_num());
+    op->session->lock.Unlock();
+  }
+  return r;
+}
+
+void Objecter::session_op_assign(OSDSession *s, Op *op)
+{
+  assert(!op->session);
+  s->lock.Lock();
+  s->ops[op->tid] = op;
+  op->session = s;
+  s->lock.Unlock();
+}
+
+void Objecter::session_op_remove(Op *op)
+{
+  OSDSession *s = op->session;
+  assert(s);
+  s->lock.Lock();
+  _unindex_op(op);
+  s->ops.erase(op->tid);
+  op->session = NULL;
+  s->lock.Unlock();
+}
+
+/* with op->session's lock held */
+void Objecter::_index_op(Op *op, pg_t actual_pgid, const vector<int>& acting,
+			 unsigned pg_num)
+{
+  OSDSession *s = op->session;
+  if (op->actual_pgid != actual_pgid)
+    _unindex_op(op);
+  OSDSession::PGOps& g = s->ops_by_pg[actual_pgid];
+  g.acting = acting;
+  g.pg_num = pg_num;
+  g.ops.insert(op);
+  op->actual_pgid = actual_pgid;
+}
+
+/* with op->session's lock held */
+void Objecter::_unindex_op(Op *op)
+{
+  OSDSession *s = op->session;
+  map<pg_t,OSDSession::PGOps>::iterator p = s->ops_by_pg.find(op->actual_pgid);
+  if (p == s->ops_by_pg.end())
+    return;
+  p->second.ops.erase(op);
+  if (p->second.ops.empty())
+    s->ops_by_pg.erase(p);
 }
 
 bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
@@ -1086,6 +1342,7 @@ bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+/* called with the op's session lock, or rwlock for write */
 void Objecter::send_op(Op *op)
 {
   ldout(cct, 15) << "send_op " << op->tid << " to osd." << op->session->osd << dendl;
@@ -1135,7 +1392,85 @@ void Objecter::send_op(Op *op)
   logger->inc(l_osdc_op_send);
   logger->inc(l_osdc_op_send_bytes, m->get_data().length());
 
-  messenger->send_message(m, op->session->con);
+  _send_message(op->session, m);
+}
+
+/*
+ * send an op now, or add it to the osd's pending batch.  ops that are
+ * too big to batch flush the batch first so they can't overtake it.
+ */
+void Objecter::_send_message(OSDSession *s, MOSDOp *m)
+{
+  int window = cct->_conf->objecter_batch_window_us;
+  if (window <= 0 || !s->con->has_feature(CEPH_FEATURE_OSD_OP_BATCH)) {
+    messenger->send_message(m, s->con);
+    return;
+  }
+
+  uint64_t bytes = m->get_data().length();
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p)
+    bytes += p->indata.length();
+
+  Mutex::Locker l(batch_lock);
+  if (bytes > cct->_conf->objecter_batch_max_bytes) {
+    if (op_batches.count(s->osd))
+      _flush_batch(s->osd);
+    messenger->send_message(m, s->con);
+    return;
+  }
+
+  OpBatch& b = op_batches[s->osd];
+  if (!b.m) {
+    b.con = s->con->get();
+    b.m = new MOSDOpBatch;
+    b.flush_event = new C_FlushBatch(this, s->osd);
+    batch_timer.add_event_after((double)window / 1000000.0, b.flush_event);
+  }
+  b.m->ops.push_back(m);
+  b.bytes += bytes;
+  ldout(cct, 20) << "_send_message batching tid " << m->get_tid() << " to osd." << s->osd
+		 << ", " << b.m->ops.size() << " ops " << b.bytes << " bytes" << dendl;
+
+  if ((int)b.m->ops.size() >= cct->_conf->objecter_batch_max_ops ||
+      b.bytes >= cct->_conf->objecter_batch_max_bytes)
+    _flush_batch(s->osd);
+}
+
+void Objecter::_flush_batch(int osd)
+{
+  assert(batch_lock.is_locked());
+  map<int,OpBatch>::iterator p = op_batches.find(osd);
+  assert(p != op_batches.end());
+  OpBatch& b = p->second;
+  if (b.flush_event)
+    batch_timer.cancel_event(b.flush_event);
+
+  ldout(cct, 15) << "_flush_batch osd." << osd << " " << b.m->ops.size() << " ops" << dendl;
+  if (b.m->ops.size() == 1) {
+    messenger->send_message(b.m->ops.front(), b.con);
+    b.m->ops.clear();
+    b.m->put();
+  } else {
+    logger->inc(l_osdc_op_batch);
+    logger->inc(l_osdc_op_batched, b.m->ops.size());
+    messenger->send_message(b.m, b.con);
+  }
+  b.con->put();
+  op_batches.erase(p);
+}
+
+void Objecter::_discard_batch(int osd)
+{
+  assert(batch_lock.is_locked());
+  map<int,OpBatch>::iterator p = op_batches.find(osd);
+  if (p == op_batches.end())
+    return;
+  ldout(cct, 10) << "_discard_batch osd." << osd << " " << p->second.m->ops.size() << " ops" << dendl;
+  if (p->second.flush_event)
+    batch_timer.cancel_event(p->second.flush_event);
+  p->second.m->put();
+  p->second.con->put();
+  op_batches.erase(p);
 }
 
 int Objecter::calc_op_budget(Op *op)
@@ -1162,32 +1497,52 @@ void Objecter::throttle_op(Op *op, int op_budget)
 {
   if (!op_budget)
     op_budget = calc_op_budget(op);
+  // budget comes back as replies are handled, which may need
+  // client_lock (callbacks, map updates), so don't wait holding it
+  bool locked = client_lock.is_locked_by_me();
   if (!op_throttle_bytes.get_or_fail(op_budget)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_bytes.get(op_budget);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
   if (!op_throttle_ops.get_or_fail(1)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_ops.get(1);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
 }
 
+/* This function DOES put the passed message before returning */
 /* This function DOES put the passed message before returning */
 void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 {
-  assert(client_lock.is_locked());
-  assert(initialized);
   ldout(cct, 10) << "in handle_osd_op_reply" << dendl;
 
   // get pio
   tid_t tid = m->get_tid();
+  int osd = m->get_source().num();
+
+  rwlock.get_read();
+  if (!initialized) {
+    rwlock.unlock();
+    m->put();
+    return;
+  }
 
-  if (ops.count(tid) == 0) {
+  OSDSession *s = lookup_session(osd);
+  if (s)
+    s->lock.Lock();
+  if (!s || s->ops.count(tid) == 0) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 	    << (m->is_ondisk() ? " ondisk":(m->is_onnvram() ? " onnvram":" ack"))
 	    << " ... stray" << dendl;
+    if (s)
+      s->lock.Unlock();
+    rwlock.unlock();
     m->put();
     return;
   }
@@ -1197,14 +1552,16 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " v " << m->get_version() << " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = ops[tid];
+  Op *op = s->ops[tid];
 
   if (m->get_retry_attempt() >= 0) {
     if (m->get_retry_attempt() != (op->attempts - 1)) {
       ldout(cct, 7) << " ignoring reply from attempt " << m->get_retry_attempt()
 		    << " from " << m->get_source_inst()
 		    << "; last attempt " << (op->attempts - 1) << " sent to "
-		    << op->session->con->get_peer_addr() << dendl;
+		    << s->con->get_peer_addr() << dendl;
+      s->lock.Unlock();
+      rwlock.unlock();
       m->put();
       return;
     }
@@ -1214,18 +1571,55 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     // have, but that is better than doing callbacks out of order.
   }
 
-  Context *onack = 0;
-  Context *oncommit = 0;
-
   int rc = m->get_result();
 
   if (rc == -EAGAIN) {
-    ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
-    if (op->onack)
-      num_unacked--;
-    if (op->oncommit)
-      num_uncommitted--;
-    op_submit(op);
+    // retargeting may need a new session; take the write lock, and
+    // make sure the op is still where we left it.
+    s->lock.Unlock();
+    rwlock.unlock();
+    rwlock.get_write();
+    s = lookup_session(osd);
+    if (!s || s->ops.count(tid) == 0) {
+      rwlock.unlock();
+      m->put();
+      return;
+    }
+    op = s->ops[tid];
+    if (m->get_retry_attempt() >= 0 &&
+	m->get_retry_attempt() != (op->attempts - 1)) {
+      ldout(cct, 7) << " op was resent, ignoring reply from attempt "
+		    << m->get_retry_attempt() << dendl;
+      rwlock.unlock();
+      m->put();
+      return;
+    }
+
+    if (op->used_replica) {
+      // the replica can't serve this read consistently; the primary can
+      ldout(cct, 7) << " got -EAGAIN from replica osd." << osd
+		    << ", resending to primary" << dendl;
+      op->flags &= ~(CEPH_OSD_FLAG_BALANCE_READS | CEPH_OSD_FLAG_LOCALIZE_READS);
+      op->acting.clear();
+      recalc_op_target(op, true);
+      if (op->session != homeless_session) {
+	logger->inc(l_osdc_op_resend);
+	send_op(op);
+      } else {
+	maybe_request_map();
+      }
+    } else {
+      ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
+      if (op->onack)
+	num_unacked.dec();
+      if (op->oncommit)
+	num_uncommitted.dec();
+      session_op_remove(op);
+      num_in_flight.dec();
+      op->acting.clear();
+      _op_submit(op, true);
+    }
+    rwlock.unlock();
     m->put();
     return;
   }
@@ -1244,6 +1638,8 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		  << " != request ops " << op->ops
 		  << " from " << m->get_source_inst() << dendl;
 
+  // handlers run after we drop our locks, and only once
+  list<pair<Context*, int> > handlers;
   vector<bufferlist*>::iterator pb = op->out_bl.begin();
   vector<int*>::iterator pr = op->out_rval.begin();
   vector<Context*>::iterator ph = op->out_handler.begin();
@@ -1261,24 +1657,27 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
       **pr = p->rval;
     if (*ph) {
       ldout(cct, 10) << " op " << i << " handler " << *ph << dendl;
-      (*ph)->complete(p->rval);
+      handlers.push_back(make_pair(*ph, p->rval));
+      *ph = NULL;
     }
   }
 
   // ack|commit -> ack
+  Context *onack = 0;
+  Context *oncommit = 0;
   if (op->onack) {
     ldout(cct, 15) << "handle_osd_op_reply ack" << dendl;
     op->version = m->get_version();
     onack = op->onack;
     op->onack = 0;  // only do callback once
-    num_unacked--;
+    num_unacked.dec();
     logger->inc(l_osdc_op_ack);
   }
   if (op->oncommit && (m->is_ondisk() || rc)) {
     ldout(cct, 15) << "handle_osd_op_reply safe" << dendl;
     oncommit = op->oncommit;
     op->oncommit = 0;
-    num_uncommitted--;
+    num_uncommitted.dec();
     logger->inc(l_osdc_op_commit);
   }
 
@@ -1292,20 +1691,28 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   // done with this tid?
   if (!op->onack && !op->oncommit) {
-    op->session_item.remove_myself();
+    _unindex_op(op);
+    s->ops.erase(tid);
+    op->session = NULL;
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
     if (op->budgeted)
       put_op_budget(op);
-    ops.erase(tid);
-    logger->set(l_osdc_op_active, ops.size());
+    num_in_flight.dec();
+    logger->set(l_osdc_op_active, num_in_flight.read());
     if (op->con)
       op->con->put();
     delete op;
   }
+  s->lock.Unlock();
+  rwlock.unlock();
   
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
 
   // do callbacks
+  for (list<pair<Context*, int> >::iterator i = handlers.begin();
+       i != handlers.end();
+       ++i)
+    i->first->complete(i->second);
   if (onack) {
     onack->finish(rc);
     delete onack;
@@ -1336,8 +1743,10 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
     return;
   }
 
+  rwlock.get_read();
   const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
   int pg_num = pool->get_pg_num();
+  rwlock.unlock();
 
   if (list_context->starting_pg_num == 0) {     // there can't be zero pgs!
     list_context->starting_pg_num = pg_num;
@@ -1446,6 +1855,197 @@ void Objecter::_list_reply(ListContext *list_context, int r, bufferlist *bl,
   return;
 }
 
+// parallel listing
+
+bool Objecter::ParallelListContext::can_issue() const
+{
+  if (error || num_in_flight >= max_in_flight ||
+      (int)queue.size() >= max_in_flight)
+    return false;
+  return !pg_num || next_pg < pg_num || issue.size() > busy_pgs.size();
+}
+
+void Objecter::ParallelListContext::pop_batch()
+{
+  Batch& b = queue.front();
+  if (b.pg_done)
+    consumed.erase(b.pg);
+  else
+    consumed[b.pg] = b.next;
+  queue.pop_front();
+}
+
+int Objecter::ParallelListContext::pop_entry()
+{
+  while (!queue.empty()) {
+    Batch& b = queue.front();
+    if (b.entries.empty()) {
+      pop_batch();
+      continue;
+    }
+    cur = b.entries.front();
+    b.entries.pop_front();
+    if (b.entries.empty())
+      pop_batch();
+    return 0;
+  }
+  if (error)
+    return error;
+  if (pg_num && next_pg >= pg_num && consumed.empty())
+    return -ENOENT;
+  return -EAGAIN;
+}
+
+void Objecter::ParallelListContext::encode_cursor(bufferlist& bl)
+{
+  Mutex::Locker l(lock);
+  ENCODE_START(1, 1, bl);
+  ::encode(pool_id, bl);
+  ::encode(pg_num, bl);
+  ::encode(next_pg, bl);
+  __u32 n = consumed.size();
+  ::encode(n, bl);
+  for (map<int, PGCursor>::iterator p = consumed.begin(); p != consumed.end(); ++p) {
+    ::encode(p->first, bl);
+    ::encode(p->second.cookie, bl);
+    ::encode(p->second.epoch, bl);
+  }
+  ENCODE_FINISH(bl);
+}
+
+int Objecter::ParallelListContext::decode_cursor(bufferlist& bl)
+{
+  Mutex::Locker l(lock);
+  assert(!pg_num);  // only before we start
+  int64_t pool;
+  int pgs, next;
+  map<int, PGCursor> pos;
+  try {
+    bufferlist::iterator p = bl.begin();
+    DECODE_START(1, p);
+    ::decode(pool, p);
+    ::decode(pgs, p);
+    ::decode(next, p);
+    __u32 n;
+    ::decode(n, p);
+    while (n--) {
+      int pg;
+      ::decode(pg, p);
+      ::decode(pos[pg].cookie, p);
+      ::decode(pos[pg].epoch, p);
+    }
+    DECODE_FINISH(p);
+  }
+  catch (buffer::error& e) {
+    return -EINVAL;
+  }
+  if (pool != pool_id || pgs <= 0 || next > pgs)
+    return -EINVAL;
+  pg_num = pgs;
+  next_pg = next;
+  consumed = pos;
+  issue = pos;
+  return 0;
+}
+
+void Objecter::list_objects_parallel(ParallelListContext *list_context)
+{
+  rwlock.get_read();
+  const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
+  int pg_num = pool ? pool->get_pg_num() : 0;
+  rwlock.unlock();
+
+  vector<Op*> ops;
+  list_context->lock.Lock();
+  if (!pg_num) {
+    list_context->error = -ENOENT;
+    list_context->cond.Signal();
+  } else if (list_context->pg_num != pg_num) {
+    if (list_context->pg_num)
+      ldout(cct, 10) << "list_objects_parallel pg_num changed from " << list_context->pg_num
+		     << " to " << pg_num << ", restarting" << dendl;
+    list_context->pg_num = pg_num;
+    list_context->next_pg = 0;
+    list_context->gen++;
+    list_context->issue.clear();
+    list_context->busy_pgs.clear();
+    list_context->queue.clear();
+    list_context->consumed.clear();
+  }
+
+  while (list_context->can_issue()) {
+    // continue an idle pg we've started before starting a new one
+    map<int, ParallelListContext::PGCursor>::iterator p = list_context->issue.begin();
+    while (p != list_context->issue.end() && list_context->busy_pgs.count(p->first))
+      ++p;
+    if (p == list_context->issue.end()) {
+      int pg = list_context->next_pg++;
+      list_context->consumed[pg];
+      p = list_context->issue.insert(make_pair(pg, ParallelListContext::PGCursor())).first;
+    }
+
+    ldout(cct, 20) << "list_objects_parallel pg " << p->first
+		   << " cookie " << p->second.cookie << dendl;
+    ObjectOperation op;
+    op.pg_ls(list_context->max_entries, list_context->filter, p->second.cookie,
+	     p->second.epoch);
+    C_ParallelList *onack = new C_ParallelList(this, list_context, p->first,
+					       list_context->gen);
+    Op *o = new Op(object_t(), object_locator_t(list_context->pool_id), op.ops,
+		   CEPH_OSD_FLAG_READ, onack, NULL, NULL);
+    o->priority = op.priority;
+    o->snapid = list_context->pool_snap_seq;
+    o->outbl = &onack->bl;
+    o->reply_epoch = &onack->epoch;
+    o->pgid = pg_t(p->first, list_context->pool_id, -1);
+    o->precalc_pgid = true;
+    ops.push_back(o);
+
+    list_context->busy_pgs.insert(p->first);
+    list_context->num_in_flight++;
+  }
+  list_context->lock.Unlock();
+
+  for (vector<Op*>::iterator p = ops.begin(); p != ops.end(); ++p)
+    op_submit(*p);
+}
+
+void Objecter::_parallel_list_reply(ParallelListContext *list_context, int pg,
+				    unsigned gen, int r, bufferlist& bl,
+				    epoch_t reply_epoch)
+{
+  Mutex::Locker l(list_context->lock);
+  ldout(cct, 20) << "_parallel_list_reply pg " << pg << " r " << r << dendl;
+  list_context->num_in_flight--;
+  list_context->cond.Signal();
+  if (gen != list_context->gen)
+    return;  // from before a restart
+  list_context->busy_pgs.erase(pg);
+  if (r < 0) {
+    list_context->error = r;
+    return;
+  }
+
+  bufferlist::iterator iter = bl.begin();
+  pg_ls_response_t response;
+  ::decode(response, iter);
+
+  ParallelListContext::PGCursor& c = list_context->issue[pg];
+  c.cookie = response.handle;
+  if (!c.epoch)
+    c.epoch = reply_epoch;  // first pgls result, set epoch marker
+
+  list_context->queue.push_back(ParallelListContext::Batch());
+  ParallelListContext::Batch& b = list_context->queue.back();
+  b.pg = pg;
+  b.next = c;
+  // as in _list_reply, a return of 1 or no entries is the end of the pg
+  b.pg_done = !(r == 0 && response.entries.size() > 0);
+  b.entries.swap(response.entries);
+  if (b.pg_done)
+    list_context->issue.erase(pg);
+}
+
 
 //snapshots
 
@@ -1454,7 +2054,7 @@ int Objecter::create_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1487,7 +2087,7 @@ int Objecter::allocate_selfmanaged_snap(int64_t pool, snapid_t *psnapid,
   ldout(cct, 10) << "allocate_selfmanaged_snap; pool: " << pool << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   C_SelfmanagedSnap *fin = new C_SelfmanagedSnap(psnapid, onfinish);
   op->onfinish = fin;
@@ -1505,7 +2105,7 @@ int Objecter::delete_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1523,7 +2123,7 @@ int Objecter::delete_selfmanaged_snap(int64_t pool, snapid_t snap,
 	   << snap << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->onfinish = onfinish;
   op->pool_op = POOL_OP_DELETE_UNMANAGED_SNAP;
@@ -1542,7 +2142,7 @@ int Objecter::create_pool(string& name, Context *onfinish, uint64_t auid,
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = 0;
   op->name = name;
   op->onfinish = onfinish;
@@ -1562,7 +2162,7 @@ int Objecter::delete_pool(int64_t pool, Context *onfinish)
 
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "delete";
   op->onfinish = onfinish;
@@ -1585,7 +2185,7 @@ int Objecter::change_pool_auid(int64_t pool, Context *onfinish, uint64_t auid)
   ldout(cct, 10) << "change_pool_auid " << pool << " to " << auid << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "change_pool_auid";
   op->onfinish = onfinish;
@@ -1663,7 +2263,7 @@ void Objecter::get_pool_stats(list<string>& pools, map<string,pool_stat_t> *resu
   ldout(cct, 10) << "get_pool_stats " << pools << dendl;
 
   PoolStatOp *op = new PoolStatOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pools = pools;
   op->pool_stats = result;
   op->onfinish = onfinish;
@@ -1716,7 +2316,7 @@ void Objecter::get_fs_stats(ceph_statfs& result, Context *onfinish)
   ldout(cct, 10) << "get_fs_stats" << dendl;
 
   StatfsOp *op = new StatfsOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->stats = &result;
   op->onfinish = onfinish;
   statfs_ops[op->tid] = op;
@@ -1886,7 +2486,7 @@ void Objecter::ms_handle_connect(Connection *con)
 void Objecter::ms_handle_reset(Connection *con)
 {
   if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
-    //
+    rwlock.get_write();
     int osd = osdmap->identify_osd(con->get_peer_addr());
     if (osd >= 0) {
       ldout(cct, 1) << "ms_handle_reset on osd." << osd << dendl;
@@ -1900,6 +2500,7 @@ void Objecter::ms_handle_reset(Connection *con)
     } else {
       ldout(cct, 10) << "ms_handle_reset on unknown osd addr " << con->get_peer_addr() << dendl;
     }
+    rwlock.unlock();
   }
 }
 
@@ -1912,12 +2513,15 @@ void Objecter::ms_handle_remote_reset(Connection *con)
 }
 
 
+/* rwlock must be held for write */
 void Objecter::dump_active()
 {
-  ldout(cct, 20) << "dump_active .. " << num_homeless_ops << " homeless" << dendl;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
-    Op *op = p->second;
-    ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
+  ldout(cct, 20) << "dump_active .. " << homeless_session->ops.size() << " homeless" << dendl;
+  vector<Op*> ls;
+  get_all_ops(ls);
+  for (vector<Op*>::iterator p = ls.begin(); p != ls.end(); p++) {
+    Op *op = *p;
+    ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << op->session->osd
 	    << "\t" << op->oid << "\t" << op->ops << dendl;
   }
 }
@@ -1937,32 +2541,44 @@ void Objecter::dump_requests(Formatter& fmt) const
 
 void Objecter::dump_ops(Formatter& fmt) const
 {
+  vector<OSDSession*> sessions;
+  for (map<int,OSDSession*>::const_iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p)
+    sessions.push_back(p->second);
+  sessions.push_back(homeless_session);
+
   fmt.open_array_section("ops");
-  for (hash_map<tid_t,Op*>::const_iterator p = ops.begin();
-       p != ops.end();
-       ++p) {
-    Op *op = p->second;
-    fmt.open_object_section("op");
-    fmt.dump_unsigned("tid", op->tid);
-    fmt.dump_stream("pg") << op->pgid;
-    fmt.dump_int("osd", op->session ? op->session->osd : -1);
-    fmt.dump_stream("last_sent") << op->stamp;
-    fmt.dump_int("attempts", op->attempts);
-    fmt.dump_stream("object_id") << op->oid;
-    fmt.dump_stream("object_locator") << op->oloc;
-    fmt.dump_stream("snapid") << op->snapid;
-    fmt.dump_stream("snap_context") << op->snapc;
-    fmt.dump_stream("mtime") << op->mtime;
+  for (vector<OSDSession*>::iterator s = sessions.begin();
+       s != sessions.end();
+       ++s) {
+    Mutex::Locker l((*s)->lock);
+    for (map<tid_t,Op*>::const_iterator p = (*s)->ops.begin();
+	 p != (*s)->ops.end();
+	 ++p) {
+      Op *op = p->second;
+      fmt.open_object_section("op");
+      fmt.dump_unsigned("tid", op->tid);
+      fmt.dump_stream("pg") << op->pgid;
+      fmt.dump_int("osd", (*s)->osd);
+      fmt.dump_stream("last_sent") << op->stamp;
+      fmt.dump_int("attempts", op->attempts);
+      fmt.dump_stream("object_id") << op->oid;
+      fmt.dump_stream("object_locator") << op->oloc;
+      fmt.dump_stream("snapid") << op->snapid;
+      fmt.dump_stream("snap_context") << op->snapc;
+      fmt.dump_stream("mtime") << op->mtime;
+
+      fmt.open_array_section("osd_ops");
+      for (vector<OSDOp>::const_iterator it = op->ops.begin();
+	   it != op->ops.end();
+	   ++it) {
+	fmt.dump_stream("osd_op") << *it;
+      }
+      fmt.close_section(); // osd_ops array
 
-    fmt.open_array_section("osd_ops");
-    for (vector<OSDOp>::const_iterator it = op->ops.begin();
-	 it != op->ops.end();
-	 ++it) {
-      fmt.dump_stream("osd_op") << *it;
+      fmt.close_section(); // op object
     }
-    fmt.close_section(); // osd_ops array
-
-    fmt.close_section(); // op object
   }
   fmt.close_section(); // ops array
 }
@@ -2058,7 +2674,9 @@ bool Objecter::RequestStateHook::call(std::string command, std::string args, buf
   stringstream ss;
   JSONFormatter formatter(true);
   m_objecter->client_lock.Lock();
+  m_objecter->rwlock.get_read();
   m_objecter->dump_requests(formatter);
+  m_objecter->rwlock.unlock();
   m_objecter->client_lock.Unlock();
   formatter.flush(ss);
   out.append(ss);
@@ -18,12 +18,14 @@
 #include "include/types.h"
 #include "include/buffer.h"
 #include "include/xlist.h"
+#include "include/atomic.h"
 
 #include "osd/OSDMap.h"
 #include "messages/MOSDOp.h"
 
 #include "common/admin_socket.h"
 #include "common/Timer.h"
+#include "common/RWLock.h"
 
 #include <list>
 #include <map>
@@ -42,6 +44,7 @@ class MPoolOpReply;
 
 class MGetPoolStatsReply;
 class MStatfsReply;
+class MOSDOpBatch;
 
 class PerfCounters;
 
@@ -514,11 +517,11 @@ class Objecter {
   bool initialized;
  
  private:
-  tid_t last_tid;
+  atomic_t last_tid;
   int client_inc;
   uint64_t max_linger_id;
-  int num_unacked;
-  int num_uncommitted;
+  atomic_t num_unacked;
+  atomic_t num_uncommitted;
   int global_op_flags; // flags which are applied to each IO op
   bool keep_balanced_budget;
   bool honor_osdmap_full;
@@ -531,6 +534,19 @@ class Objecter {
   Mutex &client_lock;
   SafeTimer &timer;
 
+  /*
+   * rwlock protects osdmap, osd_sessions, the linger ops and the
+   * map-check and waiting_for_map bookkeeping.  op submission and
+   * reply handling take it for read, plus the target session's lock;
+   * map updates, session resets and linger changes take it for write.
+   * lock order is client_lock, rwlock, OSDSession::lock.
+   *
+   * osdmap only changes in handle_osd_map(), which is still called
+   * with client_lock held, so code holding client_lock may read it
+   * without taking rwlock.
+   */
+  RWLock rwlock;
+
   PerfCounters *logger;
   
   class C_Tick : public Context {
@@ -561,7 +577,6 @@ public:
 
   struct Op {
     OSDSession *session;
-    xlist<Op*>::item session_item;
     int incarnation;
     
     object_t oid;
@@ -570,6 +585,7 @@ public:
     pg_t pgid;
     vector<int> acting;
     bool used_replica;
+    pg_t actual_pgid;  ///< pgid folded by pg_num; our key in session->ops_by_pg
 
     Connection *con;  // for rx buffer only
 
@@ -604,7 +620,7 @@ public:
 
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
-      session(NULL), session_item(this), incarnation(0),
+      session(NULL), incarnation(0),
       oid(o), oloc(ol),
       used_replica(false), con(NULL),
       snapid(CEPH_NOSNAP),
@@ -721,6 +737,89 @@ public:
     }
   };
   
+  /**
+   * state for listing a pool with several pgls ops in flight at once.
+   *
+   * each pg is still walked in order by its own cookie, but up to
+   * max_in_flight pgs are listed concurrently, so objects come back in
+   * no particular order.  replies wait in queue until the caller takes
+   * them; we stop issuing pgls ops while max_in_flight batches are
+   * queued, so a slow consumer bounds our memory use.
+   *
+   * a pg's position in the cursor (see encode_cursor) only moves past a
+   * batch once the caller has taken every entry in it, so a listing
+   * resumed from a cursor may return some objects again but never skips
+   * any.  as with ListContext, if pg_num changes we start over.
+   */
+  struct ParallelListContext {
+    struct PGCursor {
+      collection_list_handle_t cookie;
+      epoch_t epoch;
+      PGCursor() : epoch(0) {}
+    };
+    struct Batch {
+      int pg;
+      PGCursor next;          ///< where pg resumes once this batch is consumed
+      bool pg_done;
+      std::list<pair<object_t, string> > entries;
+      Batch() : pg(0), pg_done(false) {}
+    };
+
+    int64_t pool_id;
+    snapid_t pool_snap_seq;
+    int max_in_flight;
+    int max_entries;          ///< per pgls op
+    bufferlist filter;
+
+    Mutex lock;               ///< protects the rest; replies arrive asynchronously
+    Cond cond;
+    int pg_num;               ///< pg count we're listing against; 0 until we start
+    int next_pg;              ///< pgs >= this haven't been started
+    unsigned gen;             ///< bumped on restart, to ignore stale replies
+    map<int, PGCursor> issue; ///< started pgs the osds haven't exhausted
+    set<int> busy_pgs;        ///< pgs with a pgls op outstanding
+    int num_in_flight;        ///< includes stale ops from before a restart
+    std::list<Batch> queue;
+    map<int, PGCursor> consumed; ///< where each started, unfinished pg resumes
+    int error;
+
+    pair<object_t, string> cur;  ///< last entry handed to the caller
+
+    ParallelListContext() : pool_id(0), max_in_flight(1), max_entries(0),
+			    lock("Objecter::ParallelListContext::lock"),
+			    pg_num(0), next_pg(0), gen(0), num_in_flight(0),
+			    error(0) {}
+
+    /// true if a pgls op could be issued now; call with lock held
+    bool can_issue() const;
+    /**
+     * take the next queued entry into cur; call with lock held
+     *
+     * @returns 0 on success, -EAGAIN if we must wait for a reply,
+     * -ENOENT at the end of the pool, or the error that stopped us
+     */
+    int pop_entry();
+    void encode_cursor(bufferlist& bl);
+    int decode_cursor(bufferlist& bl);
+
+  private:
+    void pop_batch();
+  };
+
+  struct C_ParallelList : public Context {
+    Objecter *objecter;
+    ParallelListContext *list_context;
+    int pg;
+    unsigned gen;
+    bufferlist bl;
+    epoch_t epoch;
+    C_ParallelList(Objecter *ob, ParallelListContext *lc, int p, unsigned g) :
+      objecter(ob), list_context(lc), pg(p), gen(g), epoch(0) {}
+    void finish(int r) {
+      objecter->_parallel_list_reply(list_context, pg, gen, r, bl, epoch);
+    }
+  };
+
   struct PoolStatOp {
     tid_t tid;
     list<string> pools;
@@ -829,21 +928,70 @@ public:
 
   // -- osd sessions --
   struct OSDSession {
-    xlist<Op*> ops;
+    /// protects ops (with rwlock held for read; rwlock for write is enough)
+    Mutex lock;
+    map<tid_t,Op*> ops;
+
+    /*
+     * the same ops by the pg they map to, with that pg's acting set and
+     * pool pg_num as of the last map we checked, so that a new map only
+     * retargets ops whose pg moved.  homeless ops aren't indexed.
+     */
+    struct PGOps {
+      vector<int> acting;
+      unsigned pg_num;
+      set<Op*> ops;
+      PGOps() : pg_num(0) {}
+    };
+    map<pg_t,PGOps> ops_by_pg;
     xlist<LingerOp*> linger_ops;
     int osd;
     int incarnation;
     Connection *con;
 
-    OSDSession(int o) : osd(o), incarnation(0), con(NULL) {}
+    OSDSession(int o) : lock("OSDSession::lock"),
+			osd(o), incarnation(0), con(NULL) {}
   };
   map<int,OSDSession*> osd_sessions;
 
-
  private:
+  /*
+   * small ops bound for the same osd are held for up to
+   * objecter_batch_window_us and sent as one MOSDOpBatch.  batch_lock
+   * nests inside the session locks (and rwlock); batch_timer runs
+   * under it and never touches sessions.
+   */
+  struct OpBatch {
+    Connection *con;
+    MOSDOpBatch *m;
+    uint64_t bytes;
+    Context *flush_event;
+    OpBatch() : con(NULL), m(NULL), bytes(0), flush_event(NULL) {}
+  };
+  Mutex batch_lock;
+  SafeTimer batch_timer;
+  map<int,OpBatch> op_batches;  ///< by osd
+
+  struct C_FlushBatch : public Context {
+    Objecter *objecter;
+    int osd;
+    C_FlushBatch(Objecter *o, int d) : objecter(o), osd(d) {}
+    void finish(int r) {
+      map<int,OpBatch>::iterator p = objecter->op_batches.find(osd);
+      if (p != objecter->op_batches.end()) {
+	p->second.flush_event = NULL;
+	objecter->_flush_batch(osd);
+      }
+    }
+  };
+
+  void _send_message(OSDSession *s, MOSDOp *m);
+  void _flush_batch(int osd);
+  void _discard_batch(int osd);
+
   // pending ops
-  hash_map<tid_t,Op*>       ops;
-  int                       num_homeless_ops;
+  OSDSession               *homeless_session;  ///< ops with no target osd
+  atomic_t                  num_in_flight;
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
   map<tid_t,StatfsOp*>      statfs_ops;
@@ -862,13 +1010,20 @@ public:
     RECALC_OP_TARGET_NO_ACTION = 0,
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
+    RECALC_OP_TARGET_NEED_SESSION,  ///< target has no session; retry with rwlock for write
   };
-  int recalc_op_target(Op *op);
+  int recalc_op_target(Op *op, bool wlocked);
   bool recalc_linger_op_target(LingerOp *op);
+  void session_op_assign(OSDSession *s, Op *op);
+  void session_op_remove(Op *op);
+  void _index_op(Op *op, pg_t actual_pgid, const vector<int>& acting,
+		 unsigned pg_num);
+  void _unindex_op(Op *op);
 
-  void send_linger(LingerOp *info, bool first_send);
+  void send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
   void _linger_commit(LingerOp *info, int r);
+  void _unregister_linger(uint64_t linger_id);
 
   void op_check_for_latest_map(Op *op);
   void op_cancel_map_check(Op *op);
@@ -876,13 +1031,19 @@ public:
   void linger_cancel_map_check(LingerOp *op);
 
   void kick_requests(OSDSession *session);
+  void get_all_ops(vector<Op*>& ls);
+  void get_moved_ops(vector<Op*>& ls);
 
+  OSDSession *lookup_session(int osd);
   OSDSession *get_session(int osd);
   void reopen_session(OSDSession *session);
   void close_session(OSDSession *session);
   
   void _list_reply(ListContext *list_context, int r, bufferlist *bl, Context *final_finish,
 		   epoch_t reply_epoch);
+  void _parallel_list_reply(ParallelListContext *list_context, int pg,
+			    unsigned gen, int r, bufferlist& bl,
+			    epoch_t reply_epoch);
 
   void resend_mon_ops();
 
@@ -890,7 +1051,9 @@ public:
    * handle a budget for in-flight ops
    * budget is taken whenever an op goes into the ops map
    * and returned whenever an op is removed from the map
-   * If throttle_op needs to throttle it will unlock client_lock.
+   * If throttle_op needs to throttle it blocks the caller, dropping
+   * client_lock meanwhile if the caller holds it; it is called before
+   * any of our own locks are taken.
    */
   int calc_op_budget(Op *op);
   void throttle_op(Op *op, int op_size=0);
@@ -924,9 +1087,13 @@ public:
     last_seen_osdmap_version(0),
     last_seen_pgmap_version(0),
     client_lock(l), timer(t),
+    rwlock("Objecter::rwlock"),
     logger(NULL), tick_event(NULL),
     m_request_state_hook(NULL),
-    num_homeless_ops(0),
+    batch_lock("Objecter::batch_lock"),
+    batch_timer(cct_, batch_lock),
+    homeless_session(new OSDSession(-1)),
+    num_in_flight(0),
     op_throttle_bytes(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes),
     op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops)
   { }
@@ -934,6 +1101,7 @@ public:
     assert(!tick_event);
     assert(!m_request_state_hook);
     assert(!logger);
+    delete homeless_session;
   }
 
   void init();
@@ -941,10 +1109,10 @@ public:
 
   /**
    * Tell the objecter to throttle outgoing ops according to its
-   * budget (in _conf). If you do this, ops can block, in
-   * which case it will unlock client_lock and sleep until
-   * incoming messages reduce the used budget low enough for
-   * the ops to continue going; then it will lock client_lock again.
+   * budget (in _conf). If you do this, ops can block until
+   * incoming replies reduce the used budget low enough for
+   * the ops to continue going.  A caller that holds client_lock
+   * gives it up while it waits.
    */
   void set_balanced_budget() { keep_balanced_budget = true; }
   void unset_balanced_budget() { keep_balanced_budget = false; }
@@ -962,12 +1130,13 @@ public:
 private:
   // low-level
   tid_t op_submit(Op *op);
-  tid_t _op_submit(Op *op);
+  tid_t _op_submit(Op *op, bool wlocked);
 
   // public interface
  public:
   bool is_active() {
-    return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
+    return !(num_in_flight.read() == 0 && linger_ops.empty() &&
+	     poolstat_ops.empty() && statfs_ops.empty());
   }
 
   /**
@@ -985,8 +1154,10 @@ private:
   void set_client_incarnation(int inc) { client_inc = inc; }
 
   void wait_for_new_map(Context *c, epoch_t epoch, int replyCode=0) {
+    rwlock.get_write();
     maybe_request_map(epoch);
     waiting_for_map[epoch].push_back(pair<Context *, int>(c, replyCode));
+    rwlock.unlock();
   }
 
   /** Get the current set of global op flags */
@@ -1005,6 +1176,9 @@ private:
     o->priority = op.priority;
     o->mtime = mtime;
     o->snapc = snapc;
+    o->out_bl.swap(op.out_bl);
+    o->out_handler.swap(op.out_handler);
+    o->out_rval.swap(op.out_rval);
     return op_submit(o);
   }
   tid_t read(const object_t& oid, const object_locator_t& oloc,
@@ -1372,6 +1546,12 @@ private:
   }
 
   void list_objects(ListContext *p, Context *onfinish);
+  /**
+   * top up the pgls ops in flight for a parallel listing.  never
+   * waits for replies, but may block on the op throttle, so don't
+   * call it from a reply callback.
+   */
+  void list_objects_parallel(ParallelListContext *p);
 
   // -------------------------
   // pool ops
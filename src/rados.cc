@@ -76,8 +76,10 @@ void usage(ostream& out)
 "   mksnap <snap-name>               create snap <snap-name>\n"
 "   rmsnap <snap-name>               remove snap <snap-name>\n"
 "   rollback <obj-name> <snap-name>  roll back object to snap <snap-name>\n\n"
-"   bench <seconds> write|seq|rand [-t concurrent_operations]\n"
+"   bench <seconds> write|seq|rand|mix [-t concurrent_operations]\n"
 "                                    default is 16 concurrent IOs and 4 MB ops\n"
+"                                    mix runs a mix of reads, writes, stats\n"
+"                                    and removes (see BENCH OPTIONS)\n"
 "   load-gen [options]               generate load on the cluster\n"
 "   listomapkeys <obj-name>          list the keys in the object map\n"
 "   getomapval <obj-name> <key>      show the value for the specified key in the object's object map"
@@ -120,6 +122,14 @@ STR(DEFAULT_NUM_RADOS_WORKER_THREADS) ")\n"
 "BENCH OPTIONS:\n"
 "   --show-time\n"
 "        prefix output with date/time\n"
+"   --op-mix read:write:stat:remove\n"
+"        relative share of each op type for mix (default 0:1:0:0)\n"
+"   --min-object-size, --max-object-size\n"
+"        mix writes objects of random size in this range (default -b)\n"
+"   --target-iops ops_per_sec\n"
+"        issue mix ops at a fixed rate, with at most -t in flight\n"
+"   --json-output file\n"
+"        write latency percentiles and a per-second series to file\n"
 "\n"
 "LOAD GEN OPTIONS:\n"
 "   --num-objects                    total number of objects\n"
@@ -632,6 +642,16 @@ protected:
   int sync_write(const std::string& oid, bufferlist& bl, size_t len) {
     return io_ctx.write(oid, bl, len, 0);
   }
+  int aio_stat(const std::string& oid, int slot, uint64_t *psize) {
+    librados::ObjectReadOperation op;
+    op.stat(psize, NULL, NULL);
+    return io_ctx.aio_operate(oid, completions[slot], &op, NULL);
+  }
+  int aio_remove(const std::string& oid, int slot) {
+    librados::ObjectWriteOperation op;
+    op.remove();
+    return io_ctx.aio_operate(oid, completions[slot], &op);
+  }
 
   bool completion_is_done(int slot) {
     return completions[slot]->is_safe();
@@ -678,6 +698,9 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   int run_length = 0;
 
   bool show_time = false;
+  const char *op_mix = NULL;
+  double target_iops = 0;
+  string json_output;
 
   Formatter *formatter = NULL;
   bool pretty_format = false;
@@ -758,6 +781,18 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   if (i != opts.end()) {
     show_time = true;
   }
+  i = opts.find("op-mix");
+  if (i != opts.end()) {
+    op_mix = i->second.c_str();
+  }
+  i = opts.find("target-iops");
+  if (i != opts.end()) {
+    target_iops = strtod(i->second.c_str(), NULL);
+  }
+  i = opts.find("json-output");
+  if (i != opts.end()) {
+    json_output = i->second;
+  }
   i = opts.find("pretty-format");
   if (i != opts.end()) {
     pretty_format = true;
@@ -1417,10 +1452,25 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       operation = OP_SEQ_READ;
     else if (strcmp(nargs[2], "rand") == 0)
       operation = OP_RAND_READ;
+    else if (strcmp(nargs[2], "mix") == 0)
+      operation = OP_MIX;
     else
       usage_exit();
     RadosBencher bencher(rados, io_ctx);
     bencher.set_show_time(show_time);
+    if (op_mix) {
+      int rd, wr, st, rm;
+      if (sscanf(op_mix, "%d:%d:%d:%d", &rd, &wr, &st, &rm) != 4) {
+	cerr << "bad op mix '" << op_mix << "', want read:write:stat:remove" << std::endl;
+	return 1;
+      }
+      bencher.set_op_mix(rd, wr, st, rm);
+    }
+    if (min_obj_len || max_obj_len)
+      bencher.set_object_size_range(min_obj_len ? min_obj_len : max_obj_len,
+				     max_obj_len ? max_obj_len : min_obj_len);
+    bencher.set_target_iops(target_iops);
+    bencher.set_json_output(json_output);
     ret = bencher.aio_bench(operation, seconds, concurrent_ios, op_size);
     if (ret != 0)
       cerr << "error during benchmark: " << ret << std::endl;
@@ -1583,6 +1633,12 @@ int main(int argc, const char **argv)
       opts["workers"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--format", (char*)NULL)) {
       opts["format"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--op-mix", (char*)NULL)) {
+      opts["op-mix"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--target-iops", (char*)NULL)) {
+      opts["target-iops"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--json-output", (char*)NULL)) {
+      opts["json-output"] = val;
     } else {
       if (val[0] == '-')
         usage_exit();
@@ -5,27 +5,36 @@
 #include <set>
 #include <tr1/memory>
 #include <iostream>
+#include <algorithm>
+#include "include/assert.h"
 
 using namespace std;
 
 class MemIterator : public KeyValueDB::IteratorImpl {
   string prefix;
   KeyValueDBMemory *db;
+  string start;
+  string end;
+  bool keys_only;
 
   bool ready;
   map<string, bufferlist>::iterator iter;
 
 public:
   MemIterator(const string &prefix,
-	      KeyValueDBMemory *db) :
-    prefix(prefix), db(db), ready(false) {}
+	      KeyValueDBMemory *db,
+	      const string &start = "",
+	      const string &end = "",
+	      bool keys_only = false) :
+    prefix(prefix), db(db), start(start), end(end), keys_only(keys_only),
+    ready(false) {}
 
   int seek_to_first() {
     if (!db->db.count(prefix)) {
       ready = false;
       return 0;
     }
-    iter = db->db[prefix].begin();
+    iter = db->db[prefix].lower_bound(start);
     ready = true;
     return 0;
   }
@@ -34,11 +43,13 @@ public:
     if (!db->db.count(prefix)) {
       ready = false;
       return 0;
-    } else if (db->db[prefix].size() == 0) {
-      iter = db->db[prefix].end();
-    } else {
-      iter = --db->db[prefix].end();
     }
+    map<string, bufferlist> &keys = db->db[prefix];
+    iter = end.size() ? keys.lower_bound(end) : keys.end();
+    if (iter == keys.begin())
+      iter = keys.end();
+    else
+      --iter;
     ready = true;
     return 0;
   }
@@ -48,7 +59,7 @@ public:
       ready = false;
       return 0;
     }
-    iter = db->db[prefix].lower_bound(to);
+    iter = db->db[prefix].lower_bound(max(to, start));
     ready = true;
     return 0;
   }
@@ -58,13 +69,17 @@ public:
       ready = false;
       return 0;
     }
-    iter = db->db[prefix].upper_bound(after);
+    if (after < start)
+      iter = db->db[prefix].lower_bound(start);
+    else
+      iter = db->db[prefix].upper_bound(after);
     ready = true;
     return 0;
   }
 
   bool valid() {
-    return ready && iter != db->db[prefix].end();
+    return ready && iter != db->db[prefix].end() &&
+      iter->first >= start && (end.empty() || iter->first < end);
   }
 
   bool begin() {
@@ -91,6 +106,7 @@ public:
   }
 
   bufferlist value() {
+    assert(!keys_only);
     if (valid())
       return iter->second;
     else
@@ -160,6 +176,24 @@ int KeyValueDBMemory::rmkeys_by_prefix(const string &prefix) {
   return 0;
 }
 
+int KeyValueDBMemory::rm_range_keys(const string &prefix,
+				    const string &start,
+				    const string &end) {
+  if (!db.count(prefix))
+    return 0;
+  map<string, bufferlist> &keys = db[prefix];
+  keys.erase(keys.lower_bound(start),
+	     end.size() ? keys.lower_bound(end) : keys.end());
+  return 0;
+}
+
 KeyValueDB::Iterator KeyValueDBMemory::get_iterator(const string &prefix) {
   return tr1::shared_ptr<IteratorImpl>(new MemIterator(prefix, this));
 }
+
+KeyValueDB::Iterator KeyValueDBMemory::get_bounded_iterator(
+  const string &prefix, const string &start, const string &end,
+  bool keys_only) {
+  return tr1::shared_ptr<IteratorImpl>(
+    new MemIterator(prefix, this, start, end, keys_only));
+}
@@ -40,6 +40,12 @@ public:
     const string &prefix
     );
 
+  int rm_range_keys(
+    const string &prefix,
+    const string &start,
+    const string &end
+    );
+
   class TransactionImpl_ : public TransactionImpl {
   public:
     list<Context *> on_commit;
@@ -94,6 +100,25 @@ public:
       on_commit.push_back(new RmKeysByPrefixOp(db, prefix));
     }
 
+    struct RmRangeKeysOp : public Context {
+      KeyValueDBMemory *db;
+      string prefix;
+      string start;
+      string end;
+      RmRangeKeysOp(KeyValueDBMemory *db,
+		    const string &prefix,
+		    const string &start,
+		    const string &end)
+	: db(db), prefix(prefix), start(start), end(end) {}
+      void finish(int r) {
+	db->rm_range_keys(prefix, start, end);
+      }
+    };
+    void rm_range_keys(const string &prefix, const string &start,
+		       const string &end) {
+      on_commit.push_back(new RmRangeKeysOp(db, prefix, start, end));
+    }
+
     int complete() {
       for (list<Context *>::iterator i = on_commit.begin();
 	   i != on_commit.end();
@@ -123,4 +148,6 @@ public:
 
   friend class MemIterator;
   Iterator get_iterator(const string &prefix);
+  Iterator get_bounded_iterator(const string &prefix, const string &start,
+				const string &end, bool keys_only = false);
 };
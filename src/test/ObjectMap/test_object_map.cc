@@ -639,6 +639,48 @@ TEST_F(ObjectMapTest, CloneOneObject) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, Batch) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  string result;
+
+  db->start_batch();
+  tester.set_key(hoid, "foo", "bar");
+  tester.set_xattr(hoid, "xfoo", "xbar");
+  tester.set_key(hoid, "foo2", "bar2");
+  int r = tester.get_key(hoid, "foo2", &result);
+  ASSERT_EQ(r, 1);
+  ASSERT_EQ(result, "bar2");
+
+  tester.set_key(hoid, "foo3", "bar3");
+  tester.remove_key(hoid, "foo");
+  db->clone(hoid, hoid2);
+  tester.set_key(hoid2, "foo4", "bar4");
+  ASSERT_EQ(db->end_batch(), 0);
+
+  r = tester.get_key(hoid, "foo", &result);
+  ASSERT_EQ(r, 0);
+  r = tester.get_key(hoid2, "foo3", &result);
+  ASSERT_EQ(r, 1);
+  ASSERT_EQ(result, "bar3");
+  r = tester.get_key(hoid2, "foo4", &result);
+  ASSERT_EQ(r, 1);
+  ASSERT_EQ(result, "bar4");
+  r = tester.get_xattr(hoid2, "xfoo", &result);
+  ASSERT_EQ(r, 1);
+  ASSERT_EQ(result, "xbar");
+
+  db->start_batch();
+  tester.clear(hoid);
+  tester.set_key(hoid, "foo5", "bar5");
+  ASSERT_EQ(db->end_batch(), 0);
+  r = tester.get_key(hoid, "foo2", &result);
+  ASSERT_EQ(r, 0);
+  r = tester.get_key(hoid, "foo5", &result);
+  ASSERT_EQ(r, 1);
+  ASSERT_EQ(result, "bar5");
+}
+
 TEST_F(ObjectMapTest, OddEvenClone) {
   hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
   hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
@@ -747,3 +789,68 @@ TEST_F(ObjectMapTest, RandomTest) {
     }
   }
 }
+
+static void check_range_keys(KeyValueDB &db) {
+  map<string, bufferlist> to_set;
+  for (char c = 'a'; c <= 'f'; ++c)
+    to_set[string(1, c)].append(c);
+  KeyValueDB::Transaction t = db.get_transaction();
+  t->set("p", to_set);
+  t->set("q", to_set);
+  db.submit_transaction(t);
+
+  set<string> keys;
+  KeyValueDB::Iterator iter = db.get_bounded_iterator("p", "b", "e", true);
+  for (iter->seek_to_first(); iter->valid(); iter->next())
+    keys.insert(iter->key());
+  ASSERT_EQ(keys.size(), (unsigned)3);
+  ASSERT_EQ(*keys.begin(), "b");
+  ASSERT_EQ(*keys.rbegin(), "d");
+  iter->seek_to_last();
+  ASSERT_TRUE(iter->valid());
+  ASSERT_EQ(iter->key(), "d");
+  iter->lower_bound("a");
+  ASSERT_EQ(iter->key(), "b");
+  iter->upper_bound("a");
+  ASSERT_TRUE(iter->valid());
+  ASSERT_EQ(iter->key(), "b");
+  iter->upper_bound("b");
+  ASSERT_EQ(iter->key(), "c");
+  iter->upper_bound("d");
+  ASSERT_FALSE(iter->valid());
+
+  t = db.get_transaction();
+  t->rm_range_keys("p", "b", "e");
+  t->rm_range_keys("q", "d", "");
+  db.submit_transaction(t);
+
+  keys.clear();
+  iter = db.get_iterator("p");
+  for (iter->seek_to_first(); iter->valid(); iter->next())
+    keys.insert(iter->key());
+  ASSERT_EQ(keys.size(), (unsigned)3);
+  ASSERT_TRUE(keys.count("a") && keys.count("e") && keys.count("f"));
+
+  keys.clear();
+  iter = db.get_iterator("q");
+  for (iter->seek_to_first(); iter->valid(); iter->next())
+    keys.insert(iter->key());
+  ASSERT_EQ(keys.size(), (unsigned)3);
+  ASSERT_EQ(*keys.rbegin(), "c");
+}
+
+TEST(KeyValueDBMemory, RangeKeys) {
+  KeyValueDBMemory db;
+  check_range_keys(db);
+}
+
+TEST(LevelDBStore, RangeKeys) {
+  char path[] = "/tmp/test_object_map.XXXXXX";
+  ASSERT_TRUE(mkdtemp(path));
+  {
+    LevelDBStore db(path);
+    ASSERT_EQ(db.init(cerr), 0);
+    check_range_keys(db);
+  }
+  ASSERT_EQ(system((string("rm -rf ") + path).c_str()), 0);
+}
@@ -1,24 +1,34 @@
-// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 #include "include/rados/librados.h"
 #include "include/rados/librados.hpp"
+#include "include/atomic.h"
+#include "common/admin_socket_client.h"
+#include "json_spirit/json_spirit.h"
 #include "test/rados-api/test.h"
 
 #include <semaphore.h>
 #include <errno.h>
+#include <pthread.h>
 #include <map>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 using namespace librados;
 using ceph::buffer;
 using std::map;
 using std::ostringstream;
+using std::pair;
 using std::string;
+using std::vector;
 
 static sem_t sem;
+static atomic_t notified;
 
 class WatchNotifyTestCtx : public WatchCtx
 {
@@ -29,22 +39,31 @@ public:
     }
 };
 
-int main(int args, char **argv)
+class FanoutCtx : public WatchCtx
 {
-  if (args < 3) {
-    std::cerr << "Error: " << argv[0] << " pool_name obj_name" << std::endl;
-    return 1;
-  }
+public:
+    void notify(uint8_t opcode, uint64_t ver, bufferlist& bl)
+    {
+      notified.inc();
+    }
+};
 
-  std::string pool_name(argv[1]);
-  std::string obj_name(argv[2]);
-  std::cerr << "pool_name, obj_name are " << pool_name << ", " << obj_name << std::endl;
+static void usage(const char *me)
+{
+  std::cerr << "usage: " << me << " pool_name obj_name\n"
+	    << "       " << me << " pool_name obj_name fanout [clients [notifies [objects [osd_asok...]]]]\n"
+	    << "\n"
+	    << "the first form watches, notifies and unwatches in a loop.  the\n"
+	    << "second has each of clients (default 250) watch each of objects\n"
+	    << "(default 4), and times notifies (default 100) sent to every\n"
+	    << "object at once, a thread each.  given the osds' admin sockets, it\n"
+	    << "reports the notify batches they sent."
+	    << std::endl;
+}
 
-  char *id = getenv("CEPH_CLIENT_ID");
-  if (id) std::cerr << "Client id is: " << id << std::endl;
-  Rados cluster;
-  int ret;
-  ret = cluster.init(id);
+static int connect_cluster(Rados &cluster, const char *id)
+{
+  int ret = cluster.init(id);
   if (ret) {
     std::cerr << "Error " << ret << " in cluster.init" << std::endl;
     return ret;
@@ -59,22 +78,28 @@ int main(int args, char **argv)
     std::cerr << "Error " << ret << " in cluster.conf_read_env" << std::endl;
     return ret;
   }
-  cluster.connect();
-
-  // May already exist
-  cluster.pool_create(pool_name.c_str());
-
-  IoCtx ioctx;
-  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  ret = cluster.connect();
+  if (ret) {
+    std::cerr << "Error " << ret << " in cluster.connect" << std::endl;
+    return ret;
+  }
+  return 0;
+}
 
-  ioctx.create(obj_name, false);
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
 
-  
+static int stress(IoCtx& ioctx, const string& obj_name)
+{
   for (int i = 0; i < 10000; ++i) {
     std::cerr << "Iteration " << i << std::endl;
     uint64_t handle;
     WatchNotifyTestCtx ctx;
-    ret = ioctx.watch(obj_name, 0, &handle, &ctx);
+    int ret = ioctx.watch(obj_name, 0, &handle, &ctx);
     assert(!ret);
     bufferlist bl2;
     ret = ioctx.notify(obj_name, 0, bl2);
@@ -83,8 +108,253 @@ int main(int args, char **argv)
     sem_wait(&sem);
     ioctx.unwatch(obj_name, handle);
   }
+  return 0;
+}
+
+struct Notifier {
+  IoCtx *ioctx;
+  string oid;
+  int num_notifies;
+  int ret;
+  double total, min_lat, max_lat;
+};
+
+static void *notifier_entry(void *arg)
+{
+  Notifier *n = (Notifier*)arg;
+  for (int i = 0; i < n->num_notifies; ++i) {
+    bufferlist bl;
+    double s = now();
+    n->ret = n->ioctx->notify(n->oid, 0, bl);
+    double lat = now() - s;
+    if (n->ret) {
+      std::cerr << "Error " << n->ret << " in notify " << i
+		<< " on " << n->oid << std::endl;
+      break;
+    }
+    n->total += lat;
+    if (i == 0 || lat < n->min_lat)
+      n->min_lat = lat;
+    if (lat > n->max_lat)
+      n->max_lat = lat;
+  }
+  return NULL;
+}
+
+/// sum the osds' notify batch counters, from their admin sockets
+static int get_notify_batches(const vector<string>& asoks,
+			      uint64_t *batches, uint64_t *batched)
+{
+  *batches = *batched = 0;
+  for (unsigned i = 0; i < asoks.size(); ++i) {
+    AdminSocketClient client(asoks[i]);
+    string msg;
+    string err = client.do_request("perf dump", &msg);
+    json_spirit::Value v;
+    if (!err.empty() || !json_spirit::read(msg, v) ||
+	v.type() != json_spirit::obj_type) {
+      std::cerr << "can't read perf counters from " << asoks[i]
+		<< ": " << err << std::endl;
+      return -EINVAL;
+    }
+    json_spirit::Object& o = v.get_obj();
+    for (unsigned j = 0; j < o.size(); ++j) {
+      if (o[j].name_ != "osd" || o[j].value_.type() != json_spirit::obj_type)
+	continue;
+      json_spirit::Object& osd = o[j].value_.get_obj();
+      for (unsigned k = 0; k < osd.size(); ++k) {
+	if (osd[k].name_ == "notify_batches")
+	  *batches += osd[k].value_.get_uint64();
+	else if (osd[k].name_ == "notify_batched")
+	  *batched += osd[k].value_.get_uint64();
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * a watch is per client, so each watcher needs its own Rados handle.
+ * every client watches every object, and a thread per object notifies
+ * it, all at once: notify() returns once every watcher has acked, so
+ * its latency is the whole fan-out, and notifies from different
+ * objects to one client may go out together in an MWatchNotifyBatch.
+ */
+static int fanout(IoCtx& ioctx, const char *id, const string& pool_name,
+		  const string& obj_name, int num_clients, int num_notifies,
+		  int num_objects, const vector<string>& asoks)
+{
+  vector<Rados*> clients;
+  vector<IoCtx*> ioctxs;
+  vector<pair<IoCtx*, pair<string, uint64_t> > > watches;
+  vector<string> oids;
+  FanoutCtx ctx;
+  int ret = 0;
+
+  for (int i = 0; i < num_objects; ++i) {
+    ostringstream oss;
+    oss << obj_name << "." << i;
+    oids.push_back(oss.str());
+    ioctx.create(oids.back(), false);
+  }
+
+  std::cerr << "connecting " << num_clients << " clients to watch "
+	    << num_objects << " objects" << std::endl;
+  double start = now();
+  for (int i = 0; i < num_clients && !ret; ++i) {
+    Rados *c = new Rados;
+    ret = connect_cluster(*c, id);
+    if (ret) {
+      delete c;
+      break;
+    }
+    clients.push_back(c);
+    IoCtx *io = new IoCtx;
+    ret = c->ioctx_create(pool_name.c_str(), *io);
+    if (ret) {
+      std::cerr << "Error " << ret << " in ioctx_create" << std::endl;
+      delete io;
+      break;
+    }
+    ioctxs.push_back(io);
+    for (int j = 0; j < num_objects; ++j) {
+      uint64_t handle;
+      ret = io->watch(oids[j], 0, &handle, &ctx);
+      if (ret) {
+	std::cerr << "Error " << ret << " in watch " << i << " on "
+		  << oids[j] << std::endl;
+	break;
+      }
+      watches.push_back(make_pair(io, make_pair(oids[j], handle)));
+    }
+  }
+  std::cerr << watches.size() << " watches up in " << (now() - start)
+	    << " s" << std::endl;
+
+  uint64_t batches_before = 0, batched_before = 0;
+  if (!ret && !asoks.empty())
+    ret = get_notify_batches(asoks, &batches_before, &batched_before);
+
+  if (!ret) {
+    vector<Notifier> notifiers(num_objects);
+    vector<pthread_t> threads(num_objects);
+    TestAlarm alarm;
+    start = now();
+    for (int i = 0; i < num_objects; ++i) {
+      Notifier& n = notifiers[i];
+      n.ioctx = &ioctx;
+      n.oid = oids[i];
+      n.num_notifies = num_notifies;
+      n.ret = 0;
+      n.total = n.min_lat = n.max_lat = 0;
+      pthread_create(&threads[i], NULL, notifier_entry, &n);
+    }
+    double total = 0, min_lat = 0, max_lat = 0;
+    for (int i = 0; i < num_objects; ++i) {
+      Notifier& n = notifiers[i];
+      pthread_join(threads[i], NULL);
+      if (n.ret)
+	ret = n.ret;
+      total += n.total;
+      if (i == 0 || n.min_lat < min_lat)
+	min_lat = n.min_lat;
+      if (n.max_lat > max_lat)
+	max_lat = n.max_lat;
+    }
+    double elapsed = now() - start;
+
+    if (!ret) {
+      uint64_t expected = (uint64_t)num_clients * num_objects * num_notifies;
+      std::cout << "clients " << num_clients
+		<< " objects " << num_objects
+		<< " notifies " << num_notifies
+		<< " elapsed " << elapsed
+		<< " avg_lat " << (total / (num_objects * num_notifies))
+		<< " min_lat " << min_lat
+		<< " max_lat " << max_lat
+		<< " delivered " << notified.read() << "/" << expected;
+      if (!asoks.empty()) {
+	uint64_t batches, batched;
+	ret = get_notify_batches(asoks, &batches, &batched);
+	if (!ret)
+	  std::cout << " batches " << (batches - batches_before)
+		    << " batched " << (batched - batched_before);
+      }
+      std::cout << std::endl;
+      if (!ret && (uint64_t)notified.read() != expected)
+	ret = -EIO;
+    }
+  }
+
+  for (unsigned i = 0; i < watches.size(); ++i)
+    watches[i].first->unwatch(watches[i].second.first, watches[i].second.second);
+  for (unsigned i = 0; i < ioctxs.size(); ++i) {
+    ioctxs[i]->close();
+    delete ioctxs[i];
+  }
+  for (unsigned i = 0; i < clients.size(); ++i) {
+    clients[i]->shutdown();
+    delete clients[i];
+  }
+  return ret;
+}
+
+int main(int args, char **argv)
+{
+  if (args < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string pool_name(argv[1]);
+  std::string obj_name(argv[2]);
+  std::cerr << "pool_name, obj_name are " << pool_name << ", " << obj_name << std::endl;
+
+  bool do_fanout = false;
+  int num_clients = 250, num_notifies = 100, num_objects = 4;
+  vector<string> asoks;
+  if (args > 3) {
+    if (strcmp(argv[3], "fanout") != 0) {
+      usage(argv[0]);
+      return 1;
+    }
+    do_fanout = true;
+    if (args > 4)
+      num_clients = atoi(argv[4]);
+    if (args > 5)
+      num_notifies = atoi(argv[5]);
+    if (args > 6)
+      num_objects = atoi(argv[6]);
+    for (int i = 7; i < args; ++i)
+      asoks.push_back(argv[i]);
+    if (num_clients <= 0 || num_notifies <= 0 || num_objects <= 0) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  char *id = getenv("CEPH_CLIENT_ID");
+  if (id) std::cerr << "Client id is: " << id << std::endl;
+  Rados cluster;
+  int ret = connect_cluster(cluster, id);
+  if (ret)
+    return ret;
+
+  // May already exist
+  cluster.pool_create(pool_name.c_str());
+
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+
+  ioctx.create(obj_name, false);
+
+  if (do_fanout)
+    ret = fanout(ioctx, id, pool_name, obj_name, num_clients, num_notifies,
+		 num_objects, asoks);
+  else
+    ret = stress(ioctx, obj_name);
 
   ioctx.close();
   sem_destroy(&sem);
-  return 0;
+  return ret ? 1 : 0;
 }
@@ -57,6 +57,15 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--test") == 0) {
+	if (strcmp("write", args[i+1]) == 0) {
+	  test = &OmapBench::write_objects_in_parallel;
+	}
+	else if (strcmp("update", args[i+1]) == 0) {
+	  test = &OmapBench::update_objects_in_parallel;
+	}
+      } else if (strcmp(args[i], "--ops") == 0) {
+	ops = atoi(args[i+1]);
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: omapbench [options]\n"
@@ -86,6 +95,12 @@ int OmapBench::setup(int argc, const char** argv) {
       	   << " to be specified size.\n"
       	   << "                        (default "<<omap_value_size;
       cout <<"\n  --name          the rados id to use (default "<<rados_id;
+      cout << ")\n"
+	   << "	--test          write to write whole object maps, update for "
+	   << "small set/rm operations\n"
+	   << "                        on existing objects (default write)\n"
+	   << "	--ops           number of operations for the update test "
+	   << "(default "<<ops;
       cout<<")\n";
       exit(1);
     }
@@ -319,6 +334,74 @@ int OmapBench::write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+int OmapBench::update_omap_asynchronously(AioWriter *aiow,
+    const std::map<std::string,bufferlist> &omap) {
+  librados::ObjectWriteOperation owo;
+  set<string> to_rm;
+  to_rm.insert(random_string(omap_key_size));
+  owo.omap_set(omap);
+  owo.omap_rm_keys(to_rm);
+  aiow->start_time();
+  int err = io_ctx.aio_operate(aiow->get_oid(), aiow->get_aioc(), &owo);
+  if (err < 0) {
+    cout << "updating omap failed with code "<<err;
+    cout << std::endl;
+    return err;
+  }
+  return 0;
+}
+
+int OmapBench::update_objects_in_parallel(omap_generator_t omap_gen) {
+  //create the objects first; their latencies are not part of the result
+  int err = write_objects_in_parallel(omap_gen);
+  if (err < 0) {
+    return err;
+  }
+  data = omap_bench_data();
+  data.started_ops = objects;
+
+  comp = NULL;
+  AioWriter *this_aio_writer;
+
+  Mutex::Locker l(thread_is_free_lock);
+  for (int i = 0; i < ops; i++) {
+    assert(busythreads_count <= threads);
+    //wait for a writer to be free
+    if (busythreads_count == threads) {
+      err = thread_is_free.Wait(thread_is_free_lock);
+      assert(busythreads_count < threads);
+      if (err < 0) {
+	return err;
+      }
+    }
+
+    //set up the update on one of the existing objects
+    this_aio_writer = new AioWriter(this);
+    stringstream name;
+    name << prefix << (i % objects + 1);
+    this_aio_writer->oid = name.str();
+    this_aio_writer->set_aioc(NULL,safe);
+
+    //perform the update
+    busythreads_count++;
+    err = omap_gen(1, omap_key_size, omap_value_size,
+	& this_aio_writer->get_omap());
+    if (err < 0) {
+      return err;
+    }
+    err = update_omap_asynchronously(this_aio_writer,
+	this_aio_writer->get_omap());
+    if (err < 0) {
+      return err;
+    }
+  }
+  while(busythreads_count > 0) {
+    thread_is_free.Wait(thread_is_free_lock);
+  }
+
+  return 0;
+}
+
 int OmapBench::run() {
   return (((OmapBench *)this)->*OmapBench::test)(omap_generator);
 }
@@ -361,6 +444,9 @@ int OmapBench::print_written_omap() {
 void OmapBench::print_results() {
   cout << "========================================================";
   cout << "\nNumber of object maps written:\t" << objects;
+  if (test == &OmapBench::update_objects_in_parallel) {
+    cout << "\nNumber of updates:\t\t" << ops;
+  }
   cout << "\nNumber of threads used:\t\t" << threads;
   cout << "\nEntries per object map:\t\t" << omap_entries;
   cout << "\nCharacters per object map key:\t" <<omap_key_size;
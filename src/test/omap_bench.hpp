@@ -102,6 +102,7 @@ protected:
   int omap_entries;
   int omap_key_size;
   int omap_value_size;
+  int ops;
   double increment;
 
   friend class Writer;
@@ -119,7 +120,7 @@ public:
       rados_id("admin"),
       prefix(rados_id+".obj."),
       threads(3), objects(100), omap_entries(10), omap_key_size(10),
-      omap_value_size(100), increment(10)
+      omap_value_size(100), ops(1000), increment(10)
   {}
   /**
    * Parses command line args, initializes rados and ioctx
@@ -177,6 +178,25 @@ public:
    */
   int write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /**
+   * Sets one small entry on and removes one key from the object of the
+   * specified AioWriter, the way a bucket index or directory is updated.
+   *
+   * @param aiow the AioWriter to write with
+   * @param omap the entries to set
+   * @post: an asynchronous omap_set and omap_rm_keys is launched
+   */
+  int update_omap_asynchronously(AioWriter *aiow,
+      const std::map<std::string,bufferlist> &omap);
+
+  /*
+   * Writes OBJECTS objects with write_objects_in_parallel, then times OPS
+   * small updates spread over them using THREADS AioWriters at a time.
+   *
+   * @param omap_gen the method used to generate the omaps.
+   */
+  int update_objects_in_parallel(omap_generator_t omap_gen);
+
   /*
    * runs the test specified by test using the omap generator specified by
    * omap_generator
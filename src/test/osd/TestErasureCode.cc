@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <sstream>
+
+#include "osd/ErasureCode.h"
+#include "osd/ErasureCodeReedSolomon.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static void fill_chunks(int k, unsigned len, map<int, bufferlist> *chunks)
+{
+  for (int i = 0; i < k; i++) {
+    bufferptr bp(len);
+    for (unsigned j = 0; j < len; j++)
+      bp[j] = (char)(i * 31 + j * 7 + 1);
+    (*chunks)[i].push_back(bp);
+  }
+}
+
+TEST(ErasureCode, GaloisField) {
+  for (int a = 1; a < 256; a++) {
+    ASSERT_EQ(1, ErasureCodeReedSolomon::gf_mul(a, ErasureCodeReedSolomon::gf_inv(a)));
+    ASSERT_EQ(0, ErasureCodeReedSolomon::gf_mul(a, 0));
+  }
+}
+
+TEST(ErasureCode, Registry) {
+  stringstream ss;
+  ErasureCodeInterface *ec = ErasureCode::create("no_such_code", 2, 1, &ss);
+  ASSERT_FALSE(ec);
+  ASSERT_FALSE(ss.str().empty());
+
+  ec = ErasureCode::create("reed_solomon", 0, 1, &ss);
+  ASSERT_FALSE(ec);
+
+  ec = ErasureCode::create("reed_solomon", 4, 2, &ss);
+  ASSERT_TRUE(ec);
+  ASSERT_EQ(4u, ec->get_data_chunk_count());
+  ASSERT_EQ(6u, ec->get_chunk_count());
+  delete ec;
+}
+
+TEST(ErasureCode, LoseAnyM) {
+  const int k = 4, m = 2;
+  ErasureCodeInterface *ec = ErasureCode::create("reed_solomon", k, m);
+  ASSERT_TRUE(ec);
+
+  map<int, bufferlist> encoded;
+  fill_chunks(k, 4096, &encoded);
+  ASSERT_EQ(0, ec->encode(encoded));
+  ASSERT_EQ((size_t)(k + m), encoded.size());
+
+  set<int> all;
+  for (int i = 0; i < k + m; i++)
+    all.insert(i);
+
+  for (int a = 0; a < k + m; a++) {
+    for (int b = a + 1; b < k + m; b++) {
+      map<int, bufferlist> chunks = encoded;
+      chunks.erase(a);
+      chunks.erase(b);
+      ASSERT_EQ(0, ec->decode(all, chunks));
+      for (int i = 0; i < k + m; i++)
+	ASSERT_TRUE(chunks[i].contents_equal(encoded[i]));
+    }
+  }
+
+  // one more is too many
+  map<int, bufferlist> chunks = encoded;
+  chunks.erase(0);
+  chunks.erase(1);
+  chunks.erase(2);
+  ASSERT_EQ(-EIO, ec->decode(all, chunks));
+  delete ec;
+}
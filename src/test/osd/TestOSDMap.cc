@@ -0,0 +1,234 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "test/unit.h"
+
+#include "osd/OSDMap.h"
+#include "crush/CrushWrapper.h"
+
+using namespace std;
+
+static const int num_osds = 6;
+
+/*
+ * map every pg of every pool twice, once to fill the placement cache
+ * and once to read it back, and compare both against a copy of the map
+ * decoded from scratch, whose first lookups go straight to crush.
+ */
+static void check_mappings(const OSDMap& m)
+{
+  bufferlist bl;
+  m.encode(bl);
+  OSDMap fresh;
+  fresh.decode(bl);
+
+  const map<int64_t,pg_pool_t>& pools = m.get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps) {
+      pg_t pg(ps, p->first, -1);
+      vector<int> expected, first, cached;
+      fresh.pg_to_osds(pg, expected);
+      m.pg_to_osds(pg, first);
+      m.pg_to_osds(pg, cached);
+      ASSERT_EQ(expected, first) << "epoch " << m.get_epoch() << " pg " << pg;
+      ASSERT_EQ(expected, cached) << "epoch " << m.get_epoch() << " pg " << pg;
+    }
+  }
+}
+
+static void apply(OSDMap& m, OSDMap::Incremental& inc)
+{
+  inc.fsid = m.get_fsid();
+  ASSERT_EQ(0, m.apply_incremental(inc));
+}
+
+static void build_map(OSDMap& m)
+{
+  uuid_d fsid;
+  fsid.generate_random();
+  m.build_simple(g_ceph_context, 1, fsid, num_osds, 4, 4);
+  check_mappings(m);
+
+  // bring every osd up and in
+  OSDMap::Incremental inc(m.get_epoch() + 1);
+  for (int i = 0; i < num_osds; ++i) {
+    inc.new_up_client[i] = entity_addr_t();
+    inc.new_weight[i] = CEPH_OSD_IN;
+  }
+  apply(m, inc);
+}
+
+static void copy_map(const OSDMap& from, OSDMap& to)
+{
+  bufferlist bl;
+  from.encode(bl);
+  to.decode(bl);
+}
+
+TEST(OSDMap, PlacementCache) {
+  OSDMap m;
+  build_map(m);
+  check_mappings(m);
+
+  // weights
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_weight[1] = CEPH_OSD_IN / 2;
+    inc.new_weight[2] = CEPH_OSD_OUT;
+    apply(m, inc);
+    check_mappings(m);
+  }
+
+  // an osd going down changes nothing; removing it does
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_state[3] = CEPH_OSD_UP;
+    apply(m, inc);
+    check_mappings(m);
+  }
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_state[3] = CEPH_OSD_EXISTS;
+    apply(m, inc);
+    ASSERT_FALSE(m.exists(3));
+    check_mappings(m);
+  }
+
+  // crush
+  {
+    CrushWrapper c;
+    bufferlist cbl;
+    ::encode(*m.crush, cbl);
+    bufferlist::iterator p = cbl.begin();
+    c.decode(p);
+    c.adjust_item_weightf(g_ceph_context, 0, 4.0);
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    ::encode(c, inc.crush);
+    apply(m, inc);
+    check_mappings(m);
+  }
+
+  // pools: changed placement, a new one, a removed one
+  {
+    const map<int64_t,pg_pool_t>& pools = m.get_pools();
+    map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    int64_t first = p->first;
+    inc.new_pools[first] = p->second;
+    inc.new_pools[first].set_pgp_num(p->second.get_pgp_num() / 2);
+    ++p;
+    inc.new_pools[p->first] = p->second;
+    inc.new_pools[p->first].size = p->second.get_size() + 1;
+    ++p;
+    inc.old_pools.insert(p->first);
+    inc.new_pool_max = m.get_pool_max() + 1;
+    inc.new_pools[inc.new_pool_max] = p->second;
+    inc.new_pool_names[inc.new_pool_max] = "new";
+    apply(m, inc);
+    check_mappings(m);
+  }
+
+  // more osds
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_max_osd = num_osds + 2;
+    inc.new_up_client[num_osds] = entity_addr_t();
+    inc.new_weight[num_osds] = CEPH_OSD_IN;
+    apply(m, inc);
+    check_mappings(m);
+  }
+}
+
+/*
+ * dedup() may hand the next epoch the tables the previous one already
+ * filled in.  it must only do so when placement is unchanged.
+ */
+TEST(OSDMap, PlacementCacheDedup) {
+  OSDMap m;
+  build_map(m);
+  check_mappings(m);
+
+  // nothing that affects placement
+  {
+    OSDMap n;
+    copy_map(m, n);
+    OSDMap::Incremental inc(n.get_epoch() + 1);
+    inc.new_up_thru[0] = n.get_epoch();
+    inc.new_state[4] = CEPH_OSD_UP;
+    apply(n, inc);
+    OSDMap::dedup(&m, &n);
+    check_mappings(n);
+    check_mappings(m);
+  }
+
+  // weights
+  {
+    OSDMap n;
+    copy_map(m, n);
+    OSDMap::Incremental inc(n.get_epoch() + 1);
+    inc.new_weight[0] = CEPH_OSD_OUT;
+    apply(n, inc);
+    OSDMap::dedup(&m, &n);
+    check_mappings(n);
+    check_mappings(m);
+  }
+
+  // exists
+  {
+    OSDMap n;
+    copy_map(m, n);
+    OSDMap::Incremental inc(n.get_epoch() + 1);
+    inc.new_state[5] = CEPH_OSD_UP | CEPH_OSD_EXISTS;
+    apply(n, inc);
+    ASSERT_FALSE(n.exists(5));
+    OSDMap::dedup(&m, &n);
+    check_mappings(n);
+    check_mappings(m);
+  }
+
+  // crush
+  {
+    OSDMap n;
+    copy_map(m, n);
+    CrushWrapper c;
+    bufferlist cbl;
+    ::encode(*n.crush, cbl);
+    bufferlist::iterator p = cbl.begin();
+    c.decode(p);
+    c.adjust_item_weightf(g_ceph_context, 1, 0.25);
+    OSDMap::Incremental inc(n.get_epoch() + 1);
+    ::encode(c, inc.crush);
+    apply(n, inc);
+    OSDMap::dedup(&m, &n);
+    check_mappings(n);
+    check_mappings(m);
+  }
+
+  // one pool's placement
+  {
+    OSDMap n;
+    copy_map(m, n);
+    const map<int64_t,pg_pool_t>& pools = n.get_pools();
+    map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+    OSDMap::Incremental inc(n.get_epoch() + 1);
+    inc.new_pools[p->first] = p->second;
+    inc.new_pools[p->first].set_pgp_num(p->second.get_pgp_num() / 4);
+    apply(n, inc);
+    OSDMap::dedup(&m, &n);
+    check_mappings(n);
+    check_mappings(m);
+  }
+}
@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osd/ReplicaReads.h"
+
+#include "gtest/gtest.h"
+
+static hobject_t obj(const char *name, snapid_t snap)
+{
+  return hobject_t(object_t(name), "", snap, 0x1234, 1);
+}
+
+TEST(ReplicaReads, AckedVersion) {
+  ReplicaReads r;
+  ASSERT_EQ(eversion_t(), r.get_acked());
+
+  // nothing was acked by an old primary that doesn't say
+  r.acked_to(eversion_t());
+  ASSERT_EQ(eversion_t(), r.get_acked());
+
+  r.acked_to(eversion_t(1, 5));
+  ASSERT_EQ(eversion_t(1, 5), r.get_acked());
+
+  // sub ops may arrive with an older value; it never goes back
+  r.acked_to(eversion_t(1, 3));
+  ASSERT_EQ(eversion_t(1, 5), r.get_acked());
+}
+
+/*
+ * a write committed and applied here still blocks reads until the
+ * primary says every replica has it.
+ */
+TEST(ReplicaReads, PendingUntilAcked) {
+  ReplicaReads r;
+  hobject_t a = obj("a", CEPH_NOSNAP), b = obj("b", CEPH_NOSNAP);
+  ASSERT_FALSE(r.is_writing(a));
+
+  r.start_write(a, eversion_t(1, 1));
+  ASSERT_TRUE(r.is_writing(a));
+  ASSERT_FALSE(r.is_writing(b));
+
+  r.applied(a);
+  ASSERT_TRUE(r.is_writing(a));
+
+  r.start_write(b, eversion_t(1, 2));
+  r.acked_to(eversion_t(1, 1));
+  ASSERT_FALSE(r.is_writing(a));
+  ASSERT_TRUE(r.is_writing(b));
+
+  // acked, but not yet readable here
+  r.acked_to(eversion_t(1, 2));
+  ASSERT_TRUE(r.is_writing(b));
+  r.applied(b);
+  ASSERT_FALSE(r.is_writing(b));
+}
+
+TEST(ReplicaReads, OverlappingWrites) {
+  ReplicaReads r;
+  hobject_t a = obj("a", CEPH_NOSNAP);
+
+  r.start_write(a, eversion_t(1, 1));
+  r.start_write(a, eversion_t(1, 2));
+  r.acked_to(eversion_t(1, 1));
+  r.applied(a);
+  r.applied(a);
+  ASSERT_TRUE(r.is_writing(a));  // 1'2 isn't acked yet
+  r.acked_to(eversion_t(1, 2));
+  ASSERT_FALSE(r.is_writing(a));
+
+  // still applying the first when both are acked
+  r.start_write(a, eversion_t(1, 3));
+  r.start_write(a, eversion_t(1, 4));
+  r.acked_to(eversion_t(1, 4));
+  r.applied(a);
+  ASSERT_TRUE(r.is_writing(a));
+  r.applied(a);
+  ASSERT_FALSE(r.is_writing(a));
+}
+
+TEST(ReplicaReads, ClonesAndSnapdir) {
+  ReplicaReads r;
+  hobject_t head = obj("a", CEPH_NOSNAP);
+
+  r.start_write(obj("a", 4), eversion_t(1, 1));
+  ASSERT_TRUE(r.is_writing(head));
+  ASSERT_FALSE(r.is_writing(obj("b", CEPH_NOSNAP)));
+  r.applied(obj("a", 4));
+  r.acked_to(eversion_t(1, 1));
+  ASSERT_FALSE(r.is_writing(head));
+
+  r.start_write(obj("a", CEPH_SNAPDIR), eversion_t(1, 2));
+  ASSERT_TRUE(r.is_writing(head));
+  r.applied(obj("a", CEPH_SNAPDIR));
+  r.acked_to(eversion_t(1, 2));
+  ASSERT_FALSE(r.is_writing(head));
+}
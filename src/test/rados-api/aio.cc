@@ -4,9 +4,11 @@
 
 #include "gtest/gtest.h"
 #include <errno.h>
+#include <pthread.h>
 #include <semaphore.h>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 
 using std::ostringstream;
@@ -888,3 +890,92 @@ TEST(LibRadosAio, OmapPP) {
 
   ioctx.remove("test_obj");
 }
+
+/*
+ * with a budget of a few ops, many threads' aio writes keep the objecter
+ * at its limit: submitters block for budget that only comes back with
+ * replies, while a listing submits its reads holding the client lock.
+ */
+struct ThrottleWriter {
+  IoCtx *ioctx;
+  int id;
+  int num_ops;
+  int failed;
+};
+
+static void *throttle_writer(void *arg)
+{
+  ThrottleWriter *w = (ThrottleWriter*)arg;
+  char buf[4096];
+  memset(buf, w->id, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  std::vector<AioCompletion*> completions;
+  for (int i = 0; i < w->num_ops; i++) {
+    ostringstream oss;
+    oss << "throttle." << w->id << "." << i;
+    AioCompletion *c = librados::Rados::aio_create_completion();
+    completions.push_back(c);
+    if (w->ioctx->aio_write(oss.str(), c, bl, bl.length(), 0) < 0)
+      w->failed++;
+  }
+  for (std::vector<AioCompletion*>::iterator p = completions.begin();
+       p != completions.end();
+       ++p) {
+    (*p)->wait_for_complete();
+    if ((*p)->get_return_value() < 0)
+      w->failed++;
+    (*p)->release();
+  }
+  return NULL;
+}
+
+TEST(LibRadosAio, ThrottledConcurrentPP) {
+  const int num_threads = 8, ops_per_thread = 64;
+
+  Rados cluster;
+  ASSERT_EQ(0, cluster.init(getenv("CEPH_CLIENT_ID")));
+  ASSERT_EQ(0, cluster.conf_read_file(NULL));
+  cluster.conf_parse_env(NULL);
+  ASSERT_EQ(0, cluster.conf_set("objecter_inflight_ops", "4"));
+  ASSERT_EQ(0, cluster.conf_set("objecter_inflight_op_bytes", "16384"));
+  ASSERT_EQ(0, cluster.connect());
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ(0, cluster.pool_create(pool_name.c_str()));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  TestAlarm alarm;
+  ThrottleWriter writers[num_threads];
+  pthread_t threads[num_threads];
+  for (int i = 0; i < num_threads; i++) {
+    writers[i].ioctx = &ioctx;
+    writers[i].id = i;
+    writers[i].num_ops = ops_per_thread;
+    writers[i].failed = 0;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, throttle_writer, &writers[i]));
+  }
+
+  // list while the writers hold the budget
+  int listed = 0;
+  for (ObjectIterator it = ioctx.objects_begin(); it != ioctx.objects_end(); ++it)
+    listed++;
+  ASSERT_LE(listed, num_threads * ops_per_thread);
+
+  for (int i = 0; i < num_threads; i++) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    ASSERT_EQ(0, writers[i].failed);
+  }
+
+  listed = 0;
+  for (ObjectIterator it = ioctx.objects_begin(); it != ioctx.objects_end(); ++it)
+    listed++;
+  ASSERT_EQ(num_threads * ops_per_thread, listed);
+
+  bufferlist bl;
+  ASSERT_EQ(4096, ioctx.read("throttle.3.7", bl, 4096, 0));
+  ASSERT_EQ(3, bl[0]);
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
@@ -4,6 +4,7 @@
 
 #include "gtest/gtest.h"
 #include <errno.h>
+#include <set>
 #include <string>
 
 using namespace librados;
@@ -47,3 +48,84 @@ TEST(LibRadosList, ListObjectsPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosList, ListObjectsParallel) {
+  char buf[128];
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  std::set<std::string> written;
+  for (int i = 0; i < 50; i++) {
+    char oid[32];
+    snprintf(oid, sizeof(oid), "foo%d", i);
+    ASSERT_EQ((int)sizeof(buf), rados_write(ioctx, oid, buf, sizeof(buf), 0));
+    written.insert(oid);
+  }
+
+  // list half, then resume from the cursor
+  rados_list_ctx_t ctx;
+  ASSERT_EQ(0, rados_objects_list_open_parallel(ioctx, 4, NULL, 0, &ctx));
+  std::set<std::string> seen;
+  const char *entry;
+  for (int i = 0; i < 25; i++) {
+    ASSERT_EQ(0, rados_objects_list_next(ctx, &entry, NULL));
+    seen.insert(entry);
+  }
+  char cursor[4096];
+  int len = rados_objects_list_get_cursor(ctx, cursor, sizeof(cursor));
+  ASSERT_LT(0, len);
+  ASSERT_EQ(-ERANGE, rados_objects_list_get_cursor(ctx, cursor, 1));
+  rados_objects_list_close(ctx);
+
+  ASSERT_EQ(0, rados_objects_list_open_parallel(ioctx, 0, cursor, len, &ctx));
+  int r;
+  while ((r = rados_objects_list_next(ctx, &entry, NULL)) == 0)
+    seen.insert(entry);
+  ASSERT_EQ(-ENOENT, r);
+  rados_objects_list_close(ctx);
+  ASSERT_TRUE(written == seen);
+
+  ASSERT_EQ(-EINVAL, rados_objects_list_open_parallel(ioctx, 4, "junk", 4, &ctx));
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRadosList, ListObjectsParallelPP) {
+  std::string pool_name = get_temp_pool_name();
+  Rados cluster;
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  std::set<std::string> written;
+  for (int i = 0; i < 50; i++) {
+    char oid[32];
+    snprintf(oid, sizeof(oid), "foo%d", i);
+    ASSERT_EQ((int)sizeof(buf), ioctx.write(oid, bl1, sizeof(buf), 0));
+    written.insert(oid);
+  }
+  std::set<std::string> seen;
+  bufferlist cursor;
+  {
+    ObjectIterator iter(ioctx.objects_begin_parallel(4));
+    for (int i = 0; i < 10; i++, ++iter) {
+      ASSERT_EQ(false, (iter == ioctx.objects_end()));
+      seen.insert(iter->first);
+    }
+    // the cursor is past the current entry too
+    seen.insert(iter->first);
+    ASSERT_EQ(0, iter.get_cursor(&cursor));
+  }
+  for (ObjectIterator iter = ioctx.objects_begin_parallel(4, cursor);
+       iter != ioctx.objects_end(); ++iter)
+    seen.insert(iter->first);
+  ASSERT_TRUE(written == seen);
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
@@ -287,6 +287,98 @@ TEST(LibRadosMisc, AioOperatePP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosMisc, AioOperate) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  const char *keys[] = { "k1", "k2" };
+  const char *vals[] = { "v1", "val2" };
+  size_t lens[] = { 2, 4 };
+
+  rados_write_op_t wop = rados_create_write_op();
+  ASSERT_TRUE(wop);
+  rados_write_op_create(wop, 1, NULL);
+  rados_write_op_write(wop, buf, sizeof(buf), 0);
+  rados_write_op_setxattr(wop, "attr", "val", 3);
+  rados_write_op_omap_set(wop, keys, vals, lens, 2);
+  rados_completion_t completion;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &completion));
+  ASSERT_EQ(0, rados_aio_write_op_operate(wop, ioctx, completion, "foo", NULL));
+  ASSERT_EQ(0, rados_aio_wait_for_safe(completion));
+  ASSERT_EQ(0, rados_aio_get_return_value(completion));
+  rados_aio_release(completion);
+  rados_release_write_op(wop);
+
+  // an exclusive create fails now that the object exists
+  wop = rados_create_write_op();
+  rados_write_op_create(wop, 1, NULL);
+  ASSERT_EQ(-EEXIST, rados_write_op_operate(wop, ioctx, "foo", NULL));
+  rados_release_write_op(wop);
+
+  rados_read_op_t rop = rados_create_read_op();
+  ASSERT_TRUE(rop);
+  uint64_t size = 0;
+  time_t mtime;
+  int stat_rval = -1, read_rval = -1, xattrs_rval = -1, omap_rval = -1;
+  char out[256];
+  size_t bytes_read = 0;
+  rados_xattrs_iter_t xattrs;
+  rados_omap_iter_t omap;
+  rados_read_op_cmpxattr(rop, "attr", LIBRADOS_CMPXATTR_OP_EQ, "val", 3);
+  rados_read_op_stat(rop, &size, &mtime, &stat_rval);
+  rados_read_op_read(rop, 0, sizeof(out), out, &bytes_read, &read_rval);
+  rados_read_op_getxattrs(rop, &xattrs, &xattrs_rval);
+  rados_read_op_omap_get_vals(rop, NULL, NULL, 10, &omap, &omap_rval);
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &completion));
+  ASSERT_EQ(0, rados_aio_read_op_operate(rop, ioctx, completion, "foo"));
+  ASSERT_EQ(0, rados_aio_wait_for_complete(completion));
+  ASSERT_EQ(0, rados_aio_get_return_value(completion));
+  rados_aio_release(completion);
+  rados_release_read_op(rop);
+
+  ASSERT_EQ(0, stat_rval);
+  ASSERT_EQ(sizeof(buf), size);
+  ASSERT_EQ(0, read_rval);
+  ASSERT_EQ(sizeof(buf), bytes_read);
+  ASSERT_EQ(0, memcmp(buf, out, sizeof(buf)));
+
+  ASSERT_EQ(0, xattrs_rval);
+  const char *name, *val;
+  size_t len;
+  ASSERT_EQ(0, rados_getxattrs_next(xattrs, &name, &val, &len));
+  ASSERT_EQ(std::string("attr"), name);
+  ASSERT_EQ(std::string("val"), std::string(val, len));
+  ASSERT_EQ(0, rados_getxattrs_next(xattrs, &name, &val, &len));
+  ASSERT_EQ(NULL, name);
+  rados_getxattrs_end(xattrs);
+
+  ASSERT_EQ(0, omap_rval);
+  char *key, *omap_val;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(0, rados_omap_get_next(omap, &key, &omap_val, &len));
+    ASSERT_EQ(std::string(keys[i]), key);
+    ASSERT_EQ(std::string(vals[i]), std::string(omap_val, len));
+  }
+  ASSERT_EQ(0, rados_omap_get_next(omap, &key, &omap_val, &len));
+  ASSERT_EQ(NULL, key);
+  rados_omap_get_end(omap);
+
+  // a failed comparison fails the whole op
+  rop = rados_create_read_op();
+  rados_read_op_cmpxattr(rop, "attr", LIBRADOS_CMPXATTR_OP_EQ, "nope", 4);
+  rados_read_op_stat(rop, &size, &mtime, &stat_rval);
+  ASSERT_EQ(-ECANCELED, rados_read_op_operate(rop, ioctx, "foo"));
+  rados_release_read_op(rop);
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
 TEST(LibRadosMisc, CloneRangePP) {
   Rados cluster;
   std::string pool_name = get_temp_pool_name();
@@ -272,6 +272,56 @@ TEST(TestFileJournal, ReplayCorrupt) {
   j.close();
 }
 
+TEST(TestFileJournal, ReplaySkipIndex) {
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&lock, &cond, &done));
+
+  bufferlist bl;
+  uint64_t seq = 1;
+  for (int i=0; i<100; i++) {
+    bl.append("small");
+    j.submit_entry(seq++, bl, 0, gb.new_sub());
+  }
+  gb.activate();
+  wait();
+
+  // record the skip index; the next write carries the header out
+  j.commit_start();
+  done = false;
+  bl.append("small");
+  j.submit_entry(seq++, bl, 0, new C_SafeCond(&lock, &cond, &done));
+  wait();
+
+  j.close();
+
+  j.open(90);
+
+  // nothing was trimmed, so without the index open would start at seq 1.
+  // it must have jumped ahead and stepped over only what lies between.
+  ASSERT_GT(j.get_replay_start_seq(), 1ull);
+  ASSERT_LE(j.get_replay_start_seq(), 91ull);
+  ASSERT_EQ(91 - j.get_replay_start_seq(), j.get_replay_walked());
+  ASSERT_LT(j.get_replay_walked(), 90u);
+
+  bufferlist inbl;
+  string v;
+  uint64_t rseq = 0;
+  ASSERT_EQ(true, j.read_entry(inbl, rseq));
+  ASSERT_EQ(rseq, 91ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ("small", v);
+  while (j.read_entry(inbl, rseq))
+    ;
+  ASSERT_EQ(rseq, 101ull);
+
+  j.make_writeable();
+  j.close();
+}
+
 TEST(TestFileJournal, WriteTrim) {
   fsid.generate_random();
   FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
@@ -122,3 +122,192 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(eversion_t, get_key_name)
+{
+  eversion_t a(3, 9), b(3, 10), c(4, 1);
+  ASSERT_LT(a.get_key_name(), b.get_key_name());
+  ASSERT_LT(b.get_key_name(), c.get_key_name());
+  ASSERT_EQ(string("0000000003.00000000000000000010"), b.get_key_name());
+}
+
+/*
+ * a toy object and the log entries the osd would record for each
+ * write/truncate/zero, to check that patching a stale copy with just
+ * the logged extents reproduces the object.
+ */
+struct DeltaModel {
+  hobject_t soid, other;
+  pg_log_t log;
+  vector<string> versions;  // contents after each version, [0] is empty
+  set<unsigned> ours;       // versions that modified soid
+  eversion_t last, other_last;
+
+  DeltaModel()
+    : soid(object_t("obj"), "", CEPH_NOSNAP, 0, 0),
+      other(object_t("other"), "", CEPH_NOSNAP, 0, 0) {
+    versions.push_back(string());
+  }
+
+  void add(const string& data, const interval_set<uint64_t>& extents,
+	   bool have_extents = true) {
+    eversion_t v(1, versions.size());
+    pg_log_entry_t e(pg_log_entry_t::MODIFY, soid, v, last,
+		     osd_reqid_t(), utime_t());
+    e.have_extents = have_extents;
+    e.extents = extents;
+    log.log.push_back(e);
+    log.head = last = v;
+    ours.insert(versions.size());
+    versions.push_back(data);
+  }
+  // an unrelated object's write, interleaved in the log
+  void write_other() {
+    eversion_t v(1, versions.size());
+    pg_log_entry_t e(pg_log_entry_t::MODIFY, other, v, other_last,
+		     osd_reqid_t(), utime_t());
+    e.have_extents = true;
+    e.extents.insert(1000, 1000);
+    log.log.push_back(e);
+    log.head = other_last = v;
+    versions.push_back(versions.back());
+  }
+  void write(uint64_t off, const string& s) {
+    string data = versions.back();
+    if (data.size() < off + s.size())
+      data.resize(off + s.size());
+    data.replace(off, s.size(), s);
+    interval_set<uint64_t> ext;
+    ext.insert(off, s.size());
+    add(data, ext);
+  }
+  void truncate(uint64_t size) {
+    string data = versions.back();
+    interval_set<uint64_t> ext;
+    if (data.size() > size)
+      ext.insert(size, data.size() - size);
+    data.resize(size);
+    add(data, ext);
+  }
+  void zero(uint64_t off, uint64_t len) {
+    string data = versions.back();
+    if (off < data.size())
+      data.replace(off, MIN(len, data.size() - off), MIN(len, data.size() - off), '\0');
+    interval_set<uint64_t> ext;
+    ext.insert(off, len);
+    add(data, ext);
+  }
+
+  // what submit_push_data does on the stale copy
+  string patch(unsigned have, const interval_set<uint64_t>& extents) {
+    string data = versions[have];
+    const string& want = versions.back();
+    data.resize(want.size());
+    for (interval_set<uint64_t>::const_iterator p = extents.begin();
+	 p != extents.end();
+	 ++p) {
+      if (p.get_start() >= want.size())
+	continue;
+      uint64_t len = MIN(p.get_len(), want.size() - p.get_start());
+      data.replace(p.get_start(), len, want, p.get_start(), len);
+    }
+    return data;
+  }
+};
+
+TEST(pg_log_t, get_dirty_extents)
+{
+  DeltaModel m;
+  m.write(0, string(100, 'a'));
+  m.write(40, string(20, 'b'));
+  m.write_other();
+  m.truncate(30);
+  m.write(80, string(10, 'c'));   // leaves a hole from 30 to 80
+  m.zero(0, 10);
+  m.write_other();
+  m.truncate(120);
+  m.write(110, string(5, 'd'));
+  m.zero(100, 50);
+
+  // recover from wherever a replica stopped along the way
+  eversion_t need = m.last;
+  for (set<unsigned>::iterator have = m.ours.begin(); *have != need.version; ++have) {
+    interval_set<uint64_t> extents;
+    ASSERT_TRUE(m.log.get_dirty_extents(m.soid, eversion_t(1, *have), need, extents));
+    ASSERT_FALSE(extents.contains(1000, 1));  // nothing from the other object
+    ASSERT_EQ(m.versions.back(), m.patch(*have, extents)) << "from version " << *have;
+  }
+
+  // a version the object never had
+  interval_set<uint64_t> extents;
+  ASSERT_FALSE(m.log.get_dirty_extents(m.soid, m.other_last, need, extents));
+}
+
+TEST(pg_log_t, get_dirty_extents_unknown)
+{
+  DeltaModel m;
+  m.write(0, string(100, 'a'));
+  m.write(10, string(10, 'b'));
+  m.add(m.versions.back(), interval_set<uint64_t>(), false);  // e.g. an omap update
+  m.write(50, string(10, 'c'));
+
+  interval_set<uint64_t> extents;
+  // across the entry with no extents we can't tell
+  ASSERT_FALSE(m.log.get_dirty_extents(m.soid, eversion_t(1, 1), m.log.head, extents));
+  // after it we can
+  ASSERT_TRUE(m.log.get_dirty_extents(m.soid, eversion_t(1, 3), m.log.head, extents));
+  ASSERT_EQ(m.versions.back(), m.patch(3, extents));
+
+  // nor from before the log tail
+  m.log.tail = eversion_t(1, 2);
+  m.log.log.pop_front();
+  m.log.log.pop_front();
+  ASSERT_FALSE(m.log.get_dirty_extents(m.soid, eversion_t(1, 1), m.log.head, extents));
+
+  // nor from a version the object never had
+  ASSERT_FALSE(m.log.get_dirty_extents(m.soid, eversion_t(1, 3), eversion_t(1, 5), extents));
+}
+
+TEST(pg_history_t, deep_scrub_due)
+{
+  double interval = 60*60*24*7;
+  utime_t now(1000000, 0);
+
+  pg_history_t h;
+  ASSERT_TRUE(h.is_deep_scrub_due(now, interval));  // never deep scrubbed
+
+  h.last_deep_scrub_stamp = now;
+  ASSERT_FALSE(h.is_deep_scrub_due(now, interval));
+  ASSERT_FALSE(h.is_deep_scrub_due(now + utime_t(interval - 1, 0), interval));
+  ASSERT_TRUE(h.is_deep_scrub_due(now + utime_t(interval, 0), interval));
+}
+
+TEST(pg_history_t, deep_scrub_due_after_upgrade)
+{
+  double interval = 60*60*24*7;
+  utime_t scrubbed(1000000, 0);
+
+  // a v4 pg_history_t, from before deep scrub
+  bufferlist bl;
+  ENCODE_START(4, 4, bl);
+  ::encode((epoch_t)1, bl);   // epoch_created
+  ::encode((epoch_t)2, bl);   // last_epoch_started
+  ::encode((epoch_t)2, bl);   // last_epoch_clean
+  ::encode((epoch_t)0, bl);   // last_epoch_split
+  ::encode((epoch_t)2, bl);   // same_interval_since
+  ::encode((epoch_t)2, bl);   // same_up_since
+  ::encode((epoch_t)2, bl);   // same_primary_since
+  ::encode(eversion_t(2, 10), bl);  // last_scrub
+  ::encode(scrubbed, bl);           // last_scrub_stamp
+  ENCODE_FINISH(bl);
+
+  pg_history_t h;
+  bufferlist::iterator p = bl.begin();
+  ::decode(h, p);
+  ASSERT_EQ(h.last_deep_scrub, eversion_t(2, 10));
+  ASSERT_EQ(h.last_deep_scrub_stamp, scrubbed);
+
+  // due on the schedule of the last scrub, not as soon as we start
+  ASSERT_FALSE(h.is_deep_scrub_due(scrubbed + utime_t(60, 0), interval));
+  ASSERT_TRUE(h.is_deep_scrub_due(scrubbed + utime_t(interval, 0), interval));
+}
@@ -35,7 +35,7 @@
 void usage(ostream& out)
 {
   out <<					\
-"usage: rest-bench [options] <write|seq>\n"
+"usage: rest-bench [options] <write|seq|mix>\n"
 "BENCHMARK OPTIONS\n"
 "   --seconds\n"
 "        benchmak length (default: 60)\n"
@@ -47,6 +47,12 @@ void usage(ostream& out)
 "        set the size of write ops for put or benchmarking\n"
 "   --show-time\n"
 "        prefix output lines with date and time\n"
+"   --op-mix=read:write\n"
+"        relative share of reads and writes for mix (default 0:1)\n"
+"   --target-iops=ops_per_sec\n"
+"        issue mix ops at a fixed rate, with at most -t in flight\n"
+"   --json-output=file\n"
+"        write latency percentiles and a per-second series to file\n"
 "REST CONFIG OPTIONS\n"
 "   --api-host=bhost\n"
 "        host name\n"
@@ -552,6 +558,9 @@ int main(int argc, const char **argv)
   int seconds = 60;
 
   bool show_time = false;
+  int mix_read = 0, mix_write = 1;
+  double target_iops = 0;
+  string json_output;
 
 
   for (i = args.begin(); i != args.end(); ) {
@@ -598,6 +607,15 @@ int main(int argc, const char **argv)
       seconds = strtol(val.c_str(), NULL, 10);
     } else if (ceph_argparse_witharg(args, i, &val, "-b", "--block-size", (char*)NULL)) {
       op_size = strtol(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--op-mix", (char*)NULL)) {
+      if (sscanf(val.c_str(), "%d:%d", &mix_read, &mix_write) != 2) {
+        cerr << "bad op mix" << std::endl;
+        usage_exit();
+      }
+    } else if (ceph_argparse_witharg(args, i, &val, "--target-iops", (char*)NULL)) {
+      target_iops = strtod(val.c_str(), NULL);
+    } else if (ceph_argparse_witharg(args, i, &json_output, "--json-output", (char*)NULL)) {
+      /* nothing */
     } else {
       if (val[0] == '-')
         usage_exit();
@@ -618,6 +636,8 @@ int main(int argc, const char **argv)
     operation = OP_SEQ_READ;
   else if (strcmp(args[0], "rand") == 0)
     operation = OP_RAND_READ;
+  else if (strcmp(args[0], "mix") == 0)
+    operation = OP_MIX;
   else
     usage_exit();
 
@@ -642,6 +662,9 @@ int main(int argc, const char **argv)
 
   RESTBencher bencher(&dispatcher);
   bencher.set_show_time(show_time);
+  bencher.set_op_mix(mix_read, mix_write, 0, 0);
+  bencher.set_target_iops(target_iops);
+  bencher.set_json_output(json_output);
 
   int ret = bencher.init(user_agent, host, bucket, protocol, uri_style, access_key, secret);
   if (ret < 0) {